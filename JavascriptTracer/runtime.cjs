@@ -6,6 +6,7 @@
 const constants = require("./constants.cjs");
 const uidUtil = require("./uid.cjs");
 const fs = require("fs");
+const zlib = require("zlib");
 const { execSync } = require("child_process");
 const pathModule = require("path");
 
@@ -32,6 +33,45 @@ let previousTraceFilePath = "";
 // WARNING: This may lead to huge files, and is incompatible to Microwalk's preprocessor module!
 let disableTraceCompression = false;
 
+// If set, the trace is written in a binary format instead of text lines (MW_TRACE_FORMAT=binary).
+// This avoids building and concatenating strings for every trace entry.
+const useBinaryTraceFormat = process.env.MW_TRACE_FORMAT === "binary";
+
+// If set, each flushed chunk of a binary trace is gzip-compressed (MW_TRACE_COMPRESSION=gzip).
+// The resulting files consist of one gzip member per flush.
+const compressBinaryTrace = process.env.MW_TRACE_COMPRESSION === "gzip";
+if(compressBinaryTrace && !useBinaryTraceFormat)
+    throw new Error("MW_TRACE_COMPRESSION requires MW_TRACE_FORMAT=binary!");
+
+// Binary trace buffer, which is flushed to the trace file when full (MW_TRACE_BUFFER_SIZE, in bytes).
+// Writes are synchronous, so a slow disk throttles the traced program instead of letting the buffered trace grow.
+const binaryTraceBufferSize = parseInt(process.env.MW_TRACE_BUFFER_SIZE ?? "") || 4 * 1024 * 1024;
+let binaryTraceBuffer = useBinaryTraceFormat ? Buffer.allocUnsafe(binaryTraceBufferSize) : null;
+let binaryTraceBufferPosition = 0;
+
+// Binary trace format. Each file starts with the magic bytes, followed by entries that start with a type byte.
+// All integers are little endian. Strings (code locations, function and property names) are defined once per trace and then referenced by ID.
+const binaryTraceMagic = Buffer.from("MWJSBIN\x01", "latin1");
+const BinaryEntryTypes = {
+    String: 1,       // u32 id, u32 byte length, UTF-8 data
+    Call: 2,         // u32 source file, u32 source location, i32 destination file (-1 = external), u32 destination location, u32 function name
+    Return1: 3,      // u32 file, u32 location
+    Return2: 4,      // u32 file, u32 location
+    Yield: 5,        // u32 file, u32 location, u8 is resume
+    Jump: 6,         // u32 file, u32 source location, u32 destination location
+    MemoryAccess: 7  // u8 flags, u32 file, u32 location, u32 object ID, u32 offset (index or string ID)
+};
+const MemoryAccessFlags = {
+    Write: 1,
+    NamedOffset: 2
+};
+
+// Strings of the binary trace, analogous to the compressed lines of the text trace
+let nextStringId = 0;
+let stringIds = new Map();
+let prefixNextStringId = 0;
+let prefixStringIds = new Map();
+
 // Compressed lines from the trace prefix can be reused in all other traces
 let nextCompressedLineIndex = 0;
 let compressedLines = {};
@@ -56,6 +96,10 @@ const scriptNameToIdMap = new Map();
 // File handle of the script information file.
 let scriptsFile = fs.openSync(`${traceDirectory}/scripts.txt`, "w");
 
+// The prefix trace starts right away
+if(useBinaryTraceFormat)
+    _beginBinaryTrace();
+
 
 /**
  * Registers the given script in the trace writer and returns an ID that can be used with the trace writing functions.
@@ -112,12 +156,90 @@ function _persistTrace()
         traceFile = fs.openSync(traceFilePath, "a+");
     }
 
-    fs.writeSync(traceFile, traceData.join('\n'));
-    fs.writeSync(traceFile, '\n');
+    if(useBinaryTraceFormat)
+    {
+        let data = binaryTraceBuffer.subarray(0, binaryTraceBufferPosition);
+        if(compressBinaryTrace)
+            data = zlib.gzipSync(data, { level: 1 });
+        fs.writeSync(traceFile, data);
+    }
+    else
+    {
+        fs.writeSync(traceFile, traceData.join('\n'));
+        fs.writeSync(traceFile, '\n');
+    }
 
     fs.closeSync(traceFile);
 }
 
+/**
+ * Starts a new binary trace file, by clearing the buffer and writing the file header.
+ */
+function _beginBinaryTrace()
+{
+    binaryTraceMagic.copy(binaryTraceBuffer, 0);
+    binaryTraceBufferPosition = binaryTraceMagic.length;
+}
+
+/**
+ * Ensures that the binary trace buffer has space for the given number of bytes, and flushes it if necessary.
+ * @param {number} size - Number of bytes
+ */
+function _reserveBinaryTraceSpace(size)
+{
+    if(binaryTraceBufferPosition + size <= binaryTraceBuffer.length)
+        return;
+
+    _persistTrace();
+    binaryTraceBufferPosition = 0;
+
+    // Very long strings may not fit into the buffer at all
+    if(size > binaryTraceBuffer.length)
+        binaryTraceBuffer = Buffer.allocUnsafe(size);
+}
+
+/**
+ * Returns the ID of the given string in the binary trace. If the string is not yet known, its definition is written to the trace.
+ * @param {string} str - String
+ * @returns {number} ID of the string
+ */
+function _getBinaryStringId(str)
+{
+    let id = stringIds.get(str);
+    if(id !== undefined)
+        return id;
+
+    id = nextStringId++;
+    stringIds.set(str, id);
+
+    const length = Buffer.byteLength(str, "utf8");
+    _reserveBinaryTraceSpace(9 + length);
+    binaryTraceBuffer[binaryTraceBufferPosition] = BinaryEntryTypes.String;
+    binaryTraceBuffer.writeUInt32LE(id, binaryTraceBufferPosition + 1);
+    binaryTraceBuffer.writeUInt32LE(length, binaryTraceBufferPosition + 5);
+    binaryTraceBuffer.write(str, binaryTraceBufferPosition + 9, length, "utf8");
+    binaryTraceBufferPosition += 9 + length;
+
+    return id;
+}
+
+/**
+ * Writes a binary trace entry which consists of the given type and 32-bit integers.
+ * String IDs must be retrieved before calling this function, as their definitions have to precede the entry.
+ * @param {number} type - Entry type
+ * @param {...number} values - Entry fields
+ */
+function _writeBinaryTraceEntry(type, ...values)
+{
+    _reserveBinaryTraceSpace(1 + 4 * values.length);
+    binaryTraceBuffer[binaryTraceBufferPosition++] = type;
+    for(const value of values)
+    {
+        binaryTraceBuffer.writeInt32LE(value | 0, binaryTraceBufferPosition);
+        binaryTraceBufferPosition += 4;
+    }
+}
+
 /**
  * Checks whether we already have a compressed representation of the given line.
  * If not, a new one is created.
@@ -195,7 +317,7 @@ function startCall(fileId, sourceLoc, fnObj)
     if(fnName === testcaseBeginFunctionName)
     {
         // Ensure that previous trace has been fully written (prefix mode)
-        if(isTracing && traceData.length > 0)
+        if(isTracing && (traceData.length > 0 || binaryTraceBufferPosition > 0))
             _persistTrace();
         traceData = [];
 
@@ -212,6 +334,19 @@ function startCall(fileId, sourceLoc, fnObj)
         lastCompressedLineIndex = -1000;
         lastLineWasEncodedRelatively = false;
 
+        if(useBinaryTraceFormat)
+        {
+            if(currentTestcaseId === -1)
+            {
+                prefixNextStringId = nextStringId;
+                prefixStringIds = stringIds;
+            }
+
+            stringIds = new Map(prefixStringIds);
+            nextStringId = prefixNextStringId;
+            _beginBinaryTrace();
+        }
+
         // Enter new testcase
         ++currentTestcaseId;
         isTracing = true;
@@ -223,6 +358,7 @@ function startCall(fileId, sourceLoc, fnObj)
         // Close trace
         _persistTrace();
         traceData = [];
+        binaryTraceBufferPosition = 0;
         isTracing = false;
     }
 
@@ -260,7 +396,18 @@ function writeCall()
     let destFileId = callInfo.destinationFileId ?? "E";
     let destLoc = callInfo.destinationLocation ?? callInfo.functionName;
     let fnName = callInfo.functionName;
-    _writeTraceLine(`c;${srcFileId};${srcLoc};${destFileId};${destLoc};${fnName}`);
+    if(useBinaryTraceFormat)
+    {
+        if(isTracing)
+        {
+            const srcLocId = _getBinaryStringId(srcLoc);
+            const destLocId = _getBinaryStringId(destLoc);
+            const fnNameId = _getBinaryStringId(fnName);
+            _writeBinaryTraceEntry(BinaryEntryTypes.Call, srcFileId, srcLocId, callInfo.destinationFileId ?? -1, destLocId, fnNameId);
+        }
+    }
+    else
+        _writeTraceLine(`c;${srcFileId};${srcLoc};${destFileId};${destLoc};${fnName}`);
     
     callInfo = null;
 }
@@ -270,12 +417,34 @@ function writeReturn(fileId, location, isReturn1)
     if(callInfo)
         writeCall();
 
+    if(useBinaryTraceFormat)
+    {
+        if(isTracing)
+            _writeBinaryTraceEntry(isReturn1 ? BinaryEntryTypes.Return1 : BinaryEntryTypes.Return2, fileId, _getBinaryStringId(location));
+        return;
+    }
+
     const ret = isReturn1 ? 'r' : 'R';
     _writeTraceLine(`${ret};${fileId};${location}`);
 }
 
 function writeYield(fileId, location, isResume)
 {
+    if(useBinaryTraceFormat)
+    {
+        if(isTracing)
+        {
+            const locationId = _getBinaryStringId(location);
+            _reserveBinaryTraceSpace(10);
+            binaryTraceBuffer[binaryTraceBufferPosition] = BinaryEntryTypes.Yield;
+            binaryTraceBuffer.writeUInt32LE(fileId, binaryTraceBufferPosition + 1);
+            binaryTraceBuffer.writeUInt32LE(locationId, binaryTraceBufferPosition + 5);
+            binaryTraceBuffer[binaryTraceBufferPosition + 9] = isResume ? 1 : 0;
+            binaryTraceBufferPosition += 10;
+        }
+        return;
+    }
+
     const res = isResume ? 'Y' : 'Y';
     _writeTraceLine(`${res};${fileId};${location}`);
 }
@@ -291,11 +460,28 @@ function writeBranch(fileId, sourceLoc, bodyLocation)
 
 function writeJump(fileId, sourceLoc, destLoc)
 {
+    if(useBinaryTraceFormat)
+    {
+        if(isTracing)
+        {
+            const sourceLocId = _getBinaryStringId(sourceLoc);
+            const destLocId = _getBinaryStringId(destLoc);
+            _writeBinaryTraceEntry(BinaryEntryTypes.Jump, fileId, sourceLocId, destLocId);
+        }
+        return;
+    }
+
     _writeTraceLine(`j;${fileId};${sourceLoc};${destLoc}`);
 }
 
 function writeMemoryAccess(fileId, loc, objId, offset, isWrite, computedVar)
 {
+    if(useBinaryTraceFormat)
+    {
+        _writeBinaryMemoryAccess(fileId, loc, objId, offset, isWrite, computedVar);
+        return;
+    }
+
     let offsetStr = offset;
     if (offset == constants.COMPUTED_OFFSET_INDICATOR) {
         offsetStr = `${computedVar}`;
@@ -308,6 +494,36 @@ function writeMemoryAccess(fileId, loc, objId, offset, isWrite, computedVar)
     }
 }
 
+function _writeBinaryMemoryAccess(fileId, loc, objId, offset, isWrite, computedVar)
+{
+    if(!isTracing)
+        return;
+
+    const objIdValue = uidUtil.getUid(objId);
+    if(!objIdValue || objIdValue == constants.PRIMITIVE_INDICATOR)
+        return;
+
+    // Integer offsets fitting into 32 bits are stored directly, everything else is stored as a string,
+    // so the preprocessor sees the same offsets as in the text format
+    let flags = isWrite ? MemoryAccessFlags.Write : 0;
+    let offsetValue = offset == constants.COMPUTED_OFFSET_INDICATOR ? computedVar : offset;
+    if(!(typeof offsetValue === "number" && Number.isInteger(offsetValue) && offsetValue >= 0 && offsetValue <= 0xFFFFFFFF))
+    {
+        flags |= MemoryAccessFlags.NamedOffset;
+        offsetValue = _getBinaryStringId(`${offsetValue}`);
+    }
+    const locId = _getBinaryStringId(loc);
+
+    _reserveBinaryTraceSpace(18);
+    binaryTraceBuffer[binaryTraceBufferPosition] = BinaryEntryTypes.MemoryAccess;
+    binaryTraceBuffer[binaryTraceBufferPosition + 1] = flags;
+    binaryTraceBuffer.writeUInt32LE(fileId, binaryTraceBufferPosition + 2);
+    binaryTraceBuffer.writeUInt32LE(locId, binaryTraceBufferPosition + 6);
+    binaryTraceBuffer.writeUInt32LE(objIdValue, binaryTraceBufferPosition + 10);
+    binaryTraceBuffer.writeUInt32LE(offsetValue, binaryTraceBufferPosition + 14);
+    binaryTraceBufferPosition += 18;
+}
+
 /**
  * Instruments the given dynamically imported file.
  * 
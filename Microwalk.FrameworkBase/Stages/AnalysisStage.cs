@@ -1,4 +1,5 @@
-﻿using System.Threading.Tasks;
+﻿using System;
+using System.Threading.Tasks;
 
 namespace Microwalk.FrameworkBase.Stages;
 
@@ -8,6 +9,12 @@ namespace Microwalk.FrameworkBase.Stages;
 /// <remarks>
 /// This stage functions as a sink; it receives a stream of <see cref="TraceEntity"/> objects, which might be processed on the fly, or stored for later processing.
 /// After processing all traces, the function <see cref="FinishAsync"/> is called by the pipeline implementation; this may either be a no-op, or perform final analysis steps like outputting results.
+///
+/// Modules may additionally publish a running leakage estimate through <see cref="GetLeakageEstimate"/>, which the pipeline uses to stop testcase generation early.
+///
+/// In a distributed campaign, the workers run the analysis modules on their own traces and periodically hand the collected state to the coordinator through
+/// <see cref="ExportStateAsync"/>. The coordinator combines these states with <see cref="MergeStateAsync"/> and then calls <see cref="FinishAsync"/> as usual.
+/// Only modules returning true for <see cref="SupportsStateMerging"/> can be used in distributed campaigns.
 /// </remarks>
 public abstract class AnalysisStage : PipelineStage
 {
@@ -26,4 +33,29 @@ public abstract class AnalysisStage : PipelineStage
     /// Performs final analysis steps (e.g. outputting results). This function is called exactly once, after the trace pipeline is done.
     /// </summary>
     public abstract Task FinishAsync();
+
+    /// <summary>
+    /// Returns a snapshot of the running leakage estimate, or null if the module does not support incremental estimates.
+    /// Modules supporting this must return a non-null value from the start, even before any trace was added. This method is expected to be thread-safe.
+    /// </summary>
+    public virtual LeakageEstimate? GetLeakageEstimate() => null;
+
+    /// <summary>
+    /// Returns whether the module supports exporting and merging its analysis state, and thus can be used in distributed campaigns.
+    /// </summary>
+    public virtual bool SupportsStateMerging => false;
+
+    /// <summary>
+    /// Serializes the analysis state of all traces added since the last call, and removes it from this module instance.
+    /// This is only called while no trace is added concurrently.
+    /// </summary>
+    /// <returns>Serialized state, which can be passed to <see cref="MergeStateAsync"/> of an instance with the same configuration.</returns>
+    public virtual Task<byte[]> ExportStateAsync() => throw new NotSupportedException("This analysis module does not support exporting its state.");
+
+    /// <summary>
+    /// Merges the given state, which was produced by <see cref="ExportStateAsync"/> of an instance with the same configuration, into the analysis state.
+    /// This method is expected to be thread-safe.
+    /// </summary>
+    /// <param name="state">Serialized state.</param>
+    public virtual Task MergeStateAsync(byte[] state) => throw new NotSupportedException("This analysis module does not support merging states.");
 }
\ No newline at end of file
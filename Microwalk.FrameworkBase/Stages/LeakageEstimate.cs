@@ -0,0 +1,21 @@
+﻿namespace Microwalk.FrameworkBase.Stages;
+
+/// <summary>
+/// Running leakage estimate of an analysis module, as published by <see cref="AnalysisStage.GetLeakageEstimate"/>.
+/// </summary>
+/// <param name="TestcaseCount">Number of testcases that the estimate is based on.</param>
+/// <param name="TrackedCount">Number of tracked targets (e.g., memory accessing instructions).</param>
+/// <param name="LeakingCount">Number of tracked targets that are already known to leak.</param>
+/// <param name="LastChangeTestcaseCount">Value of <paramref name="TestcaseCount"/> when <paramref name="TrackedCount"/> or <paramref name="LeakingCount"/> last changed.</param>
+public sealed record LeakageEstimate(int TestcaseCount, int TrackedCount, int LeakingCount, int LastChangeTestcaseCount)
+{
+    /// <summary>
+    /// Number of testcases which were analyzed since the estimate last changed.
+    /// </summary>
+    public int StableTestcaseCount => TestcaseCount - LastChangeTestcaseCount;
+
+    /// <summary>
+    /// Returns whether all tracked targets are known to leak, i.e., further testcases cannot change the classification.
+    /// </summary>
+    public bool AllLeaking => TrackedCount > 0 && LeakingCount == TrackedCount;
+}
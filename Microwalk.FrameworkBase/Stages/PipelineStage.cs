@@ -21,6 +21,13 @@ public abstract class PipelineStage
     /// </summary>
     public abstract bool SupportsParallelism { get; }
 
+    /// <summary>
+    /// Returns data which identifies the configuration of this stage, i.e., everything apart from the testcase that influences the stage's results.
+    /// The pipeline uses this to reuse results of earlier runs with the same configuration.
+    /// If this is null, the results of this stage are never cached.
+    /// </summary>
+    public virtual byte[]? CacheKey => null;
+
     /// <summary>
     /// Cancellation token for controlling the pipeline.
     /// If this is cancelled, the respective pipeline stages should abort.
@@ -1,4 +1,6 @@
-﻿using Microwalk.FrameworkBase.TraceFormat;
+﻿using System;
+using System.Collections.Generic;
+using Microwalk.FrameworkBase.TraceFormat;
 
 namespace Microwalk.FrameworkBase;
 
@@ -22,11 +24,27 @@ public class TraceEntity
     /// </summary>
     public string TestcaseFilePath { get; init; } = "";
 
+    /// <summary>
+    /// The contents of the associated testcase, if the testcase stage keeps it in memory. May be null.
+    /// If the testcase was not written to disk, <see cref="TestcaseFilePath"/> is empty.
+    /// </summary>
+    public byte[]? TestcaseData { get; init; }
+
     /// <summary>
     /// The associated raw trace file. May be null.
     /// </summary>
     public string? RawTraceFilePath { get; set; }
 
+    /// <summary>
+    /// The raw trace files of further threads of the investigated program, if the trace stage records those separately. May be null.
+    /// </summary>
+    public List<string>? RawThreadTraceFilePaths { get; set; }
+
+    /// <summary>
+    /// The contents of the associated raw trace, if the trace stage passes it in memory instead of writing it to <see cref="RawTraceFilePath"/>. May be null.
+    /// </summary>
+    public ArraySegment<byte>? RawTraceData { get; set; }
+
     /// <summary>
     /// The associated preprocessed trace file. May be null.
     /// </summary>
@@ -0,0 +1,174 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using Microwalk.FrameworkBase.Utilities;
+
+namespace Microwalk.FrameworkBase.TraceFormat;
+
+/// <summary>
+/// Represents a leakage fingerprint, which is computed by a trace generator instead of a full trace.
+/// A fingerprint holds the final per-instruction hashes of a single testcase.
+/// </summary>
+public class FingerprintFile
+{
+    /// <summary>
+    /// File name extension of fingerprint files.
+    /// </summary>
+    public const string FileExtension = ".fingerprint";
+
+    /// <summary>
+    /// Magic number at the beginning of fingerprint files ("MWFP").
+    /// </summary>
+    private const uint FingerprintFileMagic = 0x5046574D;
+
+    /// <summary>
+    /// Supported version of the fingerprint file format.
+    /// </summary>
+    private const uint FingerprintFileVersion = 1;
+
+    /// <summary>
+    /// The different kinds of fingerprints.
+    /// </summary>
+    public enum FingerprintKinds : uint
+    {
+        /// <summary>
+        /// One rolling hash over the accessed memory addresses per memory accessing instruction, as computed by the instruction memory access trace leakage analysis.
+        /// </summary>
+        InstructionMemoryAccess = 1,
+
+        /// <summary>
+        /// One rolling hash over the accessed memory addresses per memory accessing instruction and call stack, as computed by the call stack memory access
+        /// trace leakage analysis.
+        /// </summary>
+        CallStackMemoryAccess = 2
+    }
+
+    /// <summary>
+    /// The kind of this fingerprint.
+    /// </summary>
+    public FingerprintKinds Kind { get; }
+
+    /// <summary>
+    /// The loaded images, indexed by their IDs.
+    /// </summary>
+    public Dictionary<int, TracePrefixFile.ImageFileInfo> ImageFiles { get; }
+
+    /// <summary>
+    /// The instruction hashes (instruction ID => hash). The hashes have the same layout as in the memory access trace leakage analyses.
+    /// Only filled for <see cref="FingerprintKinds.InstructionMemoryAccess"/>.
+    /// </summary>
+    public InstructionHashTable InstructionHashes { get; }
+
+    /// <summary>
+    /// The call tree nodes, parents before children, starting with the root node (call stack ID 0).
+    /// Only filled for <see cref="FingerprintKinds.CallStackMemoryAccess"/>.
+    /// </summary>
+    public List<CallStackNodeInfo> CallStackNodes { get; }
+
+    /// <summary>
+    /// The instruction hashes per call stack (call stack ID => instruction ID => hash).
+    /// Only filled for <see cref="FingerprintKinds.CallStackMemoryAccess"/>.
+    /// </summary>
+    public Dictionary<ulong, InstructionHashTable> CallStackInstructionHashes { get; }
+
+    /// <summary>
+    /// Loads a fingerprint file from the given byte buffer.
+    /// </summary>
+    /// <param name="buffer">Buffer containing the fingerprint data.</param>
+    public FingerprintFile(Memory<byte> buffer)
+    {
+        // Header
+        var reader = new FastBinaryBufferReader(buffer);
+        if(reader.ReadUInt32() != FingerprintFileMagic)
+            throw new InvalidDataException("Invalid fingerprint file magic.");
+        uint version = reader.ReadUInt32();
+        if(version != FingerprintFileVersion)
+            throw new InvalidDataException($"Unsupported fingerprint file version {version}.");
+        Kind = (FingerprintKinds)reader.ReadUInt32();
+
+        // Read image file information
+        int imageFileCount = reader.ReadInt32();
+        ImageFiles = new Dictionary<int, TracePrefixFile.ImageFileInfo>();
+        for(int i = 0; i < imageFileCount; ++i)
+        {
+            var imageFile = new TracePrefixFile.ImageFileInfo(reader);
+            ImageFiles.Add(imageFile.Id, imageFile);
+        }
+
+        // Read call tree
+        bool hasCallStacks = Kind == FingerprintKinds.CallStackMemoryAccess;
+        CallStackNodes = new List<CallStackNodeInfo>();
+        CallStackInstructionHashes = new Dictionary<ulong, InstructionHashTable>();
+        if(hasCallStacks)
+        {
+            int callStackNodeCount = reader.ReadInt32();
+            for(int i = 0; i < callStackNodeCount; ++i)
+            {
+                var callStackNode = new CallStackNodeInfo
+                {
+                    CallStackId = reader.ReadUInt64(),
+                    ParentCallStackId = reader.ReadUInt64(),
+                    InstructionId = reader.ReadUInt64(),
+                    Hits = reader.ReadInt32()
+                };
+                CallStackNodes.Add(callStackNode);
+                CallStackInstructionHashes.Add(callStackNode.CallStackId, new InstructionHashTable());
+            }
+        }
+
+        // Read hashes
+        int entryCount = reader.ReadInt32();
+        InstructionHashes = new InstructionHashTable(hasCallStacks ? 0 : entryCount);
+        for(int i = 0; i < entryCount; ++i)
+        {
+            ulong callStackId = hasCallStacks ? reader.ReadUInt64() : 0;
+            ulong instructionId = reader.ReadUInt64();
+            ulong hash = reader.ReadUInt64();
+            ulong memoryAddressId = reader.ReadUInt64();
+
+            if(hasCallStacks)
+            {
+                if(!CallStackInstructionHashes.TryGetValue(callStackId, out var instructionHashes))
+                    throw new InvalidDataException($"Unknown call stack ID {callStackId:x16} in fingerprint file.");
+                instructionHashes.Set(instructionId, ((UInt128)memoryAddressId << 64) | hash);
+            }
+            else
+                InstructionHashes.Set(instructionId, ((UInt128)memoryAddressId << 64) | hash);
+        }
+    }
+
+    /// <summary>
+    /// Describes one node of the call tree of a call stack fingerprint.
+    /// </summary>
+    public class CallStackNodeInfo
+    {
+        /// <summary>
+        /// Identifier for the call stack until this node: id = hash(parentId || instructionId).
+        /// </summary>
+        public ulong CallStackId { get; init; }
+
+        /// <summary>
+        /// Call stack ID of the parent node.
+        /// </summary>
+        public ulong ParentCallStackId { get; init; }
+
+        /// <summary>
+        /// Identifier for the associated call target instruction (0 for the root node).
+        /// </summary>
+        public ulong InstructionId { get; init; }
+
+        /// <summary>
+        /// Number of times this node was entered.
+        /// </summary>
+        public int Hits { get; init; }
+    }
+
+    /// <summary>
+    /// Checks whether the given raw trace file is a fingerprint file.
+    /// </summary>
+    /// <param name="path">Path of the raw trace file.</param>
+    public static bool IsFingerprintFile(string? path)
+    {
+        return path != null && path.EndsWith(FileExtension, StringComparison.Ordinal);
+    }
+}
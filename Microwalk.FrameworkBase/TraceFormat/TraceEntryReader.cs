@@ -0,0 +1,215 @@
+﻿using System;
+using System.IO;
+using System.Linq;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Exceptions;
+using Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
+
+namespace Microwalk.FrameworkBase.TraceFormat;
+
+/// <summary>
+/// Sequential reader for trace files, which decodes the trace entries into value types instead of <see cref="ITraceEntry"/> objects.
+/// This avoids interface dispatch and type casts in performance critical loops.
+/// </summary>
+/// <remarks>
+/// Usage: Call <see cref="MoveNext"/> to advance to the next entry, check <see cref="EntryType"/>, and then call the respective <c>Read*</c> method.
+/// Entries which are not needed may be skipped without decoding them.
+///
+/// The entry value types have the same memory layout as the serialized entries, so decoding is a single unaligned read. As the trace format, this assumes
+/// a little endian platform.
+/// </remarks>
+public sealed class TraceEntryReader : IDisposable
+{
+    /// <summary>
+    /// Chunk size when reading from a file.
+    /// </summary>
+    private const int ChunkSize = 1 * 1024 * 1024;
+
+    /// <summary>
+    /// The maximum size of a trace entry, including the entry type byte.
+    /// </summary>
+    private static readonly int _maxEntrySize = new[]
+    {
+        Branch.EntrySize,
+        HeapAllocation.EntrySize,
+        HeapFree.EntrySize,
+        HeapMemoryAccess.EntrySize,
+        ImageMemoryAccess.EntrySize,
+        StackAllocation.EntrySize,
+        StackMemoryAccess.EntrySize
+    }.Max();
+
+    /// <summary>
+    /// Trace data sources, which are read one after another. Each source is either a buffer or a file path.
+    /// </summary>
+    private readonly (Memory<byte>? Buffer, string? Path)[] _sources;
+
+    /// <summary>
+    /// Index of the next source in <see cref="_sources"/>.
+    /// </summary>
+    private int _nextSourceIndex;
+
+    /// <summary>
+    /// Current buffer. When reading from a file, this holds the current chunk.
+    /// </summary>
+    private Memory<byte> _data;
+
+    /// <summary>
+    /// Number of valid bytes in <see cref="_data"/>.
+    /// </summary>
+    private int _length;
+
+    /// <summary>
+    /// Offset of the current entry in <see cref="_data"/>.
+    /// </summary>
+    private int _position;
+
+    /// <summary>
+    /// Size of the current entry, including the entry type byte.
+    /// </summary>
+    private int _currentEntrySize;
+
+    /// <summary>
+    /// The currently read file, if any.
+    /// </summary>
+    private FileStream? _fileStream;
+
+    /// <summary>
+    /// Chunk buffer for reading files.
+    /// </summary>
+    private byte[]? _chunk;
+
+    /// <summary>
+    /// Type of the current entry.
+    /// </summary>
+    public TraceEntryTypes.TraceEntryTypes EntryType { get; private set; }
+
+    /// <summary>
+    /// Creates a reader for the given trace data sources.
+    /// </summary>
+    /// <param name="sources">Trace data sources, which are read one after another. Each source is either a buffer or a file path.</param>
+    internal TraceEntryReader(params (Memory<byte>? Buffer, string? Path)[] sources)
+    {
+        _sources = sources;
+    }
+
+    /// <summary>
+    /// Advances to the next trace entry.
+    /// </summary>
+    /// <returns>false if the end of the trace was reached, else true.</returns>
+    public bool MoveNext()
+    {
+        _position += _currentEntrySize;
+        _currentEntrySize = 0;
+
+        while(true)
+        {
+            // Make sure that the chunk buffer contains the entire next entry
+            if(_fileStream != null && _length - _position < _maxEntrySize)
+                ReadNextChunk();
+
+            if(_position < _length)
+                break;
+
+            if(!OpenNextSource())
+                return false;
+        }
+
+        EntryType = (TraceEntryTypes.TraceEntryTypes)_data.Span[_position];
+        _currentEntrySize = EntryType switch
+        {
+            TraceEntryTypes.TraceEntryTypes.HeapAllocation => HeapAllocation.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.HeapFree => HeapFree.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.StackAllocation => StackAllocation.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.Branch => Branch.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.HeapMemoryAccess => HeapMemoryAccess.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.ImageMemoryAccess => ImageMemoryAccess.EntrySize,
+            TraceEntryTypes.TraceEntryTypes.StackMemoryAccess => StackMemoryAccess.EntrySize,
+            _ => throw new TraceFormatException("Illegal trace entry type.")
+        };
+        if(_position + _currentEntrySize > _length)
+            throw new TraceFormatException("Incomplete trace entry at end of trace.");
+
+        return true;
+    }
+
+    public HeapAllocationEntry ReadHeapAllocation() => Read<HeapAllocationEntry>(TraceEntryTypes.TraceEntryTypes.HeapAllocation);
+    public HeapFreeEntry ReadHeapFree() => Read<HeapFreeEntry>(TraceEntryTypes.TraceEntryTypes.HeapFree);
+    public StackAllocationEntry ReadStackAllocation() => Read<StackAllocationEntry>(TraceEntryTypes.TraceEntryTypes.StackAllocation);
+    public BranchEntry ReadBranch() => Read<BranchEntry>(TraceEntryTypes.TraceEntryTypes.Branch);
+    public HeapMemoryAccessEntry ReadHeapMemoryAccess() => Read<HeapMemoryAccessEntry>(TraceEntryTypes.TraceEntryTypes.HeapMemoryAccess);
+    public ImageMemoryAccessEntry ReadImageMemoryAccess() => Read<ImageMemoryAccessEntry>(TraceEntryTypes.TraceEntryTypes.ImageMemoryAccess);
+    public StackMemoryAccessEntry ReadStackMemoryAccess() => Read<StackMemoryAccessEntry>(TraceEntryTypes.TraceEntryTypes.StackMemoryAccess);
+
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    private T Read<T>(TraceEntryTypes.TraceEntryTypes entryType) where T : struct
+    {
+        if(EntryType != entryType || _currentEntrySize == 0)
+            throw new InvalidOperationException($"The current trace entry is not of type {entryType}.");
+
+        return MemoryMarshal.Read<T>(_data.Span.Slice(_position + 1));
+    }
+
+    /// <summary>
+    /// Switches to the next trace data source.
+    /// </summary>
+    /// <returns>false if there are no more sources, else true.</returns>
+    private bool OpenNextSource()
+    {
+        _fileStream?.Dispose();
+        _fileStream = null;
+
+        if(_nextSourceIndex == _sources.Length)
+            return false;
+
+        var (buffer, path) = _sources[_nextSourceIndex++];
+        _position = 0;
+        if(buffer != null)
+        {
+            _data = buffer.Value;
+            _length = _data.Length;
+        }
+        else
+        {
+            _chunk ??= new byte[ChunkSize];
+            _data = _chunk;
+            _length = 0;
+            _fileStream = File.Open(path!, FileMode.Open, FileAccess.Read, FileShare.Read);
+            ReadNextChunk();
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Moves the remaining bytes of the current chunk to its start, and fills the rest with data from the file.
+    /// </summary>
+    private void ReadNextChunk()
+    {
+        int remaining = _length - _position;
+        _chunk.AsSpan(_position, remaining).CopyTo(_chunk);
+        _position = 0;
+        _length = remaining;
+
+        while(_length < ChunkSize)
+        {
+            int r = _fileStream!.Read(_chunk.AsSpan(_length));
+            if(r == 0)
+            {
+                // End of file, no need to check again
+                _fileStream.Dispose();
+                _fileStream = null;
+                break;
+            }
+
+            _length += r;
+        }
+    }
+
+    public void Dispose()
+    {
+        _fileStream?.Dispose();
+        _fileStream = null;
+    }
+}
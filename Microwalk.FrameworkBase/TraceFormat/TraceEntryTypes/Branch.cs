@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -70,4 +71,42 @@ public class Branch : ITraceEntry
         Call = 1,
         Return = 2
     }
+}
+
+/// <summary>
+/// Value representation of a code branch, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="Branch"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct BranchEntry
+{
+    /// <summary>
+    /// The image ID of the source instruction.
+    /// </summary>
+    public readonly int SourceImageId;
+
+    /// <summary>
+    /// The address of the source instruction, relative to the image start address.
+    /// </summary>
+    public readonly uint SourceInstructionRelativeAddress;
+
+    /// <summary>
+    /// The image ID of the destination instruction.
+    /// </summary>
+    public readonly int DestinationImageId;
+
+    /// <summary>
+    /// The address of the destination instruction, relative to the image start address.
+    /// </summary>
+    public readonly uint DestinationInstructionRelativeAddress;
+
+    /// <summary>
+    /// Tells whether the branch was taken.
+    /// </summary>
+    public readonly bool Taken;
+
+    /// <summary>
+    /// The type of the branching instruction.
+    /// </summary>
+    public readonly Branch.BranchTypes BranchType;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -39,4 +40,27 @@ public class HeapAllocation : ITraceEntry
     /// The address of the allocated memory.
     /// </summary>
     public ulong Address { get; set; }
+}
+
+/// <summary>
+/// Value representation of a memory allocation, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="HeapAllocation"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct HeapAllocationEntry
+{
+    /// <summary>
+    /// The ID of the allocated block.
+    /// </summary>
+    public readonly int Id;
+
+    /// <summary>
+    /// The size of the allocated memory.
+    /// </summary>
+    public readonly uint Size;
+
+    /// <summary>
+    /// The address of the allocated memory.
+    /// </summary>
+    public readonly ulong Address;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -25,4 +26,17 @@ public class HeapFree : ITraceEntry
     /// The ID of the freed allocation block.
     /// </summary>
     public int Id { get; set; }
+}
+
+/// <summary>
+/// Value representation of a memory free, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="HeapFree"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct HeapFreeEntry
+{
+    /// <summary>
+    /// The ID of the freed allocation block.
+    /// </summary>
+    public readonly int Id;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -60,4 +61,42 @@ public class HeapMemoryAccess : ITraceEntry
     /// The address of the accessed memory, relative to the allocated block's start address.
     /// </summary>
     public uint MemoryRelativeAddress { get; set; }
+}
+
+/// <summary>
+/// Value representation of an access to memory allocated on the heap, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="HeapMemoryAccess"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct HeapMemoryAccessEntry
+{
+    /// <summary>
+    /// Determines whether this is a write access.
+    /// </summary>
+    public readonly bool IsWrite;
+
+    /// <summary>
+    /// Size of the memory access.
+    /// </summary>
+    public readonly short Size;
+
+    /// <summary>
+    /// The image ID of the accessing instruction.
+    /// </summary>
+    public readonly int InstructionImageId;
+
+    /// <summary>
+    /// The address of the accessing instruction, relative to the image start address.
+    /// </summary>
+    public readonly uint InstructionRelativeAddress;
+
+    /// <summary>
+    /// The allocation block ID of the accessed memory.
+    /// </summary>
+    public readonly int HeapAllocationBlockId;
+
+    /// <summary>
+    /// The address of the accessed memory, relative to the allocated block's start address.
+    /// </summary>
+    public readonly uint MemoryRelativeAddress;
 }
\ No newline at end of file
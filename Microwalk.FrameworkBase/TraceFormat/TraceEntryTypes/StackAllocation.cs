@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -53,4 +54,37 @@ public class StackAllocation : ITraceEntry
     /// The base address of the allocated memory.
     /// </summary>
     public ulong Address { get; set; }
+}
+
+/// <summary>
+/// Value representation of a stack allocation, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="StackAllocation"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct StackAllocationEntry
+{
+    /// <summary>
+    /// The ID of the allocated block.
+    /// </summary>
+    public readonly int Id;
+
+    /// <summary>
+    /// The image ID of the instruction which makes the stack allocation.
+    /// </summary>
+    public readonly int InstructionImageId;
+
+    /// <summary>
+    /// The address of the allocating instruction, relative to the image start address.
+    /// </summary>
+    public readonly uint InstructionRelativeAddress;
+
+    /// <summary>
+    /// The size of the allocated memory.
+    /// </summary>
+    public readonly uint Size;
+
+    /// <summary>
+    /// The base address of the allocated memory.
+    /// </summary>
+    public readonly ulong Address;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
-﻿using Microwalk.FrameworkBase.Utilities;
+﻿using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 
@@ -61,4 +62,42 @@ public class StackMemoryAccess : ITraceEntry
     /// The address of the accessed memory, relative to the allocated block's start address.
     /// </summary>
     public uint MemoryRelativeAddress { get; set; }
+}
+
+/// <summary>
+/// Value representation of an access to memory allocated on the stack, with the same memory layout as the serialized trace entry (without the entry type byte).
+/// See <see cref="StackMemoryAccess"/>.
+/// </summary>
+[StructLayout(LayoutKind.Sequential, Pack = 1)]
+public readonly struct StackMemoryAccessEntry
+{
+    /// <summary>
+    /// Determines whether this is a write access.
+    /// </summary>
+    public readonly bool IsWrite;
+
+    /// <summary>
+    /// Size of the memory access.
+    /// </summary>
+    public readonly short Size;
+
+    /// <summary>
+    /// The image ID of the accessing instruction.
+    /// </summary>
+    public readonly int InstructionImageId;
+
+    /// <summary>
+    /// The address of the accessing instruction, relative to the image start address.
+    /// </summary>
+    public readonly uint InstructionRelativeAddress;
+
+    /// <summary>
+    /// The allocation block ID of the accessed stack memory. -1 indicates that the allocation block could not be resolved.
+    /// </summary>
+    public readonly int StackAllocationBlockId;
+
+    /// <summary>
+    /// The address of the accessed memory, relative to the allocated block's start address.
+    /// </summary>
+    public readonly uint MemoryRelativeAddress;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 ﻿using System;
 using System.Collections;
 using System.Collections.Generic;
+using System.IO;
 using System.Linq;
 using Microwalk.FrameworkBase.Exceptions;
 using Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
@@ -68,6 +69,22 @@ public class TraceFile : IEnumerable<ITraceEntry>
     /// <returns></returns>
     public IEnumerable<ITraceEntry> GetEntriesWithPrefix() => Prefix == null ? this : Prefix.Concat(this);
 
+    /// <summary>
+    /// Writes the serialized trace data to the given stream, such that it can be loaded again with one of the constructors.
+    /// The trace prefix is not included.
+    /// </summary>
+    /// <param name="stream">Output stream.</param>
+    public virtual void CopyTo(Stream stream)
+    {
+        if(Buffer == null)
+        {
+            using var fileStream = File.OpenRead(_path!);
+            fileStream.CopyTo(stream);
+        }
+        else
+            stream.Write(Buffer.Value.Span);
+    }
+
     public IEnumerator<ITraceEntry> GetEnumerator()
     {
         if(Buffer == null)
@@ -114,6 +131,22 @@ public class TraceFile : IEnumerable<ITraceEntry>
             );
         }
     }
+
+    /// <summary>
+    /// Returns a reader, which decodes the trace entries into value types. The trace prefix is not included.
+    /// </summary>
+    public TraceEntryReader GetEntryReader() => new((Buffer, _path));
+
+    /// <summary>
+    /// Returns a reader, which decodes the trace entries into value types, including the trace prefix.
+    /// </summary>
+    public TraceEntryReader GetEntryReaderWithPrefix()
+    {
+        if(Prefix == null)
+            return GetEntryReader();
+
+        return new TraceEntryReader((Prefix.Buffer!.Value, null), (Buffer, _path));
+    }
 }
 
 /// <summary>
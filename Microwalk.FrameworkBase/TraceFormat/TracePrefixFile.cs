@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.IO;
 using Microwalk.FrameworkBase.Utilities;
 
 namespace Microwalk.FrameworkBase.TraceFormat;
@@ -14,6 +15,11 @@ public class TracePrefixFile : TraceFile
     /// </summary>
     public Dictionary<int, ImageFileInfo> ImageFiles { get; }
 
+    /// <summary>
+    /// The entire serialized prefix, including the image file information.
+    /// </summary>
+    private readonly Memory<byte> _data;
+
     /// <summary>
     /// Loads a trace prefix file from the given byte buffer.
     /// </summary>
@@ -31,9 +37,19 @@ public class TracePrefixFile : TraceFile
         }
 
         // Set internal buffer
+        _data = buffer;
         Buffer = buffer.Slice(reader.Position);
     }
 
+    /// <summary>
+    /// Writes the serialized trace prefix, including the image file information, to the given stream.
+    /// </summary>
+    /// <param name="stream">Output stream.</param>
+    public override void CopyTo(Stream stream)
+    {
+        stream.Write(_data.Span);
+    }
+
     /// <summary>
     /// Describes one loaded image file.
     /// </summary>
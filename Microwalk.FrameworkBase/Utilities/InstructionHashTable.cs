@@ -0,0 +1,220 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.Numerics;
+using System.Runtime.CompilerServices;
+
+namespace Microwalk.FrameworkBase.Utilities;
+
+/// <summary>
+/// Flat open-addressed hash table, which maps instruction IDs to rolling hashes over the memory addresses accessed by the respective instructions.
+/// </summary>
+/// <remarks>
+/// Each hash is stored inline in its table entry, and exposed as a 128-bit value: The lower 64 bits hold the rolling hash, the upper 64 bits hold the last
+/// accessed memory address ID. This matches the 16-byte layout of the hashes which are computed by the memory access trace leakage analyses and stored in
+/// fingerprint files.
+///
+/// This class is not thread-safe.
+/// </remarks>
+public class InstructionHashTable
+{
+    // xxHash64 constants.
+    private const ulong XxHashPrime64_1 = 0x9E3779B185EBCA87;
+    private const ulong XxHashPrime64_2 = 0xC2B2AE3D27D4EB4F;
+    private const ulong XxHashPrime64_3 = 0x165667B19E3779F9;
+    private const ulong XxHashPrime64_4 = 0x85EBCA77C2B2AE63;
+    private const ulong XxHashPrime64_5 = 0x27D4EB2F165667C5;
+
+    /// <summary>
+    /// Table entries. All data of an entry is stored together, so a lookup usually touches only one cache line.
+    /// </summary>
+    private Entry[] _entries;
+
+    /// <summary>
+    /// Number of stored instructions.
+    /// </summary>
+    public int Count { get; private set; }
+
+    /// <summary>
+    /// Creates a new empty hash table.
+    /// </summary>
+    /// <param name="capacity">Number of instructions which can be stored without growing the table.</param>
+    public InstructionHashTable(int capacity = 0)
+    {
+        int size = (int)BitOperations.RoundUpToPowerOf2((uint)Math.Max(16, 2 * capacity));
+        _entries = new Entry[size];
+    }
+
+    /// <summary>
+    /// Updates the hash of the given instruction with the given memory address: newHash = hash(oldHash || address).
+    /// Newly encountered instructions start with a zero hash.
+    /// </summary>
+    /// <param name="instructionId">Instruction ID.</param>
+    /// <param name="memoryAddressId">Accessed memory address ID.</param>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    public void AddMemoryAccess(ulong instructionId, ulong memoryAddressId)
+    {
+        ref Entry entry = ref GetOrAddEntry(instructionId);
+        entry.Hash = XxHash64(entry.Hash, memoryAddressId);
+        entry.MemoryAddressId = memoryAddressId;
+    }
+
+    /// <summary>
+    /// Sets the hash of the given instruction.
+    /// </summary>
+    /// <param name="instructionId">Instruction ID.</param>
+    /// <param name="hash">Hash.</param>
+    public void Set(ulong instructionId, UInt128 hash)
+    {
+        ref Entry entry = ref GetOrAddEntry(instructionId);
+        entry.Hash = (ulong)hash;
+        entry.MemoryAddressId = (ulong)(hash >> 64);
+    }
+
+    /// <summary>
+    /// Returns an enumerator over all (instruction ID, hash) pairs, in no particular order.
+    /// </summary>
+    public Enumerator GetEnumerator() => new(this);
+
+    /// <summary>
+    /// Returns a reference to the entry of the given instruction. If the instruction does not exist yet, a new entry with a zero hash is created.
+    /// </summary>
+    /// <param name="instructionId">Instruction ID.</param>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    private ref Entry GetOrAddEntry(ulong instructionId)
+    {
+        var entries = _entries;
+        int mask = entries.Length - 1;
+        int index = GetIndex(instructionId, mask);
+        while(entries[index].Used)
+        {
+            if(entries[index].InstructionId == instructionId)
+                return ref entries[index];
+
+            index = (index + 1) & mask;
+        }
+
+        return ref AddEntry(instructionId);
+    }
+
+    /// <summary>
+    /// Adds a new entry for the given instruction, which must not exist yet.
+    /// </summary>
+    /// <param name="instructionId">Instruction ID.</param>
+    private ref Entry AddEntry(ulong instructionId)
+    {
+        // Keep load factor below 1/2
+        if(2 * (Count + 1) > _entries.Length)
+            Grow();
+
+        int mask = _entries.Length - 1;
+        int index = GetIndex(instructionId, mask);
+        while(_entries[index].Used)
+            index = (index + 1) & mask;
+
+        ref Entry entry = ref _entries[index];
+        entry.Used = true;
+        entry.InstructionId = instructionId;
+        ++Count;
+
+        return ref entry;
+    }
+
+    private void Grow()
+    {
+        var oldEntries = _entries;
+        _entries = new Entry[2 * oldEntries.Length];
+
+        int mask = _entries.Length - 1;
+        foreach(var entry in oldEntries)
+        {
+            if(!entry.Used)
+                continue;
+
+            int index = GetIndex(entry.InstructionId, mask);
+            while(_entries[index].Used)
+                index = (index + 1) & mask;
+
+            _entries[index] = entry;
+        }
+    }
+
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    private static int GetIndex(ulong instructionId, int mask) => (int)((instructionId * XxHashPrime64_1) >> 32) & mask;
+
+    /// <summary>
+    /// Computes the xxHash64 (seed 0) of the 16-byte little endian concatenation of the given values.
+    /// This is equivalent to hashing a 16-byte buffer with a generic xxHash64 implementation, but avoids its overhead.
+    /// </summary>
+    /// <param name="left">First 8 bytes.</param>
+    /// <param name="right">Last 8 bytes.</param>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    public static ulong XxHash64(ulong left, ulong right)
+    {
+        // Short input path of xxHash64 for exactly two 8-byte lanes
+        ulong hash = XxHashPrime64_5 + 16;
+        hash ^= BitOperations.RotateLeft(left * XxHashPrime64_2, 31) * XxHashPrime64_1;
+        hash = BitOperations.RotateLeft(hash, 27) * XxHashPrime64_1 + XxHashPrime64_4;
+        hash ^= BitOperations.RotateLeft(right * XxHashPrime64_2, 31) * XxHashPrime64_1;
+        hash = BitOperations.RotateLeft(hash, 27) * XxHashPrime64_1 + XxHashPrime64_4;
+
+        // Avalanche
+        hash ^= hash >> 33;
+        hash *= XxHashPrime64_2;
+        hash ^= hash >> 29;
+        hash *= XxHashPrime64_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    /// <summary>
+    /// Formats the given hash as a hex string of its 16-byte little endian representation.
+    /// </summary>
+    /// <param name="hash">Hash.</param>
+    public static string FormatHash(UInt128 hash)
+    {
+        return $"{BinaryPrimitives.ReverseEndianness((ulong)hash):X16}{BinaryPrimitives.ReverseEndianness((ulong)(hash >> 64)):X16}";
+    }
+
+    /// <summary>
+    /// Enumerator over the entries of an <see cref="InstructionHashTable"/>.
+    /// </summary>
+    public struct Enumerator
+    {
+        private readonly InstructionHashTable _table;
+        private int _index;
+
+        internal Enumerator(InstructionHashTable table)
+        {
+            _table = table;
+            _index = -1;
+        }
+
+        public (ulong InstructionId, UInt128 Hash) Current
+        {
+            get
+            {
+                ref Entry entry = ref _table._entries[_index];
+                return (entry.InstructionId, ((UInt128)entry.MemoryAddressId << 64) | entry.Hash);
+            }
+        }
+
+        public bool MoveNext()
+        {
+            while(++_index < _table._entries.Length)
+            {
+                if(_table._entries[_index].Used)
+                    return true;
+            }
+
+            return false;
+        }
+    }
+
+    private struct Entry
+    {
+        public ulong InstructionId;
+        public ulong Hash;
+        public ulong MemoryAddressId;
+        public bool Used;
+    }
+}
@@ -0,0 +1,83 @@
+﻿using System;
+using System.Collections.Generic;
+using Microwalk.FrameworkBase.Stages;
+
+namespace Microwalk.FrameworkBase.Utilities;
+
+/// <summary>
+/// Keeps a running classification of instructions, based on the per-testcase instruction hashes: An instruction is considered leaking as soon as
+/// two testcases produce different hashes for it.
+/// </summary>
+/// <remarks>
+/// This matches the criterion of the final analysis, where an instruction with more than one distinct hash has a non-zero minimum entropy.
+/// The tracker only stores the first hash of each instruction, so its memory usage does not grow with the number of testcases.
+///
+/// This class is thread-safe.
+/// </remarks>
+public class InstructionLeakageTracker
+{
+    /// <summary>
+    /// Maps each tracked instruction to its first observed hash, or to null once the instruction is known to leak.
+    /// </summary>
+    private readonly Dictionary<ulong, UInt128?> _instructions = new();
+
+    /// <summary>
+    /// Lock for all tracker state.
+    /// </summary>
+    private readonly object _lock = new();
+
+    /// <summary>
+    /// Number of added testcases.
+    /// </summary>
+    private int _testcaseCount;
+
+    /// <summary>
+    /// Number of instructions which are known to leak.
+    /// </summary>
+    private int _leakingCount;
+
+    /// <summary>
+    /// Number of added testcases at the last time a new instruction was seen or an instruction was classified as leaking.
+    /// </summary>
+    private int _lastChangeTestcaseCount;
+
+    /// <summary>
+    /// Adds the instruction hashes of a single testcase.
+    /// </summary>
+    /// <param name="instructionHashes">Instruction hashes of the testcase.</param>
+    public void AddTestcase(InstructionHashTable instructionHashes)
+    {
+        lock(_lock)
+        {
+            ++_testcaseCount;
+
+            bool changed = false;
+            foreach(var (instructionId, hash) in instructionHashes)
+            {
+                if(!_instructions.TryGetValue(instructionId, out var firstHash))
+                {
+                    _instructions.Add(instructionId, hash);
+                    changed = true;
+                }
+                else if(firstHash != null && firstHash.Value != hash)
+                {
+                    _instructions[instructionId] = null;
+                    ++_leakingCount;
+                    changed = true;
+                }
+            }
+
+            if(changed)
+                _lastChangeTestcaseCount = _testcaseCount;
+        }
+    }
+
+    /// <summary>
+    /// Returns the current leakage estimate.
+    /// </summary>
+    public LeakageEstimate GetEstimate()
+    {
+        lock(_lock)
+            return new LeakageEstimate(_testcaseCount, _instructions.Count, _leakingCount, _lastChangeTestcaseCount);
+    }
+}
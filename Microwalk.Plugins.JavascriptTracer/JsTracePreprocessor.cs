@@ -1,4 +1,6 @@
-﻿using System.Collections.Concurrent;
+﻿using System.Buffers.Binary;
+using System.Collections.Concurrent;
+using System.IO.Compression;
 using System.Text;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
@@ -15,6 +17,11 @@ public class JsTracePreprocessor : PreprocessorStage
 {
     public override bool SupportsParallelism => true;
 
+    /// <summary>
+    /// Magic bytes at the beginning of binary traces, including the format version.
+    /// </summary>
+    private static readonly byte[] _binaryTraceMagic = "MWJSBIN\x01"u8.ToArray();
+
     /// <summary>
     /// Determines whether preprocessed traces are stored to disk.
     /// </summary>
@@ -67,6 +74,11 @@ public class JsTracePreprocessor : PreprocessorStage
     /// </summary>
     private Dictionary<int, string>? _prefixCompressedLinesLookup;
 
+    /// <summary>
+    /// Strings from the binary trace prefix, indexed by string ID.
+    /// </summary>
+    private List<string>? _prefixBinaryTraceStrings;
+
     /// <summary>
     /// ID of the external functions image.
     /// </summary>
@@ -273,30 +285,57 @@ public class JsTracePreprocessor : PreprocessorStage
             Options = FileOptions.SequentialScan,
             BufferSize = 1 * 1024 * 1024
         });
-        using var inputFileStreamReader = new StreamReader(inputFileStream, Encoding.UTF8);
 
         // If we are writing to memory, set the capacity of the writer to a rough estimate of the preprocessed file size,
         // in order to avoid reallocations and expensive copying
         if(!_firstTestcase && traceFileWriter is FastBinaryBufferWriter binaryBufferWriter)
             binaryBufferWriter.ResizeBuffer((int)inputFileStream.Length);
 
-        // Preallocated trace entry variables (only needed for serialization)
-        Branch branchEntry = new();
-        HeapAllocation heapAllocationEntry = new();
-        HeapMemoryAccess heapMemoryAccessEntry = new();
-
         // Helper function for adding requested MAP entries without having to check _firstTestcase every time
         // We cannot cast to IDictionary, as the TryAdd extension does not work with ConcurrentDictionary
         Func<(int imageId, uint relativeAddress), object?, bool> tryAddRequestedMapEntry = _firstTestcase
             ? (key, value) => _requestedMapEntriesPrefix!.TryAdd(key, value)
             : (key, value) => _requestedMapEntries!.TryAdd(key, value);
 
+        var state = new PreprocessingState(traceFileWriter, tryAddRequestedMapEntry)
+        {
+            HeapObjects = _prefixHeapObjects == null ? new() : new(_prefixHeapObjects),
+            NextHeapAllocationAddress = _prefixNextHeapAllocationAddress
+        };
+
+        // Check trace format: The binary format has a header, which may be wrapped in a gzip stream
+        Span<byte> header = stackalloc byte[_binaryTraceMagic.Length];
+        int headerLength = inputFileStream.ReadAtLeast(header, header.Length, false);
+        inputFileStream.Position = 0;
+        if(headerLength >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+        {
+            using var decompressionStream = new GZipStream(inputFileStream, CompressionMode.Decompress);
+            PreprocessBinaryTrace(decompressionStream, state, logPrefix);
+        }
+        else if(header[..headerLength].SequenceEqual(_binaryTraceMagic))
+            PreprocessBinaryTrace(inputFileStream, state, logPrefix);
+        else
+            PreprocessTextTrace(inputFileStream, state, logPrefix);
+
+        if(_firstTestcase)
+        {
+            _prefixNextHeapAllocationAddress = state.NextHeapAllocationAddress;
+            _prefixHeapObjects = state.HeapObjects;
+        }
+    }
+
+    /// <summary>
+    /// Parses a text trace and passes its entries to the Process* methods.
+    /// </summary>
+    /// <param name="inputFileStream">Trace file stream.</param>
+    /// <param name="state">Preprocessing state of the current trace.</param>
+    /// <param name="logPrefix">Prefix for error messages.</param>
+    private void PreprocessTextTrace(FileStream inputFileStream, PreprocessingState state, string logPrefix)
+    {
+        using var inputFileStreamReader = new StreamReader(inputFileStream, Encoding.UTF8);
+
         // Parse trace entries
-        (TracePrefixFile.ImageFileInfo imageFileInfo, uint address)? lastRet1Entry = null;
-        Dictionary<int, HeapObjectData> heapObjects = _prefixHeapObjects == null ? new() : new(_prefixHeapObjects);
         Dictionary<int, string> compressedLinesLookup = _prefixCompressedLinesLookup == null ? new() : new(_prefixCompressedLinesLookup);
-        ulong nextHeapAllocationAddress = _prefixNextHeapAllocationAddress;
-        const uint heapAllocationChunkSize = 0x100000;
         int lastLineId = 0;
         int inputBufferLength = 0;
         int inputBufferPosition = 0;
@@ -483,32 +522,7 @@ public class JsTracePreprocessor : PreprocessorStage
                         var source = ResolveLineInfo(sourceScriptId, sourcePart);
                         var destination = ResolveLineInfo(destinationScriptId, destinationPart);
 
-                        // Produce MAP entries
-                        tryAddRequestedMapEntry((source.imageData.ImageFileInfo.Id, source.relativeStartAddress), null);
-                        tryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeStartAddress), null);
-                        tryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeEndAddress), null);
-
-                        if(_firstTestcase)
-                        {
-                            // Record function name, if it is not already known
-                            destination.imageData.FunctionNameLookupPrefix!.TryAdd((destination.relativeStartAddress, destination.relativeEndAddress), new string(namePart));
-
-                            // Do not trace branches in prefix mode
-                            break;
-                        }
-
-                        // Record function name, if it is not already known
-                        destination.imageData.FunctionNameLookup!.TryAdd((destination.relativeStartAddress, destination.relativeEndAddress), new string(namePart));
-
-                        // Record call
-                        branchEntry.BranchType = Branch.BranchTypes.Call;
-                        branchEntry.Taken = true;
-                        branchEntry.SourceImageId = source.imageData.ImageFileInfo.Id;
-                        branchEntry.SourceInstructionRelativeAddress = source.relativeStartAddress;
-                        branchEntry.DestinationImageId = destination.imageData.ImageFileInfo.Id;
-                        branchEntry.DestinationInstructionRelativeAddress = destination.relativeStartAddress;
-                        branchEntry.Store(traceFileWriter);
-
+                        ProcessCall(state, source, destination, new string(namePart));
                         break;
                     }
 
@@ -522,16 +536,7 @@ public class JsTracePreprocessor : PreprocessorStage
                         int scriptId = ParseInt32NotSigned(scriptIdPart);
                         var location = ResolveLineInfo(scriptId, locationPart);
 
-                        // Produce MAP entries
-                        tryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
-
-                        // Do not trace branches in prefix mode
-                        if(_firstTestcase)
-                            break;
-
-                        // Remember for next Ret2 entry
-                        lastRet1Entry = (location.imageData.ImageFileInfo, location.relativeStartAddress);
-
+                        ProcessReturn1(state, location);
                         break;
                     }
 
@@ -545,35 +550,7 @@ public class JsTracePreprocessor : PreprocessorStage
                         int scriptId = ParseInt32NotSigned(scriptIdPart);
                         var location = ResolveLineInfo(scriptId, locationPart);
 
-                        // Produce MAP entries
-                        tryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
-
-                        // Do not trace branches in prefix mode
-                        if(_firstTestcase)
-                            break;
-
-                        // Create branch entry
-                        branchEntry.BranchType = Branch.BranchTypes.Return;
-                        branchEntry.Taken = true;
-                        branchEntry.DestinationImageId = location.imageData.ImageFileInfo.Id;
-                        branchEntry.DestinationInstructionRelativeAddress = location.relativeStartAddress;
-
-                        // Did we see a Ret1 entry? -> accurate source location info
-                        if(lastRet1Entry != null)
-                        {
-                            branchEntry.SourceImageId = lastRet1Entry.Value.imageFileInfo.Id;
-                            branchEntry.SourceInstructionRelativeAddress = lastRet1Entry.Value.address;
-
-                            lastRet1Entry = null;
-                        }
-                        else
-                        {
-                            branchEntry.SourceImageId = _externalFunctionsImageId;
-                            branchEntry.SourceInstructionRelativeAddress = _catchAllExternalFunctionAddress;
-                        }
-
-                        branchEntry.Store(traceFileWriter);
-
+                        ProcessReturn2(state, location);
                         break;
                     }
 
@@ -590,23 +567,7 @@ public class JsTracePreprocessor : PreprocessorStage
                         var source = ResolveLineInfo(scriptId, sourcePart);
                         var destination = ResolveLineInfo(scriptId, destinationPart);
 
-                        // Produce MAP entries
-                        tryAddRequestedMapEntry((source.imageData.ImageFileInfo.Id, source.relativeStartAddress), null);
-                        tryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeStartAddress), null);
-
-                        // Do not trace branches in prefix mode
-                        if(_firstTestcase)
-                            break;
-
-                        // Create branch entry
-                        branchEntry.BranchType = Branch.BranchTypes.Jump;
-                        branchEntry.Taken = true;
-                        branchEntry.SourceImageId = source.imageData.ImageFileInfo.Id;
-                        branchEntry.SourceInstructionRelativeAddress = source.relativeStartAddress;
-                        branchEntry.DestinationImageId = destination.imageData.ImageFileInfo.Id;
-                        branchEntry.DestinationInstructionRelativeAddress = destination.relativeStartAddress;
-                        branchEntry.Store(traceFileWriter);
-
+                        ProcessJump(state, source, destination);
                         break;
                     }
 
@@ -623,63 +584,11 @@ public class JsTracePreprocessor : PreprocessorStage
                         int scriptId = ParseInt32NotSigned(scriptIdPart);
                         var location = ResolveLineInfo(scriptId, locationPart);
 
-                        // Produce MAP entries
-                        tryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
-
                         // Extract access data
                         int objectId = ParseInt32NotSigned(objectIdPart);
                         string offset = new string(offsetPart);
 
-                        // Did we already encounter this object?
-                        uint offsetRelativeAddress;
-                        if(!heapObjects.TryGetValue(objectId, out var objectData))
-                        {
-                            objectData = new HeapObjectData { NextPropertyAddress = 0x100000 };
-                            heapObjects.Add(objectId, objectData);
-
-                            heapAllocationEntry.Id = objectId;
-                            heapAllocationEntry.Address = nextHeapAllocationAddress;
-                            heapAllocationEntry.Size = 2 * heapAllocationChunkSize;
-                            heapAllocationEntry.Store(traceFileWriter);
-
-                            nextHeapAllocationAddress += 2 * heapAllocationChunkSize;
-
-                            // Create entry for current access
-                            // Numeric index, or named property?
-                            offsetRelativeAddress = uint.TryParse(offset, out uint offsetInt)
-                                ? offsetInt
-                                : objectData.NextPropertyAddress++;
-                            objectData.PropertyAddressMapping.TryAdd(offset, offsetRelativeAddress);
-                        }
-                        else
-                        {
-                            // Did we already encounter this offset?
-                            offsetRelativeAddress = objectData.PropertyAddressMapping.GetOrAdd(offset, static (offsetParam, objectDataParam) =>
-                            {
-                                // No, create new entry
-
-                                // Numeric index?
-                                if(uint.TryParse(offsetParam, out uint offsetInt))
-                                    return offsetInt;
-
-                                // Named property
-                                return Interlocked.Increment(ref objectDataParam.NextPropertyAddress);
-                            }, objectData);
-                        }
-
-                        // Do not trace memory accesses in prefix mode
-                        if(_firstTestcase)
-                            break;
-
-                        // Create memory access
-                        heapMemoryAccessEntry.InstructionImageId = location.imageData.ImageFileInfo.Id;
-                        heapMemoryAccessEntry.InstructionRelativeAddress = location.relativeStartAddress;
-                        heapMemoryAccessEntry.HeapAllocationBlockId = objectId;
-                        heapMemoryAccessEntry.MemoryRelativeAddress = offsetRelativeAddress;
-                        heapMemoryAccessEntry.Size = 1;
-                        heapMemoryAccessEntry.IsWrite = accessType == "w";
-                        heapMemoryAccessEntry.Store(traceFileWriter);
-
+                        ProcessMemoryAccess(state, location, objectId, offset, 0, accessType is "w");
                         break;
                     }
 
@@ -699,11 +608,342 @@ public class JsTracePreprocessor : PreprocessorStage
         }
 
         if(_firstTestcase)
-        {
-            _prefixNextHeapAllocationAddress = nextHeapAllocationAddress;
-            _prefixHeapObjects = heapObjects;
             _prefixCompressedLinesLookup = compressedLinesLookup;
+    }
+
+    /// <summary>
+    /// Parses a binary trace and passes its entries to the Process* methods.
+    /// </summary>
+    /// <param name="inputStream">Trace stream.</param>
+    /// <param name="state">Preprocessing state of the current trace.</param>
+    /// <param name="logPrefix">Prefix for error messages.</param>
+    /// <remarks>
+    /// The entries are decoded directly from the input buffer. Code locations are stored as string IDs, so each location string is resolved only once per
+    /// trace and script.
+    /// </remarks>
+    private void PreprocessBinaryTrace(Stream inputStream, PreprocessingState state, string logPrefix)
+    {
+        var input = new BinaryTraceInput(inputStream);
+        if(!input.Ensure(_binaryTraceMagic.Length) || !input.Buffer.AsSpan(0, _binaryTraceMagic.Length).SequenceEqual(_binaryTraceMagic))
+            throw new Exception($"{logPrefix} Invalid binary trace header.");
+        input.Position += _binaryTraceMagic.Length;
+
+        List<string> strings = _prefixBinaryTraceStrings == null ? new() : new(_prefixBinaryTraceStrings);
+        Dictionary<(int scriptId, int stringId), (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress)> locations = new();
+
+        // Resolves the given string ID as a code location
+        (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) ResolveLocation(int? scriptId, uint stringId)
+        {
+            if(stringId >= strings.Count)
+                throw new Exception($"{logPrefix} Could not resolve string #{stringId}");
+
+            var key = (scriptId ?? -1, (int)stringId);
+            if(!locations.TryGetValue(key, out var location))
+            {
+                location = ResolveLineInfo(scriptId, strings[(int)stringId]);
+                locations.Add(key, location);
+            }
+
+            return location;
         }
+
+        while(input.Ensure(1))
+        {
+            var entryType = (BinaryTraceEntryTypes)input.Buffer[input.Position];
+            switch(entryType)
+            {
+                case BinaryTraceEntryTypes.String:
+                {
+                    input.Ensure(9);
+                    int id = input.ReadInt32(1);
+                    int length = input.ReadInt32(5);
+                    if(id != strings.Count)
+                        throw new Exception($"{logPrefix} Unexpected string ID ({id}), expected {strings.Count}.");
+
+                    input.Ensure(9 + length);
+                    strings.Add(Encoding.UTF8.GetString(input.Buffer, input.Position + 9, length));
+                    input.Position += 9 + length;
+
+                    break;
+                }
+
+                case BinaryTraceEntryTypes.Call:
+                {
+                    input.Ensure(21);
+                    int sourceScriptId = input.ReadInt32(1);
+                    int destinationScriptId = input.ReadInt32(9);
+                    var source = ResolveLocation(sourceScriptId, input.ReadUInt32(5));
+                    var destination = ResolveLocation(destinationScriptId < 0 ? null : destinationScriptId, input.ReadUInt32(13));
+                    uint functionNameId = input.ReadUInt32(17);
+                    input.Position += 21;
+
+                    if(functionNameId >= strings.Count)
+                        throw new Exception($"{logPrefix} Could not resolve string #{functionNameId}");
+                    ProcessCall(state, source, destination, strings[(int)functionNameId]);
+
+                    break;
+                }
+
+                case BinaryTraceEntryTypes.Return1:
+                case BinaryTraceEntryTypes.Return2:
+                {
+                    input.Ensure(9);
+                    var location = ResolveLocation(input.ReadInt32(1), input.ReadUInt32(5));
+                    input.Position += 9;
+
+                    if(entryType == BinaryTraceEntryTypes.Return1)
+                        ProcessReturn1(state, location);
+                    else
+                        ProcessReturn2(state, location);
+
+                    break;
+                }
+
+                case BinaryTraceEntryTypes.Yield:
+                {
+                    // TODO yield/yield resume, analogous to the text format
+                    input.Ensure(10);
+                    input.Position += 10;
+
+                    break;
+                }
+
+                case BinaryTraceEntryTypes.Jump:
+                {
+                    input.Ensure(13);
+                    int scriptId = input.ReadInt32(1);
+                    var source = ResolveLocation(scriptId, input.ReadUInt32(5));
+                    var destination = ResolveLocation(scriptId, input.ReadUInt32(9));
+                    input.Position += 13;
+
+                    ProcessJump(state, source, destination);
+
+                    break;
+                }
+
+                case BinaryTraceEntryTypes.MemoryAccess:
+                {
+                    input.Ensure(18);
+                    var flags = (BinaryMemoryAccessFlags)input.Buffer[input.Position + 1];
+                    var location = ResolveLocation(input.ReadInt32(2), input.ReadUInt32(6));
+                    int objectId = input.ReadInt32(10);
+                    uint offset = input.ReadUInt32(14);
+                    input.Position += 18;
+
+                    string? offsetName = null;
+                    if((flags & BinaryMemoryAccessFlags.NamedOffset) != 0)
+                    {
+                        if(offset >= strings.Count)
+                            throw new Exception($"{logPrefix} Could not resolve string #{offset}");
+                        offsetName = strings[(int)offset];
+                    }
+
+                    ProcessMemoryAccess(state, location, objectId, offsetName, offset, (flags & BinaryMemoryAccessFlags.Write) != 0);
+
+                    break;
+                }
+
+                default:
+                    throw new Exception($"{logPrefix} Unexpected binary trace entry type: {(byte)entryType}");
+            }
+        }
+
+        if(_firstTestcase)
+            _prefixBinaryTraceStrings = strings;
+    }
+
+    /// <summary>
+    /// Handles a call entry.
+    /// </summary>
+    private void ProcessCall(PreprocessingState state,
+        (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) source,
+        (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) destination,
+        string functionName)
+    {
+        // Produce MAP entries
+        state.TryAddRequestedMapEntry((source.imageData.ImageFileInfo.Id, source.relativeStartAddress), null);
+        state.TryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeStartAddress), null);
+        state.TryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeEndAddress), null);
+
+        if(_firstTestcase)
+        {
+            // Record function name, if it is not already known
+            destination.imageData.FunctionNameLookupPrefix!.TryAdd((destination.relativeStartAddress, destination.relativeEndAddress), functionName);
+
+            // Do not trace branches in prefix mode
+            return;
+        }
+
+        // Record function name, if it is not already known
+        destination.imageData.FunctionNameLookup!.TryAdd((destination.relativeStartAddress, destination.relativeEndAddress), functionName);
+
+        // Record call
+        var branchEntry = state.BranchEntry;
+        branchEntry.BranchType = Branch.BranchTypes.Call;
+        branchEntry.Taken = true;
+        branchEntry.SourceImageId = source.imageData.ImageFileInfo.Id;
+        branchEntry.SourceInstructionRelativeAddress = source.relativeStartAddress;
+        branchEntry.DestinationImageId = destination.imageData.ImageFileInfo.Id;
+        branchEntry.DestinationInstructionRelativeAddress = destination.relativeStartAddress;
+        branchEntry.Store(state.TraceFileWriter);
+    }
+
+    /// <summary>
+    /// Handles a Ret1 entry, which denotes the location of a return statement.
+    /// </summary>
+    private void ProcessReturn1(PreprocessingState state, (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) location)
+    {
+        // Produce MAP entries
+        state.TryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
+
+        // Do not trace branches in prefix mode
+        if(_firstTestcase)
+            return;
+
+        // Remember for next Ret2 entry
+        state.LastRet1Entry = (location.imageData.ImageFileInfo, location.relativeStartAddress);
+    }
+
+    /// <summary>
+    /// Handles a Ret2 entry, which denotes the location the function returned to.
+    /// </summary>
+    private void ProcessReturn2(PreprocessingState state, (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) location)
+    {
+        // Produce MAP entries
+        state.TryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
+
+        // Do not trace branches in prefix mode
+        if(_firstTestcase)
+            return;
+
+        // Create branch entry
+        var branchEntry = state.BranchEntry;
+        branchEntry.BranchType = Branch.BranchTypes.Return;
+        branchEntry.Taken = true;
+        branchEntry.DestinationImageId = location.imageData.ImageFileInfo.Id;
+        branchEntry.DestinationInstructionRelativeAddress = location.relativeStartAddress;
+
+        // Did we see a Ret1 entry? -> accurate source location info
+        if(state.LastRet1Entry != null)
+        {
+            branchEntry.SourceImageId = state.LastRet1Entry.Value.imageFileInfo.Id;
+            branchEntry.SourceInstructionRelativeAddress = state.LastRet1Entry.Value.address;
+
+            state.LastRet1Entry = null;
+        }
+        else
+        {
+            branchEntry.SourceImageId = _externalFunctionsImageId;
+            branchEntry.SourceInstructionRelativeAddress = _catchAllExternalFunctionAddress;
+        }
+
+        branchEntry.Store(state.TraceFileWriter);
+    }
+
+    /// <summary>
+    /// Handles a jump entry.
+    /// </summary>
+    private void ProcessJump(PreprocessingState state,
+        (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) source,
+        (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) destination)
+    {
+        // Produce MAP entries
+        state.TryAddRequestedMapEntry((source.imageData.ImageFileInfo.Id, source.relativeStartAddress), null);
+        state.TryAddRequestedMapEntry((destination.imageData.ImageFileInfo.Id, destination.relativeStartAddress), null);
+
+        // Do not trace branches in prefix mode
+        if(_firstTestcase)
+            return;
+
+        // Create branch entry
+        var branchEntry = state.BranchEntry;
+        branchEntry.BranchType = Branch.BranchTypes.Jump;
+        branchEntry.Taken = true;
+        branchEntry.SourceImageId = source.imageData.ImageFileInfo.Id;
+        branchEntry.SourceInstructionRelativeAddress = source.relativeStartAddress;
+        branchEntry.DestinationImageId = destination.imageData.ImageFileInfo.Id;
+        branchEntry.DestinationInstructionRelativeAddress = destination.relativeStartAddress;
+        branchEntry.Store(state.TraceFileWriter);
+    }
+
+    /// <summary>
+    /// Handles a memory access entry.
+    /// </summary>
+    /// <param name="state">Preprocessing state of the current trace.</param>
+    /// <param name="location">Location of the accessing instruction.</param>
+    /// <param name="objectId">ID of the accessed object.</param>
+    /// <param name="offset">Accessed property name or numeric index, or null if the index is given through <paramref name="numericOffset"/>.</param>
+    /// <param name="numericOffset">Accessed numeric index, only used if <paramref name="offset"/> is null.</param>
+    /// <param name="isWrite">Determines whether this is a write access.</param>
+    private void ProcessMemoryAccess(PreprocessingState state, (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) location,
+        int objectId, string? offset, uint numericOffset, bool isWrite)
+    {
+        const uint heapAllocationChunkSize = 0x100000;
+
+        // Produce MAP entries
+        state.TryAddRequestedMapEntry((location.imageData.ImageFileInfo.Id, location.relativeStartAddress), null);
+
+        // Did we already encounter this object?
+        uint offsetRelativeAddress;
+        if(!state.HeapObjects.TryGetValue(objectId, out var objectData))
+        {
+            objectData = new HeapObjectData { NextPropertyAddress = 0x100000 };
+            state.HeapObjects.Add(objectId, objectData);
+
+            var heapAllocationEntry = state.HeapAllocationEntry;
+            heapAllocationEntry.Id = objectId;
+            heapAllocationEntry.Address = state.NextHeapAllocationAddress;
+            heapAllocationEntry.Size = 2 * heapAllocationChunkSize;
+            heapAllocationEntry.Store(state.TraceFileWriter);
+
+            state.NextHeapAllocationAddress += 2 * heapAllocationChunkSize;
+
+            // Create entry for current access
+            // Numeric index, or named property?
+            if(offset == null)
+                offsetRelativeAddress = numericOffset;
+            else
+            {
+                offsetRelativeAddress = uint.TryParse(offset, out uint offsetInt)
+                    ? offsetInt
+                    : objectData.NextPropertyAddress++;
+                objectData.PropertyAddressMapping.TryAdd(offset, offsetRelativeAddress);
+            }
+        }
+        else if(offset == null)
+        {
+            // Numeric indices always map to themselves
+            offsetRelativeAddress = numericOffset;
+        }
+        else
+        {
+            // Did we already encounter this offset?
+            offsetRelativeAddress = objectData.PropertyAddressMapping.GetOrAdd(offset, static (offsetParam, objectDataParam) =>
+            {
+                // No, create new entry
+
+                // Numeric index?
+                if(uint.TryParse(offsetParam, out uint offsetInt))
+                    return offsetInt;
+
+                // Named property
+                return Interlocked.Increment(ref objectDataParam.NextPropertyAddress);
+            }, objectData);
+        }
+
+        // Do not trace memory accesses in prefix mode
+        if(_firstTestcase)
+            return;
+
+        // Create memory access
+        var heapMemoryAccessEntry = state.HeapMemoryAccessEntry;
+        heapMemoryAccessEntry.InstructionImageId = location.imageData.ImageFileInfo.Id;
+        heapMemoryAccessEntry.InstructionRelativeAddress = location.relativeStartAddress;
+        heapMemoryAccessEntry.HeapAllocationBlockId = objectId;
+        heapMemoryAccessEntry.MemoryRelativeAddress = offsetRelativeAddress;
+        heapMemoryAccessEntry.Size = 1;
+        heapMemoryAccessEntry.IsWrite = isWrite;
+        heapMemoryAccessEntry.Store(state.TraceFileWriter);
     }
 
     /// <summary>
@@ -720,8 +960,12 @@ public class JsTracePreprocessor : PreprocessorStage
     private (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) ResolveLineInfo(int? scriptFileId, ReadOnlySpan<char> lineInfo)
     {
         // We use line info as key for caching known addresses
-        string lineInfoString = new string(lineInfo);
+        return ResolveLineInfo(scriptFileId, new string(lineInfo));
+    }
 
+    /// <inheritdoc cref="ResolveLineInfo(int?, ReadOnlySpan{char})"/>
+    private (ImageData imageData, uint relativeStartAddress, uint relativeEndAddress) ResolveLineInfo(int? scriptFileId, string lineInfoString)
+    {
         // Try to read existing address data, or generate new one if not known yet
         var imageData = _imageData[scriptFileId ?? _externalFunctionsImageId];
         (uint start, uint end) addressData;
@@ -940,6 +1184,114 @@ public class JsTracePreprocessor : PreprocessorStage
         return result;
     }
 
+    /// <summary>
+    /// Per-trace state, which is shared between the entry handlers.
+    /// </summary>
+    private class PreprocessingState(IFastBinaryWriter traceFileWriter, Func<(int imageId, uint relativeAddress), object?, bool> tryAddRequestedMapEntry)
+    {
+        public IFastBinaryWriter TraceFileWriter { get; } = traceFileWriter;
+
+        /// <summary>
+        /// Adds a requested MAP entry to the prefix or to the shared dictionary, depending on the current mode.
+        /// </summary>
+        public Func<(int imageId, uint relativeAddress), object?, bool> TryAddRequestedMapEntry { get; } = tryAddRequestedMapEntry;
+
+        public Dictionary<int, HeapObjectData> HeapObjects { get; init; } = null!;
+
+        public ulong NextHeapAllocationAddress { get; set; }
+
+        /// <summary>
+        /// Last Ret1 entry, which provides the source location for the next Ret2 entry.
+        /// </summary>
+        public (TracePrefixFile.ImageFileInfo imageFileInfo, uint address)? LastRet1Entry { get; set; }
+
+        // Preallocated trace entry variables (only needed for serialization)
+        public Branch BranchEntry { get; } = new();
+        public HeapAllocation HeapAllocationEntry { get; } = new();
+        public HeapMemoryAccess HeapMemoryAccessEntry { get; } = new();
+    }
+
+    /// <summary>
+    /// Buffered reader for binary traces, which allows decoding entries directly from the buffer.
+    /// </summary>
+    private class BinaryTraceInput(Stream stream)
+    {
+        /// <summary>
+        /// Read buffer. Entries are decoded starting at <see cref="Position"/>.
+        /// </summary>
+        public byte[] Buffer { get; private set; } = new byte[1 * 1024 * 1024];
+
+        /// <summary>
+        /// Offset of the current entry in <see cref="Buffer"/>.
+        /// </summary>
+        public int Position { get; set; }
+
+        /// <summary>
+        /// Number of valid bytes in <see cref="Buffer"/>.
+        /// </summary>
+        private int _length;
+
+        /// <summary>
+        /// Ensures that the buffer holds at least the given number of bytes, starting at <see cref="Position"/>.
+        /// </summary>
+        /// <param name="count">Number of bytes.</param>
+        /// <returns>false if the stream has ended exactly at <see cref="Position"/>, else true.</returns>
+        /// <exception cref="Exception">The stream ended within an entry.</exception>
+        public bool Ensure(int count)
+        {
+            if(_length - Position >= count)
+                return true;
+
+            // Move remaining bytes to the buffer start, and grow the buffer for very long entries
+            int remaining = _length - Position;
+            var buffer = count > Buffer.Length ? new byte[2 * count] : Buffer;
+            System.Buffer.BlockCopy(Buffer, Position, buffer, 0, remaining);
+            Buffer = buffer;
+            Position = 0;
+            _length = remaining;
+
+            while(_length < count)
+            {
+                int dataRead = stream.Read(Buffer, _length, Buffer.Length - _length);
+                if(dataRead == 0)
+                    break;
+                _length += dataRead;
+            }
+
+            if(_length >= count)
+                return true;
+            if(_length == 0)
+                return false;
+
+            throw new Exception("Incomplete entry at end of binary trace.");
+        }
+
+        public int ReadInt32(int offset) => BinaryPrimitives.ReadInt32LittleEndian(Buffer.AsSpan(Position + offset));
+
+        public uint ReadUInt32(int offset) => BinaryPrimitives.ReadUInt32LittleEndian(Buffer.AsSpan(Position + offset));
+    }
+
+    /// <summary>
+    /// Entry types of the binary trace format. Must match the definitions in the tracer runtime.
+    /// </summary>
+    private enum BinaryTraceEntryTypes : byte
+    {
+        String = 1,
+        Call = 2,
+        Return1 = 3,
+        Return2 = 4,
+        Yield = 5,
+        Jump = 6,
+        MemoryAccess = 7
+    }
+
+    [Flags]
+    private enum BinaryMemoryAccessFlags : byte
+    {
+        Write = 1,
+        NamedOffset = 2
+    }
+
     private class HeapObjectData
     {
         public uint NextPropertyAddress;
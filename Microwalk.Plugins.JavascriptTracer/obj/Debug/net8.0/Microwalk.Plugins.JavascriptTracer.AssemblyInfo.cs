@@ -0,0 +1,19 @@
+//------------------------------------------------------------------------------
+// <auto-generated>
+//     This code was generated by a tool.
+//
+//     Changes to this file may cause incorrect behavior and will be lost if
+//     the code is regenerated.
+// </auto-generated>
+//------------------------------------------------------------------------------
+
+using System;
+using System.Reflection;
+
+[assembly: System.Reflection.AssemblyCompanyAttribute("Microwalk.Plugins.JavascriptTracer")]
+[assembly: System.Reflection.AssemblyConfigurationAttribute("Debug")]
+[assembly: System.Reflection.AssemblyProductAttribute("Microwalk.Plugins.JavascriptTracer")]
+[assembly: System.Reflection.AssemblyTitleAttribute("Microwalk.Plugins.JavascriptTracer")]
+
+// Generated by the MSBuild WriteCodeFragment class.
+
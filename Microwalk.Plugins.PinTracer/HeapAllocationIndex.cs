@@ -0,0 +1,170 @@
+﻿using System.Collections.Generic;
+using System.Diagnostics.CodeAnalysis;
+using Microwalk.FrameworkBase.Extensions;
+using Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Index for finding the heap allocation block which contains a given address.
+/// The address space is divided into fixed-size buckets, and each block is registered in all buckets it overlaps. Thus, insertion, removal and lookup
+/// only touch a few small lists, instead of shifting a sorted array of all allocation blocks.
+/// Blocks which span many buckets are kept in a separate sorted list, which is searched with binary search.
+/// </summary>
+/// <remarks>
+/// Lookups do not modify the index, so a fully built index may be read concurrently.
+/// </remarks>
+internal class HeapAllocationIndex
+{
+    /// <summary>
+    /// Size of an address bucket (4 KiB), as number of bits.
+    /// </summary>
+    private const int BucketSizeBits = 12;
+
+    /// <summary>
+    /// Maximum number of buckets a block may span before it is stored in the list of large blocks.
+    /// </summary>
+    private const int MaxBucketsPerBlock = 64;
+
+    /// <summary>
+    /// All allocation blocks, indexed by start address.
+    /// </summary>
+    private readonly Dictionary<ulong, HeapAllocation> _allocationsByAddress = new();
+
+    /// <summary>
+    /// The allocation blocks overlapping each bucket, sorted by start address in ascending order.
+    /// Buckets are not removed when they become empty, as their memory is usually reused by later allocations.
+    /// </summary>
+    private readonly Dictionary<ulong, List<HeapAllocation>> _buckets = new();
+
+    /// <summary>
+    /// Allocation blocks which span more than <see cref="MaxBucketsPerBlock"/> buckets, indexed by start address.
+    /// </summary>
+    private readonly SortedList<ulong, HeapAllocation> _largeAllocations = new();
+
+    /// <summary>
+    /// Returns the number of allocation blocks.
+    /// </summary>
+    public int Count => _allocationsByAddress.Count;
+
+    /// <summary>
+    /// Adds the given allocation block. An existing block with the same start address is replaced.
+    /// </summary>
+    /// <param name="allocation">Allocation block.</param>
+    public void Add(HeapAllocation allocation)
+    {
+        Remove(allocation.Address);
+        _allocationsByAddress.Add(allocation.Address, allocation);
+
+        var (firstBucket, lastBucket) = GetBucketRange(allocation);
+        if(lastBucket - firstBucket >= MaxBucketsPerBlock)
+        {
+            _largeAllocations.Add(allocation.Address, allocation);
+            return;
+        }
+
+        for(ulong b = firstBucket; b <= lastBucket; ++b)
+        {
+            if(!_buckets.TryGetValue(b, out var bucket))
+            {
+                bucket = new List<HeapAllocation>();
+                _buckets.Add(b, bucket);
+            }
+
+            bucket.Insert(FindFirstGreater(bucket, allocation.Address), allocation);
+        }
+    }
+
+    /// <summary>
+    /// Retrieves the allocation block with the given start address.
+    /// </summary>
+    /// <param name="address">Start address of the allocation block.</param>
+    /// <param name="allocation">Allocation block, if it exists.</param>
+    public bool TryGetValue(ulong address, [NotNullWhen(true)] out HeapAllocation? allocation)
+    {
+        return _allocationsByAddress.TryGetValue(address, out allocation);
+    }
+
+    /// <summary>
+    /// Removes the allocation block with the given start address.
+    /// </summary>
+    /// <param name="address">Start address of the allocation block.</param>
+    /// <returns>false, if there is no allocation block with the given start address.</returns>
+    public bool Remove(ulong address)
+    {
+        if(!_allocationsByAddress.Remove(address, out var allocation))
+            return false;
+
+        var (firstBucket, lastBucket) = GetBucketRange(allocation);
+        if(lastBucket - firstBucket >= MaxBucketsPerBlock)
+        {
+            _largeAllocations.Remove(address);
+            return true;
+        }
+
+        for(ulong b = firstBucket; b <= lastBucket; ++b)
+            _buckets[b].Remove(allocation);
+
+        return true;
+    }
+
+    /// <summary>
+    /// Finds the allocation block with the highest start address below or equal to the given address, and returns it if it contains the address.
+    /// As long as blocks do not overlap, this yields the same result as a binary search over all blocks sorted by start address.
+    /// </summary>
+    /// <param name="address">The address to be searched.</param>
+    /// <returns>The allocation block, or null if the address is not contained in any block.</returns>
+    public HeapAllocation? Find(ulong address)
+    {
+        // Search bucket of the given address
+        HeapAllocation? candidate = null;
+        if(_buckets.TryGetValue(address >> BucketSizeBits, out var bucket))
+        {
+            int index = FindFirstGreater(bucket, address) - 1;
+            if(index >= 0)
+                candidate = bucket[index];
+        }
+
+        if(candidate != null && address <= candidate.Address + candidate.Size)
+            return candidate;
+
+        // Large blocks are not registered in the buckets
+        if(_largeAllocations.Count > 0
+           && _largeAllocations.TryFindNearestLowerKey(address, out ulong largeAllocationAddress)
+           && (candidate == null || largeAllocationAddress > candidate.Address))
+            candidate = _largeAllocations[largeAllocationAddress];
+
+        // Check end address
+        if(candidate != null && address <= candidate.Address + candidate.Size)
+            return candidate;
+        return null;
+    }
+
+    /// <summary>
+    /// Returns the indices of the first and the last bucket overlapped by the given allocation block.
+    /// </summary>
+    private static (ulong firstBucket, ulong lastBucket) GetBucketRange(HeapAllocation allocation)
+    {
+        // The end address is considered to be part of the block, like in the lookup
+        return (allocation.Address >> BucketSizeBits, (allocation.Address + allocation.Size) >> BucketSizeBits);
+    }
+
+    /// <summary>
+    /// Returns the index of the first block in the given bucket which has a start address greater than the given address.
+    /// </summary>
+    private static int FindFirstGreater(List<HeapAllocation> bucket, ulong address)
+    {
+        int left = 0;
+        int right = bucket.Count;
+        while(left < right)
+        {
+            int index = left + ((right - left) / 2);
+            if(bucket[index].Address <= address)
+                left = index + 1;
+            else
+                right = index;
+        }
+
+        return left;
+    }
+}
@@ -104,12 +104,24 @@ public class PinTraceDumper : PreprocessorStage
         await outputWriter.WriteLineAsync(await File.ReadAllTextAsync(prefixDataFilePath));
 
         // Write prefix
+        // The Pin tool may not have recorded the prefix, if another instance's prefix is shared
         await outputWriter.WriteLineAsync("-- Trace prefix --");
-        DumpRawFile(Path.Combine(rawTraceFileDirectory, "prefix.trace"), outputWriter, $"[pin-dump:{traceEntity.Id}:prefix]");
+        string tracePrefixFilePath = Path.Combine(rawTraceFileDirectory, "prefix.trace");
+        if(File.Exists(tracePrefixFilePath))
+            DumpRawFile(tracePrefixFilePath, outputWriter, $"[pin-dump:{traceEntity.Id}:prefix]");
+        else
+            await outputWriter.WriteLineAsync("(not recorded)");
 
         // Write trace
         await outputWriter.WriteLineAsync("-- Trace --");
         DumpRawFile(traceEntity.RawTraceFilePath, outputWriter, $"[pin-dump:{traceEntity.Id}]");
+
+        // Write traces of secondary threads
+        foreach(string threadTraceFilePath in traceEntity.RawThreadTraceFilePaths ?? Enumerable.Empty<string>())
+        {
+            await outputWriter.WriteLineAsync($"-- Thread trace {Path.GetFileName(threadTraceFilePath)} --");
+            DumpRawFile(threadTraceFilePath, outputWriter, $"[pin-dump:{traceEntity.Id}:{Path.GetFileName(threadTraceFilePath)}]");
+        }
     }
 
     /// <summary>
@@ -121,144 +133,149 @@ public class PinTraceDumper : PreprocessorStage
     /// <returns></returns>
     private unsafe void DumpRawFile(string fileName, StreamWriter outputWriter, string logPrefix)
     {
-        // Read entire trace file into memory
-        byte[] inputFile = File.ReadAllBytes(fileName);
-        int inputFileLength = inputFile.Length;
-        int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
+        // Read trace file chunk by chunk; compressed files are decompressed while reading
+        using var rawTraceChunkReader = new RawTraceChunkReader(fileName);
 
         // Dump trace entries
-        fixed(byte* inputFilePtr = inputFile)
-            for(long pos = 0; pos < inputFileLength; pos += rawTraceEntrySize)
+        var rawTraceReader = new RawTraceReader();
+        while(rawTraceChunkReader.TryReadNextChunk(out byte[] chunk, out int chunkLength))
+        {
+            fixed(byte* chunkPtr = chunk)
             {
-                // Read entry
-                var rawTraceEntry = *(PinTracePreprocessor.RawTraceEntry*)&inputFilePtr[pos];
-
-                // Write string representation
-                switch(rawTraceEntry.Type)
+                rawTraceReader.SetChunk(chunkPtr, chunkLength);
+                while(rawTraceReader.TryReadNext(out var rawTraceEntry))
                 {
-                    case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocSizeParameter:
+                    // Write string representation
+                    switch(rawTraceEntry.Type)
                     {
-                        outputWriter.WriteLine($"AllocSize: {(uint)rawTraceEntry.Param1:x8}");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocAddressReturn:
-                    {
-                        outputWriter.WriteLine($"AllocReturn: {rawTraceEntry.Param2:x16}");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.HeapFreeAddressParameter:
-                    {
-                        outputWriter.WriteLine($"HeapFree: {rawTraceEntry.Param2:x16}");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.StackPointerInfo:
-                    {
-                        outputWriter.WriteLine($"StackPtr: {rawTraceEntry.Param1:x16} {rawTraceEntry.Param2:x16}");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.Branch:
-                    {
-                        var flags = (PinTracePreprocessor.RawTraceBranchEntryFlags)rawTraceEntry.Flag;
-
-                        bool taken = (flags & PinTracePreprocessor.RawTraceBranchEntryFlags.Taken) != 0;
-
-                        string formattedSourceAddress = rawTraceEntry.Param1.ToString("x16");
-                        string formattedDestinationAddress = rawTraceEntry.Param2.ToString("x16");
-                        string formattedTaken = taken ? "[taken]" : "[not taken]";
-                        if(_mapFileCollection != null)
+                        case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocSizeParameter:
                         {
-                            var sourceImage = FindImage(rawTraceEntry.Param1);
-                            if(sourceImage != null)
-                                formattedSourceAddress = $"{_mapFileCollection.FormatAddress(sourceImage.Id, sourceImage.Name, (uint)(rawTraceEntry.Param1 - sourceImage.StartAddress))} [{formattedSourceAddress}]";
-
-                            var destinationImage = FindImage(rawTraceEntry.Param2);
-                            if(destinationImage != null)
-                                formattedDestinationAddress = $"{_mapFileCollection.FormatAddress(destinationImage.Id, destinationImage.Name, (uint)(rawTraceEntry.Param2 - destinationImage.StartAddress))} [{formattedDestinationAddress}]";
+                            outputWriter.WriteLine($"AllocSize: {(uint)rawTraceEntry.Param1:x8}");
+                            break;
                         }
 
-                        var rawBranchType = flags & PinTracePreprocessor.RawTraceBranchEntryFlags.BranchEntryTypeMask;
-                        switch(rawBranchType)
+                        case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocAddressReturn:
                         {
-                            case PinTracePreprocessor.RawTraceBranchEntryFlags.Jump:
-                                outputWriter.WriteLine($"Jump: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
-                                break;
-
-                            case PinTracePreprocessor.RawTraceBranchEntryFlags.Call:
-                                outputWriter.WriteLine($"Call: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
-                                break;
-
-                            case PinTracePreprocessor.RawTraceBranchEntryFlags.Return:
-                                outputWriter.WriteLine($"Return: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
-                                break;
-
-                            default:
-                                Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on branch {formattedSourceAddress} -> {formattedDestinationAddress}, skipping").Wait();
-                                break;
+                            outputWriter.WriteLine($"AllocReturn: {rawTraceEntry.Param2:x16}");
+                            break;
                         }
 
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.MemoryRead:
-                    {
-                        string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
-                        if(_mapFileCollection != null)
+                        case PinTracePreprocessor.RawTraceEntryTypes.HeapFreeAddressParameter:
                         {
-                            var instructionImage = FindImage(rawTraceEntry.Param1);
-                            if(instructionImage != null)
-                                formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            outputWriter.WriteLine($"HeapFree: {rawTraceEntry.Param2:x16}");
+                            break;
                         }
 
-                        outputWriter.WriteLine($"MemoryRead: {formattedInstructionAddress} reads {rawTraceEntry.Param2:x16} ({rawTraceEntry.Param0} bytes)");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.MemoryWrite:
-                    {
-                        string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
-                        if(_mapFileCollection != null)
+                        case PinTracePreprocessor.RawTraceEntryTypes.StackPointerInfo:
                         {
-                            var instructionImage = FindImage(rawTraceEntry.Param1);
-                            if(instructionImage != null)
-                                formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            outputWriter.WriteLine($"StackPtr: {rawTraceEntry.Param1:x16} {rawTraceEntry.Param2:x16}");
+                            break;
                         }
 
-                        outputWriter.WriteLine($"MemoryWrite: {formattedInstructionAddress} writes {rawTraceEntry.Param2:x16} ({rawTraceEntry.Param0} bytes)");
-                        break;
-                    }
-
-                    case PinTracePreprocessor.RawTraceEntryTypes.StackPointerModification:
-                    {
-                        string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
-                        if(_mapFileCollection != null)
+                        case PinTracePreprocessor.RawTraceEntryTypes.Branch:
                         {
-                            var instructionImage = FindImage(rawTraceEntry.Param1);
-                            if(instructionImage != null)
-                                formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            var flags = (PinTracePreprocessor.RawTraceBranchEntryFlags)rawTraceEntry.Flag;
+
+                            bool taken = (flags & PinTracePreprocessor.RawTraceBranchEntryFlags.Taken) != 0;
+
+                            string formattedSourceAddress = rawTraceEntry.Param1.ToString("x16");
+                            string formattedDestinationAddress = rawTraceEntry.Param2.ToString("x16");
+                            string formattedTaken = taken ? "[taken]" : "[not taken]";
+                            if(_mapFileCollection != null)
+                            {
+                                var sourceImage = FindImage(rawTraceEntry.Param1);
+                                if(sourceImage != null)
+                                    formattedSourceAddress = $"{_mapFileCollection.FormatAddress(sourceImage.Id, sourceImage.Name, (uint)(rawTraceEntry.Param1 - sourceImage.StartAddress))} [{formattedSourceAddress}]";
+
+                                var destinationImage = FindImage(rawTraceEntry.Param2);
+                                if(destinationImage != null)
+                                    formattedDestinationAddress = $"{_mapFileCollection.FormatAddress(destinationImage.Id, destinationImage.Name, (uint)(rawTraceEntry.Param2 - destinationImage.StartAddress))} [{formattedDestinationAddress}]";
+                            }
+
+                            var rawBranchType = flags & PinTracePreprocessor.RawTraceBranchEntryFlags.BranchEntryTypeMask;
+                            switch(rawBranchType)
+                            {
+                                case PinTracePreprocessor.RawTraceBranchEntryFlags.Jump:
+                                    outputWriter.WriteLine($"Jump: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
+                                    break;
+
+                                case PinTracePreprocessor.RawTraceBranchEntryFlags.Call:
+                                    outputWriter.WriteLine($"Call: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
+                                    break;
+
+                                case PinTracePreprocessor.RawTraceBranchEntryFlags.Return:
+                                    outputWriter.WriteLine($"Return: {formattedSourceAddress} -> {formattedDestinationAddress} {formattedTaken}");
+                                    break;
+
+                                default:
+                                    Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on branch {formattedSourceAddress} -> {formattedDestinationAddress}, skipping").Wait();
+                                    break;
+                            }
+
+                            break;
                         }
 
-                        var flags = (PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags)rawTraceEntry.Flag;
+                        case PinTracePreprocessor.RawTraceEntryTypes.MemoryRead:
+                        {
+                            string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
+                            if(_mapFileCollection != null)
+                            {
+                                var instructionImage = FindImage(rawTraceEntry.Param1);
+                                if(instructionImage != null)
+                                    formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            }
+
+                            outputWriter.WriteLine($"MemoryRead: {formattedInstructionAddress} reads {rawTraceEntry.Param2:x16} ({rawTraceEntry.Param0} bytes)");
+                            break;
+                        }
 
-                        var instructionType = flags & PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.InstructionTypeMask;
-                        if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Call)
-                            outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (call)");
-                        else if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Return)
-                            outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (ret)");
-                        else if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Other)
-                            outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (other)");
-                        else
+                        case PinTracePreprocessor.RawTraceEntryTypes.MemoryWrite:
                         {
-                            Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on stack pointer modification, skipping").Wait();
+                            string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
+                            if(_mapFileCollection != null)
+                            {
+                                var instructionImage = FindImage(rawTraceEntry.Param1);
+                                if(instructionImage != null)
+                                    formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            }
+
+                            outputWriter.WriteLine($"MemoryWrite: {formattedInstructionAddress} writes {rawTraceEntry.Param2:x16} ({rawTraceEntry.Param0} bytes)");
+                            break;
                         }
 
-                        break;
+                        case PinTracePreprocessor.RawTraceEntryTypes.StackPointerModification:
+                        {
+                            string formattedInstructionAddress = rawTraceEntry.Param1.ToString("x16");
+                            if(_mapFileCollection != null)
+                            {
+                                var instructionImage = FindImage(rawTraceEntry.Param1);
+                                if(instructionImage != null)
+                                    formattedInstructionAddress = $"{_mapFileCollection.FormatAddress(instructionImage.Id, instructionImage.Name, (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress))} [{formattedInstructionAddress}]";
+                            }
+
+                            var flags = (PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags)rawTraceEntry.Flag;
+
+                            var instructionType = flags & PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.InstructionTypeMask;
+                            if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Call)
+                                outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (call)");
+                            else if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Return)
+                                outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (ret)");
+                            else if(instructionType == PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Other)
+                                outputWriter.WriteLine($"StackMod: {formattedInstructionAddress} sets RSP = {rawTraceEntry.Param2:x16} (other)");
+                            else
+                            {
+                                Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on stack pointer modification, skipping").Wait();
+                            }
+
+                            break;
+                        }
                     }
                 }
+
+                // An incomplete entry at the end of the chunk is continued in the next one
+                rawTraceChunkReader.SetUnconsumedLength((int)(chunkLength - rawTraceReader.Position));
             }
+        }
     }
 
     /// <summary>
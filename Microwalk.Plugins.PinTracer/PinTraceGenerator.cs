@@ -1,8 +1,13 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
 using System.Linq;
+using System.Security.Cryptography;
+using System.Text;
+using System.Text.RegularExpressions;
+using System.Threading;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
@@ -15,22 +20,55 @@ namespace Microwalk.Plugins.PinTracer;
 [FrameworkModule("pin", "Generates traces using a Pin tool.")]
 public class PinTraceGenerator : TraceStage
 {
-    private const string _genericLogMessagePrefix = "[trace:pin]";
-    private const string _pinLogMessagePrefix = "[trace:pin:stderr]";
-    private const string _pinOutMessagePrefix = "[trace:pin:stdout]";
-
     /// <summary>
     /// The trace output directory.
     /// </summary>
     private DirectoryInfo _outputDirectory = null!;
 
     /// <summary>
-    /// The Pin tool process handle.
+    /// The Pin tool workers.
+    /// </summary>
+    private PinToolWorker[] _workers = Array.Empty<PinToolWorker>();
+
+    /// <summary>
+    /// Free testcase slots of the workers. Each worker is contained once for every further testcase it can accept.
+    /// </summary>
+    private readonly ConcurrentQueue<PinToolWorker> _freeWorkerSlots = new();
+
+    /// <summary>
+    /// Counts the free worker slots.
+    /// </summary>
+    private SemaphoreSlim _freeWorkerSlotsSemaphore = null!;
+
+    /// <summary>
+    /// Number of testcases which may be queued at a single worker.
+    /// </summary>
+    private int _testcaseWindow = 1;
+
+    /// <summary>
+    /// Writer for the per-testcase tracing statistics, if a statistics file is specified.
+    /// </summary>
+    private StreamWriter? _statisticsWriter;
+
+    /// <summary>
+    /// Serializes writes to <see cref="_statisticsWriter"/>.
+    /// </summary>
+    private readonly SemaphoreSlim _statisticsWriterLock = new(1, 1);
+
+    /// <summary>
+    /// Column names of the statistics file, taken from the first reported testcase.
     /// </summary>
-    private Process _pinToolProcess = null!;
+    private string[]? _statisticsColumns;
+
+    // Supported if there is more than one Pin tool worker, or if a worker may queue several testcases.
+    public override bool SupportsParallelism => _workers.Length * _testcaseWindow > 1;
+
+    public override byte[]? CacheKey => _cacheKey;
 
-    // Not supported. This module only manages a single Pin instance, which currently is fast enough.
-    public override bool SupportsParallelism => false;
+    /// <summary>
+    /// Hash of the Pin tool, the wrapper and the traced binaries, and of all options influencing the generated traces.
+    /// </summary>
+    private byte[]? _cacheKey;
 
     public override async Task GenerateTraceAsync(TraceEntity traceEntity)
     {
@@ -39,28 +77,49 @@ public class PinTraceGenerator : TraceStage
         // Debug
         await Logger.LogDebugAsync($"{logMessagePrefix} Trace #" + traceEntity.Id);
 
-        // Send test case
-        await _pinToolProcess.StandardInput.WriteLineAsync($"t {traceEntity.Id}");
-        await _pinToolProcess.StandardInput.WriteLineAsync(traceEntity.TestcaseFilePath);
-        while(true)
+        // Get worker with a free slot
+        await _freeWorkerSlotsSemaphore.WaitAsync(PipelineToken);
+        if(!_freeWorkerSlots.TryDequeue(out var worker))
+            throw new Exception("Could not find a free Pin tool worker slot.");
+        Dictionary<string, long>? statistics;
+        try
         {
-            // Read Pin tool output
-            await Logger.LogDebugAsync($"{logMessagePrefix} Read from Pin tool stdout...");
-            string pinToolOutput = await _pinToolProcess.StandardOutput.ReadLineAsync()
-                                   ?? throw new IOException("Could not read from Pin tool standard output (null). Probably the process has exited early.");
+            statistics = await worker.GenerateTraceAsync(traceEntity, logMessagePrefix);
+        }
+        finally
+        {
+            _freeWorkerSlots.Enqueue(worker);
+            _freeWorkerSlotsSemaphore.Release();
+        }
+
+        if(statistics != null)
+            await WriteStatisticsAsync(traceEntity, statistics, logMessagePrefix);
+    }
+
+    /// <summary>
+    /// Logs the tracing statistics of the given testcase, and appends them to the statistics file, if one is specified.
+    /// </summary>
+    private async Task WriteStatisticsAsync(TraceEntity traceEntity, Dictionary<string, long> statistics, string logMessagePrefix)
+    {
+        await Logger.LogDebugAsync($"{logMessagePrefix} Pin tool statistics: {string.Join(", ", statistics.Select(s => $"{s.Key}={s.Value}"))}");
+
+        if(_statisticsWriter == null)
+            return;
 
-            // Parse output
-            await Logger.LogDebugAsync($"{_pinOutMessagePrefix} {pinToolOutput}");
-            string[] outputParts = pinToolOutput.Split('\t');
-            if(outputParts[0] == "t")
+        await _statisticsWriterLock.WaitAsync();
+        try
+        {
+            if(_statisticsColumns == null)
             {
-                // Store trace file name
-                traceEntity.RawTraceFilePath = outputParts[1];
-                break;
+                _statisticsColumns = statistics.Keys.ToArray();
+                await _statisticsWriter.WriteLineAsync("testcase;" + string.Join(';', _statisticsColumns));
             }
 
-            await Logger.LogWarningAsync($"{logMessagePrefix} Unexpected message from Pin tool.\nPlease make sure that the investigated program does not print anything on stdout, since this might interfere with the Pin tool's output pipe.");
-            await Logger.LogWarningAsync($"{logMessagePrefix}   >>> {pinToolOutput}");
+            await _statisticsWriter.WriteLineAsync($"{traceEntity.Id};" + string.Join(';', _statisticsColumns.Select(c => statistics.GetValueOrDefault(c))));
+        }
+        finally
+        {
+            _statisticsWriterLock.Release();
         }
     }
 
@@ -88,7 +147,35 @@ public class PinTraceGenerator : TraceStage
         ulong? fixedRdrand = moduleOptions.GetChildNodeOrDefault("rdrand")?.AsUnsignedLongHex();
         int cpuModelId = moduleOptions.GetChildNodeOrDefault("cpu")?.AsInteger() ?? 0;
         bool enableStackTracking = moduleOptions.GetChildNodeOrDefault("stack-tracking")?.AsBoolean() ?? false;
-        
+        int asyncBufferCount = moduleOptions.GetChildNodeOrDefault("async-buffers")?.AsInteger() ?? 0;
+        bool usePinTraceBuffer = moduleOptions.GetChildNodeOrDefault("pin-trace-buffer")?.AsBoolean() ?? false;
+        bool compactTraces = moduleOptions.GetChildNodeOrDefault("compact-traces")?.AsBoolean() ?? false;
+        bool compressTraces = moduleOptions.GetChildNodeOrDefault("compress-traces")?.AsBoolean() ?? false;
+        bool strictImageFilter = moduleOptions.GetChildNodeOrDefault("strict-image-filter")?.AsBoolean() ?? false;
+        bool basicBlockRecords = moduleOptions.GetChildNodeOrDefault("basic-block-records")?.AsBoolean() ?? false;
+        bool traceAllThreads = moduleOptions.GetChildNodeOrDefault("trace-all-threads")?.AsBoolean() ?? false;
+        int threadStackSize = moduleOptions.GetChildNodeOrDefault("thread-stack-size")?.AsInteger() ?? 8192;
+        if(threadStackSize <= 0)
+            throw new ConfigurationException("The thread stack size must be positive.");
+        string fingerprintMode = moduleOptions.GetChildNodeOrDefault("fingerprint-mode")?.AsString() ?? "none";
+        bool useSharedMemoryTransport = moduleOptions.GetChildNodeOrDefault("shared-memory-transport")?.AsBoolean() ?? false;
+        int sharedMemoryRingSize = moduleOptions.GetChildNodeOrDefault("shared-memory-ring-size")?.AsInteger() ?? 64;
+        if(sharedMemoryRingSize <= 0)
+            throw new ConfigurationException("The shared memory ring size must be positive.");
+        int sharedMemoryMaxTraceSize = moduleOptions.GetChildNodeOrDefault("shared-memory-max-trace-size")?.AsInteger() ?? 256;
+        if(sharedMemoryMaxTraceSize <= 0 || sharedMemoryMaxTraceSize > 1024)
+            throw new ConfigurationException("The maximum in-memory trace size must be between 1 and 1024 MiB.");
+        int workerCount = moduleOptions.GetChildNodeOrDefault("worker-count")?.AsInteger() ?? 1;
+        if(workerCount < 1)
+            throw new ConfigurationException("The worker count must be at least 1.");
+        bool shareTracePrefix = moduleOptions.GetChildNodeOrDefault("shared-prefix")?.AsBoolean() ?? false;
+        _testcaseWindow = moduleOptions.GetChildNodeOrDefault("testcase-window")?.AsInteger() ?? 1;
+        if(_testcaseWindow < 1)
+            throw new ConfigurationException("The testcase window must be at least 1.");
+        bool inMemoryTestcases = moduleOptions.GetChildNodeOrDefault("in-memory-testcases")?.AsBoolean() ?? false;
+        string? statisticsFilePath = moduleOptions.GetChildNodeOrDefault("statistics-file")?.AsString();
+        bool collectStatistics = (moduleOptions.GetChildNodeOrDefault("statistics")?.AsBoolean() ?? false) || statisticsFilePath != null;
+
         // Wrapper arguments
         List<string> wrapperArgs = new();
         var wrapperArgsNode = moduleOptions.GetChildNodeOrDefault("wrapper-args");
@@ -98,106 +185,603 @@ public class PinTraceGenerator : TraceStage
             throw new ConfigurationException("Wrapper arguments node has wrong type (should be a list node).");
 
         // Prepare argument list
-        var pinArgs = new List<string>
+        // The output prefix and the shared memory ring are set per worker
+        var pinToolArgs = new List<string>
         {
-            "-t", $"{pinToolPath}",
-            "-o",
-            $"{Path.GetFullPath(_outputDirectory.FullName) + Path.DirectorySeparatorChar} ", // The trailing space is required on Windows: Pin's command line parser else believes that the final backslash is an escape character
             "-i", $"{imagesList}"
         };
 
         if(fixedRdrand != null)
         {
-            pinArgs.Add("-r");
-            pinArgs.Add($"{fixedRdrand.Value}");
+            pinToolArgs.Add("-r");
+            pinToolArgs.Add($"{fixedRdrand.Value}");
         }
 
         if(enableStackTracking)
         {
-            pinArgs.Add("-s");
-            pinArgs.Add("1");
+            pinToolArgs.Add("-s");
+            pinToolArgs.Add("1");
         }
 
-        pinArgs.Add("-c");
-        pinArgs.Add($"{cpuModelId}");
-        pinArgs.Add("--");           
-        pinArgs.Add(wrapperPath);
-        pinArgs.AddRange(wrapperArgs);
+        if(asyncBufferCount > 1)
+        {
+            pinToolArgs.Add("-a");
+            pinToolArgs.Add($"{asyncBufferCount}");
+        }
 
-        // Prepare Pin tool process
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Starting Pin tool process");
-        ProcessStartInfo pinToolProcessStartInfo = new()
+        if(usePinTraceBuffer)
         {
-            Arguments = string.Empty,
-            FileName = pinPath,
-            WorkingDirectory = _outputDirectory.FullName, // Places pin.log at the trace directory
-            UseShellExecute = false,
-            RedirectStandardInput = true,
-            RedirectStandardOutput = true,
-            RedirectStandardError = true
-        };
-        pinToolProcessStartInfo.ArgumentList.AddRange(pinArgs);
+            pinToolArgs.Add("-b");
+            pinToolArgs.Add("1");
+        }
+
+        if(compactTraces)
+        {
+            pinToolArgs.Add("-e");
+            pinToolArgs.Add("1");
+        }
+
+        if(compressTraces)
+        {
+            pinToolArgs.Add("-z");
+            pinToolArgs.Add("1");
+        }
+
+        if(strictImageFilter)
+        {
+            pinToolArgs.Add("-x");
+            pinToolArgs.Add("1");
+        }
+
+        if(basicBlockRecords)
+        {
+            if(usePinTraceBuffer)
+                throw new ConfigurationException("Basic block records are not supported with the Pin trace buffer backend.");
+            if(traceAllThreads)
+                throw new ConfigurationException("Basic block records are not supported when tracing all threads.");
+            if(fingerprintMode != "none")
+                throw new ConfigurationException("Basic block records are not supported with the fingerprint mode.");
+
+            pinToolArgs.Add("-g");
+            pinToolArgs.Add("1");
+        }
+
+        if(traceAllThreads)
+        {
+            if(usePinTraceBuffer)
+                throw new ConfigurationException("Tracing all threads is not supported with the Pin trace buffer backend.");
+            if(useSharedMemoryTransport)
+                throw new ConfigurationException("Tracing all threads is not supported with the shared memory transport.");
+
+            pinToolArgs.Add("-n");
+            pinToolArgs.Add("1");
+            pinToolArgs.Add("-ts");
+            pinToolArgs.Add($"{(long)threadStackSize * 1024}");
+        }
+
+        if(fingerprintMode is "instruction-memory-access" or "call-stack-memory-access")
+        {
+            if(traceAllThreads)
+                throw new ConfigurationException("The fingerprint mode is not supported when tracing all threads.");
+            if(useSharedMemoryTransport)
+                throw new ConfigurationException("The fingerprint mode is not supported with the shared memory transport.");
+
+            pinToolArgs.Add("-f");
+            pinToolArgs.Add(fingerprintMode == "instruction-memory-access" ? "1" : "2");
+        }
+        else if(fingerprintMode != "none")
+            throw new ConfigurationException($"Unknown fingerprint mode '{fingerprintMode}'.");
+
+        if(useSharedMemoryTransport)
+        {
+            if(!OperatingSystem.IsLinux())
+                throw new ConfigurationException("The shared memory transport is only supported on Linux.");
+        }
+
+        pinToolArgs.Add("-c");
+        pinToolArgs.Add($"{cpuModelId}");
 
         // Environment variables
+        var environmentVariables = new Dictionary<string, string>();
         var environmentNode = moduleOptions.GetChildNodeOrDefault("environment");
         if(environmentNode is MappingNode environmentMappingNode)
         {
             foreach(var variable in environmentMappingNode.Children)
             {
                 string value = variable.Value.AsString() ?? throw new ConfigurationException($"Invalid value for environment variable '{variable.Key}'");
-                pinToolProcessStartInfo.EnvironmentVariables[variable.Key] = value;
+                environmentVariables[variable.Key] = value;
             }
         }
         else if(environmentNode != null)
             throw new ConfigurationException($"The 'environment' node is not a mapping node.");
 
-        pinToolProcessStartInfo.EnvironmentVariables["PATH"] += Path.PathSeparator + Path.GetDirectoryName(wrapperPath);
+        // Further files which influence the generated traces (e.g., shared libraries of the investigated program)
+        List<string> cacheDependencies = new();
+        var cacheDependenciesNode = moduleOptions.GetChildNodeOrDefault("cache-dependencies");
+        if(cacheDependenciesNode is ListNode cacheDependenciesListNode)
+            cacheDependencies.AddRange(cacheDependenciesListNode.Children.Select(c => c.AsString()).OfType<string>());
+        else if(cacheDependenciesNode != null)
+            throw new ConfigurationException("Cache dependencies node has wrong type (should be a list node).");
 
-        // Start Pin tool
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Pin tool command: {pinToolProcessStartInfo.FileName} {string.Join(" ", pinToolProcessStartInfo.ArgumentList)}");
-        _pinToolProcess = Process.Start(pinToolProcessStartInfo) ?? throw new Exception("Could not start the Pin process.");
+        // Compute cache key
+        // The worker-specific arguments do not influence the contents of the preprocessed traces
+        using(var cacheKeyHash = IncrementalHash.CreateHash(HashAlgorithmName.SHA256))
+        {
+            void AppendString(string value)
+            {
+                cacheKeyHash.AppendData(Encoding.UTF8.GetBytes(value));
+                cacheKeyHash.AppendData(new byte[] { 0 });
+            }
 
-        // Ensure that the Pin process is eventually stopped when the Pipeline gets aborted early
-        PipelineToken.Register(() =>
+            foreach(string filePath in new[] { pinToolPath, wrapperPath }.Concat(cacheDependencies))
+            {
+                AppendString(filePath);
+                if(File.Exists(filePath))
+                    cacheKeyHash.AppendData(await File.ReadAllBytesAsync(filePath));
+                else
+                    await Logger.LogWarningAsync($"[trace:pin] Could not find '{filePath}' for computing the cache key, only its path is used.");
+            }
+
+            foreach(string arg in pinToolArgs.Prepend(pinPath).Concat(wrapperArgs))
+                AppendString(arg);
+            foreach(var variable in environmentVariables.OrderBy(v => v.Key, StringComparer.Ordinal))
+                AppendString($"{variable.Key}={variable.Value}");
+
+            // The wrapper reads in-memory testcases through a different file stream implementation, which may show up in the traces
+            AppendString($"in-memory-testcases={inMemoryTestcases}");
+
+            _cacheKey = cacheKeyHash.GetHashAndReset();
+        }
+
+        if(statisticsFilePath != null)
+            _statisticsWriter = new StreamWriter(File.Create(statisticsFilePath));
+
+        // Start Pin tool workers
+        // The first worker writes into the output directory itself, the others get subdirectories, so each one has its own trace prefix
+        _workers = new PinToolWorker[workerCount];
+        for(int i = 0; i < workerCount; ++i)
         {
-            if(_pinToolProcess.HasExited)
-                return;
+            var workerOutputDirectory = i == 0 ? _outputDirectory : _outputDirectory.CreateSubdirectory($"worker{i}");
 
-            try
+            SharedMemoryTraceRing? sharedMemoryTraceRing = null;
+            if(useSharedMemoryTransport)
             {
-                // Try to stop the Pin process the clean way
-                _pinToolProcess.StandardInput.WriteLineAsync("e 0").Wait(1000);
-                if(_pinToolProcess.WaitForExit(1000))
-                    return;
+                string sharedMemoryDirectory = Directory.Exists("/dev/shm") ? "/dev/shm" : Path.GetTempPath();
+                string sharedMemoryFilePath = Path.Combine(sharedMemoryDirectory, $"microwalk-pin-{Environment.ProcessId}-{Guid.NewGuid():N}.ring");
+                sharedMemoryTraceRing = new SharedMemoryTraceRing(sharedMemoryFilePath, (long)sharedMemoryRingSize * 1024 * 1024, sharedMemoryMaxTraceSize * 1024 * 1024);
+            }
 
-                _pinToolProcess.Kill(true);
+            var pinArgs = new List<string>
+            {
+                "-t", $"{pinToolPath}",
+                "-o",
+                $"{Path.GetFullPath(workerOutputDirectory.FullName) + Path.DirectorySeparatorChar} " // The trailing space is required on Windows: Pin's command line parser else believes that the final backslash is an escape character
+            };
+            if(sharedMemoryTraceRing != null)
+            {
+                pinArgs.Add("-m");
+                pinArgs.Add(sharedMemoryTraceRing.FilePath);
+            }
 
-                if(!_pinToolProcess.WaitForExit(1000))
-                    Logger.LogErrorAsync($"{_genericLogMessagePrefix} Sent a KILL signal to the Pin tool process, but it did not respond in time. Please check whether it still running.").Wait(2000);
+            // Only the first worker records the trace prefix, the others only record their image layout, so the preprocessor can reuse the prefix
+            if(shareTracePrefix && i > 0)
+            {
+                pinArgs.Add("-p");
+                pinArgs.Add("0");
             }
-            catch(Exception ex)
+
+            // Statistics do not influence the traces, so they are not part of the cache key
+            if(collectStatistics)
             {
-                Logger.LogErrorAsync($"{_genericLogMessagePrefix} Could not safely stop the Pin tool process. Please check whether it still running. Error message:\n{ex}").Wait(2000);
+                pinArgs.Add("-stats");
+                pinArgs.Add("1");
             }
-        });
 
-        // Read and log error output of Pin tool (avoids pipe contention leading to I/O hangs)
-        _pinToolProcess.ErrorDataReceived += async (_, e) =>
+            pinArgs.AddRange(pinToolArgs);
+            pinArgs.Add("--");
+            pinArgs.Add(wrapperPath);
+            pinArgs.AddRange(wrapperArgs);
+
+            _workers[i] = new PinToolWorker(Logger, workerCount > 1 ? $"{i}" : null, sharedMemoryTraceRing, inMemoryTestcases);
+            await _workers[i].StartAsync(pinPath, pinArgs, workerOutputDirectory, environmentVariables, wrapperPath, PipelineToken);
+        }
+
+        // Interleave the worker slots, so testcases are distributed evenly
+        for(int j = 0; j < _testcaseWindow; ++j)
         {
-            if(!string.IsNullOrWhiteSpace(e.Data))
-                await Logger.LogDebugAsync($"{_pinLogMessagePrefix} {e.Data}");
-        };
-        _pinToolProcess.BeginErrorReadLine();
+            foreach(var worker in _workers)
+                _freeWorkerSlots.Enqueue(worker);
+        }
+
+        _freeWorkerSlotsSemaphore = new SemaphoreSlim(workerCount * _testcaseWindow, workerCount * _testcaseWindow);
     }
 
     public override async Task UnInitAsync()
     {
-        // Exit Pin tool process
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Stopping Pin tool process");
-        if(!_pinToolProcess.HasExited)
+        // Exit Pin tool processes
+        foreach(var worker in _workers)
+            await worker.StopAsync();
+
+        if(_statisticsWriter != null)
+            await _statisticsWriter.DisposeAsync();
+    }
+
+    /// <summary>
+    /// Manages a single Pin tool process.
+    /// </summary>
+    private class PinToolWorker
+    {
+        private readonly string _genericLogMessagePrefix;
+        private readonly string _pinLogMessagePrefix;
+        private readonly string _pinOutMessagePrefix;
+
+        /// <summary>
+        /// Logger instance of the owning module.
+        /// </summary>
+        private readonly ILogger _logger;
+
+        /// <summary>
+        /// The Pin tool process handle.
+        /// </summary>
+        private Process _pinToolProcess = null!;
+
+        /// <summary>
+        /// Receives the trace files from the Pin tool, if the shared memory transport is enabled.
+        /// </summary>
+        private readonly SharedMemoryTraceRing? _sharedMemoryTraceRing;
+
+        /// <summary>
+        /// Determines whether testcases are passed to the wrapper through stdin, instead of sending their file paths.
+        /// </summary>
+        private readonly bool _inMemoryTestcases;
+
+        /// <summary>
+        /// Testcases which were sent to the wrapper, and whose trace files have not been reported yet, in sending order.
+        /// </summary>
+        private readonly ConcurrentQueue<PendingTestcase> _pendingTestcases = new();
+
+        /// <summary>
+        /// Ensures that testcases are sent one after another, in the order of <see cref="_pendingTestcases"/>.
+        /// </summary>
+        private readonly SemaphoreSlim _sendLock = new(1, 1);
+
+        /// <summary>
+        /// Set when sending a testcase failed. The wrapper may have received an incomplete command, so the worker cannot be used anymore.
+        /// Guarded by <see cref="_sendLock"/>.
+        /// </summary>
+        private Exception? _sendFailure;
+
+        /// <summary>
+        /// Task of the standard output reader loop.
+        /// </summary>
+        private Task _outputReaderTask = Task.CompletedTask;
+
+        /// <summary>
+        /// Creates a new worker.
+        /// </summary>
+        /// <param name="logger">Logger instance.</param>
+        /// <param name="workerName">Name of this worker for log messages, or null if there is only one worker.</param>
+        /// <param name="sharedMemoryTraceRing">Shared memory ring for receiving the trace files, if the shared memory transport is enabled.</param>
+        /// <param name="inMemoryTestcases">Determines whether testcases are passed to the wrapper through stdin, instead of sending their file paths.</param>
+        public PinToolWorker(ILogger logger, string? workerName, SharedMemoryTraceRing? sharedMemoryTraceRing, bool inMemoryTestcases)
+        {
+            _logger = logger;
+            _sharedMemoryTraceRing = sharedMemoryTraceRing;
+            _inMemoryTestcases = inMemoryTestcases;
+
+            string workerSuffix = workerName == null ? "" : $":worker{workerName}";
+            _genericLogMessagePrefix = $"[trace:pin{workerSuffix}]";
+            _pinLogMessagePrefix = $"[trace:pin{workerSuffix}:stderr]";
+            _pinOutMessagePrefix = $"[trace:pin{workerSuffix}:stdout]";
+        }
+
+        /// <summary>
+        /// Starts the Pin tool process.
+        /// </summary>
+        public async Task StartAsync(string pinPath, List<string> pinArgs, DirectoryInfo outputDirectory, Dictionary<string, string> environmentVariables, string wrapperPath, CancellationToken pipelineToken)
+        {
+            // Prepare Pin tool process
+            await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Starting Pin tool process");
+            ProcessStartInfo pinToolProcessStartInfo = new()
+            {
+                Arguments = string.Empty,
+                FileName = pinPath,
+                WorkingDirectory = outputDirectory.FullName, // Places pin.log at the trace directory
+                UseShellExecute = false,
+                RedirectStandardInput = true,
+                RedirectStandardOutput = true,
+                RedirectStandardError = true
+            };
+            pinToolProcessStartInfo.ArgumentList.AddRange(pinArgs);
+
+            // Environment variables
+            foreach(var variable in environmentVariables)
+                pinToolProcessStartInfo.EnvironmentVariables[variable.Key] = variable.Value;
+            pinToolProcessStartInfo.EnvironmentVariables["PATH"] += Path.PathSeparator + Path.GetDirectoryName(wrapperPath);
+
+            // Start Pin tool
+            await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Pin tool command: {pinToolProcessStartInfo.FileName} {string.Join(" ", pinToolProcessStartInfo.ArgumentList)}");
+            _pinToolProcess = Process.Start(pinToolProcessStartInfo) ?? throw new Exception("Could not start the Pin process.");
+
+            // Ensure that the Pin process is eventually stopped when the Pipeline gets aborted early
+            pipelineToken.Register(() =>
+            {
+                if(_pinToolProcess.HasExited)
+                    return;
+
+                try
+                {
+                    // Try to stop the Pin process the clean way
+                    _pinToolProcess.StandardInput.WriteLineAsync("e 0").Wait(1000);
+                    if(_pinToolProcess.WaitForExit(1000))
+                        return;
+
+                    _pinToolProcess.Kill(true);
+
+                    if(!_pinToolProcess.WaitForExit(1000))
+                        _logger.LogErrorAsync($"{_genericLogMessagePrefix} Sent a KILL signal to the Pin tool process, but it did not respond in time. Please check whether it still running.").Wait(2000);
+                }
+                catch(Exception ex)
+                {
+                    _logger.LogErrorAsync($"{_genericLogMessagePrefix} Could not safely stop the Pin tool process. Please check whether it still running. Error message:\n{ex}").Wait(2000);
+                }
+            });
+
+            // Read and log error output of Pin tool (avoids pipe contention leading to I/O hangs)
+            _pinToolProcess.ErrorDataReceived += async (_, e) =>
+            {
+                if(!string.IsNullOrWhiteSpace(e.Data))
+                    await _logger.LogDebugAsync($"{_pinLogMessagePrefix} {e.Data}");
+            };
+            _pinToolProcess.BeginErrorReadLine();
+
+            // Handle trace file notifications
+            _outputReaderTask = Task.Run(ReadOutputAsync);
+        }
+
+        /// <summary>
+        /// Lets the Pin tool trace the given testcase.
+        /// The testcase is queued behind the testcases that were sent before, and this method returns once the Pin tool has reported its trace file.
+        /// </summary>
+        /// <returns>The tracing statistics reported by the Pin tool, summed over all threads, or null if statistics are disabled.</returns>
+        public async Task<Dictionary<string, long>?> GenerateTraceAsync(TraceEntity traceEntity, string logMessagePrefix)
+        {
+            // Prepare the testcase before queueing it, so failures here do not affect the queue
+            byte[]? testcaseData = null;
+            if(_inMemoryTestcases)
+                testcaseData = traceEntity.TestcaseData ?? await File.ReadAllBytesAsync(traceEntity.TestcaseFilePath);
+            else if(string.IsNullOrEmpty(traceEntity.TestcaseFilePath))
+                throw new Exception($"Testcase #{traceEntity.Id} is only available in memory; enable the 'in-memory-testcases' option.");
+
+            var pendingTestcase = new PendingTestcase(traceEntity.Id, logMessagePrefix);
+
+            // Send test case
+            // The wrapper handles the testcases in order, so the output reader can match the reported trace files to the queued testcases
+            await _sendLock.WaitAsync();
+            try
+            {
+                if(_sendFailure != null)
+                    throw new Exception("The Pin tool worker is unusable after a previous send failure.", _sendFailure);
+
+                // Queue before sending, so the output reader always finds the testcase
+                _pendingTestcases.Enqueue(pendingTestcase);
+
+                try
+                {
+                    await SendTestcaseAsync(traceEntity, testcaseData);
+                }
+                catch(Exception ex)
+                {
+                    // The wrapper may have received a partial command, so the queue order cannot be restored.
+                    // Fault the worker and fail all testcases which are still waiting for it.
+                    _sendFailure = ex;
+                    while(_pendingTestcases.TryDequeue(out var failedTestcase))
+                        failedTestcase.Completion.TrySetException(ex);
+                    throw;
+                }
+            }
+            finally
+            {
+                _sendLock.Release();
+            }
+
+            // Wait until the trace file is reported
+            string traceFilePath = await pendingTestcase.Completion.Task;
+            traceEntity.RawTraceFilePath = traceFilePath;
+            traceEntity.RawThreadTraceFilePaths = pendingTestcase.ThreadTraceFilePaths;
+
+            // The trace file only exists in memory when using the shared memory transport, unless it was too large and has been spilled to disk
+            if(_sharedMemoryTraceRing != null)
+                traceEntity.RawTraceData = await _sharedMemoryTraceRing.GetFileDataAsync(traceFilePath);
+
+            return pendingTestcase.Statistics;
+        }
+
+        /// <summary>
+        /// Writes the command for the given testcase to the Pin tool's standard input.
+        /// </summary>
+        /// <param name="traceEntity">Testcase.</param>
+        /// <param name="testcaseData">Raw testcase bytes, if in-memory testcases are enabled.</param>
+        private async Task SendTestcaseAsync(TraceEntity traceEntity, byte[]? testcaseData)
+        {
+            if(testcaseData != null)
+            {
+                // Length-prefixed frame with the raw testcase bytes
+                await _pinToolProcess.StandardInput.WriteLineAsync($"d {traceEntity.Id} {testcaseData.Length}");
+                await _pinToolProcess.StandardInput.FlushAsync();
+                await _pinToolProcess.StandardInput.BaseStream.WriteAsync(testcaseData);
+                await _pinToolProcess.StandardInput.BaseStream.FlushAsync();
+            }
+            else
+            {
+                await _pinToolProcess.StandardInput.WriteLineAsync($"t {traceEntity.Id}");
+                await _pinToolProcess.StandardInput.WriteLineAsync(traceEntity.TestcaseFilePath);
+            }
+        }
+
+        /// <summary>
+        /// Reads the Pin tool's standard output, and completes the pending testcases.
+        /// </summary>
+        private async Task ReadOutputAsync()
+        {
+            try
+            {
+                while(true)
+                {
+                    // Read Pin tool output
+                    string? pinToolOutput = await _pinToolProcess.StandardOutput.ReadLineAsync();
+                    if(pinToolOutput == null)
+                    {
+                        if(!_pendingTestcases.IsEmpty)
+                            throw new IOException("Could not read from Pin tool standard output (null). Probably the process has exited early.");
+                        return;
+                    }
+
+                    // Parse output
+                    await _logger.LogDebugAsync($"{_pinOutMessagePrefix} {pinToolOutput}");
+                    string[] outputParts = pinToolOutput.Split('\t');
+                    _pendingTestcases.TryPeek(out var pendingTestcase);
+                    if((outputParts[0] == "t" || outputParts[0] == "e") && outputParts.Length >= 2)
+                    {
+                        // Trace file or load failure of a pending testcase
+                        int testcaseId;
+                        if(outputParts[0] == "t")
+                            testcaseId = GetTraceFileTestcaseId(outputParts[1]);
+                        else if(!int.TryParse(outputParts[1], out testcaseId))
+                            testcaseId = -1;
+                        if(_pendingTestcases.Any(p => p.TestcaseId == testcaseId))
+                        {
+                            CompletePendingTestcase(testcaseId, outputParts[0] == "t" ? outputParts[1] : null);
+                            continue;
+                        }
+                    }
+
+                    if(outputParts[0] == "s" && pendingTestcase != null)
+                    {
+                        // Trace file of a secondary thread, which is reported before the main trace file
+                        pendingTestcase.ThreadTraceFilePaths ??= new List<string>();
+                        pendingTestcase.ThreadTraceFilePaths.Add(outputParts[1]);
+                        continue;
+                    }
+
+                    if(outputParts[0] == "m")
+                    {
+                        // Tracing statistics of one thread, which are reported before its trace file
+                        if(pendingTestcase != null)
+                        {
+                            pendingTestcase.Statistics ??= new Dictionary<string, long>();
+                            foreach(string part in outputParts.Skip(1))
+                            {
+                                int separatorIndex = part.IndexOf('=');
+                                if(separatorIndex > 0 && long.TryParse(part.AsSpan(separatorIndex + 1), out long value))
+                                {
+                                    string key = part[..separatorIndex];
+                                    pendingTestcase.Statistics[key] = pendingTestcase.Statistics.GetValueOrDefault(key) + value;
+                                }
+                            }
+                        }
+
+                        continue;
+                    }
+
+                    string logMessagePrefix = pendingTestcase?.LogMessagePrefix ?? _genericLogMessagePrefix;
+                    await _logger.LogWarningAsync($"{logMessagePrefix} Unexpected message from Pin tool.\nPlease make sure that the investigated program does not print anything on stdout, since this might interfere with the Pin tool's output pipe.");
+                    await _logger.LogWarningAsync($"{logMessagePrefix}   >>> {pinToolOutput}");
+                }
+            }
+            catch(Exception ex)
+            {
+                // Fail all waiting testcases
+                while(_pendingTestcases.TryDequeue(out var pendingTestcase))
+                    pendingTestcase.Completion.TrySetException(ex);
+            }
+        }
+
+        /// <summary>
+        /// Completes the given pending testcase with the given trace file, or fails it if the wrapper could not load it.
+        /// The wrapper handles the testcases in order, so all testcases queued before the given one were skipped and are failed as well.
+        /// </summary>
+        /// <param name="testcaseId">Testcase ID.</param>
+        /// <param name="traceFilePath">Path of the testcase's main trace file, or null if the wrapper reported a failure.</param>
+        private void CompletePendingTestcase(int testcaseId, string? traceFilePath)
         {
-            await _pinToolProcess.StandardInput.WriteLineAsync("e 0");
-            await _pinToolProcess.WaitForExitAsync();
+            while(_pendingTestcases.TryDequeue(out var pendingTestcase))
+            {
+                if(pendingTestcase.TestcaseId != testcaseId)
+                {
+                    pendingTestcase.Completion.TrySetException(new Exception($"The wrapper did not report a trace file for testcase #{pendingTestcase.TestcaseId}."));
+                    continue;
+                }
+
+                if(traceFilePath == null)
+                    pendingTestcase.Completion.TrySetException(new Exception($"The wrapper could not load testcase #{testcaseId}."));
+                else
+                    pendingTestcase.Completion.TrySetResult(traceFilePath);
+                return;
+            }
+        }
+
+        /// <summary>
+        /// Extracts the testcase ID from a trace file name reported by the Pin tool ("[prefix]t{id}[_{thread}].trace").
+        /// </summary>
+        /// <param name="traceFilePath">Trace file path.</param>
+        private static int GetTraceFileTestcaseId(string traceFilePath)
+        {
+            var match = Regex.Match(Path.GetFileNameWithoutExtension(traceFilePath), @"t(\d+)(?:_\d+)?$");
+            if(!match.Success)
+                throw new IOException($"Could not determine the testcase ID of trace file \"{traceFilePath}\".");
+
+            return int.Parse(match.Groups[1].ValueSpan);
+        }
+
+        /// <summary>
+        /// Stops the Pin tool process.
+        /// </summary>
+        public async Task StopAsync()
+        {
+            // Exit Pin tool process
+            await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Stopping Pin tool process");
+            if(!_pinToolProcess.HasExited)
+            {
+                await _pinToolProcess.StandardInput.WriteLineAsync("e 0");
+                await _pinToolProcess.WaitForExitAsync();
+            }
+
+            await _outputReaderTask;
+
+            // Release shared memory file
+            _sharedMemoryTraceRing?.Dispose();
+        }
+
+        /// <summary>
+        /// A testcase which was sent to the wrapper.
+        /// </summary>
+        private class PendingTestcase
+        {
+            public PendingTestcase(int testcaseId, string logMessagePrefix)
+            {
+                TestcaseId = testcaseId;
+                LogMessagePrefix = logMessagePrefix;
+            }
+
+            public int TestcaseId { get; }
+
+            public string LogMessagePrefix { get; }
+
+            /// <summary>
+            /// Trace files of secondary threads, if any.
+            /// </summary>
+            public List<string>? ThreadTraceFilePaths { get; set; }
+
+            /// <summary>
+            /// Tracing statistics, summed over all threads, if any.
+            /// </summary>
+            public Dictionary<string, long>? Statistics { get; set; }
+
+            /// <summary>
+            /// Completed with the path of the main trace file.
+            /// </summary>
+            public TaskCompletionSource<string> Completion { get; } = new(TaskCreationOptions.RunContinuationsAsynchronously);
         }
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@ using System.Globalization;
 using System.IO;
 using System.Linq;
 using System.Runtime.InteropServices;
+using System.Text;
 using System.Threading;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
@@ -35,623 +36,757 @@ public class PinTracePreprocessor : PreprocessorStage
     private bool _keepRawTraces;
 
     /// <summary>
-    /// Determines whether the next incoming test case is the first one.
+    /// Determines whether the traces of secondary threads are appended to the trace of the main thread. If not, only the main thread is analyzed.
     /// </summary>
-    private bool _firstTestcase = true;
+    private bool _mergeThreadTraces;
 
     /// <summary>
-    /// Protects the first test case variable.
+    /// Preprocessed trace prefixes, indexed by the directory of the corresponding raw trace files.
+    /// Each trace generator instance (e.g., each worker of a Pin tool worker pool) records its own trace prefix, or reuses the first recorded one.
     /// </summary>
-    private readonly SemaphoreSlim _firstTestcaseSemaphore = new(1, 1);
+    private readonly Dictionary<string, Task<TracePrefixState>> _tracePrefixes = new();
 
     /// <summary>
-    /// Trace prefix data.
+    /// Protects the trace prefix dictionary.
     /// </summary>
-    private TracePrefixFile _tracePrefix = null!;
+    private readonly SemaphoreSlim _tracePrefixesSemaphore = new(1, 1);
 
     /// <summary>
-    /// Metadata about loaded images (is also assigned to the prefix file), sorted by image start address.
+    /// Number of recorded trace prefixes.
     /// </summary>
-    private TracePrefixFile.ImageFileInfo[] _imageFiles = null!;
+    private int _recordedTracePrefixCount;
 
     /// <summary>
-    /// The minimum stack pointer value (set when reading the prefix).
+    /// The first recorded trace prefix, which is reused by trace generator instances that did not record their own.
     /// </summary>
-    private ulong _stackPointerMin = 0xFFFF_FFFF_FFFF_FFFFUL;
-
-    /// <summary>
-    /// The maximum stack pointer value (set when reading the prefix).
-    /// </summary>
-    private ulong _stackPointerMax = 0x0000_0000_0000_0000UL;
-
-    /// <summary>
-    /// Heap allocation information from the trace prefix, indexed by start address.
-    /// </summary>
-    private SortedList<ulong, HeapAllocation>? _tracePrefixHeapAllocationLookup;
-
-    /// <summary>
-    /// Stack frames from the trace prefix.
-    /// This list is used as a stack, where the highest index contains the most recent stack frame (i.e. the stack frame with the lowest base address).
-    /// The current stack frame list for each trace is initialized with this list.
-    /// </summary>
-    private List<(int id, ulong baseAddress)>? _tracePrefixStackFrames;
-
-    /// <summary>
-    /// The last heap allocation ID used by the trace prefix.
-    /// </summary>
-    private int _tracePrefixLastHeapAllocationId;
-
-    /// <summary>
-    /// The last stack allocation ID used by the trace prefix.
-    /// </summary>
-    private int _tracePrefixLastStackAllocationId;
+    private readonly TaskCompletionSource<TracePrefixState> _firstRecordedTracePrefix = new(TaskCreationOptions.RunContinuationsAsynchronously);
 
     public override bool SupportsParallelism => true;
 
+    // Storing and keeping traces does not influence the preprocessed trace contents
+    public override byte[]? CacheKey => Encoding.UTF8.GetBytes($"merge-thread-traces={_mergeThreadTraces}");
+
     public override async Task PreprocessTraceAsync(TraceEntity traceEntity)
     {
         // Input check
         if(traceEntity.RawTraceFilePath == null)
             throw new Exception("Raw trace file path is null. Is the trace stage missing?");
 
-        // First test case?
-        await _firstTestcaseSemaphore.WaitAsync();
+        // Fingerprints are already in their final form and directly consumed by the analysis
+        if(FingerprintFile.IsFingerprintFile(traceEntity.RawTraceFilePath))
+            return;
+
+        // First test case of this trace prefix?
+        string rawTraceFileDirectory = Path.GetDirectoryName(traceEntity.RawTraceFilePath) ?? throw new Exception($"Could not determine directory: {traceEntity.RawTraceFilePath}");
+        Task<TracePrefixState>? tracePrefixTask;
+        await _tracePrefixesSemaphore.WaitAsync();
         try
         {
-            if(_firstTestcase)
+            if(!_tracePrefixes.TryGetValue(rawTraceFileDirectory, out tracePrefixTask))
             {
-                // Paths
-                string rawTraceFileDirectory = Path.GetDirectoryName(traceEntity.RawTraceFilePath) ?? throw new Exception($"Could not determine directory: {traceEntity.RawTraceFilePath}");
-                string prefixDataFilePath = Path.Combine(rawTraceFileDirectory, "prefix_data.txt");
-                string tracePrefixFilePath = Path.Combine(rawTraceFileDirectory, "prefix.trace");
-
-                // Read image data
-                string[] imageDataLines = await File.ReadAllLinesAsync(prefixDataFilePath);
-                int nextImageFileId = 0;
-                int maxImageNameLength = 1;
-                List<TracePrefixFile.ImageFileInfo> imageFiles = new();
-                foreach(string line in imageDataLines)
+                // The Pin tool only writes a prefix trace file if it records the trace prefix itself
+                if(File.Exists(Path.Combine(rawTraceFileDirectory, "prefix.trace")))
                 {
-                    string[] imageData = line.Split('\t');
-                    var imageFile = new TracePrefixFile.ImageFileInfo
-                    {
-                        Id = nextImageFileId++,
-                        Interesting = byte.Parse(imageData[1]) != 0,
-                        StartAddress = ulong.Parse(imageData[2], NumberStyles.HexNumber),
-                        EndAddress = ulong.Parse(imageData[3], NumberStyles.HexNumber),
-                        Name = Path.GetFileName(imageData[4])
-                    };
-                    imageFiles.Add(imageFile);
-
-                    if(imageFile.Name.Length > maxImageNameLength)
-                        maxImageNameLength = imageFile.Name.Length;
+                    // Additional trace prefixes are named after their directory
+                    string prefixName = _recordedTracePrefixCount++ == 0 ? "prefix" : $"prefix.{Path.GetFileName(rawTraceFileDirectory)}";
+                    tracePrefixTask = Task.Run(() => LoadTracePrefixAsync(rawTraceFileDirectory, prefixName));
+                }
+                else
+                {
+                    tracePrefixTask = Task.Run(() => ReuseTracePrefixAsync(rawTraceFileDirectory));
                 }
 
-                // Order image files
-                // Interesting image files come first, since memory accesses almost always hit those
-                _imageFiles = imageFiles.OrderByDescending(img => img.Interesting).ToArray();
+                _tracePrefixes.Add(rawTraceFileDirectory, tracePrefixTask);
+            }
+        }
+        finally
+        {
+            _tracePrefixesSemaphore.Release();
+        }
+
+        var prefix = await tracePrefixTask;
+
+        // Prepare writer for serializing trace data
+        // If the trace is stored, it is streamed to disk and not kept in memory. Otherwise, the buffer will be resized by the preprocess method,
+        // which can compute a good upper bound for the output file size
+        string? preprocessedTraceFilePath = null;
+        IFastBinaryWriter traceFileWriter;
+        if(_storeTraces)
+        {
+            preprocessedTraceFilePath = Path.Combine(_outputDirectory!.FullName, Path.GetFileName(traceEntity.RawTraceFilePath) + ".preprocessed");
+            traceFileWriter = new FastBinaryFileWriter(preprocessedTraceFilePath);
+        }
+        else
+            traceFileWriter = new FastBinaryBufferWriter(1);
 
-                // Prepare writer for serializing trace data
-                using var tracePrefixFileWriter = new FastBinaryBufferWriter(_imageFiles.Length * (32 + maxImageNameLength));
+        var threadTraceFilePaths = OrderByThreadId(traceEntity.RawThreadTraceFilePaths ?? Enumerable.Empty<string>());
+        try
+        {
+            // Preprocess trace data
+            // The trace stage may have passed the raw trace in memory
+            var allocationState = new TraceAllocationState(prefix.LastHeapAllocationId + 1, prefix.LastStackAllocationId + 1);
+            using(var rawTraceChunkReader = traceEntity.RawTraceData != null ? new RawTraceChunkReader(traceEntity.RawTraceData.Value) : new RawTraceChunkReader(traceEntity.RawTraceFilePath))
+                PreprocessFile(rawTraceChunkReader, prefix, allocationState, false, false, traceFileWriter, $"[preprocess:{traceEntity.Id}]");
+            traceEntity.RawTraceData = null;
+
+            // Append traces of secondary threads
+            // The threads share the heap, so allocations are tracked across all thread traces
+            if(_mergeThreadTraces)
+            {
+                foreach(string threadTraceFilePath in threadTraceFilePaths)
+                {
+                    using var threadTraceChunkReader = new RawTraceChunkReader(threadTraceFilePath);
+                    PreprocessFile(threadTraceChunkReader, prefix, allocationState, false, true, traceFileWriter, $"[preprocess:{traceEntity.Id}:{Path.GetFileName(threadTraceFilePath)}]");
+                }
+            }
 
-                // Write image files
-                tracePrefixFileWriter.WriteInt32(_imageFiles.Length);
-                foreach(var imageFile in _imageFiles)
-                    imageFile.Store(tracePrefixFileWriter);
+            // Create trace file object
+            if(traceFileWriter is FastBinaryFileWriter traceFileFileWriter)
+            {
+                traceFileFileWriter.Flush();
+                traceEntity.PreprocessedTraceFilePath = preprocessedTraceFilePath;
+                traceEntity.PreprocessedTraceFile = new TraceFile(prefix.TracePrefix, preprocessedTraceFilePath!);
+            }
+            else
+            {
+                var traceFileBufferWriter = (FastBinaryBufferWriter)traceFileWriter;
+                var preprocessedTraceData = traceFileBufferWriter.Buffer.AsMemory(0, traceFileBufferWriter.Length);
+                traceEntity.PreprocessedTraceFile = new TraceFile(prefix.TracePrefix, preprocessedTraceData);
+            }
+        }
+        finally
+        {
+            ((IDisposable)traceFileWriter).Dispose();
+        }
 
-                // Load and parse trace prefix data
-                PreprocessFile(tracePrefixFilePath, true, tracePrefixFileWriter, "[preprocess:prefix]");
+        // Keep raw trace?
+        if(!_keepRawTraces)
+        {
+            File.Delete(traceEntity.RawTraceFilePath);
+            traceEntity.RawTraceFilePath = null;
 
-                // Create trace prefix object
-                var preprocessedTracePrefixData = tracePrefixFileWriter.Buffer.AsMemory(0, tracePrefixFileWriter.Length);
-                _tracePrefix = new TracePrefixFile(preprocessedTracePrefixData);
-                _firstTestcase = false;
+            foreach(string threadTraceFilePath in threadTraceFilePaths)
+                File.Delete(threadTraceFilePath);
+            traceEntity.RawThreadTraceFilePaths = null;
+        }
+    }
 
-                // Keep raw trace data?
-                if(!_keepRawTraces)
+    /// <summary>
+    /// Reads and preprocesses the trace prefix in the given directory.
+    /// </summary>
+    /// <param name="rawTraceFileDirectory">Directory containing the raw trace prefix files.</param>
+    /// <param name="prefixName">Name of the trace prefix, for log messages and the preprocessed file.</param>
+    private async Task<TracePrefixState> LoadTracePrefixAsync(string rawTraceFileDirectory, string prefixName)
+    {
+        var prefix = new TracePrefixState();
+        try
+        {
+            // Paths
+            string prefixDataFilePath = Path.Combine(rawTraceFileDirectory, "prefix_data.txt");
+            string tracePrefixFilePath = Path.Combine(rawTraceFileDirectory, "prefix.trace");
+
+            // Read image data
+            string[] imageDataLines = await File.ReadAllLinesAsync(prefixDataFilePath);
+            prefix.ImageDataLines = imageDataLines;
+            int nextImageFileId = 0;
+            int maxImageNameLength = 1;
+            List<TracePrefixFile.ImageFileInfo> imageFiles = new();
+            foreach(string line in imageDataLines)
+            {
+                string[] imageData = line.Split('\t');
+                var imageFile = new TracePrefixFile.ImageFileInfo
                 {
-                    File.Delete(prefixDataFilePath);
-                    File.Delete(tracePrefixFilePath);
-                }
+                    Id = nextImageFileId++,
+                    Interesting = byte.Parse(imageData[1]) != 0,
+                    StartAddress = ulong.Parse(imageData[2], NumberStyles.HexNumber),
+                    EndAddress = ulong.Parse(imageData[3], NumberStyles.HexNumber),
+                    Name = Path.GetFileName(imageData[4])
+                };
+                imageFiles.Add(imageFile);
+
+                if(imageFile.Name.Length > maxImageNameLength)
+                    maxImageNameLength = imageFile.Name.Length;
+            }
+
+            // Order image files
+            // Interesting image files come first, since memory accesses almost always hit those
+            prefix.ImageFiles = imageFiles.OrderByDescending(img => img.Interesting).ToArray();
+            prefix.ImageFilesByAddress = imageFiles.OrderBy(img => img.StartAddress).ToArray();
+
+            // Prepare writer for serializing trace data
+            using var tracePrefixFileWriter = new FastBinaryBufferWriter(prefix.ImageFiles.Length * (32 + maxImageNameLength));
+
+            // Write image files
+            tracePrefixFileWriter.WriteInt32(prefix.ImageFiles.Length);
+            foreach(var imageFile in prefix.ImageFiles)
+                imageFile.Store(tracePrefixFileWriter);
+
+            // Load and parse trace prefix data
+            var allocationState = new TraceAllocationState(0, 0);
+            using(var tracePrefixChunkReader = new RawTraceChunkReader(tracePrefixFilePath))
+                PreprocessFile(tracePrefixChunkReader, prefix, allocationState, true, false, tracePrefixFileWriter, $"[preprocess:{prefixName}]");
 
-                // Store to disk?
-                if(_storeTraces)
+            // Threads which were started during the prefix have their own prefix trace files
+            var threadTracePrefixFilePaths = OrderByThreadId(Directory.EnumerateFiles(rawTraceFileDirectory, "prefix_*.trace"));
+            if(_mergeThreadTraces)
+            {
+                foreach(string threadTracePrefixFilePath in threadTracePrefixFilePaths)
                 {
-                    string outputPath = Path.Combine(_outputDirectory!.FullName, "prefix.trace.preprocessed");
-                    await using var writer = new BinaryWriter(File.Open(outputPath, FileMode.Create, FileAccess.Write, FileShare.None));
-                    writer.Write(preprocessedTracePrefixData.Span);
+                    using var threadTracePrefixChunkReader = new RawTraceChunkReader(threadTracePrefixFilePath);
+                    PreprocessFile(threadTracePrefixChunkReader, prefix, allocationState, true, true, tracePrefixFileWriter, $"[preprocess:{prefixName}:{Path.GetFileName(threadTracePrefixFilePath)}]");
                 }
             }
+
+            prefix.HeapAllocationLookup = allocationState.HeapAllocationLookup;
+            prefix.LastHeapAllocationId = allocationState.NextHeapAllocationId - 1;
+            prefix.LastStackAllocationId = allocationState.NextStackAllocationId - 1;
+
+            // Create trace prefix object
+            var preprocessedTracePrefixData = tracePrefixFileWriter.Buffer.AsMemory(0, tracePrefixFileWriter.Length);
+            prefix.TracePrefix = new TracePrefixFile(preprocessedTracePrefixData);
+
+            // Keep raw trace data?
+            if(!_keepRawTraces)
+            {
+                File.Delete(prefixDataFilePath);
+                File.Delete(tracePrefixFilePath);
+                foreach(string threadTracePrefixFilePath in threadTracePrefixFilePaths)
+                    File.Delete(threadTracePrefixFilePath);
+            }
+
+            // Store to disk?
+            if(_storeTraces)
+            {
+                string outputPath = Path.Combine(_outputDirectory!.FullName, $"{prefixName}.trace.preprocessed");
+                await using var writer = new BinaryWriter(File.Open(outputPath, FileMode.Create, FileAccess.Write, FileShare.None));
+                writer.Write(preprocessedTracePrefixData.Span);
+            }
         }
-        finally
+        catch(Exception ex)
         {
-            _firstTestcaseSemaphore.Release();
+            _firstRecordedTracePrefix.TrySetException(ex);
+            throw;
         }
 
-        // Prepare writer for serializing trace data
-        // The buffer will be resized by the preprocess method, which can compute a good upper bound for the output file size
-        using var traceFileWriter = new FastBinaryBufferWriter(1);
+        _firstRecordedTracePrefix.TrySetResult(prefix);
+        return prefix;
+    }
 
-        // Preprocess trace data
-        PreprocessFile(traceEntity.RawTraceFilePath, false, traceFileWriter, $"[preprocess:{traceEntity.Id}]");
+    /// <summary>
+    /// Checks that the image layout in the given directory matches the first recorded trace prefix, and returns that prefix.
+    /// </summary>
+    /// <param name="rawTraceFileDirectory">Directory containing the raw trace prefix metadata.</param>
+    private async Task<TracePrefixState> ReuseTracePrefixAsync(string rawTraceFileDirectory)
+    {
+        string prefixDataFilePath = Path.Combine(rawTraceFileDirectory, "prefix_data.txt");
+        string[] imageDataLines = await File.ReadAllLinesAsync(prefixDataFilePath);
 
-        // Create trace file object
-        var preprocessedTraceData = traceFileWriter.Buffer.AsMemory(0, traceFileWriter.Length);
-        var preprocessedTraceFile = new TraceFile(_tracePrefix, preprocessedTraceData);
+        var prefix = await _firstRecordedTracePrefix.Task.WaitAsync(PipelineToken);
 
-        // Store to disk?
-        if(_storeTraces)
+        // The traces are only compatible if all images are loaded at the same addresses
+        for(int i = 0; i < Math.Max(imageDataLines.Length, prefix.ImageDataLines.Length); ++i)
         {
-            traceEntity.PreprocessedTraceFilePath = Path.Combine(_outputDirectory!.FullName, Path.GetFileName(traceEntity.RawTraceFilePath) + ".preprocessed");
-            await using var writer = new BinaryWriter(File.Open(traceEntity.PreprocessedTraceFilePath, FileMode.Create, FileAccess.Write, FileShare.None));
-            writer.Write(preprocessedTraceData.Span);
+            string? imageDataLine = i < imageDataLines.Length ? imageDataLines[i] : null;
+            string? prefixImageDataLine = i < prefix.ImageDataLines.Length ? prefix.ImageDataLines[i] : null;
+            if(imageDataLine != prefixImageDataLine)
+                throw new Exception($"The image layout in '{rawTraceFileDirectory}' does not match the recorded trace prefix, which is required for sharing it: "
+                                    + $"Expected '{prefixImageDataLine ?? "<end>"}', got '{imageDataLine ?? "<end>"}'. Is ASLR disabled?");
         }
 
-        // Keep raw trace?
+        await Logger.LogDebugAsync($"[preprocess] Reusing recorded trace prefix for '{rawTraceFileDirectory}'");
+
+        // Keep raw trace data?
         if(!_keepRawTraces)
-        {
-            File.Delete(traceEntity.RawTraceFilePath);
-            traceEntity.RawTraceFilePath = null;
-        }
+            File.Delete(prefixDataFilePath);
 
-        // Keep trace data in memory for the analysis stages
-        traceEntity.PreprocessedTraceFile = preprocessedTraceFile;
+        return prefix;
     }
 
     /// <summary>
-    /// Preprocesses the given raw trace file and emits a preprocessed one.
+    /// Preprocesses the given raw trace and emits a preprocessed one.
     /// </summary>
-    /// <param name="inputFileName">Input file.</param>
+    /// <param name="rawTraceChunkReader">Reader for the raw trace data.</param>
+    /// <param name="prefix">The trace prefix the raw trace belongs to. The stack information is filled when handling the prefix file of the main thread.</param>
+    /// <param name="allocationState">Allocation state, which is shared by the traces of all threads of a testcase.</param>
     /// <param name="isPrefix">Determines whether the prefix file is handled.</param>
+    /// <param name="isThreadTrace">Determines whether the trace belongs to a secondary thread, which has its own stack.</param>
     /// <param name="traceFileWriter">Writer for storing the preprocessed trace data.</param>
     /// <param name="logPrefix">Short prefix for log messages printed by this function.</param>
     /// <remarks>
     /// This function as not designed as asynchronous, to allow unsafe operations and stack allocations.
     /// </remarks>
-    private unsafe void PreprocessFile(string inputFileName, bool isPrefix, FastBinaryBufferWriter traceFileWriter, string logPrefix)
+    private unsafe void PreprocessFile(RawTraceChunkReader rawTraceChunkReader, TracePrefixState prefix, TraceAllocationState allocationState, bool isPrefix, bool isThreadTrace,
+        IFastBinaryWriter traceFileWriter, string logPrefix)
     {
-        // Read entire trace file into memory, since these files should not get too big
-        byte[] inputFile = File.ReadAllBytes(inputFileName);
-        int inputFileLength = inputFile.Length;
-        int rawTraceEntrySize = Marshal.SizeOf(typeof(RawTraceEntry));
-
-        // Resize output buffer to avoid re-allocations
-        traceFileWriter.ResizeBuffer(MaxPreprocessedTraceEntrySize * inputFileLength / rawTraceEntrySize);
-
         // Parse trace entries
         var lastAllocationSizes = new Stack<uint>();
         var stackFrames = new List<(int id, ulong baseAddress)>(); // Is used as a stack, where the top element is the most recent stack frame
-        if(_tracePrefixStackFrames != null)
-            stackFrames.AddRange(_tracePrefixStackFrames);
+        if(prefix.StackFrames != null && !isThreadTrace)
+            stackFrames.AddRange(prefix.StackFrames);
+        ulong stackPointerMin = isThreadTrace ? 0xFFFF_FFFF_FFFF_FFFFUL : prefix.StackPointerMin;
+        ulong stackPointerMax = isThreadTrace ? 0x0000_0000_0000_0000UL : prefix.StackPointerMax;
         ulong lastAllocReturnAddress = 0;
         bool encounteredSizeSinceLastAlloc = false;
-        var heapAllocationLookup = new SortedList<ulong, HeapAllocation>();
-        int nextHeapAllocationId = isPrefix ? 0 : _tracePrefixLastHeapAllocationId + 1;
-        int nextStackAllocationId = isPrefix ? 0 : _tracePrefixLastStackAllocationId + 1;
-        fixed(byte* inputFilePtr = inputFile)
+        var heapAllocationLookup = allocationState.HeapAllocationLookup;
+        HeapAllocation? lastHitAllocation = null;
+        TracePrefixFile.ImageFileInfo? lastHitImage = null;
+        int nextHeapAllocationId = allocationState.NextHeapAllocationId;
+        int nextStackAllocationId = allocationState.NextStackAllocationId;
+
+        // The reader transparently handles both the plain and the compact trace encoding
+        var rawTraceReader = new RawTraceReader();
+        while(rawTraceChunkReader.TryReadNextChunk(out byte[] chunk, out int chunkLength))
         {
-            for(long pos = 0; pos < inputFileLength; pos += rawTraceEntrySize)
+            fixed(byte* chunkPtr = chunk)
             {
-                // Read entry
-                RawTraceEntry rawTraceEntry = *(RawTraceEntry*)&inputFilePtr[pos];
-                switch(rawTraceEntry.Type)
-                {
-                    case RawTraceEntryTypes.HeapAllocSizeParameter:
-                    {
-                        // Remember size parameter until the address return
-                        lastAllocationSizes.Push((uint)rawTraceEntry.Param1);
-                        encounteredSizeSinceLastAlloc = true;
+                rawTraceReader.SetChunk(chunkPtr, chunkLength);
 
-                        break;
-                    }
+                // If we are writing to memory, resize output buffer to avoid re-allocations
+                if(traceFileWriter is FastBinaryBufferWriter traceFileBufferWriter)
+                {
+                    long maxChunkOutputLength = MaxPreprocessedTraceEntrySize * rawTraceReader.EstimatedEntryCount;
+                    if(traceFileBufferWriter.Buffer.Length - traceFileBufferWriter.Length < maxChunkOutputLength)
+                        traceFileBufferWriter.ResizeBuffer((int)Math.Min(int.MaxValue - traceFileBufferWriter.Buffer.Length, maxChunkOutputLength));
+                }
 
-                    case RawTraceEntryTypes.HeapAllocAddressReturn:
+                while(rawTraceReader.TryReadNext(out var rawTraceEntry))
+                {
+                    switch(rawTraceEntry.Type)
                     {
-                        // Catch double returns of the same allocated address (happens for some allocator implementations)
-                        if(rawTraceEntry.Param2 == lastAllocReturnAddress && !encounteredSizeSinceLastAlloc)
-                        {
-                            Logger.LogDebugAsync($"{logPrefix} Skipped double return of allocated address").Wait();
-                            break;
-                        }
-
-                        // HeapAllocation stack empty?
-                        if(lastAllocationSizes.Count == 0)
+                        case RawTraceEntryTypes.HeapAllocSizeParameter:
                         {
-                            Logger.LogErrorAsync($"{logPrefix} Encountered heap allocation address return, but size stack is empty").Wait();
-                            break;
-                        }
-
-                        uint size = lastAllocationSizes.Pop();
-
-                        // Create entry
-                        var entry = new HeapAllocation
-                        {
-                            Id = nextHeapAllocationId++,
-                            Size = size,
-                            Address = rawTraceEntry.Param2
-                        };
-                        entry.Store(traceFileWriter);
+                            // Remember size parameter until the address return
+                            lastAllocationSizes.Push((uint)rawTraceEntry.Param1);
+                            encounteredSizeSinceLastAlloc = true;
 
-                        // Store allocation information
-                        heapAllocationLookup[entry.Address] = entry;
-
-                        // Update state
-                        lastAllocReturnAddress = entry.Address;
-                        encounteredSizeSinceLastAlloc = false;
-
-                        break;
-                    }
-
-                    case RawTraceEntryTypes.HeapFreeAddressParameter:
-                    {
-                        // Skip nonsense frees
-                        if(rawTraceEntry.Param2 == 0)
-                            break;
-                        if(!heapAllocationLookup.TryGetValue(rawTraceEntry.Param2, out var allocationEntry))
-                        {
-                            // Reasons why this may happen:
-                            // - We missed a heap allocation (unknown function, missed heap allocation address return due to tail call, ...)
-                            // - The allocation was within the prefix or another trace. Due to parallelism we do not carry over allocations from preceding traces
-                            Logger.LogWarningAsync($"{logPrefix} Free of address {rawTraceEntry.Param2:x16} does not correspond to any heap allocation, skipping").Wait();
                             break;
                         }
 
-                        // Create entry
-                        var entry = new HeapFree
+                        case RawTraceEntryTypes.HeapAllocAddressReturn:
                         {
-                            Id = allocationEntry.Id
-                        };
-                        entry.Store(traceFileWriter);
+                            // Catch double returns of the same allocated address (happens for some allocator implementations)
+                            if(rawTraceEntry.Param2 == lastAllocReturnAddress && !encounteredSizeSinceLastAlloc)
+                            {
+                                Logger.LogDebugAsync($"{logPrefix} Skipped double return of allocated address").Wait();
+                                break;
+                            }
 
-                        // Remove entry from allocation list
-                        heapAllocationLookup.Remove(allocationEntry.Address);
+                            // HeapAllocation stack empty?
+                            if(lastAllocationSizes.Count == 0)
+                            {
+                                Logger.LogErrorAsync($"{logPrefix} Encountered heap allocation address return, but size stack is empty").Wait();
+                                break;
+                            }
 
-                        break;
-                    }
+                            uint size = lastAllocationSizes.Pop();
 
-                    case RawTraceEntryTypes.StackPointerInfo:
-                    {
-                        // Save stack pointer data
-                        _stackPointerMin = rawTraceEntry.Param1;
-                        _stackPointerMax = rawTraceEntry.Param2;
-                        Logger.LogDebugAsync($"{logPrefix} Stack pointer info: {_stackPointerMin:x16}..{_stackPointerMax:x16}");
-
-                        // HACK See comment below
-                        if(stackFrames.Count == 0)
-                        {
-                            stackFrames.Add((nextStackAllocationId, _stackPointerMin));
-                            var entry = new StackAllocation
+                            // Create entry
+                            var entry = new HeapAllocation
                             {
-                                Id = nextStackAllocationId++,
-                                InstructionImageId = _imageFiles.First().Id,
-                                InstructionRelativeAddress = 0,
-                                Size = (uint)(_stackPointerMax - _stackPointerMin),
-                                Address = _stackPointerMin
+                                Id = nextHeapAllocationId++,
+                                Size = size,
+                                Address = rawTraceEntry.Param2
                             };
                             entry.Store(traceFileWriter);
-                        }
 
-                        break;
-                    }
+                            // Store allocation information
+                            // The new block may shadow the cached one
+                            heapAllocationLookup.Add(entry);
+                            lastHitAllocation = null;
 
-                    case RawTraceEntryTypes.StackPointerModification:
-                    {
-                        // TODO This is disabled for now. Problem: A function without any call instructions may never explicitly allocate a stack frame,
-                        //      because it doesn't need to ("red zone"). It can just use the empty stack space. However, this breaks the assumption of
-                        //      our stack frame tracking: We can't determine a minimum "base address" for stack frame, but have to use the stack pointer
-                        //      at the time of the call/ret instruction. This in turn means that stack memory accesses need to support negative offsets.
-                        //      For the time being, we just generate a single dummy stack frame and ignore all other stack pointer data.
-
-                        /*
-                         * To reduce overhead and complexity, we focus on the "easy" and most likely cases:
-                         * (STACKMOD marks a StackPointerModification trace entry)
-                         *
-                         *     call func       ; STACKMOD - new <stack frame #x+1> with the return address (and possible arguments on the stack)
-                         *
-                         *   func:
-                         *     push r15        ; ignored
-                         *     sub rsp, 0x20   ; STACKMOD - new <stack frame #x+2> which includes the pushed register
-                         *     ...
-                         *     add rsp, 0x20   ; STACKMOD - new temporary <stack frame #x+3> which only includes the pushed register;
-                         *                     ;   will get discarded with the next call instruction, so this causes no harm
-                         *     pop r15         ; ignored
-                         *     ret             ; STACKMOD - end of <stack frame #x+1>; if there are arguments on the stack, there may be allocation of
-                         *                     ;   temporary <stack frame #x+4>. This causes no harm, as this scenario (lots of arguments) is unlikely
-                         *
-                         * -- OR --
-                         *
-                         *     call func       ; STACKMOD - new <stack frame #x+1> with the return address (and possible arguments on the stack)
-                         *
-                         *   func:
-                         *     sub rsp, 0x20   ; STACKMOD - new <stack frame #x+2>
-                         *     ...
-                         *     ret 0x20        ; STACKMOD - full deallocation of <stack frame #x+2> and <stack frame #x+1>, <stack frame #x> is back on top, or
-                         *                     ;   creation of temporary <stack frame #x+3> if there are arguments on the stack
-                         *
-                         * The temporary stack frames usually get quietly discarded, as push/pop instructions are ignored and there will probably be no
-                         * other direct accesses to that areas.
-                         */
-
-                        /*
-                        // Remove all addresses from stack frame list which are strictly smaller than the new one
-                        // We assume that an instruction never accesses addresses which are _before_ (i.e. smaller than) the current stack frame
-                        ulong newStackPointerValue = rawTraceEntry.Param2;
-                        while(stackFrames.Count > 0 && stackFrames[^1].baseAddress < newStackPointerValue)
-                        {
-                            stackFrames.RemoveAt(stackFrames.Count - 1);
+                            // Update state
+                            lastAllocReturnAddress = entry.Address;
+                            encounteredSizeSinceLastAlloc = false;
+
+                            break;
                         }
 
-                        // The new address is the top most stack frame
-                        if(stackFrames.Count == 0 || stackFrames[^1].baseAddress != newStackPointerValue)
+                        case RawTraceEntryTypes.HeapFreeAddressParameter:
                         {
-                            // Resolve allocating instruction
-                            var (instructionImageId, instructionImage) = FindImage(rawTraceEntry.Param1);
-                            if(instructionImageId < 0)
+                            // Skip nonsense frees
+                            if(rawTraceEntry.Param2 == 0)
+                                break;
+                            if(!heapAllocationLookup.TryGetValue(rawTraceEntry.Param2, out var allocationEntry))
                             {
-                                Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of instruction {rawTraceEntry.Param1:x16}, skipping").Wait();
+                                // Reasons why this may happen:
+                                // - We missed a heap allocation (unknown function, missed heap allocation address return due to tail call, ...)
+                                // - The allocation was within the prefix or another trace. Due to parallelism we do not carry over allocations from preceding traces
+                                Logger.LogWarningAsync($"{logPrefix} Free of address {rawTraceEntry.Param2:x16} does not correspond to any heap allocation, skipping").Wait();
                                 break;
                             }
 
-                            // Create trace entry
-                            var entry = new StackAllocation
+                            // Create entry
+                            var entry = new HeapFree
                             {
-                                Id = nextStackAllocationId++,
-                                InstructionImageId = instructionImageId,
-                                InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage!.StartAddress),
-                                Size = (uint)(stackFrames.Count == 0 ? _stackPointerMax - newStackPointerValue : stackFrames[^1].baseAddress - newStackPointerValue),
-                                Address = newStackPointerValue
+                                Id = allocationEntry.Id
                             };
                             entry.Store(traceFileWriter);
 
-                            stackFrames.Add((entry.Id, newStackPointerValue));
-                        }
-                        */
-
-                        /*
-                        // NOTE The instruction type flag is ignored right now, as the stack pointer tracking technique does not depend on it.
-                        //      It may be used to do more fine granular tracking, or for inferring which kind of data is contained in the allocation blocks.
-                        var flags = (RawTraceStackPointerModificationEntryFlags)rawTraceEntry.Flag;
-                        var instructionType = flags & RawTraceStackPointerModificationEntryFlags.InstructionTypeMask;
-                        if(instructionType == RawTraceStackPointerModificationEntryFlags.PushOrPop)
-                        {
+                            // Remove entry from allocation list
+                            heapAllocationLookup.Remove(allocationEntry.Address);
+                            lastHitAllocation = null;
 
+                            break;
                         }
-                        else if(instructionType == RawTraceStackPointerModificationEntryFlags.Return)
-                        {
 
-                        }
-                        else if(instructionType == RawTraceStackPointerModificationEntryFlags.Other)
+                        case RawTraceEntryTypes.StackPointerInfo:
                         {
+                            // Save stack pointer data
+                            stackPointerMin = rawTraceEntry.Param1;
+                            stackPointerMax = rawTraceEntry.Param2;
+                            Logger.LogDebugAsync($"{logPrefix} Stack pointer info: {stackPointerMin:x16}..{stackPointerMax:x16}");
 
-                        }
-                        */
-
-                        break;
-                    }
+                            // HACK See comment below
+                            if(stackFrames.Count == 0)
+                            {
+                                stackFrames.Add((nextStackAllocationId, stackPointerMin));
+                                var entry = new StackAllocation
+                                {
+                                    Id = nextStackAllocationId++,
+                                    InstructionImageId = prefix.ImageFiles.First().Id,
+                                    InstructionRelativeAddress = 0,
+                                    Size = (uint)(stackPointerMax - stackPointerMin),
+                                    Address = stackPointerMin
+                                };
+                                entry.Store(traceFileWriter);
+                            }
 
-                    case RawTraceEntryTypes.Branch when !isPrefix:
-                    {
-                        // Find image of source and destination instruction
-                        var (sourceImageId, sourceImage) = FindImage(rawTraceEntry.Param1);
-                        var (destinationImageId, destinationImage) = FindImage(rawTraceEntry.Param2);
-                        if(sourceImageId < 0 || destinationImageId < 0)
-                        {
-                            Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of branch {rawTraceEntry.Param1:x16} -> {rawTraceEntry.Param2:x16}, skipping").Wait();
                             break;
                         }
 
-                        // Interesting?
-                        if(!sourceImage!.Interesting && !destinationImage!.Interesting)
-                            break;
-
-                        // Create entry
-                        var flags = (RawTraceBranchEntryFlags)rawTraceEntry.Flag;
-                        var entry = new Branch
+                        case RawTraceEntryTypes.StackPointerModification:
                         {
-                            SourceImageId = sourceImageId,
-                            SourceInstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - sourceImage.StartAddress),
-                            DestinationImageId = destinationImageId,
-                            DestinationInstructionRelativeAddress = (uint)(rawTraceEntry.Param2 - destinationImage!.StartAddress),
-                            Taken = (flags & RawTraceBranchEntryFlags.Taken) != 0
-                        };
-                        var rawBranchType = flags & RawTraceBranchEntryFlags.BranchEntryTypeMask;
-                        if(rawBranchType == RawTraceBranchEntryFlags.Jump)
-                            entry.BranchType = Branch.BranchTypes.Jump;
-                        else if(rawBranchType == RawTraceBranchEntryFlags.Call)
-                            entry.BranchType = Branch.BranchTypes.Call;
-                        else if(rawBranchType == RawTraceBranchEntryFlags.Return)
-                            entry.BranchType = Branch.BranchTypes.Return;
-                        else
-                        {
-                            Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on branch {rawTraceEntry.Param1:x16} -> {rawTraceEntry.Param2:x16}, skipping").Wait();
-                            break;
-                        }
+                            // TODO This is disabled for now. Problem: A function without any call instructions may never explicitly allocate a stack frame,
+                            //      because it doesn't need to ("red zone"). It can just use the empty stack space. However, this breaks the assumption of
+                            //      our stack frame tracking: We can't determine a minimum "base address" for stack frame, but have to use the stack pointer
+                            //      at the time of the call/ret instruction. This in turn means that stack memory accesses need to support negative offsets.
+                            //      For the time being, we just generate a single dummy stack frame and ignore all other stack pointer data.
+
+                            /*
+                             * To reduce overhead and complexity, we focus on the "easy" and most likely cases:
+                             * (STACKMOD marks a StackPointerModification trace entry)
+                             *
+                             *     call func       ; STACKMOD - new <stack frame #x+1> with the return address (and possible arguments on the stack)
+                             *
+                             *   func:
+                             *     push r15        ; ignored
+                             *     sub rsp, 0x20   ; STACKMOD - new <stack frame #x+2> which includes the pushed register
+                             *     ...
+                             *     add rsp, 0x20   ; STACKMOD - new temporary <stack frame #x+3> which only includes the pushed register;
+                             *                     ;   will get discarded with the next call instruction, so this causes no harm
+                             *     pop r15         ; ignored
+                             *     ret             ; STACKMOD - end of <stack frame #x+1>; if there are arguments on the stack, there may be allocation of
+                             *                     ;   temporary <stack frame #x+4>. This causes no harm, as this scenario (lots of arguments) is unlikely
+                             *
+                             * -- OR --
+                             *
+                             *     call func       ; STACKMOD - new <stack frame #x+1> with the return address (and possible arguments on the stack)
+                             *
+                             *   func:
+                             *     sub rsp, 0x20   ; STACKMOD - new <stack frame #x+2>
+                             *     ...
+                             *     ret 0x20        ; STACKMOD - full deallocation of <stack frame #x+2> and <stack frame #x+1>, <stack frame #x> is back on top, or
+                             *                     ;   creation of temporary <stack frame #x+3> if there are arguments on the stack
+                             *
+                             * The temporary stack frames usually get quietly discarded, as push/pop instructions are ignored and there will probably be no
+                             * other direct accesses to that areas.
+                             */
+
+                            /*
+                            // Remove all addresses from stack frame list which are strictly smaller than the new one
+                            // We assume that an instruction never accesses addresses which are _before_ (i.e. smaller than) the current stack frame
+                            ulong newStackPointerValue = rawTraceEntry.Param2;
+                            while(stackFrames.Count > 0 && stackFrames[^1].baseAddress < newStackPointerValue)
+                            {
+                                stackFrames.RemoveAt(stackFrames.Count - 1);
+                            }
 
-                        entry.Store(traceFileWriter);
+                            // The new address is the top most stack frame
+                            if(stackFrames.Count == 0 || stackFrames[^1].baseAddress != newStackPointerValue)
+                            {
+                                // Resolve allocating instruction
+                                var (instructionImageId, instructionImage) = FindImage(prefix.ImageFilesByAddress, ref lastHitImage, rawTraceEntry.Param1);
+                                if(instructionImageId < 0)
+                                {
+                                    Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of instruction {rawTraceEntry.Param1:x16}, skipping").Wait();
+                                    break;
+                                }
 
-                        break;
-                    }
+                                // Create trace entry
+                                var entry = new StackAllocation
+                                {
+                                    Id = nextStackAllocationId++,
+                                    InstructionImageId = instructionImageId,
+                                    InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage!.StartAddress),
+                                    Size = (uint)(stackFrames.Count == 0 ? stackPointerMax - newStackPointerValue : stackFrames[^1].baseAddress - newStackPointerValue),
+                                    Address = newStackPointerValue
+                                };
+                                entry.Store(traceFileWriter);
 
-                    case RawTraceEntryTypes.MemoryRead when !isPrefix:
-                    case RawTraceEntryTypes.MemoryWrite when !isPrefix:
-                    {
-                        // Find image of instruction
-                        var (instructionImageId, instructionImage) = FindImage(rawTraceEntry.Param1);
-                        if(instructionImageId < 0)
-                        {
-                            Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of instruction {rawTraceEntry.Param1:x16}, skipping").Wait();
-                            break;
-                        }
+                                stackFrames.Add((entry.Id, newStackPointerValue));
+                            }
+                            */
+
+                            /*
+                            // NOTE The instruction type flag is ignored right now, as the stack pointer tracking technique does not depend on it.
+                            //      It may be used to do more fine granular tracking, or for inferring which kind of data is contained in the allocation blocks.
+                            var flags = (RawTraceStackPointerModificationEntryFlags)rawTraceEntry.Flag;
+                            var instructionType = flags & RawTraceStackPointerModificationEntryFlags.InstructionTypeMask;
+                            if(instructionType == RawTraceStackPointerModificationEntryFlags.PushOrPop)
+                            {
 
-                        // Interesting?
-                        if(!instructionImage!.Interesting)
-                            break;
+                            }
+                            else if(instructionType == RawTraceStackPointerModificationEntryFlags.Return)
+                            {
 
-                        // Resolve access location: Image, stack or heap?
-                        bool isWrite = rawTraceEntry.Type == RawTraceEntryTypes.MemoryWrite;
-                        if(_stackPointerMin <= rawTraceEntry.Param2 && rawTraceEntry.Param2 <= _stackPointerMax)
-                        {
-                            // Find stack allocation
-                            int stackAllocationId = -1;
-                            ulong relativeAddress = 0;
-                            bool stackFrameFound = false;
-                            for(int i = stackFrames.Count - 1; i >= 0; --i)
+                            }
+                            else if(instructionType == RawTraceStackPointerModificationEntryFlags.Other)
                             {
-                                var currentStackFrame = stackFrames[i];
-                                if(rawTraceEntry.Param2 >= currentStackFrame.baseAddress)
-                                {
-                                    // Check next stack frame
-                                    if(i == 0 || stackFrames[i - 1].baseAddress > rawTraceEntry.Param2)
-                                    {
-                                        // We've found our allocation
-                                        stackAllocationId = currentStackFrame.id;
-                                        relativeAddress = rawTraceEntry.Param2 - currentStackFrame.baseAddress;
-                                        stackFrameFound = true;
 
-                                        break;
-                                    }
-                                }
                             }
+                            */
 
-                            if(!stackFrameFound)
-                            {
-                                Logger.LogWarningAsync($"{logPrefix} Could not resolve stack frame of stack memory access {rawTraceEntry.Param1:x16} -> [{rawTraceEntry.Param2:x16}] ({(isWrite ? "write" : "read")}), skipping")
-                                    .Wait();
+                            break;
+                        }
 
+                        case RawTraceEntryTypes.Branch when !isPrefix:
+                        {
+                            // Find image of source and destination instruction
+                            var (sourceImageId, sourceImage) = FindImage(prefix.ImageFilesByAddress, ref lastHitImage, rawTraceEntry.Param1);
+                            var (destinationImageId, destinationImage) = FindImage(prefix.ImageFilesByAddress, ref lastHitImage, rawTraceEntry.Param2);
+                            if(sourceImageId < 0 || destinationImageId < 0)
+                            {
+                                Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of branch {rawTraceEntry.Param1:x16} -> {rawTraceEntry.Param2:x16}, skipping").Wait();
                                 break;
                             }
 
-                            var entry = new StackMemoryAccess
+                            // Interesting?
+                            if(!sourceImage!.Interesting && !destinationImage!.Interesting)
+                                break;
+
+                            // Create entry
+                            var flags = (RawTraceBranchEntryFlags)rawTraceEntry.Flag;
+                            var entry = new Branch
                             {
-                                IsWrite = isWrite,
-                                Size = rawTraceEntry.Param0,
-                                InstructionImageId = instructionImageId,
-                                InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress),
-                                StackAllocationBlockId = stackAllocationId,
-                                MemoryRelativeAddress = (uint)relativeAddress
+                                SourceImageId = sourceImageId,
+                                SourceInstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - sourceImage.StartAddress),
+                                DestinationImageId = destinationImageId,
+                                DestinationInstructionRelativeAddress = (uint)(rawTraceEntry.Param2 - destinationImage!.StartAddress),
+                                Taken = (flags & RawTraceBranchEntryFlags.Taken) != 0
                             };
+                            var rawBranchType = flags & RawTraceBranchEntryFlags.BranchEntryTypeMask;
+                            if(rawBranchType == RawTraceBranchEntryFlags.Jump)
+                                entry.BranchType = Branch.BranchTypes.Jump;
+                            else if(rawBranchType == RawTraceBranchEntryFlags.Call)
+                                entry.BranchType = Branch.BranchTypes.Call;
+                            else if(rawBranchType == RawTraceBranchEntryFlags.Return)
+                                entry.BranchType = Branch.BranchTypes.Return;
+                            else
+                            {
+                                Logger.LogErrorAsync($"{logPrefix} Unspecified instruction type on branch {rawTraceEntry.Param1:x16} -> {rawTraceEntry.Param2:x16}, skipping").Wait();
+                                break;
+                            }
+
                             entry.Store(traceFileWriter);
+
+                            break;
                         }
-                        else
+
+                        case RawTraceEntryTypes.MemoryRead when !isPrefix:
+                        case RawTraceEntryTypes.MemoryWrite when !isPrefix:
                         {
-                            // Image
-                            var (accessedImageId, accessedImage) = FindImage(rawTraceEntry.Param2);
-                            if(accessedImageId >= 0)
+                            // Find image of instruction
+                            var (instructionImageId, instructionImage) = FindImage(prefix.ImageFilesByAddress, ref lastHitImage, rawTraceEntry.Param1);
+                            if(instructionImageId < 0)
                             {
-                                var entry = new ImageMemoryAccess
-                                {
-                                    IsWrite = isWrite,
-                                    Size = rawTraceEntry.Param0,
-                                    InstructionImageId = instructionImageId,
-                                    InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress),
-                                    MemoryImageId = accessedImageId,
-                                    MemoryRelativeAddress = (uint)(rawTraceEntry.Param2 - accessedImage!.StartAddress)
-                                };
-                                entry.Store(traceFileWriter);
+                                Logger.LogWarningAsync($"{logPrefix} Could not resolve image information of instruction {rawTraceEntry.Param1:x16}, skipping").Wait();
+                                break;
                             }
-                            else
+
+                            // Interesting?
+                            if(!instructionImage!.Interesting)
+                                break;
+
+                            // Resolve access location: Image, stack or heap?
+                            bool isWrite = rawTraceEntry.Type == RawTraceEntryTypes.MemoryWrite;
+                            if(stackPointerMin <= rawTraceEntry.Param2 && rawTraceEntry.Param2 <= stackPointerMax)
                             {
-                                // Heap
-                                var (allocationBlockId, allocationBlock) = FindAllocation(heapAllocationLookup, rawTraceEntry.Param2);
-                                if(allocationBlockId < 0)
-                                    (allocationBlockId, allocationBlock) = FindAllocation(_tracePrefixHeapAllocationLookup!, rawTraceEntry.Param2);
-                                if(allocationBlockId < 0)
+                                // Find stack allocation
+                                int stackAllocationId = -1;
+                                ulong relativeAddress = 0;
+                                bool stackFrameFound = false;
+                                for(int i = stackFrames.Count - 1; i >= 0; --i)
+                                {
+                                    var currentStackFrame = stackFrames[i];
+                                    if(rawTraceEntry.Param2 >= currentStackFrame.baseAddress)
+                                    {
+                                        // Check next stack frame
+                                        if(i == 0 || stackFrames[i - 1].baseAddress > rawTraceEntry.Param2)
+                                        {
+                                            // We've found our allocation
+                                            stackAllocationId = currentStackFrame.id;
+                                            relativeAddress = rawTraceEntry.Param2 - currentStackFrame.baseAddress;
+                                            stackFrameFound = true;
+
+                                            break;
+                                        }
+                                    }
+                                }
+
+                                if(!stackFrameFound)
                                 {
-                                    Logger.LogWarningAsync($"{logPrefix} Could not resolve target of memory access {rawTraceEntry.Param1:x16} -> [{rawTraceEntry.Param2:x16}] ({(isWrite ? "write" : "read")}), skipping").Wait();
+                                    Logger.LogWarningAsync($"{logPrefix} Could not resolve stack frame of stack memory access {rawTraceEntry.Param1:x16} -> [{rawTraceEntry.Param2:x16}] ({(isWrite ? "write" : "read")}), skipping")
+                                        .Wait();
+
                                     break;
                                 }
 
-                                var entry = new HeapMemoryAccess
+                                var entry = new StackMemoryAccess
                                 {
                                     IsWrite = isWrite,
                                     Size = rawTraceEntry.Param0,
                                     InstructionImageId = instructionImageId,
                                     InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress),
-                                    HeapAllocationBlockId = allocationBlockId,
-                                    MemoryRelativeAddress = (uint)(rawTraceEntry.Param2 - allocationBlock!.Address)
+                                    StackAllocationBlockId = stackAllocationId,
+                                    MemoryRelativeAddress = (uint)relativeAddress
                                 };
                                 entry.Store(traceFileWriter);
                             }
-                        }
+                            else
+                            {
+                                // Image
+                                var (accessedImageId, accessedImage) = FindImage(prefix.ImageFilesByAddress, ref lastHitImage, rawTraceEntry.Param2);
+                                if(accessedImageId >= 0)
+                                {
+                                    var entry = new ImageMemoryAccess
+                                    {
+                                        IsWrite = isWrite,
+                                        Size = rawTraceEntry.Param0,
+                                        InstructionImageId = instructionImageId,
+                                        InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress),
+                                        MemoryImageId = accessedImageId,
+                                        MemoryRelativeAddress = (uint)(rawTraceEntry.Param2 - accessedImage!.StartAddress)
+                                    };
+                                    entry.Store(traceFileWriter);
+                                }
+                                else
+                                {
+                                    // Heap
+                                    var (allocationBlockId, allocationBlock) = FindAllocation(heapAllocationLookup, prefix.HeapAllocationLookup!, ref lastHitAllocation, rawTraceEntry.Param2);
+                                    if(allocationBlockId < 0)
+                                    {
+                                        Logger.LogWarningAsync($"{logPrefix} Could not resolve target of memory access {rawTraceEntry.Param1:x16} -> [{rawTraceEntry.Param2:x16}] ({(isWrite ? "write" : "read")}), skipping").Wait();
+                                        break;
+                                    }
+
+                                    var entry = new HeapMemoryAccess
+                                    {
+                                        IsWrite = isWrite,
+                                        Size = rawTraceEntry.Param0,
+                                        InstructionImageId = instructionImageId,
+                                        InstructionRelativeAddress = (uint)(rawTraceEntry.Param1 - instructionImage.StartAddress),
+                                        HeapAllocationBlockId = allocationBlockId,
+                                        MemoryRelativeAddress = (uint)(rawTraceEntry.Param2 - allocationBlock!.Address)
+                                    };
+                                    entry.Store(traceFileWriter);
+                                }
+                            }
 
-                        break;
+                            break;
+                        }
                     }
                 }
+
+                // An incomplete entry at the end of the chunk is continued in the next one
+                rawTraceChunkReader.SetUnconsumedLength((int)(chunkLength - rawTraceReader.Position));
             }
         }
 
         // Create trace file object
-        if(isPrefix)
+        allocationState.NextHeapAllocationId = nextHeapAllocationId;
+        allocationState.NextStackAllocationId = nextStackAllocationId;
+        if(isPrefix && !isThreadTrace)
         {
-            _tracePrefixHeapAllocationLookup = heapAllocationLookup;
-            _tracePrefixStackFrames = stackFrames;
-            _tracePrefixLastHeapAllocationId = nextHeapAllocationId - 1;
-            _tracePrefixLastStackAllocationId = nextStackAllocationId - 1;
+            prefix.StackFrames = stackFrames;
+            prefix.StackPointerMin = stackPointerMin;
+            prefix.StackPointerMax = stackPointerMax;
         }
     }
 
     /// <summary>
-    /// Finds the image that contains the given address and returns its ID, or -1 if the image is not found.
+    /// Sorts the given trace files of secondary threads by the thread ID in their file names ("t5_3.trace" or "prefix_3.trace").
     /// </summary>
-    /// <param name="address">The address to be searched.</param>
-    /// <returns></returns>
-    private (int, TracePrefixFile.ImageFileInfo?) FindImage(ulong address)
+    /// <param name="threadTraceFilePaths">Trace file paths.</param>
+    private static List<string> OrderByThreadId(IEnumerable<string> threadTraceFilePaths)
     {
-        // Find image by linear search; the image count is expected to be rather small
-        // Images are sorted by "interesting" status, to reduce number of loop iterations
-        // TODO Improve this further - maybe by counting hits and then sorting after processing the first non-prefix trace?
-        foreach(var img in _imageFiles)
+        return threadTraceFilePaths.OrderBy(path =>
         {
-            if(img.StartAddress <= address)
-            {
-                // Check end address
-                if(img.EndAddress >= address)
-                    return (img.Id, img);
-            }
-        }
-
-        return (-1, null);
+            string fileName = Path.GetFileNameWithoutExtension(path);
+            return int.TryParse(fileName[(fileName.LastIndexOf('_') + 1)..], out int threadId) ? threadId : int.MaxValue;
+        }).ToList();
     }
 
     /// <summary>
-    /// Finds the allocation block that contains the given address and returns its ID, or -1 if the block is not found.
+    /// Finds the image that contains the given address and returns its ID, or -1 if the image is not found.
     /// </summary>
-    /// <param name="allocationLookup">List containing all heap allocations, sorted by start address in ascending order.</param>
+    /// <param name="imageFilesByAddress">The images of the current trace prefix, sorted by start address in ascending order.</param>
+    /// <param name="lastHitImage">The image found by the previous call, which is checked first. Is updated when another image is found.</param>
     /// <param name="address">The address to be searched.</param>
     /// <returns></returns>
-    private (int, HeapAllocation?) FindAllocation(SortedList<ulong, HeapAllocation> allocationLookup, ulong address)
+    private static (int, TracePrefixFile.ImageFileInfo?) FindImage(TracePrefixFile.ImageFileInfo[] imageFilesByAddress, ref TracePrefixFile.ImageFileInfo? lastHitImage, ulong address)
     {
-        // Use binary search to find allocation block with start address <= address
-        var startAddresses = allocationLookup.Keys;
+        // Consecutive lookups usually hit the same image
+        if(lastHitImage != null && lastHitImage.StartAddress <= address && address <= lastHitImage.EndAddress)
+            return (lastHitImage.Id, lastHitImage);
+
+        // Use binary search to find image with start address <= address
         int left = 0;
-        int right = startAddresses.Count - 1;
-        int index = -1;
-        bool found = false;
+        int right = imageFilesByAddress.Length - 1;
         while(left <= right)
         {
-            index = left + ((right - left) / 2);
-            ulong startAddress = startAddresses[index];
-            if(startAddress == address)
-            {
-                found = true;
-                break;
-            }
-            else if(startAddress < address)
+            int index = left + ((right - left) / 2);
+            if(imageFilesByAddress[index].StartAddress <= address)
                 left = index + 1;
             else
                 right = index - 1;
         }
 
-        if(!found)
-            index = left - 1;
-        if(index < 0)
-            return (-1, default);
+        if(left == 0)
+            return (-1, null);
 
         // Check end address
-        var block = allocationLookup[startAddresses[index]];
-        if(address <= (block.Address + block.Size))
-            return (block.Id, block);
-        return (-1, default);
+        var img = imageFilesByAddress[left - 1];
+        if(address > img.EndAddress)
+            return (-1, null);
+
+        lastHitImage = img;
+        return (img.Id, img);
+    }
+
+    /// <summary>
+    /// Finds the allocation block that contains the given address and returns its ID, or -1 if the block is not found.
+    /// Allocations of the current trace take precedence over the ones of the trace prefix.
+    /// </summary>
+    /// <param name="allocationLookup">Heap allocations of the current trace.</param>
+    /// <param name="prefixAllocationLookup">Heap allocations of the trace prefix.</param>
+    /// <param name="lastHitAllocation">
+    /// The allocation block found by the previous call, which is checked first. Is updated when another block is found.
+    /// Must be reset when the allocation lookup of the current trace is modified.
+    /// </param>
+    /// <param name="address">The address to be searched.</param>
+    /// <returns></returns>
+    private static (int, HeapAllocation?) FindAllocation(HeapAllocationIndex allocationLookup, HeapAllocationIndex prefixAllocationLookup, ref HeapAllocation? lastHitAllocation, ulong address)
+    {
+        // Consecutive accesses usually hit the same block
+        if(lastHitAllocation != null && lastHitAllocation.Address <= address && address <= lastHitAllocation.Address + lastHitAllocation.Size)
+            return (lastHitAllocation.Id, lastHitAllocation);
+
+        var block = allocationLookup.Find(address) ?? prefixAllocationLookup.Find(address);
+        if(block == null)
+            return (-1, default);
+
+        lastHitAllocation = block;
+        return (block.Id, block);
     }
 
     protected override Task InitAsync(MappingNode? moduleOptions)
@@ -665,6 +800,7 @@ public class PinTracePreprocessor : PreprocessorStage
         if(_storeTraces && outputDirectoryPath == null)
             throw new ConfigurationException("Missing output directory for preprocessed traces.");
         _keepRawTraces = moduleOptions?.GetChildNodeOrDefault("keep-raw-traces")?.AsBoolean() ?? false;
+        _mergeThreadTraces = moduleOptions?.GetChildNodeOrDefault("merge-thread-traces")?.AsBoolean() ?? true;
 
         return Task.CompletedTask;
     }
@@ -674,6 +810,96 @@ public class PinTracePreprocessor : PreprocessorStage
         return Task.CompletedTask;
     }
 
+    /// <summary>
+    /// Data about a trace prefix, which is needed for preprocessing the subsequent traces.
+    /// </summary>
+    private class TracePrefixState
+    {
+        /// <summary>
+        /// Trace prefix data.
+        /// </summary>
+        public TracePrefixFile TracePrefix { get; set; } = null!;
+
+        /// <summary>
+        /// Metadata about loaded images (is also assigned to the prefix file). Interesting images come first.
+        /// </summary>
+        public TracePrefixFile.ImageFileInfo[] ImageFiles { get; set; } = null!;
+
+        /// <summary>
+        /// Metadata about loaded images, sorted by image start address in ascending order.
+        /// </summary>
+        public TracePrefixFile.ImageFileInfo[] ImageFilesByAddress { get; set; } = null!;
+
+        /// <summary>
+        /// The raw image metadata lines from the trace prefix.
+        /// </summary>
+        public string[] ImageDataLines { get; set; } = null!;
+
+        /// <summary>
+        /// The minimum stack pointer value (set when reading the prefix).
+        /// </summary>
+        public ulong StackPointerMin { get; set; } = 0xFFFF_FFFF_FFFF_FFFFUL;
+
+        /// <summary>
+        /// The maximum stack pointer value (set when reading the prefix).
+        /// </summary>
+        public ulong StackPointerMax { get; set; } = 0x0000_0000_0000_0000UL;
+
+        /// <summary>
+        /// Heap allocation information from the trace prefix, indexed by start address.
+        /// </summary>
+        public HeapAllocationIndex? HeapAllocationLookup { get; set; }
+
+        /// <summary>
+        /// Stack frames from the trace prefix.
+        /// This list is used as a stack, where the highest index contains the most recent stack frame (i.e. the stack frame with the lowest base address).
+        /// The current stack frame list for each trace is initialized with this list.
+        /// </summary>
+        public List<(int id, ulong baseAddress)>? StackFrames { get; set; }
+
+        /// <summary>
+        /// The last heap allocation ID used by the trace prefix.
+        /// </summary>
+        public int LastHeapAllocationId { get; set; }
+
+        /// <summary>
+        /// The last stack allocation ID used by the trace prefix.
+        /// </summary>
+        public int LastStackAllocationId { get; set; }
+    }
+
+    /// <summary>
+    /// Heap and stack allocation state, which is carried over between the traces of the different threads of a testcase.
+    /// </summary>
+    private class TraceAllocationState
+    {
+        /// <summary>
+        /// Heap allocations, indexed by start address.
+        /// </summary>
+        public HeapAllocationIndex HeapAllocationLookup { get; } = new();
+
+        /// <summary>
+        /// The next heap allocation ID.
+        /// </summary>
+        public int NextHeapAllocationId { get; set; }
+
+        /// <summary>
+        /// The next stack allocation ID.
+        /// </summary>
+        public int NextStackAllocationId { get; set; }
+
+        /// <summary>
+        /// Creates a new allocation state.
+        /// </summary>
+        /// <param name="nextHeapAllocationId">The first heap allocation ID.</param>
+        /// <param name="nextStackAllocationId">The first stack allocation ID.</param>
+        public TraceAllocationState(int nextHeapAllocationId, int nextStackAllocationId)
+        {
+            NextHeapAllocationId = nextHeapAllocationId;
+            NextStackAllocationId = nextStackAllocationId;
+        }
+    }
+
     /// <summary>
     /// One trace entry, as present in the trace files.
     /// </summary>
@@ -713,6 +939,19 @@ public class PinTracePreprocessor : PreprocessorStage
         /// Used with: MemoryRead, MemoryWrite, HeapAllocAddressReturn, HeapFreeAddressParameter, Branch, StackPointerInfo.
         /// </summary>
         public readonly ulong Param2;
+
+        /// <summary>
+        /// Creates a new trace entry, e.g. when decoding a compact trace file.
+        /// </summary>
+        public RawTraceEntry(RawTraceEntryTypes type, byte flag, short param0, ulong param1, ulong param2)
+        {
+            Type = type;
+            Flag = flag;
+            _padding1 = 0;
+            Param0 = param0;
+            Param1 = param1;
+            Param2 = param2;
+        }
     }
 
     /// <summary>
@@ -758,7 +997,19 @@ public class PinTracePreprocessor : PreprocessorStage
         /// <summary>
         /// A modification of the stack pointer.
         /// </summary>
-        StackPointerModification = 8
+        StackPointerModification = 8,
+
+        /// <summary>
+        /// The static memory accesses of a basic block, which are followed by the respective memory access entries (without memory address).
+        /// This is resolved by <see cref="RawTraceReader"/>.
+        /// </summary>
+        BlockDefinition = 9,
+
+        /// <summary>
+        /// The memory addresses accessed by one execution of a basic block, packed into the following entries.
+        /// This is resolved by <see cref="RawTraceReader"/>.
+        /// </summary>
+        BlockMemoryAccesses = 10
     }
 
     /// <summary>
@@ -0,0 +1,299 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.IO;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Reads a raw Pin trace file chunk by chunk. The trace may also be passed as an in-memory buffer.
+/// Compressed trace files are decompressed frame by frame while reading; uncompressed trace files are read in chunks of bounded size, so
+/// memory usage does not depend on the trace length.
+/// Chunks may end in the middle of an entry: The caller reports the length of the incomplete tail via <see cref="SetUnconsumedLength"/>, and
+/// these bytes are then returned again at the beginning of the next chunk.
+/// </summary>
+internal class RawTraceChunkReader : IDisposable
+{
+    /// <summary>
+    /// Magic number at the beginning of compressed trace files ("MWCZ").
+    /// </summary>
+    private const uint CompressedTraceMagic = 0x5A43574D;
+
+    /// <summary>
+    /// Supported version of the compressed trace container.
+    /// </summary>
+    private const uint CompressedTraceVersion = 1;
+
+    /// <summary>
+    /// Size of the compressed trace file header and of the frame headers.
+    /// </summary>
+    private const int HeaderSize = 8;
+
+    /// <summary>
+    /// Minimum length of an LZ4 match.
+    /// </summary>
+    private const int Lz4MinMatch = 4;
+
+    /// <summary>
+    /// Size of the chunks which are read from uncompressed trace files.
+    /// </summary>
+    private const int UncompressedChunkSize = 4 * 1024 * 1024;
+
+    /// <summary>
+    /// The trace data stream.
+    /// </summary>
+    private readonly Stream _inputStream;
+
+    /// <summary>
+    /// Determines whether the trace file is compressed.
+    /// </summary>
+    private readonly bool _compressed;
+
+    /// <summary>
+    /// Determines whether the in-memory trace data has already been returned.
+    /// </summary>
+    private bool _inMemoryDataRead;
+
+    /// <summary>
+    /// Length of the last returned chunk.
+    /// </summary>
+    private int _chunkLength;
+
+    /// <summary>
+    /// Number of bytes at the end of the last returned chunk which have not been consumed yet.
+    /// </summary>
+    private int _unconsumedLength;
+
+    /// <summary>
+    /// Buffer for the decompressed frame data.
+    /// </summary>
+    private byte[] _chunkBuffer = Array.Empty<byte>();
+
+    /// <summary>
+    /// Buffer for the compressed frame data.
+    /// </summary>
+    private byte[] _compressedBuffer = Array.Empty<byte>();
+
+    /// <summary>
+    /// Opens the given raw trace file.
+    /// </summary>
+    /// <param name="fileName">Raw trace file.</param>
+    public RawTraceChunkReader(string fileName)
+        : this(new FileStream(fileName, FileMode.Open, FileAccess.Read, FileShare.Read, 1 << 16, FileOptions.SequentialScan))
+    {
+    }
+
+    /// <summary>
+    /// Reads the given in-memory raw trace data.
+    /// </summary>
+    /// <param name="data">Raw trace data. Must start at the beginning of its underlying array, as the array is returned as chunk without copying.</param>
+    public RawTraceChunkReader(ArraySegment<byte> data)
+        : this(new MemoryStream(data.Array ?? Array.Empty<byte>(), 0, data.Count, false, true))
+    {
+        if(data.Offset != 0)
+            throw new ArgumentException("The raw trace data must start at the beginning of its underlying array.", nameof(data));
+    }
+
+    /// <summary>
+    /// Reads raw trace data from the given stream.
+    /// </summary>
+    /// <param name="inputStream">Raw trace data stream.</param>
+    private RawTraceChunkReader(Stream inputStream)
+    {
+        _inputStream = inputStream;
+
+        // Check for compressed container header
+        Span<byte> header = stackalloc byte[HeaderSize];
+        int headerLength = _inputStream.ReadAtLeast(header, HeaderSize, false);
+        if(headerLength == HeaderSize && BinaryPrimitives.ReadUInt32LittleEndian(header) == CompressedTraceMagic)
+        {
+            uint version = BinaryPrimitives.ReadUInt32LittleEndian(header[4..]);
+            if(version != CompressedTraceVersion)
+                throw new Exception($"Unsupported compressed trace container version {version}.");
+
+            _compressed = true;
+        }
+        else
+        {
+            _inputStream.Position = 0;
+        }
+    }
+
+    /// <summary>
+    /// Reads the next chunk of trace data.
+    /// </summary>
+    /// <param name="chunk">Buffer containing the chunk data. Is reused by subsequent calls.</param>
+    /// <param name="chunkLength">Length of the chunk data.</param>
+    /// <returns>false, if the end of the trace file has been reached.</returns>
+    public bool TryReadNextChunk(out byte[] chunk, out int chunkLength)
+    {
+        chunk = _chunkBuffer;
+        chunkLength = 0;
+
+        // In-memory data does not need to be copied
+        if(_inputStream is MemoryStream memoryStream && !_compressed)
+        {
+            if(_inMemoryDataRead)
+            {
+                if(_unconsumedLength > 0)
+                    throw new Exception("Unexpected end of trace file.");
+                return false;
+            }
+
+            _inMemoryDataRead = true;
+            chunk = _chunkBuffer = memoryStream.GetBuffer();
+            chunkLength = _chunkLength = (int)memoryStream.Length;
+            return true;
+        }
+
+        // Move unconsumed bytes of the previous chunk to the beginning of the buffer
+        int carryLength = _unconsumedLength;
+        if(carryLength > 0)
+            Buffer.BlockCopy(_chunkBuffer, _chunkLength - carryLength, _chunkBuffer, 0, carryLength);
+        _unconsumedLength = 0;
+
+        if(!_compressed)
+        {
+            if(_chunkBuffer.Length < UncompressedChunkSize)
+                chunk = _chunkBuffer = new byte[UncompressedChunkSize];
+
+            int readLength = _inputStream.ReadAtLeast(chunk.AsSpan(carryLength), UncompressedChunkSize - carryLength, false);
+            if(readLength == 0)
+            {
+                if(carryLength > 0)
+                    throw new Exception("Unexpected end of trace file.");
+                return false;
+            }
+
+            chunkLength = _chunkLength = carryLength + readLength;
+            return true;
+        }
+
+        // Read frame header
+        Span<byte> frameHeader = stackalloc byte[HeaderSize];
+        int frameHeaderLength = _inputStream.ReadAtLeast(frameHeader, HeaderSize, false);
+        if(frameHeaderLength == 0)
+        {
+            if(carryLength > 0)
+                throw new Exception("Unexpected end of compressed trace file.");
+            return false;
+        }
+
+        if(frameHeaderLength < HeaderSize)
+            throw new Exception("Unexpected end of compressed trace file.");
+        int uncompressedLength = (int)BinaryPrimitives.ReadUInt32LittleEndian(frameHeader);
+        int storedLength = (int)BinaryPrimitives.ReadUInt32LittleEndian(frameHeader[4..]);
+
+        // The decompressed frame is placed behind the unconsumed bytes
+        if(_chunkBuffer.Length < carryLength + uncompressedLength)
+        {
+            var newChunkBuffer = new byte[carryLength + uncompressedLength];
+            Buffer.BlockCopy(_chunkBuffer, 0, newChunkBuffer, 0, carryLength);
+            chunk = _chunkBuffer = newChunkBuffer;
+        }
+
+        // Stored frames are not compressed
+        if(storedLength == uncompressedLength)
+        {
+            _inputStream.ReadExactly(chunk, carryLength, uncompressedLength);
+            chunkLength = _chunkLength = carryLength + uncompressedLength;
+            return true;
+        }
+
+        if(_compressedBuffer.Length < storedLength)
+            _compressedBuffer = new byte[storedLength];
+        _inputStream.ReadExactly(_compressedBuffer, 0, storedLength);
+
+        int decompressedLength = Lz4DecompressBlock(_compressedBuffer.AsSpan(0, storedLength), chunk.AsSpan(carryLength, uncompressedLength));
+        if(decompressedLength != uncompressedLength)
+            throw new Exception("Corrupted frame in compressed trace file.");
+        chunkLength = _chunkLength = carryLength + uncompressedLength;
+        return true;
+    }
+
+    /// <summary>
+    /// Marks the given number of bytes at the end of the last returned chunk as not consumed, e.g. because they contain an incomplete entry.
+    /// These bytes are returned again at the beginning of the next chunk.
+    /// </summary>
+    /// <param name="length">Number of unconsumed bytes.</param>
+    public void SetUnconsumedLength(int length)
+    {
+        if(length < 0 || length > _chunkLength)
+            throw new ArgumentOutOfRangeException(nameof(length));
+
+        _unconsumedLength = length;
+    }
+
+    /// <summary>
+    /// Decompresses the given LZ4 block.
+    /// </summary>
+    /// <param name="input">Compressed block.</param>
+    /// <param name="output">Output buffer.</param>
+    /// <returns>The decompressed length.</returns>
+    private static int Lz4DecompressBlock(ReadOnlySpan<byte> input, Span<byte> output)
+    {
+        int inputPosition = 0;
+        int outputPosition = 0;
+        while(inputPosition < input.Length)
+        {
+            // Token: Literal length in the upper, match length in the lower 4 bits
+            byte token = input[inputPosition++];
+            int literalLength = token >> 4;
+            if(literalLength == 15)
+                literalLength += ReadLength(input, ref inputPosition);
+
+            // Copy literals
+            input.Slice(inputPosition, literalLength).CopyTo(output[outputPosition..]);
+            inputPosition += literalLength;
+            outputPosition += literalLength;
+
+            // The last sequence only consists of literals
+            if(inputPosition >= input.Length)
+                break;
+
+            int offset = input[inputPosition] | (input[inputPosition + 1] << 8);
+            inputPosition += 2;
+            int matchLength = token & 0x0F;
+            if(matchLength == 15)
+                matchLength += ReadLength(input, ref inputPosition);
+            matchLength += Lz4MinMatch;
+
+            int matchPosition = outputPosition - offset;
+            if(offset == 0 || matchPosition < 0)
+                throw new Exception("Invalid match offset in compressed trace file.");
+
+            // Copy match; it may overlap with the output
+            if(offset >= matchLength)
+                output.Slice(matchPosition, matchLength).CopyTo(output[outputPosition..]);
+            else
+            {
+                for(int i = 0; i < matchLength; ++i)
+                    output[outputPosition + i] = output[matchPosition + i];
+            }
+
+            outputPosition += matchLength;
+        }
+
+        return outputPosition;
+    }
+
+    /// <summary>
+    /// Reads the extra bytes of a literal or match length.
+    /// </summary>
+    private static int ReadLength(ReadOnlySpan<byte> input, ref int inputPosition)
+    {
+        int length = 0;
+        byte b;
+        do
+        {
+            b = input[inputPosition++];
+            length += b;
+        } while(b == 255);
+
+        return length;
+    }
+
+    public void Dispose()
+    {
+        _inputStream.Dispose();
+    }
+}
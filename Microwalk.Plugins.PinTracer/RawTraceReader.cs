@@ -0,0 +1,466 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Runtime.CompilerServices;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Sequentially reads the entries of a raw Pin trace file.
+/// Supports both the plain format (an array of <see cref="PinTracePreprocessor.RawTraceEntry"/> records) and the compact variable-length encoding.
+/// The trace data is passed in chunks (see <see cref="RawTraceChunkReader"/>). A chunk may end with an incomplete entry, which is not consumed
+/// (see <see cref="Position"/>) and must be passed again at the beginning of the next chunk.
+///
+/// Basic block memory access records (<see cref="PinTracePreprocessor.RawTraceEntryTypes.BlockMemoryAccesses"/>) are expanded into the individual
+/// memory access entries of the respective block definition, so callers only see plain entries.
+/// </summary>
+internal unsafe ref struct RawTraceReader
+{
+    /// <summary>
+    /// Magic number at the beginning of compact encoded trace files ("MWCT").
+    /// </summary>
+    private const uint CompactTraceMagic = 0x5443574D;
+
+    /// <summary>
+    /// Supported version of the compact trace encoding.
+    /// </summary>
+    private const uint CompactTraceVersion = 1;
+
+    /// <summary>
+    /// Size of the compact trace file header.
+    /// </summary>
+    private const int CompactTraceHeaderSize = 8;
+
+    /// <summary>
+    /// Size of the smallest compact encoded memory access entry, which is used for estimating the entry count.
+    /// </summary>
+    private const int CompactTraceMinMemoryAccessEntrySize = 4;
+
+    /// <summary>
+    /// Size of a plain trace entry.
+    /// </summary>
+    private static readonly int RawTraceEntrySize = sizeof(PinTracePreprocessor.RawTraceEntry);
+
+    /// <summary>
+    /// Number of memory addresses stored in each payload entry of a plain basic block memory access record.
+    /// </summary>
+    private static readonly int BlockRecordAddressesPerEntry = RawTraceEntrySize / sizeof(ulong);
+
+    /// <summary>
+    /// Pointer to the current chunk.
+    /// </summary>
+    private byte* _data;
+
+    /// <summary>
+    /// Length of the current chunk.
+    /// </summary>
+    private long _length;
+
+    /// <summary>
+    /// Current read position.
+    /// </summary>
+    private long _position;
+
+    /// <summary>
+    /// The last decoded instruction address (delta base for instruction addresses).
+    /// </summary>
+    private ulong _lastInstructionAddress;
+
+    /// <summary>
+    /// The last decoded memory address (delta base for memory addresses).
+    /// </summary>
+    private ulong _lastMemoryAddress;
+
+    /// <summary>
+    /// Determines whether the format of the trace file has already been detected from the first chunk.
+    /// </summary>
+    private bool _formatDetected;
+
+    /// <summary>
+    /// Set when a compact entry reaches beyond the end of the current chunk.
+    /// </summary>
+    private bool _truncated;
+
+    /// <summary>
+    /// Memory accesses of the basic blocks defined so far in this trace file, indexed by block ID.
+    /// </summary>
+    private Dictionary<ulong, BlockMemoryAccess[]>? _blockDefinitions;
+
+    /// <summary>
+    /// Memory accesses of the basic block record which is currently expanded.
+    /// </summary>
+    private BlockMemoryAccess[]? _pendingBlockAccesses;
+
+    /// <summary>
+    /// Memory addresses of the basic block record which is currently expanded.
+    /// </summary>
+    private ulong[]? _pendingBlockAddresses;
+
+    /// <summary>
+    /// Index of the next returned access of the basic block record which is currently expanded.
+    /// </summary>
+    private int _pendingBlockAccessIndex;
+
+    /// <summary>
+    /// Number of accesses of the basic block record which is currently expanded.
+    /// </summary>
+    private int _pendingBlockAccessCount;
+
+    /// <summary>
+    /// Determines whether the trace file uses the compact encoding.
+    /// </summary>
+    public bool IsCompact { get; private set; }
+
+    /// <summary>
+    /// Returns an upper bound for the number of entries in the current chunk, for sizing output buffers.
+    /// </summary>
+    public long EstimatedEntryCount => IsCompact ? _length / CompactTraceMinMemoryAccessEntrySize : _length / RawTraceEntrySize;
+
+    /// <summary>
+    /// Returns the number of bytes of the current chunk which have been consumed by completely read entries.
+    /// </summary>
+    public long Position => _position;
+
+    /// <summary>
+    /// Continues reading with the given chunk. The decoder state is kept across chunks.
+    /// </summary>
+    /// <param name="data">Pointer to the chunk data. Must remain fixed while entries of this chunk are read.</param>
+    /// <param name="length">Length of the chunk data.</param>
+    public void SetChunk(byte* data, long length)
+    {
+        _data = data;
+        _length = length;
+        _position = 0;
+
+        if(_formatDetected)
+            return;
+        _formatDetected = true;
+
+        // Check for compact encoding header
+        IsCompact = length >= CompactTraceHeaderSize && *(uint*)data == CompactTraceMagic;
+        if(IsCompact)
+        {
+            uint version = *(uint*)(data + 4);
+            if(version != CompactTraceVersion)
+                throw new Exception($"Unsupported compact trace encoding version {version}.");
+
+            _position = CompactTraceHeaderSize;
+        }
+    }
+
+    /// <summary>
+    /// Reads the next trace entry.
+    /// </summary>
+    /// <param name="entry">The decoded trace entry.</param>
+    /// <returns>false, if the end of the current chunk has been reached or the next entry is incomplete.</returns>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    public bool TryReadNext(out PinTracePreprocessor.RawTraceEntry entry)
+    {
+        // The accesses of a basic block record were completely read from the chunk, so they remain valid when the chunk is switched
+        if(_pendingBlockAccessIndex < _pendingBlockAccessCount)
+        {
+            entry = NextPendingBlockAccess();
+            return true;
+        }
+
+        while(true)
+        {
+            if(!IsCompact)
+            {
+                if(_position + RawTraceEntrySize > _length)
+                {
+                    entry = default;
+                    return false;
+                }
+
+                entry = *(PinTracePreprocessor.RawTraceEntry*)&_data[_position];
+                _position += RawTraceEntrySize;
+            }
+            else if(!TryDecodeNext(out entry))
+                return false;
+
+            if(entry.Type is not (PinTracePreprocessor.RawTraceEntryTypes.BlockDefinition or PinTracePreprocessor.RawTraceEntryTypes.BlockMemoryAccesses))
+                return true;
+
+            if(!TryReadBlockEntry(entry.Type, (ushort)entry.Param0, entry.Param1))
+            {
+                entry = default;
+                return false;
+            }
+
+            if(_pendingBlockAccessIndex < _pendingBlockAccessCount)
+            {
+                entry = NextPendingBlockAccess();
+                return true;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Handles a basic block definition or memory access record, whose header has just been read. For plain traces, this reads the payload entries.
+    /// The compact decoder reads the payload together with the header.
+    /// </summary>
+    /// <param name="type">The entry type.</param>
+    /// <param name="accessCount">The number of memory accesses of the block.</param>
+    /// <param name="blockId">The block ID.</param>
+    /// <returns>false, if the payload is incomplete. In this case, the read position is reset to the header.</returns>
+    private bool TryReadBlockEntry(PinTracePreprocessor.RawTraceEntryTypes type, int accessCount, ulong blockId)
+    {
+        if(type == PinTracePreprocessor.RawTraceEntryTypes.BlockDefinition)
+        {
+            if(IsCompact)
+                return true;
+
+            // The memory access entries follow the header
+            if(_position + (long)accessCount * RawTraceEntrySize > _length)
+            {
+                _position -= RawTraceEntrySize;
+                return false;
+            }
+
+            var definitionAccesses = new BlockMemoryAccess[accessCount];
+            for(int i = 0; i < accessCount; ++i)
+            {
+                var accessEntry = (PinTracePreprocessor.RawTraceEntry*)&_data[_position];
+                definitionAccesses[i] = new BlockMemoryAccess(accessEntry->Type, accessEntry->Param0, accessEntry->Param1);
+                _position += RawTraceEntrySize;
+            }
+
+            _blockDefinitions ??= new Dictionary<ulong, BlockMemoryAccess[]>();
+            _blockDefinitions[blockId] = definitionAccesses;
+            return true;
+        }
+
+        if(_blockDefinitions == null || !_blockDefinitions.TryGetValue(blockId, out var accesses) || accesses.Length != accessCount)
+            throw new Exception($"Basic block memory access record references unknown block #{blockId}.");
+
+        if(!IsCompact)
+        {
+            // The addresses are packed into the payload entries following the header
+            long payloadSize = (long)((accessCount + BlockRecordAddressesPerEntry - 1) / BlockRecordAddressesPerEntry) * RawTraceEntrySize;
+            if(_position + payloadSize > _length)
+            {
+                _position -= RawTraceEntrySize;
+                return false;
+            }
+
+            _pendingBlockAddresses ??= new ulong[ushort.MaxValue + 1];
+            new ReadOnlySpan<ulong>(&_data[_position], accessCount).CopyTo(_pendingBlockAddresses);
+            _position += payloadSize;
+        }
+
+        _pendingBlockAccesses = accesses;
+        _pendingBlockAccessIndex = 0;
+        _pendingBlockAccessCount = accessCount;
+        return true;
+    }
+
+    /// <summary>
+    /// Returns the next access of the basic block record which is currently expanded.
+    /// </summary>
+    private PinTracePreprocessor.RawTraceEntry NextPendingBlockAccess()
+    {
+        var access = _pendingBlockAccesses![_pendingBlockAccessIndex];
+        ulong address = _pendingBlockAddresses![_pendingBlockAccessIndex];
+        ++_pendingBlockAccessIndex;
+        return new PinTracePreprocessor.RawTraceEntry(access.Type, 0, access.Size, access.InstructionAddress, address);
+    }
+
+    /// <summary>
+    /// Decodes the next entry in compact encoding. Must mirror TraceWriter::EncodeEntries() in the Pin tool.
+    /// </summary>
+    private bool TryDecodeNext(out PinTracePreprocessor.RawTraceEntry entry)
+    {
+        entry = default;
+        if(_position >= _length)
+            return false;
+
+        // Remember decoder state, in case the entry is incomplete
+        long entryPosition = _position;
+        ulong lastInstructionAddress = _lastInstructionAddress;
+        ulong lastMemoryAddress = _lastMemoryAddress;
+        _truncated = false;
+
+        // Header byte: Entry type in the lower, flags in the upper 4 bits
+        byte header = _data[_position++];
+        var type = (PinTracePreprocessor.RawTraceEntryTypes)(header & 0x0F);
+        byte flag = (byte)(header >> 4);
+
+        ulong param0 = 0;
+        ulong param1 = 0;
+        ulong param2 = 0;
+        switch(type)
+        {
+            case PinTracePreprocessor.RawTraceEntryTypes.MemoryRead:
+            case PinTracePreprocessor.RawTraceEntryTypes.MemoryWrite:
+            {
+                param0 = ReadUnsigned();
+                param1 = ReadDelta(_lastInstructionAddress);
+                param2 = ReadDelta(_lastMemoryAddress);
+                _lastInstructionAddress = param1;
+                _lastMemoryAddress = param2;
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocSizeParameter:
+            {
+                param1 = ReadUnsigned();
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocAddressReturn:
+            case PinTracePreprocessor.RawTraceEntryTypes.HeapFreeAddressParameter:
+            {
+                param2 = ReadDelta(_lastMemoryAddress);
+                _lastMemoryAddress = param2;
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.Branch:
+            {
+                param1 = ReadDelta(_lastInstructionAddress);
+                param2 = ReadDelta(param1);
+                bool taken = (flag & (byte)PinTracePreprocessor.RawTraceBranchEntryFlags.Taken) != 0;
+                _lastInstructionAddress = taken ? param2 : param1;
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.StackPointerModification:
+            {
+                param1 = ReadDelta(_lastInstructionAddress);
+                param2 = ReadDelta(_lastMemoryAddress);
+                _lastInstructionAddress = param1;
+                _lastMemoryAddress = param2;
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.BlockDefinition:
+            {
+                param0 = ReadUnsigned();
+                param1 = ReadUnsigned();
+
+                // Each access consists of its type, size and instruction address
+                var accesses = new BlockMemoryAccess[(ushort)param0];
+                for(int i = 0; i < accesses.Length && !_truncated; ++i)
+                {
+                    if(_position >= _length)
+                    {
+                        _truncated = true;
+                        break;
+                    }
+
+                    var accessType = (PinTracePreprocessor.RawTraceEntryTypes)_data[_position++];
+                    short size = (short)ReadUnsigned();
+                    _lastInstructionAddress = ReadDelta(_lastInstructionAddress);
+                    accesses[i] = new BlockMemoryAccess(accessType, size, _lastInstructionAddress);
+                }
+
+                if(!_truncated)
+                {
+                    _blockDefinitions ??= new Dictionary<ulong, BlockMemoryAccess[]>();
+                    _blockDefinitions[param1] = accesses;
+                }
+
+                break;
+            }
+
+            case PinTracePreprocessor.RawTraceEntryTypes.BlockMemoryAccesses:
+            {
+                param0 = ReadUnsigned();
+                param1 = ReadUnsigned();
+
+                _pendingBlockAddresses ??= new ulong[ushort.MaxValue + 1];
+                for(int i = 0; i < (ushort)param0 && !_truncated; ++i)
+                {
+                    _lastMemoryAddress = ReadDelta(_lastMemoryAddress);
+                    _pendingBlockAddresses[i] = _lastMemoryAddress;
+                }
+
+                break;
+            }
+
+            default:
+            {
+                param0 = ReadUnsigned();
+                param1 = ReadUnsigned();
+                param2 = ReadUnsigned();
+                break;
+            }
+        }
+
+        // The entry continues in the next chunk
+        if(_truncated)
+        {
+            _position = entryPosition;
+            _lastInstructionAddress = lastInstructionAddress;
+            _lastMemoryAddress = lastMemoryAddress;
+            return false;
+        }
+
+        entry = new PinTracePreprocessor.RawTraceEntry(type, flag, (short)param0, param1, param2);
+        return true;
+    }
+
+    /// <summary>
+    /// Reads a little endian base-128 variable-length integer.
+    /// Sets <see cref="_truncated"/> and returns 0, if the end of the chunk is reached.
+    /// </summary>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    private ulong ReadUnsigned()
+    {
+        ulong value = 0;
+        int shift = 0;
+        while(true)
+        {
+            if(_position >= _length)
+            {
+                _truncated = true;
+                return 0;
+            }
+
+            byte b = _data[_position++];
+            value |= (ulong)(b & 0x7F) << shift;
+            if((b & 0x80) == 0)
+                return value;
+            shift += 7;
+        }
+    }
+
+    /// <summary>
+    /// Reads a zig-zag encoded difference and adds it to the given base value.
+    /// </summary>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    private ulong ReadDelta(ulong baseValue)
+    {
+        ulong zigZag = ReadUnsigned();
+        long delta = (long)(zigZag >> 1) ^ -(long)(zigZag & 1);
+        return baseValue + (ulong)delta;
+    }
+
+    /// <summary>
+    /// Static information about a memory access of a basic block, from a block definition.
+    /// </summary>
+    private readonly struct BlockMemoryAccess
+    {
+        /// <summary>
+        /// The access type (read or write).
+        /// </summary>
+        public readonly PinTracePreprocessor.RawTraceEntryTypes Type;
+
+        /// <summary>
+        /// The access size.
+        /// </summary>
+        public readonly short Size;
+
+        /// <summary>
+        /// The address of the accessing instruction.
+        /// </summary>
+        public readonly ulong InstructionAddress;
+
+        public BlockMemoryAccess(PinTracePreprocessor.RawTraceEntryTypes type, short size, ulong instructionAddress)
+        {
+            Type = type;
+            Size = size;
+            InstructionAddress = instructionAddress;
+        }
+    }
+}
@@ -0,0 +1,414 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Receives trace files from the Pin tool through a single-producer/single-consumer ring buffer in a shared memory file.
+/// Must mirror the SharedMemoryRing class in the Pin tool.
+/// </summary>
+internal class SharedMemoryTraceRing : IDisposable
+{
+    /// <summary>
+    /// Magic number at the beginning of the shared memory ring ("MWRB").
+    /// </summary>
+    private const uint SharedMemoryRingMagic = 0x4252574D;
+
+    /// <summary>
+    /// Version of the shared memory ring layout.
+    /// </summary>
+    private const uint SharedMemoryRingVersion = 2;
+
+    /// <summary>
+    /// Offset of the ring data in the shared memory file.
+    /// </summary>
+    private const int DataOffset = 256;
+
+    /// <summary>
+    /// Offset of the producer position in the shared memory file.
+    /// </summary>
+    private const int WritePositionOffset = 64;
+
+    /// <summary>
+    /// Offset of the consumer position in the shared memory file.
+    /// </summary>
+    private const int ReadPositionOffset = 128;
+
+    /// <summary>
+    /// Offset of the consumer waiting flag in the shared memory file, which doubles as futex word.
+    /// </summary>
+    private const int ConsumerWaitingOffset = 192;
+
+    /// <summary>
+    /// Size of a record header.
+    /// </summary>
+    private const int RecordHeaderSize = 8;
+
+    /// <summary>
+    /// Size of the buffer used for copying spilled trace data from the ring into the trace file.
+    /// </summary>
+    private const int SpillBufferSize = 1 << 16;
+
+    /// <summary>
+    /// Maximum time the consumer blocks in a single wait, so cancellation is noticed.
+    /// </summary>
+    private const long ConsumerWaitTimeoutNanoseconds = 100_000_000;
+
+    /// <summary>
+    /// Linux x86-64 system call number of futex().
+    /// </summary>
+    private const long SysFutex = 202;
+
+    /// <summary>
+    /// futex() operation for waiting until the futex word changes.
+    /// </summary>
+    private const int FutexWait = 0;
+
+    /// <summary>
+    /// Name of the trace prefix file, which is written to disk as it is needed by the preprocessor.
+    /// </summary>
+    private const string PrefixFileName = "prefix.trace";
+
+    /// <summary>
+    /// The different record types in the shared memory ring.
+    /// </summary>
+    private enum RecordTypes : uint
+    {
+        FileBegin = 1,
+        FileData = 2,
+        FileEnd = 3
+    }
+
+    /// <summary>
+    /// The memory mapped shared memory file.
+    /// </summary>
+    private readonly MemoryMappedFile _memoryMappedFile;
+
+    /// <summary>
+    /// Accessor for the shared memory file.
+    /// </summary>
+    private readonly MemoryMappedViewAccessor _accessor;
+
+    /// <summary>
+    /// Pointer to the beginning of the mapping.
+    /// </summary>
+    private readonly unsafe byte* _basePointer;
+
+    /// <summary>
+    /// Size of the ring data.
+    /// </summary>
+    private readonly long _capacity;
+
+    /// <summary>
+    /// Maximum size of a trace file which is kept in memory. Larger trace files are spilled to disk.
+    /// </summary>
+    private readonly int _maxInMemoryFileSize;
+
+    /// <summary>
+    /// Determines whether the consumer can block on the futex word while the ring is empty.
+    /// Else, it falls back to polling.
+    /// </summary>
+    private readonly bool _useFutex = OperatingSystem.IsLinux() && RuntimeInformation.ProcessArchitecture == Architecture.X64;
+
+    /// <summary>
+    /// Cancels the consumer task.
+    /// </summary>
+    private readonly CancellationTokenSource _cancellationTokenSource = new();
+
+    /// <summary>
+    /// Consumer task.
+    /// </summary>
+    private readonly Task _consumerTask;
+
+    /// <summary>
+    /// Completed trace files, indexed by file name. A trace file which was spilled to disk has no data.
+    /// </summary>
+    private readonly ConcurrentDictionary<string, TaskCompletionSource<ArraySegment<byte>?>> _files = new();
+
+    /// <summary>
+    /// Path of the shared memory file.
+    /// </summary>
+    public string FilePath { get; }
+
+    /// <summary>
+    /// Creates and initializes the shared memory file and starts consuming its contents.
+    /// </summary>
+    /// <param name="filePath">Path of the shared memory file.</param>
+    /// <param name="capacity">Size of the ring data in bytes.</param>
+    /// <param name="maxInMemoryFileSize">Maximum size of a trace file which is kept in memory. Larger trace files are written to the path reported by the Pin tool.</param>
+    public unsafe SharedMemoryTraceRing(string filePath, long capacity, int maxInMemoryFileSize)
+    {
+        if(capacity <= 0)
+            throw new ArgumentOutOfRangeException(nameof(capacity), "The ring capacity must be positive.");
+        if(maxInMemoryFileSize <= 0)
+            throw new ArgumentOutOfRangeException(nameof(maxInMemoryFileSize), "The maximum in-memory trace file size must be positive.");
+
+        FilePath = filePath;
+        _capacity = capacity;
+        _maxInMemoryFileSize = maxInMemoryFileSize;
+
+        _memoryMappedFile = MemoryMappedFile.CreateFromFile(filePath, FileMode.Create, null, DataOffset + capacity, MemoryMappedFileAccess.ReadWrite);
+        _accessor = _memoryMappedFile.CreateViewAccessor(0, DataOffset + capacity, MemoryMappedFileAccess.ReadWrite);
+        byte* basePointer = null;
+        _accessor.SafeMemoryMappedViewHandle.AcquirePointer(ref basePointer);
+        _basePointer = basePointer + _accessor.PointerOffset;
+
+        // Initialize header
+        *(uint*)_basePointer = SharedMemoryRingMagic;
+        *(uint*)(_basePointer + 4) = SharedMemoryRingVersion;
+        *(ulong*)(_basePointer + 8) = (ulong)capacity;
+        Volatile.Write(ref *(ulong*)(_basePointer + WritePositionOffset), 0);
+        Volatile.Write(ref *(ulong*)(_basePointer + ReadPositionOffset), 0);
+        Volatile.Write(ref *(uint*)(_basePointer + ConsumerWaitingOffset), 0);
+
+        _consumerTask = Task.Factory.StartNew(Consume, _cancellationTokenSource.Token, TaskCreationOptions.LongRunning, TaskScheduler.Default);
+    }
+
+    /// <summary>
+    /// Returns the contents of the given trace file, once the Pin tool has completed it.
+    /// </summary>
+    /// <param name="fileName">Trace file name, as reported by the Pin tool.</param>
+    /// <returns>The trace file contents, or null if the trace file exceeded the in-memory size limit and was written to <paramref name="fileName"/>.</returns>
+    public async Task<ArraySegment<byte>?> GetFileDataAsync(string fileName)
+    {
+        var file = _files.GetOrAdd(fileName, _ => new TaskCompletionSource<ArraySegment<byte>?>(TaskCreationOptions.RunContinuationsAsynchronously));
+        if(await Task.WhenAny(file.Task, _consumerTask) != file.Task)
+            throw new Exception("The shared memory ring consumer has stopped.", _consumerTask.Exception?.InnerException);
+
+        _files.TryRemove(fileName, out _);
+        return file.Task.Result;
+    }
+
+    /// <summary>
+    /// Reads records from the ring until the consumer is cancelled.
+    /// </summary>
+    private void Consume()
+    {
+        var token = _cancellationTokenSource.Token;
+        byte[] recordHeader = new byte[RecordHeaderSize];
+        string? currentFileName = null;
+
+        // Trace data is collected in a single buffer, which is handed out without copying.
+        // Trace files exceeding the in-memory size limit are spilled to disk, like without the shared memory transport.
+        byte[] currentFileBuffer = Array.Empty<byte>();
+        int currentFileLength = 0;
+        FileStream? currentSpillFileStream = null;
+        byte[]? spillBuffer = null;
+        try
+        {
+            while(!token.IsCancellationRequested)
+            {
+                // Read record
+                Read(recordHeader, token);
+                var recordType = (RecordTypes)BitConverter.ToUInt32(recordHeader, 0);
+                int recordLength = BitConverter.ToInt32(recordHeader, 4);
+                switch(recordType)
+                {
+                    case RecordTypes.FileBegin:
+                    {
+                        byte[] name = new byte[recordLength];
+                        Read(name, token);
+                        currentFileName = Encoding.UTF8.GetString(name);
+                        currentFileBuffer = Array.Empty<byte>();
+                        currentFileLength = 0;
+
+                        // The trace prefix is only processed once, so for simplicity we put it on disk
+                        if(Path.GetFileName(currentFileName) == PrefixFileName)
+                            currentSpillFileStream = File.Create(currentFileName);
+                        break;
+                    }
+
+                    case RecordTypes.FileData:
+                    {
+                        if(currentFileName == null)
+                            throw new Exception("Received trace data outside of a trace file.");
+
+                        // Spill the trace file to disk once it exceeds the in-memory size limit
+                        if(currentSpillFileStream == null && (long)currentFileLength + recordLength > _maxInMemoryFileSize)
+                        {
+                            currentSpillFileStream = File.Create(currentFileName);
+                            currentSpillFileStream.Write(currentFileBuffer, 0, currentFileLength);
+                            currentFileBuffer = Array.Empty<byte>();
+                            currentFileLength = 0;
+                        }
+
+                        if(currentSpillFileStream != null)
+                        {
+                            spillBuffer ??= new byte[SpillBufferSize];
+                            for(int remaining = recordLength; remaining > 0;)
+                            {
+                                int chunkLength = Math.Min(remaining, spillBuffer.Length);
+                                Read(spillBuffer.AsSpan(0, chunkLength), token);
+                                currentSpillFileStream.Write(spillBuffer, 0, chunkLength);
+                                remaining -= chunkLength;
+                            }
+
+                            break;
+                        }
+
+                        // Grow buffer
+                        int requiredLength = currentFileLength + recordLength;
+                        if(currentFileBuffer.Length < requiredLength)
+                        {
+                            var newFileBuffer = new byte[Math.Max(requiredLength, (int)Math.Min(2L * currentFileBuffer.Length, _maxInMemoryFileSize))];
+                            Buffer.BlockCopy(currentFileBuffer, 0, newFileBuffer, 0, currentFileLength);
+                            currentFileBuffer = newFileBuffer;
+                        }
+
+                        Read(currentFileBuffer.AsSpan(currentFileLength, recordLength), token);
+                        currentFileLength = requiredLength;
+                        break;
+                    }
+
+                    case RecordTypes.FileEnd:
+                    {
+                        if(currentFileName == null)
+                            throw new Exception("Received trace file end outside of a trace file.");
+
+                        ArraySegment<byte>? data = null;
+                        if(currentSpillFileStream != null)
+                        {
+                            currentSpillFileStream.Dispose();
+                            currentSpillFileStream = null;
+                        }
+                        else
+                        {
+                            data = new ArraySegment<byte>(currentFileBuffer, 0, currentFileLength);
+                        }
+
+                        if(Path.GetFileName(currentFileName) != PrefixFileName)
+                        {
+                            _files.GetOrAdd(currentFileName, _ => new TaskCompletionSource<ArraySegment<byte>?>(TaskCreationOptions.RunContinuationsAsynchronously))
+                                .SetResult(data);
+                        }
+
+                        currentFileName = null;
+                        currentFileBuffer = Array.Empty<byte>();
+                        currentFileLength = 0;
+                        break;
+                    }
+
+                    default:
+                        throw new Exception($"Unknown shared memory ring record type {(uint)recordType}.");
+                }
+            }
+        }
+        catch(OperationCanceledException)
+        {
+        }
+        finally
+        {
+            currentSpillFileStream?.Dispose();
+        }
+    }
+
+    /// <summary>
+    /// Copies the given amount of bytes from the ring, waiting for the producer if the ring is empty.
+    /// </summary>
+    private unsafe void Read(Span<byte> buffer, CancellationToken token)
+    {
+        ref ulong writePositionRef = ref *(ulong*)(_basePointer + WritePositionOffset);
+        ref ulong readPositionRef = ref *(ulong*)(_basePointer + ReadPositionOffset);
+        ulong readPosition = readPositionRef;
+        var spinWait = new SpinWait();
+        while(buffer.Length > 0)
+        {
+            // Wait until the producer has published some data
+            // Spin shortly, as the producer usually writes several records in a row, and block afterwards
+            ulong available = Volatile.Read(ref writePositionRef) - readPosition;
+            if(available == 0)
+            {
+                token.ThrowIfCancellationRequested();
+                if(!spinWait.NextSpinWillYield)
+                    spinWait.SpinOnce(-1);
+                else
+                    WaitForProducer(readPosition);
+                continue;
+            }
+
+            spinWait.Reset();
+
+            // Copy as much as possible, wrapping around at the end of the ring
+            long ringOffset = (long)(readPosition % (ulong)_capacity);
+            int chunkLength = (int)Math.Min(Math.Min(available, (ulong)buffer.Length), (ulong)(_capacity - ringOffset));
+            new ReadOnlySpan<byte>(_basePointer + DataOffset + ringOffset, chunkLength).CopyTo(buffer);
+            buffer = buffer[chunkLength..];
+            readPosition += (ulong)chunkLength;
+
+            // Release space
+            Volatile.Write(ref readPositionRef, readPosition);
+        }
+    }
+
+    /// <summary>
+    /// Blocks until the producer has published data beyond the given read position, or until a timeout expires.
+    /// The consumer announces that it is waiting through the consumer waiting flag; the producer resets the flag and wakes the consumer after publishing data.
+    /// </summary>
+    /// <param name="readPosition">Current read position.</param>
+    private unsafe void WaitForProducer(ulong readPosition)
+    {
+        if(!_useFutex)
+        {
+            Thread.Sleep(1);
+            return;
+        }
+
+        ref ulong writePositionRef = ref *(ulong*)(_basePointer + WritePositionOffset);
+        uint* consumerWaitingPointer = (uint*)(_basePointer + ConsumerWaitingOffset);
+
+        // Announce waiting and check again, so a concurrent write is either seen here or wakes us up
+        Interlocked.Exchange(ref *consumerWaitingPointer, 1);
+        if(Volatile.Read(ref writePositionRef) != readPosition)
+        {
+            Volatile.Write(ref *consumerWaitingPointer, 0);
+            return;
+        }
+
+        // Returns immediately if the producer has already reset the flag
+        var timeout = new Timespec { Seconds = 0, Nanoseconds = ConsumerWaitTimeoutNanoseconds };
+        Syscall(SysFutex, consumerWaitingPointer, FutexWait, 1, &timeout, null, 0);
+        Volatile.Write(ref *consumerWaitingPointer, 0);
+    }
+
+    /// <summary>
+    /// Relative timeout for futex().
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    private struct Timespec
+    {
+        public long Seconds;
+        public long Nanoseconds;
+    }
+
+    /// <summary>
+    /// Invokes a Linux system call. Used for futex(), which has no managed counterpart working across processes.
+    /// </summary>
+    [DllImport("libc", EntryPoint = "syscall", SetLastError = true)]
+    private static extern unsafe long Syscall(long number, uint* address, int operation, uint value, Timespec* timeout, uint* address2, uint value3);
+
+    public void Dispose()
+    {
+        _cancellationTokenSource.Cancel();
+        try
+        {
+            _consumerTask.Wait();
+        }
+        catch(AggregateException)
+        {
+            // Errors have already been reported to pending requests
+        }
+
+        _accessor.SafeMemoryMappedViewHandle.ReleasePointer();
+        _accessor.Dispose();
+        _memoryMappedFile.Dispose();
+        _cancellationTokenSource.Dispose();
+
+        File.Delete(FilePath);
+    }
+}
@@ -44,6 +44,16 @@ public class TraceConverter : TraceStage
     /// </summary>
     readonly List<(ulong oldBaseAddress, ulong oldEndAddress, ulong offset)> _moduleSectionsTranslations = new();
 
+    /// <summary>
+    /// Number of raw trace entries which are converted by a single worker thread.
+    /// </summary>
+    private int _chunkEntryCount;
+
+    /// <summary>
+    /// Maximum number of worker threads converting chunks of a single trace file.
+    /// </summary>
+    private int _maxChunkParallelism;
+
     public override async Task GenerateTraceAsync(TraceEntity traceEntity)
     {
         // First test case?
@@ -199,19 +209,45 @@ public class TraceConverter : TraceStage
         traceEntity.RawTraceFilePath = outputTraceFilePath;
     }
 
-    private unsafe void ProcessRawTrace(string inputFilePath, string outputFilePath)
+    private void ProcessRawTrace(string inputFilePath, string outputFilePath)
     {
         // Read entire QEMU trace file into memory, since these files should not get too big
         byte[] traceFile = File.ReadAllBytes(inputFilePath);
-        int traceFileLength = traceFile.Length;
         int rawTraceEntrySize = Marshal.SizeOf(typeof(RawTraceEntry));
+        int entryCount = traceFile.Length / rawTraceEntrySize;
+
+        // The entries have a fixed size and are converted independently of each other, so every entry boundary is a safe chunk boundary.
+        // The chunks are rewritten in place, so the results end up in the original order without further stitching.
+        int chunkCount = (entryCount + _chunkEntryCount - 1) / _chunkEntryCount;
+        if(chunkCount <= 1 || _maxChunkParallelism <= 1)
+            ProcessRawTraceChunk(traceFile, 0, entryCount);
+        else
+        {
+            Parallel.For(0, chunkCount, new ParallelOptions { MaxDegreeOfParallelism = _maxChunkParallelism }, chunkIndex =>
+            {
+                int firstEntry = chunkIndex * _chunkEntryCount;
+                ProcessRawTraceChunk(traceFile, firstEntry, Math.Min(_chunkEntryCount, entryCount - firstEntry));
+            });
+        }
+
+        // Store modified trace file
+        File.WriteAllBytes(outputFilePath, traceFile);
+    }
 
-        // Analyze and rewrite entries
+    /// <summary>
+    /// Translates the addresses of the given range of raw trace entries in place.
+    /// </summary>
+    /// <param name="traceFile">Raw trace file contents.</param>
+    /// <param name="firstEntry">Index of the first entry of the range.</param>
+    /// <param name="count">Number of entries in the range.</param>
+    private unsafe void ProcessRawTraceChunk(byte[] traceFile, int firstEntry, int count)
+    {
         fixed(byte* inputFilePtr = traceFile)
         {
-            for(long pos = 0; pos < traceFileLength; pos += rawTraceEntrySize)
+            var rawTraceEntries = (RawTraceEntry*)inputFilePtr + firstEntry;
+            for(int i = 0; i < count; ++i)
             {
-                var rawTraceEntry = (RawTraceEntry*)&inputFilePtr[pos];
+                var rawTraceEntry = &rawTraceEntries[i];
                 switch(rawTraceEntry->Type)
                 {
                     case RawTraceEntryTypes.Branch:
@@ -227,9 +263,6 @@ public class TraceConverter : TraceStage
                 }
             }
         }
-
-        // Store modified trace file
-        File.WriteAllBytes(outputFilePath, traceFile);
     }
 
     /// <summary>
@@ -271,6 +304,14 @@ public class TraceConverter : TraceStage
         // Translated kernel module base address
         _translatedModuleBaseAddress = moduleOptions.GetChildNodeOrDefault("kernel-module-translated-address")?.AsUnsignedLongHex() ?? throw new ConfigurationException("Missing kernel module section translation base address.");
 
+        // Chunked conversion of large trace files
+        _chunkEntryCount = moduleOptions.GetChildNodeOrDefault("chunk-size")?.AsInteger() ?? 1024 * 1024;
+        if(_chunkEntryCount <= 0)
+            throw new ConfigurationException("The chunk size must be positive.");
+        _maxChunkParallelism = moduleOptions.GetChildNodeOrDefault("max-chunk-parallelism")?.AsInteger() ?? Environment.ProcessorCount;
+        if(_maxChunkParallelism <= 0)
+            throw new ConfigurationException("The maximum chunk parallelism must be positive.");
+
         return Task.CompletedTask;
     }
 
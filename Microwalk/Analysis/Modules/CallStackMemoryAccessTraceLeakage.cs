@@ -13,7 +13,6 @@ using Microwalk.FrameworkBase.Stages;
 using Microwalk.FrameworkBase.TraceFormat;
 using Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 using Microwalk.FrameworkBase.Utilities;
-using Standart.Hash.xxHash;
 
 namespace Microwalk.Analysis.Modules;
 
@@ -56,6 +55,13 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
 
     public override async Task AddTraceAsync(TraceEntity traceEntity)
     {
+        // The trace generator may have computed the call tree already
+        if(traceEntity.PreprocessedTraceFile == null && FingerprintFile.IsFingerprintFile(traceEntity.RawTraceFilePath))
+        {
+            await AddFingerprintAsync(traceEntity.Id, traceEntity.RawTraceFilePath!);
+            return;
+        }
+
         // Input check
         if(traceEntity.PreprocessedTraceFile == null)
             throw new Exception("Preprocessed trace is null. Is the preprocessor stage missing?");
@@ -71,7 +77,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
             Hits = 1,
             Parent = null,
             Children = new Dictionary<ulong, CallTreeNode>(),
-            InstructionHashes = new Dictionary<ulong, byte[]>()
+            InstructionHashes = new InstructionHashTable()
         };
         currentCallTree.Push(rootNode);
 
@@ -80,24 +86,25 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
         Dictionary<int, int> allocationIdToUnifiedIdMap = new();
 
         // Iterate trace entries
-        byte[] callStackHashBuffer = new byte[16];
-        foreach(var traceEntry in traceEntity.PreprocessedTraceFile)
+        // The trace entries are not stored, so we can decode them into value types
+        using var traceReader = traceEntity.PreprocessedTraceFile.GetEntryReader();
+        while(traceReader.MoveNext())
         {
+
             // Retrieve current call tree node
             var currentNode = currentCallTree.Peek();
-            BinaryPrimitives.WriteUInt64LittleEndian(callStackHashBuffer, currentNode.CallStackId);
 
             // Handle allocations
-            if(traceEntry.EntryType == TraceEntryTypes.HeapAllocation)
+            if(traceReader.EntryType == TraceEntryTypes.HeapAllocation)
             {
-                var allocation = (HeapAllocation)traceEntry;
+                var allocation = traceReader.ReadHeapAllocation();
                 allocationIdToUnifiedIdMap.Add(allocation.Id, nextUnifiedAllocationId++);
             }
 
             // Handle branch instructions
-            if(traceEntry.EntryType == TraceEntryTypes.Branch)
+            if(traceReader.EntryType == TraceEntryTypes.Branch)
             {
-                var branch = (Branch)traceEntry;
+                var branch = traceReader.ReadBranch();
 
                 // Only analyze taken branches
                 if(!branch.Taken)
@@ -117,13 +124,12 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                             Hits = 0,
                             Parent = currentNode,
                             Children = new Dictionary<ulong, CallTreeNode>(),
-                            InstructionHashes = new Dictionary<ulong, byte[]>()
+                            InstructionHashes = new InstructionHashTable()
                         };
                         currentNode.Children.Add(targetInstructionId, targetNode);
 
                         // Compute call stack ID
-                        BinaryPrimitives.WriteUInt64LittleEndian(callStackHashBuffer.AsSpan(8), targetInstructionId);
-                        targetNode.CallStackId = xxHash64.ComputeHash(callStackHashBuffer, 16);
+                        targetNode.CallStackId = InstructionHashTable.XxHash64(currentNode.CallStackId, targetInstructionId);
                     }
 
                     // Format instruction
@@ -155,11 +161,11 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
             // Extract instruction and memory address IDs
             ulong instructionId;
             ulong memoryAddressId;
-            switch(traceEntry.EntryType)
+            switch(traceReader.EntryType)
             {
                 case TraceEntryTypes.HeapMemoryAccess:
                 {
-                    var heapMemoryAccess = (HeapMemoryAccess)traceEntry;
+                    var heapMemoryAccess = traceReader.ReadHeapMemoryAccess();
 
                     if(!allocationIdToUnifiedIdMap.TryGetValue(heapMemoryAccess.HeapAllocationBlockId, out int unifiedAllocationId))
                         unifiedAllocationId = 1000000 + heapMemoryAccess.HeapAllocationBlockId;
@@ -175,7 +181,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                 }
                 case TraceEntryTypes.ImageMemoryAccess:
                 {
-                    var imageMemoryAccess = (ImageMemoryAccess)traceEntry;
+                    var imageMemoryAccess = traceReader.ReadImageMemoryAccess();
                     instructionId = ((ulong)imageMemoryAccess.InstructionImageId << 32) | imageMemoryAccess.InstructionRelativeAddress;
                     memoryAddressId = ((ulong)imageMemoryAccess.MemoryImageId << 32) | imageMemoryAccess.MemoryRelativeAddress;
 
@@ -187,7 +193,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                 }
                 case TraceEntryTypes.StackMemoryAccess:
                 {
-                    var stackMemoryAccess = (StackMemoryAccess)traceEntry;
+                    var stackMemoryAccess = traceReader.ReadStackMemoryAccess();
                     instructionId = ((ulong)stackMemoryAccess.InstructionImageId << 32) | stackMemoryAccess.InstructionRelativeAddress;
                     memoryAddressId = stackMemoryAccess.MemoryRelativeAddress;
 
@@ -201,23 +207,68 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                     continue;
             }
 
-            // Retrieve old hash
-            if(!currentNode.InstructionHashes.TryGetValue(instructionId, out var hash))
-            {
-                hash = new byte[16];
-                currentNode.InstructionHashes.Add(instructionId, hash);
-            }
-
             // Update hash:
             // newHash = hash(oldHash || address)
-            BinaryPrimitives.WriteUInt64LittleEndian(hash.AsSpan(8), memoryAddressId);
-            BinaryPrimitives.WriteUInt64LittleEndian(hash.AsSpan(0), xxHash64.ComputeHash(hash, 16));
+            currentNode.InstructionHashes.AddMemoryAccess(instructionId, memoryAddressId);
         }
 
         // Store call tree
         _testcaseCallTrees.AddOrUpdate(traceEntity.Id, rootNode, (_, n) => n);
     }
 
+    /// <summary>
+    /// Loads the call tree of the given testcase from a fingerprint file.
+    /// </summary>
+    /// <param name="testcaseId">Testcase ID.</param>
+    /// <param name="fingerprintFilePath">Path of the fingerprint file.</param>
+    private async Task AddFingerprintAsync(int testcaseId, string fingerprintFilePath)
+    {
+        var fingerprintFile = new FingerprintFile(await File.ReadAllBytesAsync(fingerprintFilePath));
+        if(fingerprintFile.Kind != FingerprintFile.FingerprintKinds.CallStackMemoryAccess)
+            throw new Exception($"Unsupported fingerprint kind {fingerprintFile.Kind} in {fingerprintFilePath}.");
+
+        // Rebuild call tree; parents are always stored before their children
+        var callTreeNodes = new Dictionary<ulong, CallTreeNode>();
+        CallTreeNode? rootNode = null;
+        foreach(var callStackNode in fingerprintFile.CallStackNodes)
+        {
+            var parentNode = rootNode == null ? null : callTreeNodes[callStackNode.ParentCallStackId];
+            var node = new CallTreeNode
+            {
+                InstructionId = callStackNode.InstructionId,
+                CallStackId = callStackNode.CallStackId,
+                Hits = callStackNode.Hits,
+                Parent = parentNode,
+                Children = new Dictionary<ulong, CallTreeNode>(),
+                InstructionHashes = fingerprintFile.CallStackInstructionHashes[callStackNode.CallStackId]
+            };
+            callTreeNodes.Add(node.CallStackId, node);
+            rootNode ??= node;
+            parentNode?.Children.Add(node.InstructionId, node);
+
+            // Format call target and instructions
+            if(parentNode != null)
+            {
+                StoreFormattedInstruction(node.InstructionId,
+                    fingerprintFile.ImageFiles[(int)(node.InstructionId >> 32)],
+                    (uint)node.InstructionId);
+            }
+
+            foreach(var (instructionId, _) in node.InstructionHashes)
+            {
+                StoreFormattedInstruction(instructionId,
+                    fingerprintFile.ImageFiles[(int)(instructionId >> 32)],
+                    (uint)instructionId);
+            }
+        }
+
+        if(rootNode == null)
+            throw new Exception($"Fingerprint file {fingerprintFilePath} does not contain a call tree.");
+
+        // Store call tree
+        _testcaseCallTrees.AddOrUpdate(testcaseId, rootNode, (_, n) => n);
+    }
+
     public override async Task FinishAsync()
     {
         // Keep track of call stacks: Call stack ID -> [instruction ID 1, instruction ID 2, ...]
@@ -266,27 +317,27 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                     pendingCallTreeNodes.Enqueue(childNode.Value);
 
                 // Iterate instructions at this call stack level
-                foreach(var instruction in currentNode.InstructionHashes)
+                foreach(var (instructionId, hash) in currentNode.InstructionHashes)
                 {
                     // Did we already encounter this call stack? Retrieve instruction data container
-                    if(!instructions.TryGetValue((currentNode.CallStackId, instruction.Key), out var instructionData))
+                    if(!instructions.TryGetValue((currentNode.CallStackId, instructionId), out var instructionData))
                     {
                         instructionData = new InstructionData();
-                        instructions.Add((currentNode.CallStackId, instruction.Key), instructionData);
+                        instructions.Add((currentNode.CallStackId, instructionId), instructionData);
                     }
 
                     // Add data from this testcase
                     ++instructionData.TestcaseCount;
-                    instructionData.HashCounts.TryGetValue(instruction.Value, out int hashCount); // Will be 0 if not existing
-                    instructionData.HashCounts[instruction.Value] = hashCount + 1;
+                    instructionData.HashCounts.TryGetValue(hash, out int hashCount); // Will be 0 if not existing
+                    instructionData.HashCounts[hash] = hashCount + 1;
 
                     // Store testcase IDs only when a full data dump is requested, since this is quite expensive
                     if(_dumpFullData)
                     {
                         // Make sure testcase ID list exists
-                        if(!instructionData.HashTestcases.ContainsKey(instruction.Value))
-                            instructionData.HashTestcases.Add(instruction.Value, new List<int>());
-                        instructionData.HashTestcases[instruction.Value].Add(testcase.Key);
+                        if(!instructionData.HashTestcases.ContainsKey(hash))
+                            instructionData.HashTestcases.Add(hash, new List<int>());
+                        instructionData.HashTestcases[hash].Add(testcase.Key);
                     }
                 }
             }
@@ -350,7 +401,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                 // Find minimum guessing entropy of each trace, weighting is not needed here
                 // Also store the hash value which has the lowest guessing entropy value
                 double minConditionalGuessingEntropy = double.MaxValue;
-                byte[] minConditionalGuessingEntropyHash = Array.Empty<byte>();
+                UInt128 minConditionalGuessingEntropyHash = 0;
                 foreach(var hashCount in instruction.Value.HashCounts)
                 {
                     double traceConditionalGuessingEntropy = (hashCount.Value + 1.0) / 2;
@@ -375,6 +426,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
         // Store results
         await Logger.LogInfoAsync($"{_genericLogMessagePrefix} Call stack memory access trace leakage analysis completed, writing results");
         string FormatCallStackId(ulong callStackId) => "CS-" + callStackId.ToString("x16");
+        string FormatInstructionHash(UInt128 hash) => "IN-" + BinaryPrimitives.ReverseEndianness((ulong)hash).ToString("X16");
         string csvListSeparator = ";"; // TextInfo.ListSeparator is unreliable
         if(_outputFormat == OutputFormat.Txt)
         {
@@ -399,7 +451,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
             foreach(var instructionData in instructionLeakage.OrderBy(l => l.Value.MinConditionalGuessingEntropy).ThenBy(mi => mi.Key))
                 await minCondGuessEntropyWriter.WriteLineAsync($"Instruction {FormatCallStackId(instructionData.Key.Item1)}...{_formattedInstructions[instructionData.Key.Item2]}: " +
                                                                $"{instructionData.Value.MinConditionalGuessingEntropy.ToString("N", numberFormat)} guesses " +
-                                                               $"[IN-{string.Concat(instructionData.Value.MinConditionalGuessingEntropyHash.Take(8).Select(b => b.ToString("X2")))}]");
+                                                               $"[{FormatInstructionHash(instructionData.Value.MinConditionalGuessingEntropyHash)}]");
         }
         else if(_outputFormat == OutputFormat.Csv)
         {
@@ -437,7 +489,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                                                csvListSeparator +
                                                leakageData.MinConditionalGuessingEntropy.ToString("N3") +
                                                csvListSeparator +
-                                               "IN-" + string.Concat(leakageData.MinConditionalGuessingEntropyHash.Take(8).Select(b => b.ToString("X2"))));
+                                               FormatInstructionHash(leakageData.MinConditionalGuessingEntropyHash));
             }
         }
 
@@ -479,7 +531,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
                     foreach(var hashCount in instruction.Value.HashCounts)
                     {
                         // Write hash and number of hits
-                        await traceHashDumpWriter.WriteAsync($"      IN-{string.Concat(hashCount.Key.Take(8).Select(b => b.ToString("X2")))}: [{hashCount.Value}]");
+                        await traceHashDumpWriter.WriteAsync($"      {FormatInstructionHash(hashCount.Key)}: [{hashCount.Value}]");
 
                         // Write testcases yielding this hash
                         // Try to merge consecutive test case IDs: "1 3 4 5 7" -> "1 3-5 7"
@@ -658,7 +710,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
         /// <summary>
         /// Memory address hashes of read/write instructions. Instruction ID -> hash.
         /// </summary>
-        public Dictionary<ulong, byte[]> InstructionHashes { get; init; } = null!;
+        public InstructionHashTable InstructionHashes { get; init; } = null!;
     }
 
     /// <summary>
@@ -683,18 +735,18 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
     private class InstructionData
     {
         public int TestcaseCount { get; set; }
-        public Dictionary<byte[], int> HashCounts { get; }
+        public Dictionary<UInt128, int> HashCounts { get; }
 
         /// <summary>
         /// This is only filled and used when a data dump is requested.
         /// </summary>
-        public Dictionary<byte[], List<int>> HashTestcases { get; }
+        public Dictionary<UInt128, List<int>> HashTestcases { get; }
 
         public InstructionData()
         {
             TestcaseCount = 0;
-            HashCounts = new Dictionary<byte[], int>(new ByteArrayComparer());
-            HashTestcases = new Dictionary<byte[], List<int>>(new ByteArrayComparer());
+            HashCounts = new Dictionary<UInt128, int>();
+            HashTestcases = new Dictionary<UInt128, List<int>>();
         }
     }
 
@@ -707,7 +759,7 @@ internal class CallStackMemoryAccessTraceLeakage : AnalysisStage
         public double MinEntropy { get; set; }
         public double ConditionalGuessingEntropy { get; set; }
         public double MinConditionalGuessingEntropy { get; set; }
-        public byte[] MinConditionalGuessingEntropyHash { get; set; } = null!;
+        public UInt128 MinConditionalGuessingEntropyHash { get; set; }
     }
 
     /// <summary>
@@ -0,0 +1,279 @@
+﻿using System.Collections.Generic;
+using System.Linq;
+using System.Threading.Tasks;
+
+namespace Microwalk.Analysis.Modules;
+
+public partial class ControlFlowLeakage
+{
+    /// <summary>
+    /// Merges the given partial call trees into a single one.
+    /// </summary>
+    /// <param name="callTrees">Partial call trees. The list is emptied.</param>
+    /// <returns>Root node of the merged call tree.</returns>
+    private async Task<RootNode> MergeCallTreesAsync(List<RootNode> callTrees)
+    {
+        if(callTrees.Count == 0)
+            return new RootNode();
+
+        // Merge pairs of call trees in parallel, until only one is left
+        while(callTrees.Count > 1)
+        {
+            var mergeTasks = new List<Task<RootNode>>();
+            for(int i = 0; i + 1 < callTrees.Count; i += 2)
+            {
+                var target = callTrees[i];
+                var source = callTrees[i + 1];
+                mergeTasks.Add(Task.Run(() =>
+                {
+                    MergeCallTree(target, source);
+                    return target;
+                }));
+            }
+
+            var mergedCallTrees = (await Task.WhenAll(mergeTasks)).ToList();
+            if(callTrees.Count % 2 != 0)
+                mergedCallTrees.Add(callTrees[^1]);
+
+            callTrees.Clear();
+            callTrees.AddRange(mergedCallTrees);
+        }
+
+        var rootNode = callTrees[0];
+        callTrees.Clear();
+        return rootNode;
+    }
+
+    /// <summary>
+    /// Merges the source call tree into the target call tree. The source tree is consumed, i.e., its nodes are reused in the target tree.
+    /// </summary>
+    /// <param name="target">Root node of the target call tree.</param>
+    /// <param name="source">Root node of the source call tree.</param>
+    /// <remarks>
+    /// The trees are walked in trace order, like in <see cref="AddTraceToCallTreeAsync"/>: Matching successors are merged, and at the first
+    /// difference both remainders become split successors. When the source tree has an allocation node at the same position as the target tree,
+    /// the source allocation ID is mapped to the target one, and all subsequent memory access targets in the source tree are translated accordingly.
+    /// </remarks>
+    private void MergeCallTree(RootNode target, RootNode source)
+    {
+        // Maps allocation IDs of the source tree to the ones of matching allocation nodes in the target tree
+        Dictionary<int, int> allocationIdMapping = new();
+
+        // Iterative depth-first search, to avoid running out of stack space for deeply nested splits
+        // The testcase IDs of the target node are those before merging; they are set when a node pair is first encountered.
+        Stack<(SplitNode Target, SplitNode Source, TestcaseIdSet? TargetTestcaseIds, int SuccessorIndex)> nodeStack = new();
+        nodeStack.Push((target, source, null, 0));
+        while(nodeStack.Count > 0)
+        {
+            var (targetNode, sourceNode, targetTestcaseIds, successorIndex) = nodeStack.Pop();
+
+            // First time encounter of this node pair?
+            if(targetTestcaseIds == null)
+            {
+                targetTestcaseIds = targetNode.TestcaseIds.Copy();
+                targetNode.TestcaseIds.UnionWith(sourceNode.TestcaseIds);
+            }
+
+            // Merge common successors
+            bool descended = false;
+            while(successorIndex < targetNode.Successors.Count
+                  && successorIndex < sourceNode.Successors.Count
+                  && SuccessorsMatch(targetNode.Successors[successorIndex], sourceNode.Successors[successorIndex]))
+            {
+                var targetSuccessor = targetNode.Successors[successorIndex];
+                var sourceSuccessor = sourceNode.Successors[successorIndex];
+
+                if(targetSuccessor is CallNode targetCallNode)
+                {
+                    // Handle the called function first, as later memory accesses may use its allocations
+                    nodeStack.Push((targetNode, sourceNode, targetTestcaseIds, successorIndex + 1));
+                    nodeStack.Push((targetCallNode, (CallNode)sourceSuccessor, null, 0));
+                    descended = true;
+                    break;
+                }
+
+                if(targetSuccessor is AllocationNode targetAllocationNode)
+                    allocationIdMapping[((AllocationNode)sourceSuccessor).Id] = targetAllocationNode.Id;
+                else if(targetSuccessor is MemoryAccessNode targetMemoryAccessNode)
+                    targetNode.Successors[successorIndex] = MergeMemoryAccessNodes(targetMemoryAccessNode, targetTestcaseIds, (MemoryAccessNode)sourceSuccessor, sourceNode.TestcaseIds, allocationIdMapping);
+
+                ++successorIndex;
+            }
+
+            if(descended)
+                continue;
+
+            // If the target node has further successors, move them to a new split successor
+            if(successorIndex < targetNode.Successors.Count)
+            {
+                var remainderSplitNode = new SplitNode();
+                remainderSplitNode.TestcaseIds.UnionWith(targetTestcaseIds);
+                remainderSplitNode.Successors.AddRange(targetNode.Successors.Skip(successorIndex));
+                targetNode.Successors.RemoveRange(successorIndex, targetNode.Successors.Count - successorIndex);
+                remainderSplitNode.SplitSuccessors.AddRange(targetNode.SplitSuccessors);
+                targetNode.SplitSuccessors.Clear();
+                targetNode.SplitSuccessors.Add(remainderSplitNode);
+            }
+
+            // Merge the remainder of the source node with the split successors of the target node
+            List<SplitNode> sourceSplitSuccessors;
+            if(successorIndex < sourceNode.Successors.Count)
+            {
+                var remainderSplitNode = new SplitNode();
+                remainderSplitNode.TestcaseIds.UnionWith(sourceNode.TestcaseIds);
+                remainderSplitNode.Successors.AddRange(sourceNode.Successors.Skip(successorIndex));
+                remainderSplitNode.SplitSuccessors.AddRange(sourceNode.SplitSuccessors);
+                sourceSplitSuccessors = new List<SplitNode> { remainderSplitNode };
+            }
+            else
+                sourceSplitSuccessors = sourceNode.SplitSuccessors;
+
+            foreach(var sourceSplitSuccessor in sourceSplitSuccessors)
+            {
+                var matchingSplitSuccessor = targetNode.SplitSuccessors.FirstOrDefault(s => SuccessorsMatch(s.Successors[0], sourceSplitSuccessor.Successors[0]));
+                if(matchingSplitSuccessor != null)
+                    nodeStack.Push((matchingSplitSuccessor, sourceSplitSuccessor, null, 0));
+                else
+                {
+                    MapAllocationIds(sourceSplitSuccessor, allocationIdMapping);
+                    targetNode.SplitSuccessors.Add(sourceSplitSuccessor);
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Checks whether the given call tree nodes from different trees describe the same trace entry, as in <see cref="AddTraceToCallTreeAsync"/>.
+    /// </summary>
+    private static bool SuccessorsMatch(CallTreeNode targetNode, CallTreeNode sourceNode)
+    {
+        return (targetNode, sourceNode) switch
+        {
+            (CallNode t, CallNode s) => t.SourceInstructionId == s.SourceInstructionId && t.TargetInstructionId == s.TargetInstructionId,
+            (ReturnNode t, ReturnNode s) => t.SourceInstructionId == s.SourceInstructionId && t.TargetInstructionId == s.TargetInstructionId,
+            (ReturnNode, _) or (_, ReturnNode) => false,
+            (BranchNode t, BranchNode s) => t.SourceInstructionId == s.SourceInstructionId && t.TargetInstructionId == s.TargetInstructionId,
+            (AllocationNode t, AllocationNode s) => t.Size == s.Size && t.IsHeap == s.IsHeap,
+            (MemoryAccessNode t, MemoryAccessNode s) => t.InstructionId == s.InstructionId,
+            _ => false
+        };
+    }
+
+    /// <summary>
+    /// Merges two memory access nodes of the same instruction.
+    /// </summary>
+    /// <param name="targetNode">Memory access node of the target tree.</param>
+    /// <param name="targetTestcaseIds">Testcases of the target tree which executed the memory access.</param>
+    /// <param name="sourceNode">Memory access node of the source tree.</param>
+    /// <param name="sourceTestcaseIds">Testcases of the source tree which executed the memory access.</param>
+    /// <param name="allocationIdMapping">Allocation ID mapping from the source to the target tree.</param>
+    /// <returns>The merged memory access node.</returns>
+    private MemoryAccessNode MergeMemoryAccessNodes(MemoryAccessNode targetNode, TestcaseIdSet targetTestcaseIds, MemoryAccessNode sourceNode, TestcaseIdSet sourceTestcaseIds,
+        Dictionary<int, int> allocationIdMapping)
+    {
+        if(targetNode is SimpleMemoryAccessNode simpleTargetNode && sourceNode is SimpleMemoryAccessNode simpleSourceNode
+                                                                 && simpleTargetNode.TargetAddress == MapTargetAddress(simpleSourceNode.TargetAddress, allocationIdMapping))
+            return targetNode;
+
+        // There are different targets, so we need a split memory access node
+        if(targetNode is not SplitMemoryAccessNode splitTargetNode)
+        {
+            splitTargetNode = new SplitMemoryAccessNode(targetNode.InstructionId, targetNode.IsWrite);
+            splitTargetNode.Targets.Add(((SimpleMemoryAccessNode)targetNode).TargetAddress, targetTestcaseIds.Copy());
+        }
+
+        IEnumerable<(ulong TargetAddress, TestcaseIdSet TestcaseIds)> sourceTargets = sourceNode switch
+        {
+            SimpleMemoryAccessNode s => new[] { (s.TargetAddress, sourceTestcaseIds) },
+            SplitMemoryAccessNode s => s.Targets.Select(t => (t.Key, t.Value)),
+            _ => Enumerable.Empty<(ulong, TestcaseIdSet)>()
+        };
+        foreach(var (sourceTargetAddress, testcaseIds) in sourceTargets)
+        {
+            ulong targetAddress = MapTargetAddress(sourceTargetAddress, allocationIdMapping);
+            if(splitTargetNode.Targets.TryGetValue(targetAddress, out var targetAddressTestcaseIds))
+                targetAddressTestcaseIds.UnionWith(testcaseIds);
+            else
+                splitTargetNode.Targets.Add(targetAddress, testcaseIds.Copy());
+        }
+
+        return splitTargetNode;
+    }
+
+    /// <summary>
+    /// Translates the memory access targets in the given subtree according to the given allocation ID mapping.
+    /// </summary>
+    /// <param name="subtreeRootNode">Root node of the subtree.</param>
+    /// <param name="allocationIdMapping">Allocation ID mapping.</param>
+    private void MapAllocationIds(SplitNode subtreeRootNode, Dictionary<int, int> allocationIdMapping)
+    {
+        if(allocationIdMapping.Count == 0)
+            return;
+
+        Stack<SplitNode> nodeStack = new();
+        nodeStack.Push(subtreeRootNode);
+        while(nodeStack.Count > 0)
+        {
+            var currentNode = nodeStack.Pop();
+
+            for(int i = 0; i < currentNode.Successors.Count; ++i)
+            {
+                switch(currentNode.Successors[i])
+                {
+                    case CallNode callNode:
+                    {
+                        nodeStack.Push(callNode);
+                        break;
+                    }
+
+                    case SimpleMemoryAccessNode simpleMemoryAccessNode:
+                    {
+                        ulong targetAddress = MapTargetAddress(simpleMemoryAccessNode.TargetAddress, allocationIdMapping);
+                        if(targetAddress != simpleMemoryAccessNode.TargetAddress)
+                            currentNode.Successors[i] = new SimpleMemoryAccessNode(simpleMemoryAccessNode.InstructionId, simpleMemoryAccessNode.IsWrite, targetAddress);
+                        break;
+                    }
+
+                    case SplitMemoryAccessNode splitMemoryAccessNode:
+                    {
+                        var mappedTargets = splitMemoryAccessNode.Targets.ToList();
+                        splitMemoryAccessNode.Targets.Clear();
+                        foreach(var (targetAddress, testcaseIds) in mappedTargets)
+                        {
+                            ulong mappedTargetAddress = MapTargetAddress(targetAddress, allocationIdMapping);
+                            if(splitMemoryAccessNode.Targets.TryGetValue(mappedTargetAddress, out var existingTestcaseIds))
+                                existingTestcaseIds.UnionWith(testcaseIds);
+                            else
+                                splitMemoryAccessNode.Targets.Add(mappedTargetAddress, testcaseIds);
+                        }
+
+                        break;
+                    }
+                }
+            }
+
+            foreach(var splitSuccessor in currentNode.SplitSuccessors)
+                nodeStack.Push(splitSuccessor);
+        }
+    }
+
+    /// <summary>
+    /// Translates the allocation ID of the given encoded memory access target.
+    /// </summary>
+    /// <param name="targetAddress">Encoded target address.</param>
+    /// <param name="allocationIdMapping">Allocation ID mapping.</param>
+    /// <returns>The encoded target address with the translated allocation ID. The address is formatted, if it is new.</returns>
+    private ulong MapTargetAddress(ulong targetAddress, Dictionary<int, int> allocationIdMapping)
+    {
+        // Image addresses do not reference allocations
+        if((targetAddress & _addressIdFlagMemory) == 0)
+            return targetAddress;
+
+        int allocationId = (int)((targetAddress & ~_addressIdFlagsMask) >> 32);
+        if(!allocationIdMapping.TryGetValue(allocationId, out var mappedAllocationId))
+            return targetAddress;
+
+        // The target tree may not have accessed this particular address yet
+        return StoreFormattedMemoryAddress((targetAddress & _addressIdFlagHeap) != 0, mappedAllocationId, (uint)targetAddress);
+    }
+}
@@ -1,5 +1,7 @@
-﻿using System.Collections.Generic;
+﻿using System;
+using System.Collections.Generic;
 using System.Numerics;
+using System.Runtime.InteropServices;
 
 namespace Microwalk.Analysis.Modules;
 
@@ -7,30 +9,31 @@ public partial class ControlFlowLeakage
 {
     /// <summary>
     /// Utility class for efficient storage of a testcase ID set.
-    /// Assumes that testcase IDs are small and don't have large gaps in between.
+    /// Uses a compressed bitmap in the style of Roaring bitmaps: The IDs are grouped by their upper 16 bits, and each group is stored in a container,
+    /// which is either a sorted array (for sparse groups) or a bitmap (for dense groups).
     /// </summary>
     /// <remarks>
+    /// Containers are shared between copies of a set, and only copied when they are modified (copy-on-write). Once shared, a container is never modified
+    /// again, so sets derived from each other may be read concurrently.
+    ///
     /// This class is not thread-safe.
     /// </remarks>
     private class TestcaseIdSet
     {
-        private ulong[] _testcaseIdBitField = new ulong[1];
-
-        private void EnsureArraySize(int id)
-        {
-            if(id / 64 < _testcaseIdBitField.Length)
-                return;
-
-            int newSize = 2 * _testcaseIdBitField.Length;
-            while(newSize <= id / 64)
-                newSize *= 2;
+        /// <summary>
+        /// Upper 16 bits of the IDs stored in the respective container, in ascending order.
+        /// </summary>
+        private ushort[] _keys = Array.Empty<ushort>();
 
-            // Resize
-            ulong[] newBitField = new ulong[newSize];
-            _testcaseIdBitField.CopyTo(newBitField, 0);
+        /// <summary>
+        /// Containers holding the lower 16 bits of the IDs.
+        /// </summary>
+        private Container[] _containers = Array.Empty<Container>();
 
-            _testcaseIdBitField = newBitField;
-        }
+        /// <summary>
+        /// Number of used entries in <see cref="_keys"/> and <see cref="_containers"/>.
+        /// </summary>
+        private int _containerCount;
 
         /// <summary>
         /// Adds the given testcase ID to this set, if it is not yet included.
@@ -38,9 +41,15 @@ public partial class ControlFlowLeakage
         /// <param name="id">Testcase ID.</param>
         public void Add(int id)
         {
-            EnsureArraySize(id);
+            ushort key = (ushort)(id >> 16);
+            int index = Array.BinarySearch(_keys, 0, _containerCount, key);
+            if(index < 0)
+            {
+                index = ~index;
+                InsertContainer(index, key, new Container());
+            }
 
-            _testcaseIdBitField[id / 64] |= (1ul << (id % 64));
+            GetWritableContainer(index).Add((ushort)id);
         }
 
         /// <summary>
@@ -49,9 +58,72 @@ public partial class ControlFlowLeakage
         /// <param name="id">Testcase ID.</param>
         public void Remove(int id)
         {
-            EnsureArraySize(id);
+            int index = Array.BinarySearch(_keys, 0, _containerCount, (ushort)(id >> 16));
+            if(index < 0 || !_containers[index].Contains((ushort)id))
+                return;
+
+            var container = GetWritableContainer(index);
+            container.Remove((ushort)id);
+
+            // Drop empty containers
+            if(container.Cardinality == 0)
+            {
+                Array.Copy(_keys, index + 1, _keys, index, _containerCount - index - 1);
+                Array.Copy(_containers, index + 1, _containers, index, _containerCount - index - 1);
+                --_containerCount;
+                _containers[_containerCount] = null!;
+            }
+        }
+
+        /// <summary>
+        /// Adds all testcase IDs of the given set to this set.
+        /// </summary>
+        /// <param name="other">Testcase ID set.</param>
+        public void UnionWith(TestcaseIdSet other)
+        {
+            // Merge sorted key lists
+            ushort[] newKeys = new ushort[_containerCount + other._containerCount];
+            Container[] newContainers = new Container[newKeys.Length];
+            int newContainerCount = 0;
+            int i = 0;
+            int j = 0;
+            while(i < _containerCount || j < other._containerCount)
+            {
+                if(j == other._containerCount || (i < _containerCount && _keys[i] < other._keys[j]))
+                {
+                    newKeys[newContainerCount] = _keys[i];
+                    newContainers[newContainerCount] = _containers[i];
+                    ++i;
+                }
+                else if(i == _containerCount || other._keys[j] < _keys[i])
+                {
+                    // Share container with the other set
+                    var otherContainer = other._containers[j];
+                    otherContainer.IsShared = true;
+
+                    newKeys[newContainerCount] = other._keys[j];
+                    newContainers[newContainerCount] = otherContainer;
+                    ++j;
+                }
+                else
+                {
+                    var container = _containers[i];
+                    if(container.IsShared)
+                        container = container.Clone();
+                    container.UnionWith(other._containers[j]);
+
+                    newKeys[newContainerCount] = _keys[i];
+                    newContainers[newContainerCount] = container;
+                    ++i;
+                    ++j;
+                }
+
+                ++newContainerCount;
+            }
 
-            _testcaseIdBitField[id / 64] &= ~(1ul << (id % 64));
+            _keys = newKeys;
+            _containers = newContainers;
+            _containerCount = newContainerCount;
         }
 
         /// <summary>
@@ -72,21 +144,24 @@ public partial class ControlFlowLeakage
         }
 
         /// <summary>
-        /// Returns a deep copy of this set.
+        /// Returns a copy of this set. The containers are shared between both sets until they are modified.
         /// </summary>
         public TestcaseIdSet Copy()
         {
             TestcaseIdSet s = new TestcaseIdSet
             {
-                _testcaseIdBitField = new ulong[_testcaseIdBitField.Length]
+                _keys = _keys.AsSpan(0, _containerCount).ToArray(),
+                _containers = _containers.AsSpan(0, _containerCount).ToArray(),
+                _containerCount = _containerCount
             };
-            _testcaseIdBitField.CopyTo(s._testcaseIdBitField, 0);
+            for(int i = 0; i < _containerCount; ++i)
+                _containers[i].IsShared = true;
 
             return s;
         }
 
         /// <summary>
-        /// Returns a deep copy of this set, with the given ID removed.
+        /// Returns a copy of this set, with the given ID removed.
         /// </summary>
         /// <param name="id">ID to exclude from the copied set.</param>
         /// <returns></returns>
@@ -103,16 +178,11 @@ public partial class ControlFlowLeakage
         /// </summary>
         public IEnumerable<int> AsEnumerable()
         {
-            for(int i = 0; i < _testcaseIdBitField.Length; ++i)
+            for(int i = 0; i < _containerCount; ++i)
             {
-                ulong b = _testcaseIdBitField[i];
-                for(int j = 0; j < 64; ++j)
-                {
-                    if((b & 1) != 0)
-                        yield return 64 * i + j;
-
-                    b >>= 1;
-                }
+                int high = _keys[i] << 16;
+                foreach(var low in _containers[i].AsEnumerable())
+                    yield return high | low;
             }
         }
 
@@ -128,12 +198,285 @@ public partial class ControlFlowLeakage
         {
             get
             {
-                // This is much faster than _testcaseIdBitField.Sum(BitOperations.PopCount), probably due to better inlining
                 int count = 0;
-                foreach(var b in _testcaseIdBitField)
-                    count += BitOperations.PopCount(b);
+                for(int i = 0; i < _containerCount; ++i)
+                    count += _containers[i].Cardinality;
                 return count;
             }
         }
+
+        private void InsertContainer(int index, ushort key, Container container)
+        {
+            if(_containerCount == _keys.Length)
+            {
+                int newSize = Math.Max(1, 2 * _keys.Length);
+                Array.Resize(ref _keys, newSize);
+                Array.Resize(ref _containers, newSize);
+            }
+
+            Array.Copy(_keys, index, _keys, index + 1, _containerCount - index);
+            Array.Copy(_containers, index, _containers, index + 1, _containerCount - index);
+            _keys[index] = key;
+            _containers[index] = container;
+            ++_containerCount;
+        }
+
+        /// <summary>
+        /// Returns the container at the given index, after copying it if it is shared with another set.
+        /// </summary>
+        /// <param name="index">Container index.</param>
+        private Container GetWritableContainer(int index)
+        {
+            var container = _containers[index];
+            if(container.IsShared)
+            {
+                container = container.Clone();
+                _containers[index] = container;
+            }
+
+            return container;
+        }
+
+        /// <summary>
+        /// Stores the lower 16 bits of the IDs with a common upper 16 bit prefix.
+        /// </summary>
+        private sealed class Container
+        {
+            /// <summary>
+            /// Maximum number of values in an array container. Larger containers are stored as bitmap, which then needs less memory.
+            /// </summary>
+            private const int MaxArraySize = 4096;
+
+            /// <summary>
+            /// Size of a bitmap container.
+            /// </summary>
+            private const int BitmapSize = 65536 / 64;
+
+            /// <summary>
+            /// Sorted values, if this is an array container.
+            /// </summary>
+            private ushort[]? _values = new ushort[4];
+
+            /// <summary>
+            /// Bitmap, if this is a bitmap container.
+            /// </summary>
+            private ulong[]? _bitmap;
+
+            /// <summary>
+            /// Number of values in this container.
+            /// </summary>
+            public int Cardinality { get; private set; }
+
+            /// <summary>
+            /// Determines whether this container is referenced by more than one set, and thus must not be modified.
+            /// </summary>
+            public bool IsShared { get; set; }
+
+            /// <summary>
+            /// Returns an unshared copy of this container.
+            /// </summary>
+            public Container Clone()
+            {
+                return new Container
+                {
+                    _values = _values?.AsSpan(0, Cardinality).ToArray(),
+                    _bitmap = _bitmap?.AsSpan().ToArray(),
+                    Cardinality = Cardinality
+                };
+            }
+
+            public bool Contains(ushort value)
+            {
+                if(_bitmap != null)
+                    return (_bitmap[value / 64] & (1ul << (value % 64))) != 0;
+
+                return Array.BinarySearch(_values!, 0, Cardinality, value) >= 0;
+            }
+
+            public void Add(ushort value)
+            {
+                if(_bitmap != null)
+                {
+                    ref ulong word = ref _bitmap[value / 64];
+                    ulong mask = 1ul << (value % 64);
+                    if((word & mask) == 0)
+                    {
+                        word |= mask;
+                        ++Cardinality;
+                    }
+
+                    return;
+                }
+
+                int index = Array.BinarySearch(_values!, 0, Cardinality, value);
+                if(index >= 0)
+                    return;
+                index = ~index;
+
+                if(Cardinality == MaxArraySize)
+                {
+                    ConvertToBitmap();
+                    Add(value);
+                    return;
+                }
+
+                if(Cardinality == _values!.Length)
+                    Array.Resize(ref _values, Math.Clamp(2 * _values.Length, 4, MaxArraySize));
+
+                Array.Copy(_values, index, _values, index + 1, Cardinality - index);
+                _values[index] = value;
+                ++Cardinality;
+            }
+
+            public void Remove(ushort value)
+            {
+                if(_bitmap != null)
+                {
+                    ref ulong word = ref _bitmap[value / 64];
+                    ulong mask = 1ul << (value % 64);
+                    if((word & mask) != 0)
+                    {
+                        word &= ~mask;
+                        --Cardinality;
+
+                        if(Cardinality <= MaxArraySize)
+                            ConvertToArray();
+                    }
+
+                    return;
+                }
+
+                int index = Array.BinarySearch(_values!, 0, Cardinality, value);
+                if(index < 0)
+                    return;
+
+                Array.Copy(_values!, index + 1, _values!, index, Cardinality - index - 1);
+                --Cardinality;
+            }
+
+            public void UnionWith(Container other)
+            {
+                if(_bitmap != null && other._bitmap != null)
+                {
+                    // Bitmap sizes are a multiple of the vector size, so we don't need to handle a remainder
+                    var bitmapVectors = MemoryMarshal.Cast<ulong, Vector<ulong>>(_bitmap);
+                    var otherBitmapVectors = MemoryMarshal.Cast<ulong, Vector<ulong>>(other._bitmap);
+                    for(int i = 0; i < bitmapVectors.Length; ++i)
+                        bitmapVectors[i] |= otherBitmapVectors[i];
+
+                    UpdateBitmapCardinality();
+                }
+                else if(_bitmap != null)
+                {
+                    for(int i = 0; i < other.Cardinality; ++i)
+                    {
+                        ushort value = other._values![i];
+                        _bitmap[value / 64] |= 1ul << (value % 64);
+                    }
+
+                    UpdateBitmapCardinality();
+                }
+                else if(other._bitmap != null)
+                {
+                    ulong[] bitmap = other._bitmap.AsSpan().ToArray();
+                    for(int i = 0; i < Cardinality; ++i)
+                    {
+                        ushort value = _values![i];
+                        bitmap[value / 64] |= 1ul << (value % 64);
+                    }
+
+                    _bitmap = bitmap;
+                    _values = null;
+                    UpdateBitmapCardinality();
+                }
+                else
+                {
+                    // Merge sorted arrays
+                    ushort[] values = new ushort[Cardinality + other.Cardinality];
+                    int count = 0;
+                    int i = 0;
+                    int j = 0;
+                    while(i < Cardinality && j < other.Cardinality)
+                    {
+                        ushort a = _values![i];
+                        ushort b = other._values![j];
+                        values[count++] = a <= b ? a : b;
+                        if(a <= b)
+                            ++i;
+                        if(b <= a)
+                            ++j;
+                    }
+
+                    while(i < Cardinality)
+                        values[count++] = _values![i++];
+                    while(j < other.Cardinality)
+                        values[count++] = other._values![j++];
+
+                    _values = values;
+                    Cardinality = count;
+
+                    if(Cardinality > MaxArraySize)
+                        ConvertToBitmap();
+                }
+            }
+
+            public IEnumerable<int> AsEnumerable()
+            {
+                if(_bitmap != null)
+                {
+                    for(int i = 0; i < BitmapSize; ++i)
+                    {
+                        ulong b = _bitmap[i];
+                        while(b != 0)
+                        {
+                            yield return 64 * i + BitOperations.TrailingZeroCount(b);
+                            b &= b - 1;
+                        }
+                    }
+                }
+                else
+                {
+                    for(int i = 0; i < Cardinality; ++i)
+                        yield return _values![i];
+                }
+            }
+
+            private void ConvertToBitmap()
+            {
+                _bitmap = new ulong[BitmapSize];
+                for(int i = 0; i < Cardinality; ++i)
+                {
+                    ushort value = _values![i];
+                    _bitmap[value / 64] |= 1ul << (value % 64);
+                }
+
+                _values = null;
+            }
+
+            private void ConvertToArray()
+            {
+                _values = new ushort[MaxArraySize];
+                int count = 0;
+                for(int i = 0; i < BitmapSize; ++i)
+                {
+                    ulong b = _bitmap![i];
+                    while(b != 0)
+                    {
+                        _values[count++] = (ushort)(64 * i + BitOperations.TrailingZeroCount(b));
+                        b &= b - 1;
+                    }
+                }
+
+                _bitmap = null;
+            }
+
+            private void UpdateBitmapCardinality()
+            {
+                int count = 0;
+                foreach(var b in _bitmap!)
+                    count += BitOperations.PopCount(b);
+                Cardinality = count;
+            }
+        }
     }
-}
\ No newline at end of file
+}
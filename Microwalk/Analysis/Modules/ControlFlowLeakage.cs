@@ -1,10 +1,12 @@
 ﻿using System;
 using System.Buffers.Binary;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Globalization;
 using System.IO;
 using System.Linq;
 using System.Text;
+using System.Threading;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
@@ -30,7 +32,8 @@ public partial class ControlFlowLeakage : AnalysisStage
     /// </summary>
     private const ulong _rootNodeCallStackId = 0;
 
-    public override bool SupportsParallelism => false;
+    // Concurrent traces are added to separate call trees, which are merged in the end.
+    public override bool SupportsParallelism => true;
 
     /// <summary>
     /// The output directory for analysis results.
@@ -58,24 +61,29 @@ public partial class ControlFlowLeakage : AnalysisStage
     private bool _includeTestcasesInCallStacks;
 
     /// <summary>
-    /// Root node of merged call tree.
+    /// Root nodes of the partial call trees. Each call tree is only accessed by one thread at a time.
     /// </summary>
-    private readonly RootNode _rootNode = new();
+    private readonly List<RootNode> _callTrees = new();
+
+    /// <summary>
+    /// Partial call trees which are currently not used by a thread.
+    /// </summary>
+    private readonly ConcurrentBag<RootNode> _idleCallTrees = new();
 
     /// <summary>
     /// Lookup for formatted image addresses.
     /// </summary>
-    private readonly Dictionary<ulong, string> _formattedImageAddresses = new();
+    private readonly ConcurrentDictionary<ulong, string> _formattedImageAddresses = new();
 
     /// <summary>
     /// Lookup for image addresses (used for machine-readable call stack dump, which needs to preserve image offsets).
     /// </summary>
-    private readonly Dictionary<ulong, (string imageName, uint offset)> _imageAddresses = new();
+    private readonly ConcurrentDictionary<ulong, (string imageName, uint offset)> _imageAddresses = new();
 
     /// <summary>
     /// Lookup for formatted heap/stack addresses.
     /// </summary>
-    private readonly Dictionary<ulong, string> _formattedMemoryAddresses = new();
+    private readonly ConcurrentDictionary<ulong, string> _formattedMemoryAddresses = new();
 
     /// <summary>
     /// Allocation ID which is used for all stack memory accesses which could not be resolved to an allocation.
@@ -88,11 +96,36 @@ public partial class ControlFlowLeakage : AnalysisStage
     private const int _unmappedHeapAllocationId = 1;
 
     /// <summary>
-    /// Next ID for an allocation node.
+    /// Next ID for an allocation node. The IDs are unique across all partial call trees.
     /// </summary>
     private int _nextSharedAllocationId = 2;
 
     public override async Task AddTraceAsync(TraceEntity traceEntity)
+    {
+        // Use an idle partial call tree, or create a new one if all are in use
+        if(!_idleCallTrees.TryTake(out var rootNode))
+        {
+            rootNode = new RootNode();
+            lock(_callTrees)
+                _callTrees.Add(rootNode);
+        }
+
+        try
+        {
+            await AddTraceToCallTreeAsync(rootNode, traceEntity);
+        }
+        finally
+        {
+            _idleCallTrees.Add(rootNode);
+        }
+    }
+
+    /// <summary>
+    /// Adds the given trace to the given call tree.
+    /// </summary>
+    /// <param name="rootNode">Root node of the call tree.</param>
+    /// <param name="traceEntity">Trace entity.</param>
+    private async Task AddTraceToCallTreeAsync(RootNode rootNode, TraceEntity traceEntity)
     {
         /*
          * Runs linearly through a trace and stores it in a radix trie-like call tree structure.
@@ -127,7 +160,7 @@ public partial class ControlFlowLeakage : AnalysisStage
         await Logger.LogDebugAsync($"{logMessagePrefix} Processing trace #{traceEntity.Id}");
 
         // Mark our visit at the root node
-        _rootNode.TestcaseIds.Add(traceEntity.Id);
+        rootNode.TestcaseIds.Add(traceEntity.Id);
 
         // Buffer for call stack ID computations
         byte[] callStackBuffer = new byte[24]; // hash | source address | target address
@@ -142,19 +175,18 @@ public partial class ControlFlowLeakage : AnalysisStage
         // Run through trace entries
         Stack<(SplitNode node, int successorIndex)> nodeStack = new();
         Stack<ulong> callStackIds = new();
-        SplitNode currentNode = _rootNode;
+        SplitNode currentNode = rootNode;
         int successorIndex = 0;
         ulong currentCallStackId = _rootNodeCallStackId;
         int traceEntryId = -1;
-        var traceEnumerator = traceEntity.PreprocessedTraceFile.GetNonAllocatingEnumeratorWithPrefix();
-        while(traceEnumerator.MoveNext())
+        using var traceReader = traceEntity.PreprocessedTraceFile.GetEntryReaderWithPrefix();
+        while(traceReader.MoveNext())
         {
-            var traceEntry = traceEnumerator.Current;
             ++traceEntryId;
 
-            if(traceEntry.EntryType == TraceEntryTypes.Branch)
+            if(traceReader.EntryType == TraceEntryTypes.Branch)
             {
-                var branchEntry = (Branch)traceEntry;
+                var branchEntry = traceReader.ReadBranch();
 
                 // Format addresses
                 ulong sourceInstructionId = StoreFormattedImageAddress(traceEntity.PreprocessedTraceFile.Prefix!.ImageFiles[branchEntry.SourceImageId], branchEntry.SourceInstructionRelativeAddress);
@@ -495,7 +527,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                     }
                 }
             }
-            else if(traceEntry.EntryType is TraceEntryTypes.HeapAllocation or TraceEntryTypes.StackAllocation)
+            else if(traceReader.EntryType is TraceEntryTypes.HeapAllocation or TraceEntryTypes.StackAllocation)
             {
                 /*
                  * Step 1: Extract allocation data
@@ -504,11 +536,11 @@ public partial class ControlFlowLeakage : AnalysisStage
                 int id = 0;
                 uint size = 0;
                 bool isHeap = false;
-                switch(traceEntry.EntryType)
+                switch(traceReader.EntryType)
                 {
                     case TraceEntryTypes.HeapAllocation:
                     {
-                        var alloc = (HeapAllocation)traceEntry;
+                        var alloc = traceReader.ReadHeapAllocation();
 
                         id = alloc.Id;
                         size = alloc.Size;
@@ -519,7 +551,7 @@ public partial class ControlFlowLeakage : AnalysisStage
 
                     case TraceEntryTypes.StackAllocation:
                     {
-                        var alloc = (StackAllocation)traceEntry;
+                        var alloc = traceReader.ReadStackAllocation();
 
                         id = alloc.Id;
                         size = alloc.Size;
@@ -554,7 +586,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                     {
                         // Successor does not match, we need to split the current node at this point
 
-                        allocationNode = new AllocationNode(_nextSharedAllocationId++, size, isHeap);
+                        allocationNode = new AllocationNode(NextSharedAllocationId(), size, isHeap);
                         var newSplitNode = currentNode.SplitAtSuccessor(successorIndex, traceEntity.Id, allocationNode);
 
                         allocationIdMapping.Add(id, allocationNode.Id);
@@ -571,7 +603,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                     if(currentNode.TestcaseIds.Count == 1)
                     {
                         // No, this is purely ours. So just append another successor
-                        var allocationNode = new AllocationNode(_nextSharedAllocationId++, size, isHeap);
+                        var allocationNode = new AllocationNode(NextSharedAllocationId(), size, isHeap);
                         currentNode.Successors.Add(allocationNode);
 
                         allocationIdMapping.Add(id, allocationNode.Id);
@@ -605,7 +637,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                         {
                             // Add new split successor
                             var splitNode = new SplitNode();
-                            var allocationNode = new AllocationNode(_nextSharedAllocationId++, size, isHeap);
+                            var allocationNode = new AllocationNode(NextSharedAllocationId(), size, isHeap);
 
                             allocationIdMapping.Add(id, allocationNode.Id);
 
@@ -624,7 +656,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                         await Logger.LogWarningAsync($"{logMessagePrefix} [{traceEntryId}] Encountered weird case for allocation entry");
 
                         var splitNode = new SplitNode();
-                        var allocationNode = new AllocationNode(_nextSharedAllocationId++, size, isHeap);
+                        var allocationNode = new AllocationNode(NextSharedAllocationId(), size, isHeap);
 
                         allocationIdMapping.Add(id, allocationNode.Id);
 
@@ -638,7 +670,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                     }
                 }
             }
-            else if(traceEntry.EntryType is TraceEntryTypes.ImageMemoryAccess or TraceEntryTypes.StackMemoryAccess or TraceEntryTypes.HeapMemoryAccess)
+            else if(traceReader.EntryType is TraceEntryTypes.ImageMemoryAccess or TraceEntryTypes.StackMemoryAccess or TraceEntryTypes.HeapMemoryAccess)
             {
                 /*
                  * Step 1: Extract memory access info
@@ -648,11 +680,11 @@ public partial class ControlFlowLeakage : AnalysisStage
                 ulong instructionId = 0;
                 ulong targetAddressId = 0;
                 bool isWrite = false;
-                switch(traceEntry.EntryType)
+                switch(traceReader.EntryType)
                 {
                     case TraceEntryTypes.ImageMemoryAccess:
                     {
-                        var memoryAccess = (ImageMemoryAccess)traceEntry;
+                        var memoryAccess = traceReader.ReadImageMemoryAccess();
 
                         instructionId = StoreFormattedImageAddress(traceEntity.PreprocessedTraceFile.Prefix!.ImageFiles[memoryAccess.InstructionImageId], memoryAccess.InstructionRelativeAddress);
                         targetAddressId = StoreFormattedImageAddress(traceEntity.PreprocessedTraceFile.Prefix!.ImageFiles[memoryAccess.MemoryImageId], memoryAccess.MemoryRelativeAddress);
@@ -664,7 +696,7 @@ public partial class ControlFlowLeakage : AnalysisStage
 
                     case TraceEntryTypes.StackMemoryAccess:
                     {
-                        var memoryAccess = (StackMemoryAccess)traceEntry;
+                        var memoryAccess = traceReader.ReadStackMemoryAccess();
 
                         instructionId = StoreFormattedImageAddress(traceEntity.PreprocessedTraceFile.Prefix!.ImageFiles[memoryAccess.InstructionImageId], memoryAccess.InstructionRelativeAddress);
 
@@ -678,9 +710,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                             await Logger.LogWarningAsync($"{logMessagePrefix} [{traceEntryId}] Could not find shared stack allocation node S#{memoryAccess.StackAllocationBlockId}, using default unmapped allocation ID");
                         }
 
-                        targetAddressId = _addressIdFlagMemory | ((((ulong)allocationId << 32) | memoryAccess.MemoryRelativeAddress) & ~_addressIdFlagsMask);
-                        if(!_formattedMemoryAddresses.ContainsKey(targetAddressId))
-                            _formattedMemoryAddresses.Add(targetAddressId, $"S#{(allocationId == _unmappedStackAllocationId ? "?" : allocationId)}+{memoryAccess.MemoryRelativeAddress:x8}");
+                        targetAddressId = StoreFormattedMemoryAddress(false, allocationId, memoryAccess.MemoryRelativeAddress);
 
                         isWrite = memoryAccess.IsWrite;
 
@@ -689,7 +719,7 @@ public partial class ControlFlowLeakage : AnalysisStage
 
                     case TraceEntryTypes.HeapMemoryAccess:
                     {
-                        var memoryAccess = (HeapMemoryAccess)traceEntry;
+                        var memoryAccess = traceReader.ReadHeapMemoryAccess();
 
                         instructionId = StoreFormattedImageAddress(traceEntity.PreprocessedTraceFile.Prefix!.ImageFiles[memoryAccess.InstructionImageId], memoryAccess.InstructionRelativeAddress);
 
@@ -700,9 +730,7 @@ public partial class ControlFlowLeakage : AnalysisStage
                             await Logger.LogWarningAsync($"{logMessagePrefix} [{traceEntryId}] Could not find shared heap allocation node, using default unmapped allocation ID");
                         }
 
-                        targetAddressId = _addressIdFlagMemory | _addressIdFlagHeap | ((((ulong)allocationId << 32) | memoryAccess.MemoryRelativeAddress) & ~_addressIdFlagsMask);
-                        if(!_formattedMemoryAddresses.ContainsKey(targetAddressId))
-                            _formattedMemoryAddresses.Add(targetAddressId, $"H#{allocationId}+{memoryAccess.MemoryRelativeAddress:x8}");
+                        targetAddressId = StoreFormattedMemoryAddress(true, allocationId, memoryAccess.MemoryRelativeAddress);
 
                         isWrite = memoryAccess.IsWrite;
 
@@ -871,6 +899,12 @@ public partial class ControlFlowLeakage : AnalysisStage
          */
 
         string logMessagePrefix = "[analyze:cfl]";
+
+        // Merge partial call trees
+        if(_callTrees.Count > 1)
+            await Logger.LogInfoAsync($"{logMessagePrefix} Merging {_callTrees.Count} partial call trees");
+        var rootNode = await MergeCallTreesAsync(_callTrees);
+
         await Logger.LogInfoAsync($"{logMessagePrefix} Running control flow leakage analysis");
 
         // Write call tree to text file
@@ -884,7 +918,7 @@ public partial class ControlFlowLeakage : AnalysisStage
 
         // Iterate call tree
         Stack<(SplitNode Node, int Level, int? SuccessorIndex, int? SplitSuccessorIndex, CallStackNode CallStackNode, Dictionary<ulong, AnalysisData.TestcaseIdTreeNode> InstructionTestcaseTrees)> nodeStack = new();
-        SplitNode currentNode = _rootNode;
+        SplitNode currentNode = rootNode;
         int level = 0;
         string indentation = "";
         int? successorIndex = null;
@@ -897,7 +931,7 @@ public partial class ControlFlowLeakage : AnalysisStage
             {
                 // First time encounter of this node
 
-                if(currentNode == _rootNode)
+                if(currentNode == rootNode)
                 {
                     if(_dumpCallTree)
                         await callTreeDumpWriter.WriteLineAsync($"{indentation}@root");
@@ -1200,7 +1234,7 @@ public partial class ControlFlowLeakage : AnalysisStage
         StringBuilder stringBuilder = new();
 
         // Compute some constants for leakage measures
-        int totalTestcaseCount = _rootNode.TestcaseIds.Count;
+        int totalTestcaseCount = rootNode.TestcaseIds.Count;
         double idealConditionalGuessingEntropy = 0.5 * (totalTestcaseCount + 1);
 
         (double mean, double standardDeviation) ComputeConditionalGuessingEntropyScore((double mean, double standardDeviation) entropy) =>
@@ -1452,11 +1486,38 @@ public partial class ControlFlowLeakage : AnalysisStage
         if(!_formattedImageAddresses.ContainsKey(key))
             _formattedImageAddresses.TryAdd(key, _mapFileCollection.FormatAddress(imageFileInfo.Id, imageFileInfo.Name, address));
         if(!_imageAddresses.ContainsKey(key))
-            _imageAddresses.Add(key, (imageFileInfo.Name, address));
+            _imageAddresses.TryAdd(key, (imageFileInfo.Name, address));
+
+        return key;
+    }
+
+    /// <summary>
+    /// Formats the given heap or stack address and returns a unique ID.
+    /// </summary>
+    /// <param name="isHeap">Determines whether the address belongs to a heap or a stack allocation.</param>
+    /// <param name="allocationId">Shared allocation ID.</param>
+    /// <param name="offset">Offset of the address relative to the allocation.</param>
+    private ulong StoreFormattedMemoryAddress(bool isHeap, int allocationId, uint offset)
+    {
+        // Compute key
+        ulong key = _addressIdFlagMemory | (isHeap ? _addressIdFlagHeap : 0) | ((((ulong)allocationId << 32) | offset) & ~_addressIdFlagsMask);
+
+        // Address already known?
+        if(!_formattedMemoryAddresses.ContainsKey(key))
+        {
+            _formattedMemoryAddresses.TryAdd(key, isHeap
+                ? $"H#{allocationId}+{offset:x8}"
+                : $"S#{(allocationId == _unmappedStackAllocationId ? "?" : allocationId)}+{offset:x8}");
+        }
 
         return key;
     }
 
+    /// <summary>
+    /// Returns a new shared allocation ID.
+    /// </summary>
+    private int NextSharedAllocationId() => Interlocked.Increment(ref _nextSharedAllocationId) - 1;
+
     /// <summary>
     /// Formats a sequence of integers in compressed form.
     /// Example:
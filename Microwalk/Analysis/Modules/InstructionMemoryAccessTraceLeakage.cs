@@ -1,10 +1,10 @@
 ﻿using System;
-using System.Buffers.Binary;
 using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Globalization;
 using System.IO;
 using System.Linq;
+using System.Text;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
@@ -13,7 +13,6 @@ using Microwalk.FrameworkBase.Stages;
 using Microwalk.FrameworkBase.TraceFormat;
 using Microwalk.FrameworkBase.TraceFormat.TraceEntryTypes;
 using Microwalk.FrameworkBase.Utilities;
-using Standart.Hash.xxHash;
 
 namespace Microwalk.Analysis.Modules;
 
@@ -23,13 +22,23 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
     /// <summary>
     /// Maps testcase IDs to lists of instruction hashes (testcase ID => instruction ID => hash).
     /// </summary>
-    private readonly ConcurrentDictionary<int, Dictionary<ulong, byte[]>> _testcaseInstructionHashes = new();
+    private readonly ConcurrentDictionary<int, InstructionHashTable> _testcaseInstructionHashes = new();
 
     /// <summary>
     /// Maps instruction addresses to formatted instructions.
     /// </summary>
     private readonly ConcurrentDictionary<ulong, string> _formattedInstructions = new();
 
+    /// <summary>
+    /// Instruction addresses whose formatted instructions were already included in an exported state.
+    /// </summary>
+    private readonly ConcurrentDictionary<ulong, bool> _exportedInstructions = new();
+
+    /// <summary>
+    /// Running leakage classification of the instructions, for early stopping.
+    /// </summary>
+    private readonly InstructionLeakageTracker _leakageTracker = new();
+
     /// <summary>
     /// The output directory for analysis results.
     /// </summary>
@@ -52,26 +61,35 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
 
     public override bool SupportsParallelism => true;
 
-    public override Task AddTraceAsync(TraceEntity traceEntity)
+    public override async Task AddTraceAsync(TraceEntity traceEntity)
     {
+        // The trace generator may have computed the instruction hashes already
+        if(traceEntity.PreprocessedTraceFile == null && FingerprintFile.IsFingerprintFile(traceEntity.RawTraceFilePath))
+        {
+            await AddFingerprintAsync(traceEntity.Id, traceEntity.RawTraceFilePath!);
+            return;
+        }
+
         // Input check
         if(traceEntity.PreprocessedTraceFile == null)
             throw new Exception("Preprocessed trace is null. Is the preprocessor stage missing?");
 
-        // Allocate dictionary for mapping instruction addresses to memory access hashes
-        var instructionHashes = new Dictionary<ulong, byte[]>();
+        // Allocate table for mapping instruction addresses to memory access hashes
+        var instructionHashes = new InstructionHashTable();
 
         // Hash all memory access instructions
-        foreach(var traceEntry in traceEntity.PreprocessedTraceFile)
+        // The trace entries are not stored, so we can decode them into value types
+        using var traceReader = traceEntity.PreprocessedTraceFile.GetEntryReader();
+        while(traceReader.MoveNext())
         {
             // Extract instruction and memory address IDs (some kind of hash consisting of image ID and relative address)
             ulong instructionId;
             ulong memoryAddressId;
-            switch(traceEntry.EntryType)
+            switch(traceReader.EntryType)
             {
                 case TraceEntryTypes.HeapMemoryAccess:
                 {
-                    var heapMemoryAccess = (HeapMemoryAccess)traceEntry;
+                    var heapMemoryAccess = traceReader.ReadHeapMemoryAccess();
                     instructionId = ((ulong)heapMemoryAccess.InstructionImageId << 32) | heapMemoryAccess.InstructionRelativeAddress;
                     memoryAddressId = ((ulong)heapMemoryAccess.HeapAllocationBlockId << 32) | heapMemoryAccess.MemoryRelativeAddress;
 
@@ -83,7 +101,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                 }
                 case TraceEntryTypes.ImageMemoryAccess:
                 {
-                    var imageMemoryAccess = (ImageMemoryAccess)traceEntry;
+                    var imageMemoryAccess = traceReader.ReadImageMemoryAccess();
                     instructionId = ((ulong)imageMemoryAccess.InstructionImageId << 32) | imageMemoryAccess.InstructionRelativeAddress;
                     memoryAddressId = ((ulong)imageMemoryAccess.MemoryImageId << 32) | imageMemoryAccess.MemoryRelativeAddress;
 
@@ -95,7 +113,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                 }
                 case TraceEntryTypes.StackMemoryAccess:
                 {
-                    var stackMemoryAccess = (StackMemoryAccess)traceEntry;
+                    var stackMemoryAccess = traceReader.ReadStackMemoryAccess();
                     instructionId = ((ulong)stackMemoryAccess.InstructionImageId << 32) | stackMemoryAccess.InstructionRelativeAddress;
                     memoryAddressId = stackMemoryAccess.MemoryRelativeAddress;
 
@@ -109,25 +127,111 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                     continue;
             }
 
-            // Retrieve old hash
-            if(!instructionHashes.TryGetValue(instructionId, out var hash))
-            {
-                hash = new byte[16];
-                instructionHashes.Add(instructionId, hash);
-            }
-
             // Update hash:
             // newHash = hash(oldHash || address)
-            var hashLeft = hash.AsSpan(0);
-            var hashRight = hash.AsSpan(8);
-            BinaryPrimitives.WriteUInt64LittleEndian(hashRight, memoryAddressId);
-            BinaryPrimitives.WriteUInt64LittleEndian(hashLeft, xxHash64.ComputeHash(hash, 16));
+            instructionHashes.AddMemoryAccess(instructionId, memoryAddressId);
         }
 
         // Store instruction hashes
         _testcaseInstructionHashes.AddOrUpdate(traceEntity.Id, instructionHashes, (_, h) => h);
+        _leakageTracker.AddTestcase(instructionHashes);
+    }
+
+    /// <summary>
+    /// Loads the instruction hashes of the given testcase from a fingerprint file.
+    /// </summary>
+    /// <param name="testcaseId">Testcase ID.</param>
+    /// <param name="fingerprintFilePath">Path of the fingerprint file.</param>
+    private async Task AddFingerprintAsync(int testcaseId, string fingerprintFilePath)
+    {
+        var fingerprintFile = new FingerprintFile(await File.ReadAllBytesAsync(fingerprintFilePath));
+        if(fingerprintFile.Kind != FingerprintFile.FingerprintKinds.InstructionMemoryAccess)
+            throw new Exception($"Unsupported fingerprint kind {fingerprintFile.Kind} in {fingerprintFilePath}.");
+
+        // Format instructions
+        foreach(var (instructionId, _) in fingerprintFile.InstructionHashes)
+        {
+            StoreFormattedInstruction(instructionId,
+                fingerprintFile.ImageFiles[(int)(instructionId >> 32)],
+                (uint)instructionId);
+        }
+
+        // Store instruction hashes
+        _testcaseInstructionHashes.AddOrUpdate(testcaseId, fingerprintFile.InstructionHashes, (_, h) => h);
+        _leakageTracker.AddTestcase(fingerprintFile.InstructionHashes);
+    }
+
+    public override LeakageEstimate GetLeakageEstimate() => _leakageTracker.GetEstimate();
+
+    public override bool SupportsStateMerging => true;
+
+    public override Task<byte[]> ExportStateAsync()
+    {
+        using var stateStream = new MemoryStream();
+        using(var stateWriter = new BinaryWriter(stateStream, Encoding.UTF8, true))
+        {
+            // Instruction hashes of the testcases since the last export
+            var testcaseIds = _testcaseInstructionHashes.Keys.ToList();
+            stateWriter.Write(testcaseIds.Count);
+            foreach(int testcaseId in testcaseIds)
+            {
+                _testcaseInstructionHashes.TryRemove(testcaseId, out var instructionHashes);
+
+                stateWriter.Write(testcaseId);
+                stateWriter.Write(instructionHashes!.Count);
+                foreach(var (instructionId, hash) in instructionHashes)
+                {
+                    stateWriter.Write(instructionId);
+                    stateWriter.Write((ulong)hash);
+                    stateWriter.Write((ulong)(hash >> 64));
+                }
+            }
+
+            // Formatted names of the instructions which were not exported before
+            var newInstructions = _formattedInstructions.Where(i => _exportedInstructions.TryAdd(i.Key, true)).ToList();
+            stateWriter.Write(newInstructions.Count);
+            foreach(var (instructionId, formattedInstruction) in newInstructions)
+            {
+                stateWriter.Write(instructionId);
+                stateWriter.Write(formattedInstruction);
+            }
+        }
+
+        return Task.FromResult(stateStream.ToArray());
+    }
+
+    public override Task MergeStateAsync(byte[] state)
+    {
+        using var stateReader = new BinaryReader(new MemoryStream(state), Encoding.UTF8);
+
+        // Instruction hashes
+        int testcaseCount = stateReader.ReadInt32();
+        for(int i = 0; i < testcaseCount; ++i)
+        {
+            int testcaseId = stateReader.ReadInt32();
+            int instructionCount = stateReader.ReadInt32();
+            var instructionHashes = new InstructionHashTable(instructionCount);
+            for(int j = 0; j < instructionCount; ++j)
+            {
+                ulong instructionId = stateReader.ReadUInt64();
+                ulong hashLow = stateReader.ReadUInt64();
+                ulong hashHigh = stateReader.ReadUInt64();
+                instructionHashes.Set(instructionId, ((UInt128)hashHigh << 64) | hashLow);
+            }
+
+            _testcaseInstructionHashes.AddOrUpdate(testcaseId, instructionHashes, (_, h) => h);
+            _leakageTracker.AddTestcase(instructionHashes);
+        }
+
+        // Formatted instructions
+        int formattedInstructionCount = stateReader.ReadInt32();
+        for(int i = 0; i < formattedInstructionCount; ++i)
+        {
+            ulong instructionId = stateReader.ReadUInt64();
+            string formattedInstruction = stateReader.ReadString();
+            _formattedInstructions.TryAdd(instructionId, formattedInstruction);
+        }
 
-        // Done
         return Task.CompletedTask;
     }
 
@@ -141,27 +245,27 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
         foreach(var testcase in _testcaseInstructionHashes)
         {
             // Iterate instructions in this testcase
-            foreach(var instruction in testcase.Value)
+            foreach(var (instructionId, hash) in testcase.Value)
             {
                 // Retrieve instruction data object
-                if(!instructions.TryGetValue(instruction.Key, out var instructionData))
+                if(!instructions.TryGetValue(instructionId, out var instructionData))
                 {
                     instructionData = new InstructionData();
-                    instructions.Add(instruction.Key, instructionData);
+                    instructions.Add(instructionId, instructionData);
                 }
 
                 // Add data from this testcase
                 ++instructionData.TestcaseCount;
-                instructionData.HashCounts.TryGetValue(instruction.Value, out int hashCount); // Will be 0 if not existing
-                instructionData.HashCounts[instruction.Value] = hashCount + 1;
+                instructionData.HashCounts.TryGetValue(hash, out int hashCount); // Will be 0 if not existing
+                instructionData.HashCounts[hash] = hashCount + 1;
 
                 // Store testcase IDs only when a full data dump is requested, since this is quite expensive
                 if(_dumpFullData)
                 {
                     // Make sure testcase ID list exists
-                    if(!instructionData.HashTestcases.ContainsKey(instruction.Value))
-                        instructionData.HashTestcases.Add(instruction.Value, new List<int>());
-                    instructionData.HashTestcases[instruction.Value].Add(testcase.Key);
+                    if(!instructionData.HashTestcases.ContainsKey(hash))
+                        instructionData.HashTestcases.Add(hash, new List<int>());
+                    instructionData.HashTestcases[hash].Add(testcase.Key);
                 }
             }
         }
@@ -220,7 +324,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                 // Find minimum guessing entropy of each trace, weighting is not needed here
                 // Also store the hash value which has the lowest guessing entropy value
                 double minConditionalGuessingEntropy = double.MaxValue;
-                byte[] minConditionalGuessingEntropyHash = Array.Empty<byte>();
+                UInt128 minConditionalGuessingEntropyHash = 0;
                 foreach(var hashCount in instruction.Value.HashCounts)
                 {
                     double traceConditionalGuessingEntropy = (hashCount.Value + 1.0) / 2;
@@ -267,7 +371,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
             foreach(var instructionData in instructionLeakage.OrderBy(l => l.Value.MinConditionalGuessingEntropy).ThenBy(mi => mi.Key))
                 await minCondGuessEntropyWriter.WriteLineAsync($"Instruction {_formattedInstructions[instructionData.Key]}: " +
                                                                $"{instructionData.Value.MinConditionalGuessingEntropy.ToString("N", numberFormat)} guesses " +
-                                                               $"[{string.Concat(instructionData.Value.MinConditionalGuessingEntropyHash.Select(b => b.ToString("X2")))}]");
+                                                               $"[{InstructionHashTable.FormatHash(instructionData.Value.MinConditionalGuessingEntropyHash)}]");
         }
         else if(_outputFormat == OutputFormat.Csv)
         {
@@ -302,7 +406,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                                                listSeparator +
                                                leakageData.MinConditionalGuessingEntropy.ToString("N3") +
                                                listSeparator +
-                                               string.Concat(leakageData.MinConditionalGuessingEntropyHash.Select(b => b.ToString("X2"))));
+                                               InstructionHashTable.FormatHash(leakageData.MinConditionalGuessingEntropyHash));
             }
         }
 
@@ -327,7 +431,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
                 foreach(var hashCount in instruction.Value.HashCounts)
                 {
                     // Write hash and number of hits
-                    await writer.WriteAsync($"  {string.Concat(hashCount.Key.Select(b => b.ToString("X2")))}: [{hashCount.Value}]");
+                    await writer.WriteAsync($"  {InstructionHashTable.FormatHash(hashCount.Key)}: [{hashCount.Value}]");
 
                     // Write testcases yielding this hash
                     // Try to merge consecutive test case IDs: "1 3 4 5 7" -> "1 3-5 7"
@@ -427,18 +531,18 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
     private class InstructionData
     {
         public int TestcaseCount { get; set; }
-        public Dictionary<byte[], int> HashCounts { get; }
+        public Dictionary<UInt128, int> HashCounts { get; }
 
         /// <summary>
         /// This is only filled and used when a data dump is requested.
         /// </summary>
-        public Dictionary<byte[], List<int>> HashTestcases { get; }
+        public Dictionary<UInt128, List<int>> HashTestcases { get; }
 
         public InstructionData()
         {
             TestcaseCount = 0;
-            HashCounts = new Dictionary<byte[], int>(new ByteArrayComparer());
-            HashTestcases = new Dictionary<byte[], List<int>>(new ByteArrayComparer());
+            HashCounts = new Dictionary<UInt128, int>();
+            HashTestcases = new Dictionary<UInt128, List<int>>();
         }
     }
 
@@ -451,7 +555,7 @@ internal class InstructionMemoryAccessTraceLeakage : AnalysisStage
         public double MinEntropy { get; set; }
         public double ConditionalGuessingEntropy { get; set; }
         public double MinConditionalGuessingEntropy { get; set; }
-        public byte[] MinConditionalGuessingEntropyHash { get; set; } = null!;
+        public UInt128 MinConditionalGuessingEntropyHash { get; set; }
     }
 
     /// <summary>
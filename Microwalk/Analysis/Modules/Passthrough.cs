@@ -1,4 +1,5 @@
-﻿using System.Threading.Tasks;
+﻿using System;
+using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
 using Microwalk.FrameworkBase.Stages;
@@ -15,6 +16,18 @@ internal class Passthrough : AnalysisStage
         return Task.CompletedTask;
     }
 
+    public override bool SupportsStateMerging => true;
+
+    public override Task<byte[]> ExportStateAsync()
+    {
+        return Task.FromResult(Array.Empty<byte>());
+    }
+
+    public override Task MergeStateAsync(byte[] state)
+    {
+        return Task.CompletedTask;
+    }
+
     public override Task FinishAsync()
     {
         return Logger.LogResultAsync("Passthrough analysis module completed.");
@@ -0,0 +1,235 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.Collections.Generic;
+using System.IO;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace Microwalk.Distributed;
+
+/// <summary>
+/// Connection between the coordinator and a worker of a distributed campaign. Implements the message protocol of both sides.
+/// </summary>
+/// <remarks>
+/// Each message consists of a header holding the payload length (32-bit little endian) and the message type (8-bit), followed by the payload.
+/// The protocol runs as follows:
+/// 1. The worker sends a <see cref="MessageTypes.Hello"/> message with the names of its analysis modules.
+/// 2. The coordinator sends a <see cref="MessageTypes.Batch"/> message with a number of testcases.
+/// 3. The worker runs the pipeline for these testcases and sends a <see cref="MessageTypes.Result"/> message with the exported analysis module states.
+/// 4. Steps 2 and 3 are repeated, until the coordinator sends an empty batch.
+/// </remarks>
+internal class CampaignConnection : IDisposable
+{
+    /// <summary>
+    /// Magic number at the beginning of the hello message ("MWDC").
+    /// </summary>
+    private const uint ProtocolMagic = 0x4344574D;
+
+    /// <summary>
+    /// Supported version of the protocol.
+    /// </summary>
+    private const uint ProtocolVersion = 1;
+
+    /// <summary>
+    /// Size of the message header.
+    /// </summary>
+    private const int HeaderSize = 5;
+
+    private readonly TcpClient _client;
+    private readonly NetworkStream _stream;
+
+    /// <summary>
+    /// Address of the remote side, for logging.
+    /// </summary>
+    public string RemoteEndPoint { get; }
+
+    /// <summary>
+    /// Creates a new connection object for the given connected TCP client.
+    /// </summary>
+    /// <param name="client">Connected TCP client.</param>
+    internal CampaignConnection(TcpClient client)
+    {
+        _client = client;
+        _client.NoDelay = true;
+        _stream = client.GetStream();
+
+        RemoteEndPoint = client.Client.RemoteEndPoint?.ToString() ?? "<unknown>";
+    }
+
+    /// <summary>
+    /// Sends the hello message.
+    /// </summary>
+    /// <param name="moduleNames">Names of the analysis modules of the worker, in configuration order.</param>
+    /// <param name="token">Cancellation token.</param>
+    public Task SendHelloAsync(List<string> moduleNames, CancellationToken token)
+    {
+        return SendAsync(MessageTypes.Hello, writer =>
+        {
+            writer.Write(ProtocolMagic);
+            writer.Write(ProtocolVersion);
+            writer.Write(moduleNames.Count);
+            foreach(var moduleName in moduleNames)
+                writer.Write(moduleName);
+        }, token);
+    }
+
+    /// <summary>
+    /// Receives the hello message.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    /// <returns>Names of the analysis modules of the worker, in configuration order.</returns>
+    public async Task<List<string>> ReceiveHelloAsync(CancellationToken token)
+    {
+        using var reader = await ReceiveAsync(MessageTypes.Hello, token);
+        if(reader.ReadUInt32() != ProtocolMagic)
+            throw new InvalidDataException("Invalid protocol magic.");
+        uint version = reader.ReadUInt32();
+        if(version != ProtocolVersion)
+            throw new InvalidDataException($"Unsupported protocol version {version}.");
+
+        int moduleCount = reader.ReadInt32();
+        var moduleNames = new List<string>(moduleCount);
+        for(int i = 0; i < moduleCount; ++i)
+            moduleNames.Add(reader.ReadString());
+        return moduleNames;
+    }
+
+    /// <summary>
+    /// Sends a batch of testcases. An empty batch signals the end of the campaign.
+    /// </summary>
+    /// <param name="testcases">Testcase IDs and contents.</param>
+    /// <param name="token">Cancellation token.</param>
+    public Task SendBatchAsync(List<(int Id, byte[] Data)> testcases, CancellationToken token)
+    {
+        return SendAsync(MessageTypes.Batch, writer =>
+        {
+            writer.Write(testcases.Count);
+            foreach(var (id, data) in testcases)
+            {
+                writer.Write(id);
+                writer.Write(data.Length);
+                writer.Write(data);
+            }
+        }, token);
+    }
+
+    /// <summary>
+    /// Receives a batch of testcases.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    /// <returns>Testcase IDs and contents.</returns>
+    public async Task<List<(int Id, byte[] Data)>> ReceiveBatchAsync(CancellationToken token)
+    {
+        using var reader = await ReceiveAsync(MessageTypes.Batch, token);
+
+        int testcaseCount = reader.ReadInt32();
+        var testcases = new List<(int Id, byte[] Data)>(testcaseCount);
+        for(int i = 0; i < testcaseCount; ++i)
+        {
+            int id = reader.ReadInt32();
+            int length = reader.ReadInt32();
+            testcases.Add((id, reader.ReadBytes(length)));
+        }
+
+        return testcases;
+    }
+
+    /// <summary>
+    /// Sends the analysis module states of a batch.
+    /// </summary>
+    /// <param name="states">Exported analysis module states, in configuration order.</param>
+    /// <param name="token">Cancellation token.</param>
+    public Task SendResultAsync(List<byte[]> states, CancellationToken token)
+    {
+        return SendAsync(MessageTypes.Result, writer =>
+        {
+            writer.Write(states.Count);
+            foreach(var state in states)
+            {
+                writer.Write(state.Length);
+                writer.Write(state);
+            }
+        }, token);
+    }
+
+    /// <summary>
+    /// Receives the analysis module states of a batch.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    /// <returns>Exported analysis module states, in configuration order.</returns>
+    public async Task<List<byte[]>> ReceiveResultAsync(CancellationToken token)
+    {
+        using var reader = await ReceiveAsync(MessageTypes.Result, token);
+
+        int stateCount = reader.ReadInt32();
+        var states = new List<byte[]>(stateCount);
+        for(int i = 0; i < stateCount; ++i)
+        {
+            int length = reader.ReadInt32();
+            states.Add(reader.ReadBytes(length));
+        }
+
+        return states;
+    }
+
+    /// <summary>
+    /// Sends a message with the given type. The payload is produced by the given callback.
+    /// </summary>
+    /// <param name="messageType">Message type.</param>
+    /// <param name="writePayload">Callback writing the payload.</param>
+    /// <param name="token">Cancellation token.</param>
+    private async Task SendAsync(MessageTypes messageType, Action<BinaryWriter> writePayload, CancellationToken token)
+    {
+        using var messageStream = new MemoryStream();
+        messageStream.SetLength(HeaderSize);
+        messageStream.Position = HeaderSize;
+        using(var writer = new BinaryWriter(messageStream, Encoding.UTF8, true))
+            writePayload(writer);
+
+        var message = messageStream.GetBuffer().AsMemory(0, (int)messageStream.Length);
+        BinaryPrimitives.WriteInt32LittleEndian(message.Span, message.Length - HeaderSize);
+        message.Span[4] = (byte)messageType;
+
+        await _stream.WriteAsync(message, token);
+    }
+
+    /// <summary>
+    /// Receives a message with the given type.
+    /// </summary>
+    /// <param name="messageType">Expected message type.</param>
+    /// <param name="token">Cancellation token.</param>
+    /// <returns>Reader for the message payload.</returns>
+    private async Task<BinaryReader> ReceiveAsync(MessageTypes messageType, CancellationToken token)
+    {
+        byte[] header = new byte[HeaderSize];
+        await _stream.ReadExactlyAsync(header, token);
+
+        int length = BinaryPrimitives.ReadInt32LittleEndian(header);
+        if(length < 0)
+            throw new InvalidDataException($"Invalid message length {length}.");
+        if((MessageTypes)header[4] != messageType)
+            throw new InvalidDataException($"Unexpected message type {header[4]}, expected {messageType}.");
+
+        byte[] payload = new byte[length];
+        await _stream.ReadExactlyAsync(payload, token);
+        return new BinaryReader(new MemoryStream(payload), Encoding.UTF8);
+    }
+
+    public void Dispose()
+    {
+        _stream.Dispose();
+        _client.Dispose();
+    }
+
+    /// <summary>
+    /// The different message types.
+    /// </summary>
+    private enum MessageTypes : byte
+    {
+        Hello = 1,
+        Batch = 2,
+        Result = 3
+    }
+}
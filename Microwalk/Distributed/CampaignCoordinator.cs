@@ -0,0 +1,328 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Net.Sockets;
+using System.Reflection;
+using System.Threading;
+using System.Threading.Tasks;
+using System.Threading.Tasks.Dataflow;
+using Microwalk.FrameworkBase;
+using Microwalk.FrameworkBase.Configuration;
+using Microwalk.FrameworkBase.Exceptions;
+using Microwalk.FrameworkBase.Stages;
+
+namespace Microwalk.Distributed;
+
+/// <summary>
+/// Coordinator of a distributed campaign. Hands batches of testcases to the connected workers, and merges the analysis module states they send back.
+/// </summary>
+/// <remarks>
+/// The coordinator does not run the trace and preprocessor stages itself. Testcases are posted into <see cref="TestcaseQueue"/>, from where they are
+/// distributed to the workers on demand. If a worker disconnects before returning the result of a batch, the batch is handed to the next free worker.
+/// </remarks>
+internal class CampaignCoordinator : IDisposable
+{
+    private readonly ILogger _logger;
+
+    /// <summary>
+    /// Analysis modules, which receive the merged states.
+    /// </summary>
+    private readonly List<AnalysisStage> _modules;
+
+    /// <summary>
+    /// Names of the analysis modules, for checking the worker configuration.
+    /// </summary>
+    private readonly List<string> _moduleNames;
+
+    /// <summary>
+    /// Listener for worker connections.
+    /// </summary>
+    private readonly TcpListener _listener;
+
+    /// <summary>
+    /// Maximum number of testcases per batch.
+    /// </summary>
+    private readonly int _batchSize;
+
+    /// <summary>
+    /// Testcases of batches which were not completed by their worker, and need to be handed out again.
+    /// </summary>
+    private readonly Queue<TraceEntity> _returnedTestcases = new();
+
+    /// <summary>
+    /// Number of batches which were handed to a worker and not yet completed or returned.
+    /// </summary>
+    private int _pendingBatchCount = 0;
+
+    /// <summary>
+    /// Signaled and replaced whenever a batch is completed or returned.
+    /// </summary>
+    private TaskCompletionSource _batchStateChanged = new(TaskCreationOptions.RunContinuationsAsynchronously);
+
+    /// <summary>
+    /// Lock for the batch state.
+    /// </summary>
+    private readonly object _lock = new();
+
+    /// <summary>
+    /// Completed once all testcases have been analyzed and merged.
+    /// </summary>
+    private readonly TaskCompletionSource _completion = new(TaskCreationOptions.RunContinuationsAsynchronously);
+
+    /// <summary>
+    /// Testcases which were not yet handed to a worker.
+    /// </summary>
+    public BufferBlock<TraceEntity> TestcaseQueue { get; }
+
+    /// <summary>
+    /// Completes once all testcases have been analyzed by the workers, and their states were merged into the analysis modules.
+    /// </summary>
+    public Task Completion => _completion.Task;
+
+    /// <summary>
+    /// Creates a new coordinator with the given configuration.
+    /// </summary>
+    /// <param name="configuration">Distributed campaign configuration.</param>
+    /// <param name="modules">Analysis modules.</param>
+    /// <param name="logger">Logger.</param>
+    internal CampaignCoordinator(MappingNode configuration, List<AnalysisStage> modules, ILogger logger)
+    {
+        _logger = logger ?? throw new ArgumentNullException(nameof(logger));
+        _modules = modules;
+        _moduleNames = modules.Select(m => m.GetType().GetCustomAttribute<FrameworkModule>()?.Name ?? m.GetType().Name).ToList();
+
+        // Read configuration
+        string address = configuration.GetChildNodeOrDefault("address")?.AsString() ?? "0.0.0.0";
+        int port = configuration.GetChildNodeOrDefault("port")?.AsInteger() ?? throw new ConfigurationException("Missing port for distributed campaign.");
+        _batchSize = configuration.GetChildNodeOrDefault("batch-size")?.AsInteger() ?? 16;
+        if(_batchSize <= 0)
+            throw new ConfigurationException("The batch size of a distributed campaign must be positive.");
+        if(!IPAddress.TryParse(address, out var listenAddress))
+            throw new ConfigurationException($"Invalid listen address '{address}'.");
+
+        _listener = new TcpListener(listenAddress, port);
+
+        // Buffer enough testcases to fill one batch, so the testcase stage keeps ahead of the workers
+        TestcaseQueue = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+        {
+            BoundedCapacity = _batchSize,
+            EnsureOrdered = true
+        });
+    }
+
+    /// <summary>
+    /// Starts accepting worker connections.
+    /// </summary>
+    /// <param name="token">Cancellation token for stopping the campaign.</param>
+    public async Task StartAsync(CancellationToken token)
+    {
+        token.Register(() => _completion.TrySetCanceled(token));
+
+        _listener.Start();
+        await _logger.LogInfoAsync($"Waiting for workers on {_listener.LocalEndpoint}");
+
+        _ = AcceptWorkersAsync(token);
+    }
+
+    /// <summary>
+    /// Accepts worker connections until the campaign is completed.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    private async Task AcceptWorkersAsync(CancellationToken token)
+    {
+        try
+        {
+            while(true)
+            {
+                var client = await _listener.AcceptTcpClientAsync(token);
+                _ = HandleWorkerAsync(client, token);
+            }
+        }
+        catch(Exception ex)
+        {
+            // The listener is stopped when the campaign is done
+            if(Completion.IsCompleted)
+                return;
+
+            await _logger.LogErrorAsync($"Could not accept worker connection: {ex.Message}");
+            _completion.TrySetException(ex);
+        }
+    }
+
+    /// <summary>
+    /// Hands batches to the given worker and merges the results, until all testcases are done.
+    /// </summary>
+    /// <param name="client">Worker connection.</param>
+    /// <param name="token">Cancellation token.</param>
+    private async Task HandleWorkerAsync(TcpClient client, CancellationToken token)
+    {
+        using var connection = new CampaignConnection(client);
+        string workerName = connection.RemoteEndPoint;
+
+        try
+        {
+            // The worker must run the same analysis modules, else the states cannot be merged
+            var workerModuleNames = await connection.ReceiveHelloAsync(token);
+            if(!workerModuleNames.SequenceEqual(_moduleNames))
+            {
+                await _logger.LogErrorAsync($"Worker {workerName} uses different analysis modules ({string.Join(", ", workerModuleNames)}), rejecting it");
+                return;
+            }
+
+            await _logger.LogInfoAsync($"Worker {workerName} connected");
+        }
+        catch(Exception ex) when(ex is IOException or InvalidDataException or OperationCanceledException)
+        {
+            await _logger.LogWarningAsync($"Handshake with worker {workerName} failed: {ex.Message}");
+            return;
+        }
+
+        while(true)
+        {
+            var batch = await NextBatchAsync(token);
+
+            // Read testcases, if they were not passed in memory
+            var testcases = new List<(int Id, byte[] Data)>(batch.Count);
+            try
+            {
+                foreach(var testcase in batch)
+                    testcases.Add((testcase.Id, testcase.TestcaseData ?? await File.ReadAllBytesAsync(testcase.TestcaseFilePath, token)));
+            }
+            catch(Exception ex)
+            {
+                ReturnBatch(batch);
+                _completion.TrySetException(ex);
+                return;
+            }
+
+            // Let worker run the pipeline
+            List<byte[]> states;
+            try
+            {
+                await connection.SendBatchAsync(testcases, token);
+                if(batch.Count == 0)
+                    break;
+
+                states = await connection.ReceiveResultAsync(token);
+                if(states.Count != _modules.Count)
+                    throw new InvalidDataException($"Received {states.Count} analysis module states, expected {_modules.Count}.");
+            }
+            catch(Exception ex) when(ex is IOException or InvalidDataException or OperationCanceledException)
+            {
+                if(batch.Count > 0)
+                    ReturnBatch(batch);
+
+                if(!token.IsCancellationRequested)
+                    await _logger.LogWarningAsync($"Lost connection to worker {workerName}, returning {batch.Count} testcases: {ex.Message}");
+                return;
+            }
+
+            // Merge results
+            try
+            {
+                for(int i = 0; i < _modules.Count; ++i)
+                    await _modules[i].MergeStateAsync(states[i]);
+            }
+            catch(Exception ex)
+            {
+                // The analysis state may be incomplete now, so the campaign cannot be continued
+                _completion.TrySetException(ex);
+                return;
+            }
+
+            await _logger.LogDebugAsync($"Merged results of {batch.Count} testcases from worker {workerName}");
+            CompleteBatch();
+        }
+
+        await _logger.LogInfoAsync($"Worker {workerName} finished");
+    }
+
+    /// <summary>
+    /// Returns the next batch of testcases. If there are no testcases left, an empty batch is returned and the campaign is marked as completed.
+    /// An empty batch is also returned when the campaign is cancelled.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    private async Task<List<TraceEntity>> NextBatchAsync(CancellationToken token)
+    {
+        while(true)
+        {
+            if(token.IsCancellationRequested)
+                return new List<TraceEntity>();
+
+            Task batchStateChangedTask;
+            lock(_lock)
+            {
+                // Returned testcases are handed out first
+                var batch = new List<TraceEntity>(_batchSize);
+                while(batch.Count < _batchSize && (_returnedTestcases.TryDequeue(out var testcase) || TestcaseQueue.TryReceive(out testcase)))
+                    batch.Add(testcase);
+                if(batch.Count > 0)
+                {
+                    ++_pendingBatchCount;
+                    return batch;
+                }
+
+                // The queue completes when the testcase stage is done and all remaining testcases were received
+                if(TestcaseQueue.Completion.IsCompleted && _pendingBatchCount == 0)
+                {
+                    _completion.TrySetResult();
+                    return batch;
+                }
+
+                batchStateChangedTask = _batchStateChanged.Task;
+            }
+
+            // Wait for new testcases, or for a pending batch being completed or returned by its worker
+            // Once the queue has completed, OutputAvailableAsync() returns immediately, so only the pending batches are waited for
+            if(TestcaseQueue.Completion.IsCompleted)
+                await Task.WhenAny(batchStateChangedTask, Task.Delay(Timeout.Infinite, token));
+            else
+                await Task.WhenAny(TestcaseQueue.OutputAvailableAsync(token), batchStateChangedTask);
+        }
+    }
+
+    /// <summary>
+    /// Marks a batch as completed.
+    /// </summary>
+    private void CompleteBatch()
+    {
+        lock(_lock)
+        {
+            --_pendingBatchCount;
+            SignalBatchStateChanged();
+        }
+    }
+
+    /// <summary>
+    /// Marks a batch as failed, so its testcases are handed to another worker.
+    /// </summary>
+    /// <param name="batch">Failed batch.</param>
+    private void ReturnBatch(List<TraceEntity> batch)
+    {
+        lock(_lock)
+        {
+            foreach(var testcase in batch)
+                _returnedTestcases.Enqueue(testcase);
+
+            --_pendingBatchCount;
+            SignalBatchStateChanged();
+        }
+    }
+
+    /// <summary>
+    /// Wakes up all workers waiting for a batch. Must be called while holding the lock.
+    /// </summary>
+    private void SignalBatchStateChanged()
+    {
+        var batchStateChanged = _batchStateChanged;
+        _batchStateChanged = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+        batchStateChanged.SetResult();
+    }
+
+    public void Dispose()
+    {
+        _listener.Stop();
+    }
+}
@@ -0,0 +1,191 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net.Sockets;
+using System.Reflection;
+using System.Threading;
+using System.Threading.Tasks;
+using System.Threading.Tasks.Dataflow;
+using Microwalk.FrameworkBase;
+using Microwalk.FrameworkBase.Configuration;
+using Microwalk.FrameworkBase.Exceptions;
+using Microwalk.FrameworkBase.Stages;
+
+namespace Microwalk.Distributed;
+
+/// <summary>
+/// Worker of a distributed campaign. Receives batches of testcases from the coordinator, runs them through the local pipeline, and sends back the
+/// exported analysis module states.
+/// </summary>
+/// <remarks>
+/// The worker replaces the testcase stage of the local pipeline. Batches are processed one after another, so the states exported after a batch contain
+/// exactly the testcases of that batch.
+/// </remarks>
+internal class CampaignWorker : IDisposable
+{
+    private readonly ILogger _logger;
+
+    /// <summary>
+    /// Analysis modules, whose states are sent to the coordinator.
+    /// </summary>
+    private readonly List<AnalysisStage> _modules;
+
+    /// <summary>
+    /// Host name or address of the coordinator.
+    /// </summary>
+    private readonly string _coordinatorAddress;
+
+    /// <summary>
+    /// Port of the coordinator.
+    /// </summary>
+    private readonly int _coordinatorPort;
+
+    /// <summary>
+    /// Time to wait for the coordinator to become available.
+    /// </summary>
+    private readonly TimeSpan _connectTimeout;
+
+    /// <summary>
+    /// Directory where the testcases of the current batch are stored.
+    /// </summary>
+    private readonly DirectoryInfo _testcaseDirectory;
+
+    /// <summary>
+    /// Connection to the coordinator.
+    /// </summary>
+    private CampaignConnection? _connection;
+
+    /// <summary>
+    /// Number of traces of the current batch which have not yet been processed by all analysis modules.
+    /// </summary>
+    private int _pendingTraceCount;
+
+    /// <summary>
+    /// Completed once all traces of the current batch have been processed by all analysis modules.
+    /// </summary>
+    private TaskCompletionSource _batchCompletion = new(TaskCreationOptions.RunContinuationsAsynchronously);
+
+    /// <summary>
+    /// Creates a new worker with the given configuration.
+    /// </summary>
+    /// <param name="configuration">Distributed campaign configuration.</param>
+    /// <param name="modules">Analysis modules.</param>
+    /// <param name="logger">Logger.</param>
+    internal CampaignWorker(MappingNode configuration, List<AnalysisStage> modules, ILogger logger)
+    {
+        _logger = logger ?? throw new ArgumentNullException(nameof(logger));
+        _modules = modules;
+
+        // Read configuration
+        _coordinatorAddress = configuration.GetChildNodeOrDefault("address")?.AsString() ?? throw new ConfigurationException("Missing coordinator address for distributed campaign.");
+        _coordinatorPort = configuration.GetChildNodeOrDefault("port")?.AsInteger() ?? throw new ConfigurationException("Missing port for distributed campaign.");
+        _connectTimeout = TimeSpan.FromSeconds(configuration.GetChildNodeOrDefault("connect-timeout")?.AsInteger() ?? 60);
+        string testcaseDirectoryPath = configuration.GetChildNodeOrDefault("testcase-directory")?.AsString() ?? throw new ConfigurationException("Missing testcase directory for distributed campaign worker.");
+        _testcaseDirectory = Directory.CreateDirectory(testcaseDirectoryPath);
+    }
+
+    /// <summary>
+    /// Connects to the coordinator and posts the received testcases into the first pipeline block, until the coordinator signals the end of the campaign.
+    /// Completes the block afterwards.
+    /// </summary>
+    /// <param name="traceStageBuffer">First pipeline block.</param>
+    /// <param name="token">Cancellation token.</param>
+    public async Task RunAsync(BufferBlock<TraceEntity> traceStageBuffer, CancellationToken token)
+    {
+        try
+        {
+            _connection = await ConnectAsync(token);
+            await _connection.SendHelloAsync(_modules.Select(m => m.GetType().GetCustomAttribute<FrameworkModule>()?.Name ?? m.GetType().Name).ToList(), token);
+
+            while(true)
+            {
+                var testcases = await _connection.ReceiveBatchAsync(token);
+                if(testcases.Count == 0)
+                    break;
+
+                await _logger.LogDebugAsync($"Received batch of {testcases.Count} testcases");
+
+                // Feed testcases into pipeline
+                _pendingTraceCount = testcases.Count;
+                _batchCompletion = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+                var testcaseFilePaths = new List<string>(testcases.Count);
+                foreach(var (id, data) in testcases)
+                {
+                    string testcaseFilePath = Path.Combine(_testcaseDirectory.FullName, $"{id}.testcase");
+                    await File.WriteAllBytesAsync(testcaseFilePath, data, token);
+                    testcaseFilePaths.Add(testcaseFilePath);
+
+                    await traceStageBuffer.SendAsync(new TraceEntity
+                    {
+                        Id = id,
+                        TestcaseFilePath = testcaseFilePath,
+                        TestcaseData = data
+                    }, token);
+                }
+
+                // Wait until the analysis modules are done with the batch, then send their states
+                await _batchCompletion.Task.WaitAsync(token);
+
+                // The traces of the batch have been generated, so its testcase files are not needed anymore
+                foreach(string testcaseFilePath in testcaseFilePaths)
+                    File.Delete(testcaseFilePath);
+
+                var states = new List<byte[]>(_modules.Count);
+                foreach(var module in _modules)
+                    states.Add(await module.ExportStateAsync());
+                await _connection.SendResultAsync(states, token);
+            }
+
+            await _logger.LogInfoAsync("Coordinator reported end of campaign");
+        }
+        finally
+        {
+            // Mark first block as completed
+            // This should propagate through the entire pipeline
+            traceStageBuffer.Complete();
+        }
+    }
+
+    /// <summary>
+    /// Notifies the worker that a trace has been processed by all analysis modules.
+    /// </summary>
+    public void OnTraceAnalyzed()
+    {
+        if(Interlocked.Decrement(ref _pendingTraceCount) == 0)
+            _batchCompletion.TrySetResult();
+    }
+
+    /// <summary>
+    /// Connects to the coordinator. If the coordinator is not yet available, the connection is retried until the configured timeout expires.
+    /// </summary>
+    /// <param name="token">Cancellation token.</param>
+    private async Task<CampaignConnection> ConnectAsync(CancellationToken token)
+    {
+        var deadline = DateTime.UtcNow + _connectTimeout;
+        while(true)
+        {
+            var client = new TcpClient();
+            try
+            {
+                await client.ConnectAsync(_coordinatorAddress, _coordinatorPort, token);
+                await _logger.LogInfoAsync($"Connected to coordinator {_coordinatorAddress}:{_coordinatorPort}");
+                return new CampaignConnection(client);
+            }
+            catch(SocketException ex)
+            {
+                client.Dispose();
+                if(DateTime.UtcNow >= deadline)
+                    throw new Exception($"Could not connect to coordinator {_coordinatorAddress}:{_coordinatorPort}.", ex);
+
+                await _logger.LogDebugAsync($"Coordinator not available ({ex.Message}), retrying");
+                await Task.Delay(TimeSpan.FromSeconds(1), token);
+            }
+        }
+    }
+
+    public void Dispose()
+    {
+        _connection?.Dispose();
+    }
+}
@@ -0,0 +1,89 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Reflection;
+using System.Threading.Tasks;
+using Microwalk.FrameworkBase;
+using Microwalk.FrameworkBase.Configuration;
+using Microwalk.FrameworkBase.Exceptions;
+using Microwalk.FrameworkBase.Stages;
+
+namespace Microwalk;
+
+/// <summary>
+/// Decides whether testcase generation can be stopped early, based on the running leakage estimates of the analysis modules.
+/// </summary>
+/// <remarks>
+/// Generation is stopped once every analysis module which publishes an estimate has seen enough testcases, and either classifies all tracked targets as
+/// leaking, or did not change its estimate for a configured number of testcases. Modules without estimate support are ignored.
+/// </remarks>
+internal class EarlyStoppingPolicy
+{
+    private readonly ILogger _logger;
+
+    /// <summary>
+    /// Analysis modules which publish leakage estimates.
+    /// </summary>
+    private readonly List<AnalysisStage> _modules;
+
+    /// <summary>
+    /// Minimum number of testcases each module must have analyzed before generation may be stopped.
+    /// </summary>
+    private readonly int _minTestcases;
+
+    /// <summary>
+    /// Number of testcases without any change after which an estimate is considered converged.
+    /// </summary>
+    private readonly int _stableTestcases;
+
+    /// <summary>
+    /// Controls whether an estimate where all tracked targets are leaking counts as converged.
+    /// </summary>
+    private readonly bool _stopWhenAllLeaking;
+
+    /// <summary>
+    /// Creates a new early stopping policy with the given configuration.
+    /// </summary>
+    /// <param name="configuration">Early stopping configuration.</param>
+    /// <param name="modules">Analysis modules which publish leakage estimates.</param>
+    /// <param name="logger">Logger.</param>
+    internal EarlyStoppingPolicy(MappingNode configuration, List<AnalysisStage> modules, ILogger logger)
+    {
+        _logger = logger ?? throw new ArgumentNullException(nameof(logger));
+        _modules = modules;
+
+        // Read configuration
+        _minTestcases = configuration.GetChildNodeOrDefault("min-testcases")?.AsInteger() ?? 100;
+        _stableTestcases = configuration.GetChildNodeOrDefault("stable-testcases")?.AsInteger() ?? 200;
+        _stopWhenAllLeaking = configuration.GetChildNodeOrDefault("stop-when-all-leaking")?.AsBoolean() ?? true;
+        if(_minTestcases < 0)
+            throw new ConfigurationException("The minimum number of testcases for early stopping must not be negative.");
+        if(_stableTestcases <= 0)
+            throw new ConfigurationException("The number of stable testcases for early stopping must be positive.");
+    }
+
+    /// <summary>
+    /// Returns whether testcase generation should be stopped. If so, the current estimates are logged.
+    /// </summary>
+    public async Task<bool> ShouldStopAsync()
+    {
+        var estimates = _modules.Select(m => (Module: m, Estimate: m.GetLeakageEstimate()!)).ToList();
+        foreach(var (_, estimate) in estimates)
+        {
+            if(estimate.TestcaseCount < _minTestcases)
+                return false;
+            if(!(_stopWhenAllLeaking && estimate.AllLeaking) && estimate.StableTestcaseCount < _stableTestcases)
+                return false;
+        }
+
+        await _logger.LogInfoAsync("Leakage estimates have converged, stopping testcase generation");
+        foreach(var (module, estimate) in estimates)
+        {
+            string moduleName = module.GetType().GetCustomAttribute<FrameworkModule>()?.Name ?? module.GetType().Name;
+            await _logger.LogInfoAsync($"  {moduleName}: {estimate.LeakingCount} of {estimate.TrackedCount} tracked targets leaking after {estimate.TestcaseCount} testcases, "
+                                       + $"last change {estimate.StableTestcaseCount} testcases ago");
+        }
+
+        return true;
+    }
+}
@@ -1,5 +1,7 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Diagnostics;
+using System.Linq;
 using System.Threading;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
@@ -8,7 +10,7 @@ using Microwalk.FrameworkBase.Configuration;
 namespace Microwalk;
 
 /// <summary>
-/// Utility class for keeping track of the process resource usage.
+/// Utility class for keeping track of the process resource usage and of the pipeline stage throughput.
 /// </summary>
 internal class ProcessMonitor : IDisposable
 {
@@ -20,6 +22,11 @@ internal class ProcessMonitor : IDisposable
 
     private long _maxMemoryUsage = 0;
 
+    /// <summary>
+    /// Processing statistics of the pipeline stages, indexed by stage name.
+    /// </summary>
+    private readonly ConcurrentDictionary<string, StageStatistics> _stageStatistics = new();
+
     /// <summary>
     /// Starts a new process monitor with the given configuration.
     /// </summary>
@@ -53,6 +60,17 @@ internal class ProcessMonitor : IDisposable
             _maxMemoryUsage = _thisProcess.PrivateMemorySize64;
     }
 
+    /// <summary>
+    /// Records that the given pipeline stage has completed processing an item.
+    /// </summary>
+    /// <param name="stageName">Stage name.</param>
+    /// <param name="startTimestamp">Value of <see cref="Stopwatch.GetTimestamp"/> when the stage started processing the item.</param>
+    public void RecordStageItem(string stageName, long startTimestamp)
+    {
+        long endTimestamp = Stopwatch.GetTimestamp();
+        _stageStatistics.GetOrAdd(stageName, _ => new StageStatistics()).Add(startTimestamp, endTimestamp);
+    }
+
     /// <summary>
     /// Ends data gathering and prints the results.
     /// </summary>
@@ -63,6 +81,15 @@ internal class ProcessMonitor : IDisposable
 
         // Print results
         await _logger.LogInfoAsync($"[monitor] Maximum private memory size: {_maxMemoryUsage} bytes ({(double)_maxMemoryUsage / (1024 * 1024):N3} MB)");
+
+        // Busy time is summed over all parallel threads of a stage, while throughput refers to the time between the first and the last item
+        foreach(var (stageName, statistics) in _stageStatistics.OrderBy(s => s.Value.FirstStartTimestamp))
+        {
+            double busyTime = (double)statistics.BusyTicks / Stopwatch.Frequency;
+            double activeTime = (double)(statistics.LastEndTimestamp - statistics.FirstStartTimestamp) / Stopwatch.Frequency;
+            double throughput = activeTime > 0 ? statistics.Count / activeTime : 0;
+            await _logger.LogInfoAsync($"[monitor] Stage '{stageName}': {statistics.Count} items, busy time {busyTime:F3} s, active time {activeTime:F3} s, throughput {throughput:F1} items/s");
+        }
     }
 
     public void Dispose()
@@ -70,4 +97,29 @@ internal class ProcessMonitor : IDisposable
         _timer.Dispose();
         _thisProcess.Dispose();
     }
+
+    /// <summary>
+    /// Accumulated processing statistics of a single pipeline stage.
+    /// </summary>
+    private class StageStatistics
+    {
+        public long Count { get; private set; }
+
+        public long BusyTicks { get; private set; }
+
+        public long FirstStartTimestamp { get; private set; } = long.MaxValue;
+
+        public long LastEndTimestamp { get; private set; } = long.MinValue;
+
+        public void Add(long startTimestamp, long endTimestamp)
+        {
+            lock(this)
+            {
+                ++Count;
+                BusyTicks += endTimestamp - startTimestamp;
+                FirstStartTimestamp = Math.Min(FirstStartTimestamp, startTimestamp);
+                LastEndTimestamp = Math.Max(LastEndTimestamp, endTimestamp);
+            }
+        }
+    }
 }
\ No newline at end of file
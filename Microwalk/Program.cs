@@ -1,14 +1,18 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.Globalization;
 using System.IO;
 using System.Linq;
 using System.Reflection;
+using System.Runtime.CompilerServices;
 using System.Text;
 using System.Threading;
 using System.Threading.Tasks;
 using System.Threading.Tasks.Dataflow;
 using CommandLine;
+using Microwalk.Distributed;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
 using Microwalk.FrameworkBase.Exceptions;
@@ -31,6 +35,36 @@ internal static class Program
     /// </summary>
     private static ILogger? _logger;
 
+    /// <summary>
+    /// Cache for preprocessed traces. May be null.
+    /// </summary>
+    private static TraceCache? _traceCache;
+
+    /// <summary>
+    /// Process monitor, which also records the pipeline stage throughput. May be null.
+    /// </summary>
+    private static ProcessMonitor? _processMonitor;
+
+    /// <summary>
+    /// Policy for stopping testcase generation early. May be null.
+    /// </summary>
+    private static EarlyStoppingPolicy? _earlyStoppingPolicy;
+
+    /// <summary>
+    /// Coordinator of a distributed campaign. Only set when running as coordinator.
+    /// </summary>
+    private static CampaignCoordinator? _campaignCoordinator;
+
+    /// <summary>
+    /// Worker of a distributed campaign. Only set when running as worker.
+    /// </summary>
+    private static CampaignWorker? _campaignWorker;
+
+    /// <summary>
+    /// Number of analysis modules which have not yet processed a given trace, indexed by testcase ID.
+    /// </summary>
+    private static readonly ConcurrentDictionary<int, StrongBox<int>> _pendingAnalysisModuleCounts = new();
+
     /// <summary>
     /// Program entry point.
     /// </summary>
@@ -162,7 +196,6 @@ internal static class Program
         };
 
         // Load configuration file
-        ProcessMonitor? processMonitor = null;
         try
         {
             // Load configuration file
@@ -181,9 +214,15 @@ internal static class Program
             if(monitorConfigurationNode?.GetChildNodeOrDefault("enable")?.AsBoolean() ?? false)
             {
                 await _logger.LogInfoAsync("Enabling process monitor");
-                processMonitor = new ProcessMonitor(monitorConfigurationNode, _logger);
+                _processMonitor = new ProcessMonitor(monitorConfigurationNode, _logger);
             }
 
+            // Distributed campaign?
+            var distributedConfigurationNode = generalConfigurationNode?.GetChildNodeOrDefault("distributed") as MappingNode;
+            string? distributedRole = distributedConfigurationNode?.GetChildNodeOrDefault("role")?.AsString();
+            if(distributedRole != null && distributedRole != "coordinator" && distributedRole != "worker")
+                throw new ConfigurationException($"Unknown distributed campaign role '{distributedRole}'.");
+
             // Read stages
             await _logger.LogDebugAsync("Reading pipeline configuration");
             foreach(var rootNode in configurationParser.RootNodes)
@@ -260,6 +299,7 @@ internal static class Program
                         if(moduleListNode is not ListNode moduleListSequenceNode)
                             throw new ConfigurationException("Module list node does not contain a sequence.");
                         _moduleConfiguration.AnalysesStageModules = new List<AnalysisStage>();
+                        _moduleConfiguration.AnalysesStageModuleOptions = new List<MappingNode?>();
                         foreach(var moduleListEntryNode in moduleListSequenceNode.Children)
                         {
                             if(moduleListEntryNode is not MappingNode moduleEntryNode)
@@ -270,6 +310,9 @@ internal static class Program
 
                             // Create module, if possible
                             _moduleConfiguration.AnalysesStageModules.Add(await AnalysisStage.Factory.CreateAsync(moduleName, _logger, moduleEntryNode.GetChildNodeOrDefault("module-options") as MappingNode, globalCancellationToken.Token));
+
+                            // Remember module-specific stage options
+                            _moduleConfiguration.AnalysesStageModuleOptions.Add(moduleEntryNode.GetChildNodeOrDefault("options") as MappingNode);
                         }
 
                         // Remember general stage options
@@ -281,85 +324,202 @@ internal static class Program
             }
 
             // Check presence of needed pipeline modules and generic options
+            // In a distributed campaign, the coordinator does not need trace and preprocessor modules, and the workers do not need a testcase module
             await _logger.LogDebugAsync("Doing some sanity checks");
-            if(_moduleConfiguration.TestcaseStageModule == null
-               || _moduleConfiguration.TraceStageModule == null
-               || _moduleConfiguration.PreprocessorStageModule == null
+            if((_moduleConfiguration.TestcaseStageModule == null && distributedRole != "worker")
+               || (_moduleConfiguration.TraceStageModule == null && distributedRole != "coordinator")
+               || (_moduleConfiguration.PreprocessorStageModule == null && distributedRole != "coordinator")
                || _moduleConfiguration.AnalysesStageModules == null
                || !_moduleConfiguration.AnalysesStageModules.Any())
                 throw new ConfigurationException(
                     "Incomplete module specification. Make sure that there is at least one module for testcase generation, trace generation, preprocessing and analysis, respectively.");
 
-            // Initialize pipeline stages
-            // -> [buffer] -> trace -> [buffer] -> preprocess -> [buffer] -> analysis
-            await _logger.LogDebugAsync("Initializing pipeline stages");
-            var traceStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
-            {
-                BoundedCapacity = _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true
-            });
-            var traceStage = new TransformBlock<TraceEntity, TraceEntity>(TraceStageFunc, new ExecutionDataflowBlockOptions
-            {
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true,
-                MaxDegreeOfParallelism = _moduleConfiguration.TraceStageModule.SupportsParallelism
-                    ? _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1,
-                BoundedCapacity = _moduleConfiguration.TraceStageModule.SupportsParallelism
-                    ? _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1
-            });
-            var preprocessorStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+            // Initialize distributed campaign
+            if(distributedRole != null)
             {
-                BoundedCapacity = _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true
-            });
-            var preprocessorStage = new TransformBlock<TraceEntity, TraceEntity>(PreprocessorStageFunc, new ExecutionDataflowBlockOptions
+                if(_moduleConfiguration.AnalysesStageModules.Any(m => !m.SupportsStateMerging))
+                    throw new ConfigurationException("Some of the configured analysis modules do not support merging their states, which is required for distributed campaigns.");
+
+                if(distributedRole == "coordinator")
+                {
+                    await _logger.LogInfoAsync("Running as coordinator of a distributed campaign");
+                    _campaignCoordinator = new CampaignCoordinator(distributedConfigurationNode!, _moduleConfiguration.AnalysesStageModules, _logger);
+                }
+                else
+                {
+                    await _logger.LogInfoAsync("Running as worker of a distributed campaign");
+                    _campaignWorker = new CampaignWorker(distributedConfigurationNode!, _moduleConfiguration.AnalysesStageModules, _logger);
+                }
+            }
+
+            // Initialize trace cache
+            var traceCacheConfigurationNode = generalConfigurationNode?.GetChildNodeOrDefault("trace-cache") as MappingNode;
+            if(traceCacheConfigurationNode != null && _campaignCoordinator == null)
             {
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true,
-                MaxDegreeOfParallelism = _moduleConfiguration.PreprocessorStageModule.SupportsParallelism
-                    ? _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1,
-                BoundedCapacity = _moduleConfiguration.PreprocessorStageModule.SupportsParallelism
-                    ? _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1
-            });
-            var analysisStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+                string traceCacheDirectoryPath = traceCacheConfigurationNode.GetChildNodeOrDefault("directory")?.AsString() ?? throw new ConfigurationException("Missing trace cache directory.");
+
+                // The cached traces must have been produced by the same trace and preprocessor stage configuration
+                var traceStageCacheKey = _moduleConfiguration.TraceStageModule!.CacheKey;
+                var preprocessorStageCacheKey = _moduleConfiguration.PreprocessorStageModule!.CacheKey;
+                if(traceStageCacheKey == null || preprocessorStageCacheKey == null)
+                    await _logger.LogWarningAsync("The configured trace or preprocessor module does not support caching, the trace cache is disabled.");
+                else
+                {
+                    using var configurationKeyStream = new MemoryStream();
+                    await using(var configurationKeyWriter = new BinaryWriter(configurationKeyStream, Encoding.UTF8, true))
+                    {
+                        configurationKeyWriter.Write(_moduleConfiguration.TraceStageModule.GetType().FullName ?? "");
+                        configurationKeyWriter.Write(traceStageCacheKey.Length);
+                        configurationKeyWriter.Write(traceStageCacheKey);
+                        configurationKeyWriter.Write(_moduleConfiguration.PreprocessorStageModule.GetType().FullName ?? "");
+                        configurationKeyWriter.Write(preprocessorStageCacheKey.Length);
+                        configurationKeyWriter.Write(preprocessorStageCacheKey);
+                    }
+
+                    await _logger.LogInfoAsync("Enabling trace cache");
+                    _traceCache = new TraceCache(traceCacheDirectoryPath, configurationKeyStream.ToArray(), _logger);
+                }
+            }
+
+            // Initialize early stopping
+            var earlyStoppingConfigurationNode = _moduleConfiguration.TestcaseStageOptions?.GetChildNodeOrDefault("early-stopping") as MappingNode;
+            if((earlyStoppingConfigurationNode?.GetChildNodeOrDefault("enable")?.AsBoolean() ?? false) && _campaignWorker == null)
             {
-                BoundedCapacity = _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true
-            });
-            var analysisStage = new ActionBlock<TraceEntity>(AnalysisStageFunc, new ExecutionDataflowBlockOptions
+                var estimatingModules = _moduleConfiguration.AnalysesStageModules.Where(m => m.GetLeakageEstimate() != null).ToList();
+                if(!estimatingModules.Any())
+                    await _logger.LogWarningAsync("None of the configured analysis modules publishes leakage estimates, early stopping is disabled.");
+                else
+                {
+                    await _logger.LogInfoAsync("Enabling early stopping");
+                    _earlyStoppingPolicy = new EarlyStoppingPolicy(earlyStoppingConfigurationNode, estimatingModules, _logger);
+                }
+            }
+
+            Task analysisStageCompletion;
+            BufferBlock<TraceEntity> testcaseTarget;
+            if(_campaignCoordinator != null)
             {
-                CancellationToken = globalCancellationToken.Token,
-                EnsureOrdered = true,
-                MaxDegreeOfParallelism = _moduleConfiguration.AnalysesStageModules.All(asm => asm.SupportsParallelism)
-                    ? _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1,
-                BoundedCapacity = _moduleConfiguration.AnalysesStageModules.All(asm => asm.SupportsParallelism)
-                    ? _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
-                    : 1
-            });
-
-            // Link pipeline stages
-            await _logger.LogDebugAsync("Linking pipeline stages");
-            var linkOptions = new DataflowLinkOptions
+                // The workers run the trace, preprocessor and analysis stages, the coordinator only merges their analysis module states
+                await _campaignCoordinator.StartAsync(globalCancellationToken.Token);
+                analysisStageCompletion = _campaignCoordinator.Completion;
+                testcaseTarget = _campaignCoordinator.TestcaseQueue;
+            }
+            else
             {
-                PropagateCompletion = true
-            };
-            traceStageBuffer.LinkTo(traceStage, linkOptions);
-            traceStage.LinkTo(preprocessorStageBuffer, linkOptions);
-            preprocessorStageBuffer.LinkTo(preprocessorStage, linkOptions);
-            preprocessorStage.LinkTo(analysisStageBuffer, linkOptions);
-            analysisStageBuffer.LinkTo(analysisStage, linkOptions);
+                // Initialize pipeline stages
+                // -> [buffer] -> trace -> [buffer] -> preprocess -> [buffer] -> distribute -> [buffer] -> analysis module 1
+                //                                                                          -> [buffer] -> analysis module 2
+                //                                                                          -> ...
+                await _logger.LogDebugAsync("Initializing pipeline stages");
+                var traceStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+                {
+                    BoundedCapacity = _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true
+                });
+                var traceStage = new TransformBlock<TraceEntity, TraceEntity>(TraceStageFunc, new ExecutionDataflowBlockOptions
+                {
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true,
+                    MaxDegreeOfParallelism = _moduleConfiguration.TraceStageModule!.SupportsParallelism
+                        ? _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
+                        : 1,
+                    BoundedCapacity = _moduleConfiguration.TraceStageModule!.SupportsParallelism
+                        ? _moduleConfiguration.TraceStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
+                        : 1
+                });
+                var preprocessorStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+                {
+                    BoundedCapacity = _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true
+                });
+                var preprocessorStage = new TransformBlock<TraceEntity, TraceEntity>(PreprocessorStageFunc, new ExecutionDataflowBlockOptions
+                {
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true,
+                    MaxDegreeOfParallelism = _moduleConfiguration.PreprocessorStageModule!.SupportsParallelism
+                        ? _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
+                        : 1,
+                    BoundedCapacity = _moduleConfiguration.PreprocessorStageModule!.SupportsParallelism
+                        ? _moduleConfiguration.PreprocessorStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger() ?? 1
+                        : 1
+                });
+                var analysisStageBuffer = new BufferBlock<TraceEntity>(new DataflowBlockOptions
+                {
+                    BoundedCapacity = _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger() ?? 1,
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true
+                });
+
+                // Each analysis module gets its own consumer block, so a module without parallelism support does not throttle the other ones
+                var analysisModuleStages = new List<ActionBlock<TraceEntity>>();
+                for(int i = 0; i < _moduleConfiguration.AnalysesStageModules!.Count; ++i)
+                {
+                    var module = _moduleConfiguration.AnalysesStageModules[i];
+                    var moduleOptions = _moduleConfiguration.AnalysesStageModuleOptions![i];
+
+                    // Module-specific options take precedence over general analysis stage options
+                    int inputBufferSize = moduleOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger()
+                                          ?? _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("input-buffer-size")?.AsInteger()
+                                          ?? 1;
+                    int maxParallelThreads = module.SupportsParallelism
+                        ? moduleOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger()
+                          ?? _moduleConfiguration.AnalysisStageOptions?.GetChildNodeOrDefault("max-parallel-threads")?.AsInteger()
+                          ?? 1
+                        : 1;
+
+                    string stageName = $"analysis:{module.GetType().GetCustomAttribute<FrameworkModule>()?.Name ?? module.GetType().Name}";
+                    analysisModuleStages.Add(new ActionBlock<TraceEntity>(t => AnalysisModuleStageFunc(module, stageName, t), new ExecutionDataflowBlockOptions
+                    {
+                        CancellationToken = globalCancellationToken.Token,
+                        EnsureOrdered = true,
+                        MaxDegreeOfParallelism = maxParallelThreads,
+                        BoundedCapacity = inputBufferSize + maxParallelThreads
+                    }));
+                }
+
+                // Hands each trace to all analysis module blocks.
+                // We do not use a BroadcastBlock here, as it drops traces when a bounded target is full.
+                var analysisDistributionStage = new ActionBlock<TraceEntity>(t => AnalysisDistributionStageFunc(analysisModuleStages, t, globalCancellationToken.Token), new ExecutionDataflowBlockOptions
+                {
+                    CancellationToken = globalCancellationToken.Token,
+                    EnsureOrdered = true,
+                    MaxDegreeOfParallelism = 1,
+                    BoundedCapacity = 1
+                });
+
+                // Link pipeline stages
+                await _logger.LogDebugAsync("Linking pipeline stages");
+                var linkOptions = new DataflowLinkOptions
+                {
+                    PropagateCompletion = true
+                };
+                traceStageBuffer.LinkTo(traceStage, linkOptions);
+                traceStage.LinkTo(preprocessorStageBuffer, linkOptions);
+                preprocessorStageBuffer.LinkTo(preprocessorStage, linkOptions);
+                preprocessorStage.LinkTo(analysisStageBuffer, linkOptions);
+                analysisStageBuffer.LinkTo(analysisDistributionStage, linkOptions);
+                _ = analysisDistributionStage.Completion.ContinueWith(t =>
+                {
+                    foreach(var analysisModuleStage in analysisModuleStages)
+                    {
+                        if(t.IsFaulted)
+                            ((IDataflowBlock)analysisModuleStage).Fault(t.Exception!);
+                        else
+                            analysisModuleStage.Complete();
+                    }
+                }, TaskScheduler.Default);
+                analysisStageCompletion = Task.WhenAll(analysisModuleStages.Select(s => s.Completion).Append(analysisDistributionStage.Completion));
+                testcaseTarget = traceStageBuffer;
+            }
 
             // Start posting test cases
+            // A worker receives them from the coordinator instead
             await _logger.LogInfoAsync("Start testcase thread -> pipeline start");
-            var testcaseTask = PostTestcases(traceStageBuffer, globalCancellationToken.Token)
+            var testcaseTask = (_campaignWorker != null
+                    ? _campaignWorker.RunAsync(testcaseTarget, globalCancellationToken.Token)
+                    : PostTestcases(testcaseTarget, globalCancellationToken.Token))
                 .ContinueWith(async t =>
                 {
                     if(t.IsFaulted && t.Exception != null && !t.Exception.Flatten().InnerExceptions.Any(e => e is TaskCanceledException))
@@ -377,12 +537,19 @@ internal static class Program
             try
             {
                 // Wait for all stages to complete
-                await analysisStage.Completion;
-                await _logger.LogInfoAsync("Pipeline completed, executing final analysis steps");
+                await analysisStageCompletion;
 
-                // Do final analysis steps
-                foreach(var module in _moduleConfiguration.AnalysesStageModules)
-                    await module.FinishAsync();
+                // The analysis results of a worker are reported by the coordinator
+                if(_campaignWorker != null)
+                    await _logger.LogInfoAsync("Pipeline completed, analysis states were sent to the coordinator");
+                else
+                {
+                    await _logger.LogInfoAsync("Pipeline completed, executing final analysis steps");
+
+                    // Do final analysis steps
+                    foreach(var module in _moduleConfiguration.AnalysesStageModules)
+                        await module.FinishAsync();
+                }
             }
             catch(Exception ex)
             {
@@ -408,14 +575,17 @@ internal static class Program
 
             // Do some cleanup
             await _logger.LogDebugAsync("Performing some clean up");
-            await _moduleConfiguration.TestcaseStageModule.UnInitAsync();
-            await _moduleConfiguration.TraceStageModule.UnInitAsync();
-            await _moduleConfiguration.PreprocessorStageModule.UnInitAsync();
+            if(_moduleConfiguration.TestcaseStageModule != null)
+                await _moduleConfiguration.TestcaseStageModule.UnInitAsync();
+            if(_moduleConfiguration.TraceStageModule != null)
+                await _moduleConfiguration.TraceStageModule.UnInitAsync();
+            if(_moduleConfiguration.PreprocessorStageModule != null)
+                await _moduleConfiguration.PreprocessorStageModule.UnInitAsync();
             await Task.WhenAll(_moduleConfiguration.AnalysesStageModules.Select(module => module.UnInitAsync()));
 
             // Statistics       
-            if(processMonitor != null)
-                await processMonitor.ConcludeAsync();
+            if(_processMonitor != null)
+                await _processMonitor.ConcludeAsync();
 
             // Done
             await _logger.LogInfoAsync("Program completed.");
@@ -439,7 +609,9 @@ internal static class Program
         }
         finally
         {
-            processMonitor?.Dispose();
+            _campaignCoordinator?.Dispose();
+            _campaignWorker?.Dispose();
+            _processMonitor?.Dispose();
             _logger?.Dispose();
             globalCancellationToken.Dispose();
         }
@@ -455,7 +627,17 @@ internal static class Program
     {
         // Feed testcases into pipeline
         while(!await _moduleConfiguration.TestcaseStageModule!.IsDoneAsync())
-            await traceStageBuffer.SendAsync(await _moduleConfiguration.TestcaseStageModule.NextTestcaseAsync(token), token);
+        {
+            // Stop when the analysis modules do not expect new results
+            if(_earlyStoppingPolicy != null && await _earlyStoppingPolicy.ShouldStopAsync())
+                break;
+
+            long startTimestamp = Stopwatch.GetTimestamp();
+            var testcase = await _moduleConfiguration.TestcaseStageModule.NextTestcaseAsync(token);
+            _processMonitor?.RecordStageItem("testcase", startTimestamp);
+
+            await traceStageBuffer.SendAsync(testcase, token);
+        }
 
         // Mark first block as completed
         // This should propagate through the entire pipeline
@@ -469,8 +651,16 @@ internal static class Program
     /// <returns></returns>
     private static async Task<TraceEntity> TraceStageFunc(TraceEntity t)
     {
-        // Run module
-        await _moduleConfiguration.TraceStageModule!.GenerateTraceAsync(t);
+        long startTimestamp = Stopwatch.GetTimestamp();
+
+        // If there is a cached preprocessed trace, skip trace generation and preprocessing
+        if(_traceCache == null || !await _traceCache.TryLoadAsync(t))
+        {
+            // Run module
+            await _moduleConfiguration.TraceStageModule!.GenerateTraceAsync(t);
+        }
+
+        _processMonitor?.RecordStageItem("trace", startTimestamp);
         return t;
     }
 
@@ -481,20 +671,63 @@ internal static class Program
     /// <returns></returns>
     private static async Task<TraceEntity> PreprocessorStageFunc(TraceEntity t)
     {
+        // The trace stage may have loaded a cached preprocessed trace
+        if(_traceCache?.IsCached(t) ?? false)
+            return t;
+
         // Run module
+        long startTimestamp = Stopwatch.GetTimestamp();
         await _moduleConfiguration.PreprocessorStageModule!.PreprocessTraceAsync(t);
+        _processMonitor?.RecordStageItem("preprocess", startTimestamp);
+
+        // Store preprocessed trace for later runs
+        if(_traceCache != null)
+            await _traceCache.StoreAsync(t);
         return t;
     }
 
     /// <summary>
-    /// Analysis stage implementation.
+    /// Analysis distribution stage implementation. Passes the given trace entity to all analysis module blocks.
     /// </summary>
+    /// <param name="analysisModuleStages">Analysis module blocks.</param>
     /// <param name="t">Input trace entity.</param>
+    /// <param name="token">Cancellation token.</param>
     /// <returns></returns>
-    private static Task AnalysisStageFunc(TraceEntity t)
+    private static async Task AnalysisDistributionStageFunc(List<ActionBlock<TraceEntity>> analysisModuleStages, TraceEntity t, CancellationToken token)
     {
-        // Run modules in parallel
-        return Task.WhenAll(_moduleConfiguration.AnalysesStageModules!.Select(module => module.AddTraceAsync(t)));
+        _pendingAnalysisModuleCounts[t.Id] = new StrongBox<int>(analysisModuleStages.Count);
+
+        // Wait until all blocks have accepted the trace entity, so slower modules exert back pressure on the pipeline
+        foreach(var analysisModuleStage in analysisModuleStages)
+        {
+            if(!await analysisModuleStage.SendAsync(t, token))
+                throw new Exception($"Analysis module block refused trace #{t.Id}, stopping distribution.");
+        }
+    }
+
+    /// <summary>
+    /// Analysis stage implementation for a single module.
+    /// </summary>
+    /// <param name="module">Analysis module.</param>
+    /// <param name="stageName">Stage name of the module, for the process monitor.</param>
+    /// <param name="t">Input trace entity.</param>
+    /// <returns></returns>
+    private static async Task AnalysisModuleStageFunc(AnalysisStage module, string stageName, TraceEntity t)
+    {
+        // Run module
+        long startTimestamp = Stopwatch.GetTimestamp();
+        await module.AddTraceAsync(t);
+        _processMonitor?.RecordStageItem(stageName, startTimestamp);
+
+        // Release trace data once all modules are done with it
+        if(Interlocked.Decrement(ref _pendingAnalysisModuleCounts[t.Id].Value) == 0)
+        {
+            _pendingAnalysisModuleCounts.TryRemove(t.Id, out _);
+            t.PreprocessedTraceFile = null;
+            t.RawTraceData = null;
+
+            _campaignWorker?.OnTraceAnalyzed();
+        }
     }
 
     /// <summary>
@@ -561,8 +794,8 @@ internal static class Program
         public TraceStage? TraceStageModule { get; set; }
         public PreprocessorStage? PreprocessorStageModule { get; set; }
         public List<AnalysisStage>? AnalysesStageModules { get; set; }
+        public List<MappingNode?>? AnalysesStageModuleOptions { get; set; }
 
-        // ReSharper disable once UnusedAutoPropertyAccessor.Local
         public MappingNode? TestcaseStageOptions { get; set; }
         public MappingNode? TraceStageOptions { get; set; }
         public MappingNode? PreprocessorStageOptions { get; set; }
@@ -28,7 +28,7 @@ internal class RandomTestcaseGenerator : TestcaseStage
     /// <summary>
     /// The test case output directory.
     /// </summary>
-    private DirectoryInfo _outputDirectory = null!;
+    private DirectoryInfo? _outputDirectory;
 
     /// <summary>
     /// The number of the next test case.
@@ -61,8 +61,13 @@ internal class RandomTestcaseGenerator : TestcaseStage
                                          "Consider increasing test case length or decreasing test case count to avoid performance hits and a possible endless loop.");
 
         // Make sure output directory exists
-        var outputDirectoryPath = moduleOptions.GetChildNodeOrDefault("output-directory")?.AsString() ?? throw new ConfigurationException("Missing output directory.");
-        _outputDirectory = Directory.CreateDirectory(outputDirectoryPath);
+        // If test cases are not stored, they are only passed in memory
+        bool storeTestcases = moduleOptions.GetChildNodeOrDefault("store-testcases")?.AsBoolean() ?? true;
+        if(storeTestcases)
+        {
+            var outputDirectoryPath = moduleOptions.GetChildNodeOrDefault("output-directory")?.AsString() ?? throw new ConfigurationException("Missing output directory.");
+            _outputDirectory = Directory.CreateDirectory(outputDirectoryPath);
+        }
     }
 
     public override async Task<TraceEntity> NextTestcaseAsync(CancellationToken token)
@@ -77,14 +82,19 @@ internal class RandomTestcaseGenerator : TestcaseStage
         _knownTestcases.Add(random);
 
         // Store test case
-        string testcaseFileName = Path.Combine(_outputDirectory.FullName, $"{_nextTestcaseNumber}.testcase");
-        await File.WriteAllBytesAsync(testcaseFileName, random, token);
+        string testcaseFileName = "";
+        if(_outputDirectory != null)
+        {
+            testcaseFileName = Path.Combine(_outputDirectory.FullName, $"{_nextTestcaseNumber}.testcase");
+            await File.WriteAllBytesAsync(testcaseFileName, random, token);
+        }
 
         // Create trace entity object
         var traceEntity = new TraceEntity
         {
             Id = _nextTestcaseNumber,
-            TestcaseFilePath = testcaseFileName
+            TestcaseFilePath = testcaseFileName,
+            TestcaseData = random
         };
 
         // Done
@@ -0,0 +1,170 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.IO;
+using System.Security.Cryptography;
+using System.Text;
+using System.Threading.Tasks;
+using Microwalk.FrameworkBase;
+using Microwalk.FrameworkBase.TraceFormat;
+
+namespace Microwalk;
+
+/// <summary>
+/// Content-addressed cache for preprocessed traces, which allows to skip the trace and preprocessor stages for testcases that were already handled by an
+/// earlier run with the same configuration.
+/// </summary>
+/// <remarks>
+/// Cache entries are stored in a subdirectory named after the hash of the trace and preprocessor stage configuration. Each entry consists of the
+/// preprocessed trace <c>[testcase hash].trace.preprocessed</c> and a file <c>[testcase hash].prefix</c> holding the hash of the associated trace
+/// prefix, which is stored as <c>prefix-[prefix hash].trace.preprocessed</c>.
+/// </remarks>
+internal class TraceCache
+{
+    private readonly ILogger _logger;
+
+    /// <summary>
+    /// Directory containing the cache entries for the current configuration.
+    /// </summary>
+    private readonly DirectoryInfo _cacheDirectory;
+
+    /// <summary>
+    /// Testcase file hashes of the testcases which were not found in the cache, indexed by testcase ID.
+    /// </summary>
+    private readonly ConcurrentDictionary<int, string> _pendingTestcaseHashes = new();
+
+    /// <summary>
+    /// IDs of the testcases which were loaded from the cache.
+    /// </summary>
+    private readonly ConcurrentDictionary<int, bool> _cachedTestcases = new();
+
+    /// <summary>
+    /// Trace prefixes loaded from the cache, indexed by their hash.
+    /// </summary>
+    private readonly ConcurrentDictionary<string, Lazy<Task<TracePrefixFile>>> _loadedPrefixes = new();
+
+    /// <summary>
+    /// Hashes of the trace prefixes which were stored in the cache.
+    /// </summary>
+    private readonly ConcurrentDictionary<TracePrefixFile, Lazy<Task<string>>> _storedPrefixes = new();
+
+    /// <summary>
+    /// Opens the trace cache in the given directory.
+    /// </summary>
+    /// <param name="directoryPath">Cache base directory.</param>
+    /// <param name="configurationKey">Data identifying the configuration of the cached pipeline stages.</param>
+    /// <param name="logger">Logger.</param>
+    internal TraceCache(string directoryPath, byte[] configurationKey, ILogger logger)
+    {
+        _logger = logger ?? throw new ArgumentNullException(nameof(logger));
+
+        _cacheDirectory = Directory.CreateDirectory(Path.Combine(directoryPath, ToHashString(SHA256.HashData(configurationKey))));
+    }
+
+    /// <summary>
+    /// Checks whether the given testcase was loaded from the cache by <see cref="TryLoadAsync"/>.
+    /// </summary>
+    /// <param name="traceEntity">Trace entity.</param>
+    public bool IsCached(TraceEntity traceEntity) => _cachedTestcases.ContainsKey(traceEntity.Id);
+
+    /// <summary>
+    /// Tries to find a preprocessed trace for the given testcase. If successful, the preprocessed trace is attached to the trace entity.
+    /// Testcases are identified by their contents, which are taken from memory if available.
+    /// </summary>
+    /// <param name="traceEntity">Trace entity.</param>
+    /// <returns>Whether a cached preprocessed trace was found.</returns>
+    public async Task<bool> TryLoadAsync(TraceEntity traceEntity)
+    {
+        string testcaseHash;
+        if(traceEntity.TestcaseData != null)
+            testcaseHash = ToHashString(SHA256.HashData(traceEntity.TestcaseData));
+        else
+        {
+            await using var testcaseFileStream = File.OpenRead(traceEntity.TestcaseFilePath);
+            testcaseHash = ToHashString(await SHA256.HashDataAsync(testcaseFileStream));
+        }
+
+        // Is there a complete entry?
+        string traceFilePath = Path.Combine(_cacheDirectory.FullName, $"{testcaseHash}.trace.preprocessed");
+        string prefixReferenceFilePath = Path.Combine(_cacheDirectory.FullName, $"{testcaseHash}.prefix");
+        string? prefixFilePath = null;
+        string prefixHash = "";
+        if(File.Exists(traceFilePath) && File.Exists(prefixReferenceFilePath))
+        {
+            prefixHash = (await File.ReadAllTextAsync(prefixReferenceFilePath)).Trim();
+            prefixFilePath = Path.Combine(_cacheDirectory.FullName, $"prefix-{prefixHash}.trace.preprocessed");
+        }
+
+        if(prefixFilePath == null || !File.Exists(prefixFilePath))
+        {
+            // Remember hash for storing the trace after preprocessing
+            _pendingTestcaseHashes[traceEntity.Id] = testcaseHash;
+            return false;
+        }
+
+        await _logger.LogDebugAsync($"[cache:{traceEntity.Id}] Loading preprocessed trace {testcaseHash} from cache");
+
+        // The trace prefix is usually shared by many entries
+        var prefix = await _loadedPrefixes.GetOrAdd(prefixHash, _ => new Lazy<Task<TracePrefixFile>>(async () => new TracePrefixFile(await File.ReadAllBytesAsync(prefixFilePath)))).Value;
+
+        // The file name of the cache entry is not meaningful for users, so we do not set the preprocessed trace file path
+        traceEntity.PreprocessedTraceFile = new TraceFile(prefix, traceFilePath);
+        _cachedTestcases[traceEntity.Id] = true;
+        return true;
+    }
+
+    /// <summary>
+    /// Stores the preprocessed trace of the given testcase, if it was not found in the cache.
+    /// </summary>
+    /// <param name="traceEntity">Trace entity.</param>
+    public async Task StoreAsync(TraceEntity traceEntity)
+    {
+        if(!_pendingTestcaseHashes.TryRemove(traceEntity.Id, out var testcaseHash))
+            return;
+
+        // Some trace stages directly produce analysis data (e.g., fingerprints), which is not cached
+        var traceFile = traceEntity.PreprocessedTraceFile;
+        if(traceFile?.Prefix == null)
+            return;
+
+        string prefixHash = await _storedPrefixes.GetOrAdd(traceFile.Prefix, prefix => new Lazy<Task<string>>(() => Task.Run(() => StorePrefix(prefix)))).Value;
+
+        // Write the prefix reference last, so incomplete entries are ignored
+        await Task.Run(() => WriteFile(Path.Combine(_cacheDirectory.FullName, $"{testcaseHash}.trace.preprocessed"), traceFile.CopyTo));
+        await Task.Run(() => WriteFile(Path.Combine(_cacheDirectory.FullName, $"{testcaseHash}.prefix"), stream => stream.Write(Encoding.ASCII.GetBytes(prefixHash))));
+
+        await _logger.LogDebugAsync($"[cache:{traceEntity.Id}] Stored preprocessed trace {testcaseHash} in cache");
+    }
+
+    /// <summary>
+    /// Stores the given trace prefix, if it does not yet exist in the cache.
+    /// </summary>
+    /// <param name="prefix">Trace prefix.</param>
+    /// <returns>The hash of the trace prefix.</returns>
+    private string StorePrefix(TracePrefixFile prefix)
+    {
+        using var prefixStream = new MemoryStream();
+        prefix.CopyTo(prefixStream);
+        string prefixHash = ToHashString(SHA256.HashData(prefixStream.GetBuffer().AsSpan(0, (int)prefixStream.Length)));
+
+        string prefixFilePath = Path.Combine(_cacheDirectory.FullName, $"prefix-{prefixHash}.trace.preprocessed");
+        if(!File.Exists(prefixFilePath))
+            WriteFile(prefixFilePath, stream => stream.Write(prefixStream.GetBuffer().AsSpan(0, (int)prefixStream.Length)));
+
+        return prefixHash;
+    }
+
+    /// <summary>
+    /// Writes a file through a temporary file, so concurrent readers never see partially written contents.
+    /// </summary>
+    /// <param name="path">File path.</param>
+    /// <param name="write">Writes the file contents into the given stream.</param>
+    private static void WriteFile(string path, Action<Stream> write)
+    {
+        string temporaryPath = $"{path}.{Guid.NewGuid():N}.tmp";
+        using(var stream = File.Open(temporaryPath, FileMode.CreateNew, FileAccess.Write, FileShare.None))
+            write(stream);
+        File.Move(temporaryPath, path, true);
+    }
+
+    private static string ToHashString(byte[] hash) => Convert.ToHexString(hash).ToLowerInvariant();
+}
@@ -0,0 +1,123 @@
+/* INCLUDES */
+
+#include "Compression.h"
+#include <cstring>
+
+
+/* DEFINES */
+
+// Minimum length of a match.
+#define LZ4_MIN_MATCH 4
+
+// The last bytes of a block are always stored as literals.
+#define LZ4_LAST_LITERALS 5
+
+// The last match must start at least this many bytes before the end of a block.
+#define LZ4_MATCH_FIND_LIMIT 12
+
+// Maximum distance between a match and its reference.
+#define LZ4_MAX_DISTANCE 65535
+
+
+/* FUNCTIONS */
+
+// Reads a potentially unaligned 32-bit value.
+static inline uint32_t Read32(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+// Computes the hash table index of the given 4-byte sequence.
+static inline uint32_t HashSequence(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - 12);
+}
+
+// Writes the remainder of a literal or match length which does not fit into the token.
+static inline uint8_t* WriteLength(uint8_t* output, size_t length)
+{
+    for(; length >= 255; length -= 255)
+        *output++ = 255;
+    *output++ = static_cast<uint8_t>(length);
+    return output;
+}
+
+// Writes a sequence consisting of the given literals and an optional match.
+static inline uint8_t* WriteSequence(uint8_t* output, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength, bool hasMatch)
+{
+    // Token: Literal length in the upper, match length in the lower 4 bits
+    uint8_t* token = output++;
+    *token = static_cast<uint8_t>((literalLength >= 15 ? 15 : literalLength) << 4);
+    if(literalLength >= 15)
+        output = WriteLength(output, literalLength - 15);
+    memcpy(output, literals, literalLength);
+    output += literalLength;
+
+    if(!hasMatch)
+        return output;
+
+    // Offset (little endian) and match length
+    *output++ = static_cast<uint8_t>(offset);
+    *output++ = static_cast<uint8_t>(offset >> 8);
+    size_t storedMatchLength = matchLength - LZ4_MIN_MATCH;
+    *token |= static_cast<uint8_t>(storedMatchLength >= 15 ? 15 : storedMatchLength);
+    if(storedMatchLength >= 15)
+        output = WriteLength(output, storedMatchLength - 15);
+    return output;
+}
+
+size_t Lz4CompressBound(size_t inputSize)
+{
+    return inputSize + (inputSize / 255) + 16;
+}
+
+size_t Lz4CompressBlock(const uint8_t* input, size_t inputSize, uint8_t* output, uint32_t* hashTable)
+{
+    const uint8_t* inputEnd = input + inputSize;
+    const uint8_t* anchor = input;
+    uint8_t* outputStart = output;
+
+    if(inputSize > LZ4_MATCH_FIND_LIMIT)
+    {
+        memset(hashTable, 0, LZ4_HASH_TABLE_SIZE * sizeof(uint32_t));
+        const uint8_t* matchFindLimit = inputEnd - LZ4_MATCH_FIND_LIMIT;
+        const uint8_t* matchEndLimit = inputEnd - LZ4_LAST_LITERALS;
+
+        // Skip faster through data which turns out to be incompressible
+        const uint8_t* ip = input + 1;
+        uint32_t searchCount = 0;
+        while(ip < matchFindLimit)
+        {
+            uint32_t sequence = Read32(ip);
+            uint32_t hash = HashSequence(sequence);
+            const uint8_t* reference = input + hashTable[hash];
+            hashTable[hash] = static_cast<uint32_t>(ip - input);
+
+            if(reference >= ip || static_cast<size_t>(ip - reference) > LZ4_MAX_DISTANCE || Read32(reference) != sequence)
+            {
+                ip += 1 + (searchCount++ >> 6);
+                continue;
+            }
+            searchCount = 0;
+
+            // Extend match forward
+            const uint8_t* matchEnd = ip + LZ4_MIN_MATCH;
+            const uint8_t* referenceEnd = reference + LZ4_MIN_MATCH;
+            while(matchEnd < matchEndLimit && *matchEnd == *referenceEnd)
+            {
+                ++matchEnd;
+                ++referenceEnd;
+            }
+
+            output = WriteSequence(output, anchor, static_cast<size_t>(ip - anchor), static_cast<size_t>(ip - reference), static_cast<size_t>(matchEnd - ip), true);
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+
+    // Remaining literals
+    output = WriteSequence(output, anchor, static_cast<size_t>(inputEnd - anchor), 0, 0, false);
+    return static_cast<size_t>(output - outputStart);
+}
@@ -0,0 +1,26 @@
+#pragma once
+/*
+Contains a minimal LZ4 block compressor for trace data.
+*/
+
+/* INCLUDES */
+
+#include <cstddef>
+#include <cstdint>
+
+
+/* DEFINES */
+
+// Number of entries of the hash table used by the compressor.
+#define LZ4_HASH_TABLE_SIZE 4096
+
+
+/* FUNCTIONS */
+
+// Returns the maximum compressed size of an input block with the given size.
+size_t Lz4CompressBound(size_t inputSize);
+
+// Compresses the given input block into the LZ4 block format and returns the compressed size.
+// -> output: Buffer with at least Lz4CompressBound(inputSize) bytes.
+// -> hashTable: Scratch buffer with LZ4_HASH_TABLE_SIZE entries.
+size_t Lz4CompressBlock(const uint8_t* input, size_t inputSize, uint8_t* output, uint32_t* hashTable);
@@ -0,0 +1,403 @@
+/* INCLUDES */
+
+#include "LeakageFingerprint.h"
+#include "TraceWriter.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+
+/* DEFINES */
+
+// xxHash64 constants.
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+
+/* STATIC VARIABLES */
+
+std::map<UINT64, LeakageFingerprint::ImageInfo> LeakageFingerprint::_images;
+
+
+/* TYPES */
+
+LeakageFingerprint::LeakageFingerprint(FingerprintKinds kind)
+{
+    _kind = kind;
+    _hashTable.resize(FINGERPRINT_INITIAL_CAPACITY);
+}
+
+void LeakageFingerprint::AddImage(bool interesting, UINT64 startAddress, UINT64 endAddress, const std::string& name)
+{
+    // The analysis only knows the file name
+    size_t separatorIndex = name.find_last_of("/\\");
+    std::string fileName = separatorIndex == std::string::npos ? name : name.substr(separatorIndex + 1);
+
+    int id = static_cast<int>(_images.size());
+    _images[startAddress] = ImageInfo{ id, interesting, startAddress, endAddress, fileName };
+}
+
+void LeakageFingerprint::BeginFile()
+{
+    // Each trace file starts with a fresh allocation size stack
+    _allocationSizes.clear();
+    _lastAllocationReturnAddress = 0;
+    _encounteredSizeSinceLastAllocation = false;
+
+    // Testcases start with the allocation and stack state of the prefix
+    if(!_processingPrefix)
+    {
+        std::fill(_hashTable.begin(), _hashTable.end(), HashTableEntry{});
+        _hashTableCount = 0;
+        _heapAllocations.clear();
+        _nextHeapAllocationId = _firstTestcaseHeapAllocationId;
+
+        // The call tree starts with the root node, which is hit once
+        _shadowCallStack.assign(1, 0);
+        _callStackNodes.clear();
+        _callStackNodeIndices.clear();
+        _callStackNodes.emplace_back(0, CallStackNode{ 0, 0, 1 });
+        _callStackNodeIndices[0] = 0;
+
+        _stackPointerMin = _prefixStackPointerMin;
+        _stackPointerMax = _prefixStackPointerMax;
+        _stackFrameBase = _prefixStackFrameBase;
+        _hasStackFrame = _prefixHasStackFrame;
+    }
+}
+
+void LeakageFingerprint::EndPrefix()
+{
+    _processingPrefix = false;
+
+    _prefixHeapAllocations = _heapAllocations;
+    _firstTestcaseHeapAllocationId = _nextHeapAllocationId;
+    _prefixStackPointerMin = _stackPointerMin;
+    _prefixStackPointerMax = _stackPointerMax;
+    _prefixStackFrameBase = _stackFrameBase;
+    _prefixHasStackFrame = _hasStackFrame;
+}
+
+void LeakageFingerprint::AddEntries(const TraceEntry* begin, const TraceEntry* end)
+{
+    for(const TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        switch(entry->Type)
+        {
+            case TraceEntryTypes::HeapAllocSizeParameter:
+            {
+                // Remember size parameter until the address return
+                _allocationSizes.push_back(static_cast<UINT32>(entry->Param1));
+                _encounteredSizeSinceLastAllocation = true;
+                break;
+            }
+
+            case TraceEntryTypes::HeapAllocAddressReturn:
+            {
+                // Same checks as in the preprocessor: Skip double returns and returns without size
+                if(entry->Param2 == _lastAllocationReturnAddress && !_encounteredSizeSinceLastAllocation)
+                    break;
+                if(_allocationSizes.empty())
+                    break;
+
+                UINT32 size = _allocationSizes.back();
+                _allocationSizes.pop_back();
+                _heapAllocations[entry->Param2] = HeapBlock{ _nextHeapAllocationId++, size };
+
+                _lastAllocationReturnAddress = entry->Param2;
+                _encounteredSizeSinceLastAllocation = false;
+                break;
+            }
+
+            case TraceEntryTypes::HeapFreeAddressParameter:
+            {
+                // Frees of prefix allocations are ignored, as in the preprocessor
+                if(entry->Param2 != 0)
+                    _heapAllocations.erase(entry->Param2);
+                break;
+            }
+
+            case TraceEntryTypes::StackPointerInfo:
+            {
+                _stackPointerMin = entry->Param1;
+                _stackPointerMax = entry->Param2;
+
+                // The preprocessor creates a single dummy stack frame at the first stack pointer info
+                if(!_hasStackFrame)
+                {
+                    _stackFrameBase = _stackPointerMin;
+                    _hasStackFrame = true;
+                }
+                break;
+            }
+
+            case TraceEntryTypes::Branch:
+            {
+                // Branches are only tracked for the call tree, and the prefix does not contain branches
+                if(_kind == FingerprintKinds::CallStackMemoryAccess && !_processingPrefix)
+                    HandleBranch(entry);
+                break;
+            }
+
+            case TraceEntryTypes::MemoryRead:
+            case TraceEntryTypes::MemoryWrite:
+            {
+                // The prefix does not contain memory accesses
+                if(_processingPrefix)
+                    break;
+
+                // Only consider instructions of interesting images
+                const ImageInfo* instructionImage = FindImage(entry->Param1);
+                if(instructionImage == nullptr || !instructionImage->interesting)
+                    break;
+
+                UINT64 memoryAddressId;
+                if(!ResolveMemoryAddress(entry->Param2, memoryAddressId))
+                    break;
+
+                UINT64 instructionId = (static_cast<UINT64>(instructionImage->id) << 32) | static_cast<UINT32>(entry->Param1 - instructionImage->startAddress);
+                UpdateHash(_kind == FingerprintKinds::CallStackMemoryAccess ? _shadowCallStack.back() : 0, instructionId, memoryAddressId);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+
+const LeakageFingerprint::ImageInfo* LeakageFingerprint::FindImage(UINT64 address)
+{
+    auto it = _images.upper_bound(address);
+    if(it == _images.begin())
+        return nullptr;
+    --it;
+    return address <= it->second.endAddress ? &it->second : nullptr;
+}
+
+const std::pair<const UINT64, LeakageFingerprint::HeapBlock>* LeakageFingerprint::FindHeapBlock(const std::map<UINT64, HeapBlock>& allocations, UINT64 address)
+{
+    auto it = allocations.upper_bound(address);
+    if(it == allocations.begin())
+        return nullptr;
+    --it;
+    return address <= it->first + it->second.size ? &*it : nullptr;
+}
+
+bool LeakageFingerprint::ResolveMemoryAddress(UINT64 address, UINT64& memoryAddressId) const
+{
+    // Stack
+    if(_stackPointerMin <= address && address <= _stackPointerMax)
+    {
+        if(!_hasStackFrame || address < _stackFrameBase)
+            return false;
+
+        memoryAddressId = static_cast<UINT32>(address - _stackFrameBase);
+        return true;
+    }
+
+    // Image
+    const ImageInfo* image = FindImage(address);
+    if(image != nullptr)
+    {
+        memoryAddressId = (static_cast<UINT64>(image->id) << 32) | static_cast<UINT32>(address - image->startAddress);
+        return true;
+    }
+
+    // Heap
+    const auto* heapBlock = FindHeapBlock(_heapAllocations, address);
+    if(heapBlock == nullptr)
+        heapBlock = FindHeapBlock(_prefixHeapAllocations, address);
+    if(heapBlock == nullptr)
+        return false;
+
+    // The call stack analysis numbers the allocations of each testcase starting at 1, and moves the prefix allocations out of the way
+    UINT64 heapBlockId = static_cast<UINT64>(heapBlock->second.id);
+    if(_kind == FingerprintKinds::CallStackMemoryAccess)
+        heapBlockId = heapBlock->second.id >= _firstTestcaseHeapAllocationId ? heapBlock->second.id - _firstTestcaseHeapAllocationId + 1 : 1000000 + heapBlock->second.id;
+
+    memoryAddressId = (heapBlockId << 32) | static_cast<UINT32>(address - heapBlock->first);
+    return true;
+}
+
+void LeakageFingerprint::HandleBranch(const TraceEntry* entry)
+{
+    // Only taken calls and returns affect the call tree
+    UINT8 branchType = entry->Flag & static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn);
+    if((entry->Flag & static_cast<UINT8>(TraceEntryFlags::BranchTaken)) == 0)
+        return;
+    if(branchType != static_cast<UINT8>(TraceEntryFlags::BranchTypeCall) && branchType != static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn))
+        return;
+
+    // The preprocessor drops branches with unknown images and branches which do not touch an interesting image
+    const ImageInfo* sourceImage = FindImage(entry->Param1);
+    const ImageInfo* destinationImage = FindImage(entry->Param2);
+    if(sourceImage == nullptr || destinationImage == nullptr)
+        return;
+    if(!sourceImage->interesting && !destinationImage->interesting)
+        return;
+
+    if(branchType == static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn))
+    {
+        // Never pop the root node
+        if(_shadowCallStack.size() > 1)
+            _shadowCallStack.pop_back();
+        return;
+    }
+
+    // Retrieve or create node of target instruction; the call stack ID is computed as hash(parentId || instructionId)
+    UINT64 targetInstructionId = (static_cast<UINT64>(destinationImage->id) << 32) | static_cast<UINT32>(entry->Param2 - destinationImage->startAddress);
+    UINT64 parentCallStackId = _shadowCallStack.back();
+    UINT64 callStackId = XxHash64(parentCallStackId, targetInstructionId);
+    auto nodeIt = _callStackNodeIndices.find(callStackId);
+    if(nodeIt == _callStackNodeIndices.end())
+    {
+        nodeIt = _callStackNodeIndices.emplace(callStackId, _callStackNodes.size()).first;
+        _callStackNodes.emplace_back(callStackId, CallStackNode{ parentCallStackId, targetInstructionId, 0 });
+    }
+
+    ++_callStackNodes[nodeIt->second].second.hits;
+    _shadowCallStack.push_back(callStackId);
+}
+
+size_t LeakageFingerprint::GetHashTableIndex(UINT64 callStackId, UINT64 instructionId, size_t mask)
+{
+    return static_cast<size_t>(((instructionId ^ callStackId) * XXH_PRIME64_1) >> 32) & mask;
+}
+
+void LeakageFingerprint::UpdateHash(UINT64 callStackId, UINT64 instructionId, UINT64 memoryAddressId)
+{
+    // Find entry
+    size_t mask = _hashTable.size() - 1;
+    size_t index = GetHashTableIndex(callStackId, instructionId, mask);
+    while(_hashTable[index].used && (_hashTable[index].instructionId != instructionId || _hashTable[index].callStackId != callStackId))
+        index = (index + 1) & mask;
+
+    HashTableEntry& hashTableEntry = _hashTable[index];
+    if(!hashTableEntry.used)
+    {
+        hashTableEntry.used = true;
+        hashTableEntry.callStackId = callStackId;
+        hashTableEntry.instructionId = instructionId;
+        ++_hashTableCount;
+    }
+
+    // newHash = hash(oldHash || address)
+    hashTableEntry.memoryAddressId = memoryAddressId;
+    hashTableEntry.hash = XxHash64(hashTableEntry.hash, memoryAddressId);
+
+    // Keep load factor below 1/2
+    if(2 * _hashTableCount > _hashTable.size())
+        GrowHashTable();
+}
+
+void LeakageFingerprint::GrowHashTable()
+{
+    std::vector<HashTableEntry> oldHashTable(_hashTable.size() * 2);
+    oldHashTable.swap(_hashTable);
+
+    size_t mask = _hashTable.size() - 1;
+    for(const HashTableEntry& hashTableEntry : oldHashTable)
+    {
+        if(!hashTableEntry.used)
+            continue;
+
+        size_t index = GetHashTableIndex(hashTableEntry.callStackId, hashTableEntry.instructionId, mask);
+        while(_hashTable[index].used)
+            index = (index + 1) & mask;
+        _hashTable[index] = hashTableEntry;
+    }
+}
+
+void LeakageFingerprint::WriteToFile(const std::string& filename) const
+{
+    std::ofstream fileStream;
+    fileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    fileStream.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+    if(!fileStream)
+    {
+        std::cerr << "Error: Could not open fingerprint output file '" << filename << "'." << std::endl;
+        exit(1);
+    }
+
+    // Header
+    UINT32 header[3] = { FINGERPRINT_FILE_MAGIC, FINGERPRINT_FILE_VERSION, static_cast<UINT32>(_kind) };
+    fileStream.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    // Images, in the same format as in the preprocessed trace prefix
+    INT32 imageCount = static_cast<INT32>(_images.size());
+    fileStream.write(reinterpret_cast<const char*>(&imageCount), sizeof(imageCount));
+    for(const auto& image : _images)
+    {
+        INT32 id = image.second.id;
+        INT32 nameLength = static_cast<INT32>(image.second.name.length());
+        UINT8 interesting = image.second.interesting ? 1 : 0;
+        fileStream.write(reinterpret_cast<const char*>(&id), sizeof(id));
+        fileStream.write(reinterpret_cast<const char*>(&image.second.startAddress), sizeof(UINT64));
+        fileStream.write(reinterpret_cast<const char*>(&image.second.endAddress), sizeof(UINT64));
+        fileStream.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+        fileStream.write(image.second.name.c_str(), nameLength);
+        fileStream.write(reinterpret_cast<const char*>(&interesting), sizeof(interesting));
+    }
+
+    // Call tree, parents before children
+    bool hasCallStacks = _kind == FingerprintKinds::CallStackMemoryAccess;
+    if(hasCallStacks)
+    {
+        INT32 callStackNodeCount = static_cast<INT32>(_callStackNodes.size());
+        fileStream.write(reinterpret_cast<const char*>(&callStackNodeCount), sizeof(callStackNodeCount));
+        for(const auto& callStackNode : _callStackNodes)
+        {
+            UINT64 record[3] = { callStackNode.first, callStackNode.second.parentCallStackId, callStackNode.second.instructionId };
+            fileStream.write(reinterpret_cast<const char*>(record), sizeof(record));
+            fileStream.write(reinterpret_cast<const char*>(&callStackNode.second.hits), sizeof(callStackNode.second.hits));
+        }
+    }
+
+    // Hashes, sorted by call stack and instruction ID to get reproducible files
+    std::vector<const HashTableEntry*> hashTableEntries;
+    hashTableEntries.reserve(_hashTableCount);
+    for(const HashTableEntry& hashTableEntry : _hashTable)
+        if(hashTableEntry.used)
+            hashTableEntries.push_back(&hashTableEntry);
+    std::sort(hashTableEntries.begin(), hashTableEntries.end(), [](const HashTableEntry* a, const HashTableEntry* b)
+    {
+        return a->callStackId != b->callStackId ? a->callStackId < b->callStackId : a->instructionId < b->instructionId;
+    });
+
+    INT32 entryCount = static_cast<INT32>(hashTableEntries.size());
+    fileStream.write(reinterpret_cast<const char*>(&entryCount), sizeof(entryCount));
+    for(const HashTableEntry* hashTableEntry : hashTableEntries)
+    {
+        if(hasCallStacks)
+            fileStream.write(reinterpret_cast<const char*>(&hashTableEntry->callStackId), sizeof(UINT64));
+        UINT64 record[3] = { hashTableEntry->instructionId, hashTableEntry->hash, hashTableEntry->memoryAddressId };
+        fileStream.write(reinterpret_cast<const char*>(record), sizeof(record));
+    }
+
+    fileStream.close();
+}
+
+UINT64 LeakageFingerprint::XxHash64(UINT64 left, UINT64 right)
+{
+    // Short input path of xxHash64 for exactly two 8-byte lanes
+    auto rotateLeft = [](UINT64 value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto round = [&](UINT64 input) { return rotateLeft(input * XXH_PRIME64_2, 31) * XXH_PRIME64_1; };
+
+    UINT64 hash = XXH_PRIME64_5 + 16;
+    hash ^= round(left);
+    hash = rotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    hash ^= round(right);
+    hash = rotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,199 @@
+#pragma once
+/*
+Contains an in-tool replacement of the full trace for the instruction memory access trace leakage analysis:
+Instead of writing trace entries, their memory accesses are directly reduced to one rolling hash per instruction.
+*/
+
+/* INCLUDES */
+
+#include "pin.H"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+
+/* DEFINES */
+
+// Magic number at the beginning of fingerprint files ("MWFP").
+#define FINGERPRINT_FILE_MAGIC 0x5046574D
+
+// Version of the fingerprint file format.
+#define FINGERPRINT_FILE_VERSION 1
+
+// Initial capacity of the per-instruction hash table. Must be a power of two.
+#define FINGERPRINT_INITIAL_CAPACITY 4096
+
+
+/* TYPES */
+
+struct TraceEntry;
+
+// The different kinds of fingerprints.
+enum struct FingerprintKinds : UINT32
+{
+    // One rolling hash over the accessed memory addresses per memory accessing instruction.
+    InstructionMemoryAccess = 1,
+
+    // One rolling hash over the accessed memory addresses per memory accessing instruction and call stack.
+    CallStackMemoryAccess = 2
+};
+
+// Computes the memory access hashes of the main thread, mirroring the resolution of memory addresses done by the Pin trace preprocessor.
+// In call stack mode, a shadow call stack is maintained from the call and return entries, mirroring the call tree of the call stack memory access trace leakage analysis.
+// The image list is shared by all instances and must only be modified during the trace prefix.
+class LeakageFingerprint
+{
+private:
+    // Metadata of an image, as known to the preprocessor.
+    struct ImageInfo
+    {
+        int id;
+        bool interesting;
+        UINT64 startAddress;
+        UINT64 endAddress;
+        std::string name;
+    };
+
+    // A heap allocation block.
+    struct HeapBlock
+    {
+        int id;
+        UINT32 size;
+    };
+
+    // A node of the call tree, identified by its call stack ID.
+    struct CallStackNode
+    {
+        // The call stack ID of the parent node.
+        UINT64 parentCallStackId;
+
+        // ID of the call target instruction.
+        UINT64 instructionId;
+
+        // Number of calls which led to this node.
+        INT32 hits;
+    };
+
+    // An entry of the per-instruction hash table.
+    struct HashTableEntry
+    {
+        // Call stack ID (0 if call stacks are not tracked).
+        UINT64 callStackId;
+
+        // Instruction ID (image ID and image relative address).
+        UINT64 instructionId;
+
+        // The current rolling hash.
+        UINT64 hash;
+
+        // The last accessed memory address ID, which is hashed together with the previous hash.
+        UINT64 memoryAddressId;
+
+        // Determines whether this entry is used.
+        bool used;
+    };
+
+    // The loaded images, indexed by start address. Only images which were loaded during the trace prefix are known.
+    static std::map<UINT64, ImageInfo> _images;
+
+    // The kind of this fingerprint.
+    FingerprintKinds _kind;
+
+    // Determines whether the trace prefix is currently processed.
+    bool _processingPrefix = true;
+
+    // The per-instruction hash table (open addressing with linear probing).
+    std::vector<HashTableEntry> _hashTable;
+
+    // Number of used hash table entries.
+    size_t _hashTableCount = 0;
+
+    // The call stack IDs of the current call chain, starting with the root (0).
+    std::vector<UINT64> _shadowCallStack;
+
+    // The call tree nodes of the current testcase, in creation order (parents before children).
+    std::vector<std::pair<UINT64, CallStackNode>> _callStackNodes;
+
+    // Maps call stack IDs to indices in the node list.
+    std::unordered_map<UINT64, size_t> _callStackNodeIndices;
+
+    // Heap allocations of the current testcase, indexed by start address.
+    std::map<UINT64, HeapBlock> _heapAllocations;
+
+    // Heap allocations of the trace prefix, indexed by start address.
+    std::map<UINT64, HeapBlock> _prefixHeapAllocations;
+
+    // The next heap allocation ID.
+    int _nextHeapAllocationId = 0;
+
+    // The first heap allocation ID of each testcase.
+    int _firstTestcaseHeapAllocationId = 0;
+
+    // Pending allocation sizes.
+    std::vector<UINT32> _allocationSizes;
+
+    // The last returned allocation address.
+    UINT64 _lastAllocationReturnAddress = 0;
+
+    // Determines whether an allocation size has been encountered since the last allocation address return.
+    bool _encounteredSizeSinceLastAllocation = false;
+
+    // Stack boundaries.
+    UINT64 _stackPointerMin = ~0ULL;
+    UINT64 _stackPointerMax = 0;
+
+    // Base address of the stack frame, if a stack pointer info entry was encountered.
+    UINT64 _stackFrameBase = 0;
+    bool _hasStackFrame = false;
+
+    // Stack state at the end of the trace prefix.
+    UINT64 _prefixStackPointerMin = ~0ULL;
+    UINT64 _prefixStackPointerMax = 0;
+    UINT64 _prefixStackFrameBase = 0;
+    bool _prefixHasStackFrame = false;
+
+private:
+    // Returns the image containing the given address, or nullptr.
+    static const ImageInfo* FindImage(UINT64 address);
+
+    // Returns the heap block containing the given address in the given allocation list, or nullptr.
+    static const std::pair<const UINT64, HeapBlock>* FindHeapBlock(const std::map<UINT64, HeapBlock>& allocations, UINT64 address);
+
+    // Resolves the given memory address to the ID used by the analysis. Returns false if the address could not be resolved.
+    bool ResolveMemoryAddress(UINT64 address, UINT64& memoryAddressId) const;
+
+    // Updates the call tree with the given call or return entry.
+    void HandleBranch(const TraceEntry* entry);
+
+    // Updates the rolling hash of the given instruction in the given call stack.
+    void UpdateHash(UINT64 callStackId, UINT64 instructionId, UINT64 memoryAddressId);
+
+    // Returns the initial hash table index of the given key.
+    static size_t GetHashTableIndex(UINT64 callStackId, UINT64 instructionId, size_t mask);
+
+    // Doubles the capacity of the hash table.
+    void GrowHashTable();
+
+public:
+    // Initializes an empty fingerprint of the given kind.
+    explicit LeakageFingerprint(FingerprintKinds kind);
+
+    // Records the given loaded image. Image IDs are assigned in load order, like the preprocessor does.
+    static void AddImage(bool interesting, UINT64 startAddress, UINT64 endAddress, const std::string& name);
+
+    // Resets the per-file state and clears the hash table, before the entries of a new testcase are added.
+    void BeginFile();
+
+    // Ends the trace prefix, so its allocation and stack state is used as the starting point of each testcase.
+    void EndPrefix();
+
+    // Processes the given trace entries.
+    void AddEntries(const TraceEntry* begin, const TraceEntry* end);
+
+    // Writes the images and the hash table of the current testcase into the given file.
+    void WriteToFile(const std::string& filename) const;
+
+    // Computes the xxHash64 of the given 16 bytes (two little endian 64-bit words) with seed 0.
+    static UINT64 XxHash64(UINT64 left, UINT64 right);
+};
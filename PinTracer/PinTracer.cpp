@@ -7,6 +7,11 @@ To get meaningful outputs, make sure that these functions are called with "call"
 
 
 /* INCLUDES */
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include "TraceWriter.h"
 #include "Utilities.h"
 #include "CpuOverride.h"
@@ -34,6 +39,43 @@ KNOB<UINT64> KnobFixedRandomNumbers(KNOB_MODE_WRITEONCE, "pintool", "r", "841534
 // Enable stack allocation tracking.
 KNOB<int> KnobEnableStackAllocationTracking(KNOB_MODE_WRITEONCE, "pintool", "s", "0", "enable stack allocation tracking");
 
+// Number of trace buffers for asynchronous trace writing.
+KNOB<int> KnobAsyncTraceBufferCount(KNOB_MODE_WRITEONCE, "pintool", "a", "0", "specify number of trace buffers for asynchronous trace writing (0/1 = write synchronously on the instrumented thread)");
+
+// Compact trace encoding.
+KNOB<int> KnobCompactTraceEncoding(KNOB_MODE_WRITEONCE, "pintool", "e", "0", "enable compact variable-length trace encoding");
+
+// Trace compression.
+KNOB<int> KnobTraceCompression(KNOB_MODE_WRITEONCE, "pintool", "z", "0", "enable LZ4 compression of trace files");
+
+// Shared memory trace transport.
+KNOB<std::string> KnobSharedMemoryRingPath(KNOB_MODE_WRITEONCE, "pintool", "m", "", "specify path of a shared memory ring file which receives the trace data instead of the file system (Linux only)");
+
+// Trace prefix recording.
+KNOB<int> KnobRecordPrefixTrace(KNOB_MODE_WRITEONCE, "pintool", "p", "1", "record the trace prefix (0 = only record image metadata, for reusing the trace prefix of another Pin instance)");
+
+// Strict image filtering.
+KNOB<int> KnobStrictImageFiltering(KNOB_MODE_WRITEONCE, "pintool", "x", "0", "enable strict image filtering: only instrument calls and returns in uninteresting images");
+
+// The multi-threaded tracing command line option.
+KNOB<int> KnobTraceAllThreads(KNOB_MODE_WRITEONCE, "pintool", "n", "0", "trace all application threads, each into its own trace files (0 = only trace the main thread)");
+
+// Assumed stack size of secondary threads, for which the investigated program does not announce the stack boundaries.
+// The default matches the default stack size of new threads on Linux (glibc uses RLIMIT_STACK, which is usually 8 MiB).
+KNOB<UINT64> KnobSecondaryThreadStackSize(KNOB_MODE_WRITEONCE, "pintool", "ts", "8388608", "specify assumed stack size of secondary threads in bytes (only used when tracing all threads)");
+
+// The leakage fingerprint mode.
+KNOB<int> KnobFingerprintMode(KNOB_MODE_WRITEONCE, "pintool", "f", "0", "specify output mode: 0 = trace files (default), 1 = instruction memory access fingerprints, 2 = call stack memory access fingerprints (only for the respective memory access trace leakage analysis)");
+
+// Tracing statistics.
+KNOB<int> KnobTracingStatistics(KNOB_MODE_WRITEONCE, "pintool", "stats", "0", "report tracing statistics (entry counts, buffer flushes, instrumentation) per testcase");
+
+// The trace buffer backend.
+KNOB<int> KnobTraceBufferBackend(KNOB_MODE_WRITEONCE, "pintool", "b", "0", "specify trace buffer backend: 0 = analysis routines (default), 1 = Pin trace buffer API");
+
+// Basic block memory access records.
+KNOB<int> KnobBlockMemoryAccessRecords(KNOB_MODE_WRITEONCE, "pintool", "g", "0", "record the memory accesses of each basic block execution in a single trace entry, instead of one entry per access");
+
 // The names of interesting images, parsed from the command line option.
 std::vector<std::string> _interestingImages;
 
@@ -52,8 +94,37 @@ REG _cpuIdEaxInputReg;
 // The ECX input register of a CPUID instruction.
 REG _cpuIdEcxInputReg;
 
-// Data of loaded images for lookup during trace instrumentation.
-std::vector<ImageData*> _images;
+// Controls whether trace entries are recorded through Pin's trace buffer API instead of our own analysis routines.
+// In this mode the tool registers only mark whether a thread is instrumented; the actual trace entry pointer of a thread lives in its TraceBufferThreadState.
+bool _useTraceBuffer = false;
+
+// The Pin trace buffer (if the trace buffer backend is used).
+BUFFER_ID _traceBufferId;
+
+// TLS key for the per-thread trace buffer state.
+TLS_KEY _traceBufferThreadStateKey;
+
+// The trace writers of all instrumented threads (needed for stopping their writer threads on exit).
+std::vector<TraceWriter*> _traceWriters;
+
+// The trace writers of exited threads, whose asynchronous writer threads were asked to exit. Pin does not allow waiting for internal threads inside
+// a thread fini callback, so these are joined and freed in PrepareForFini().
+std::vector<TraceWriter*> _exitedTraceWriters;
+
+// Controls whether all application threads are traced, instead of only the main thread.
+bool _traceAllThreads = false;
+
+// The ID of the currently traced testcase, or -1 if no testcase is active. Used for threads starting in the middle of a testcase.
+int _currentTestcaseId = -1;
+
+// Protects the list of trace writers and the testcase state of the threads.
+PIN_LOCK _threadStateLock;
+
+// Data of loaded images for lookup during trace instrumentation, indexed by image start address.
+std::map<UINT64, ImageData*> _images;
+
+// The image of the most recently instrumented basic block. Consecutive traces very likely belong to the same image.
+ImageData* _lastInstrumentedImage = nullptr;
 
 // Controls whether RDRAND random numbers are replaced by fixed ones.
 bool _useFixedRandomNumber = false;
@@ -61,6 +132,15 @@ bool _useFixedRandomNumber = false;
 // Controls whether stack allocation tracking is enabled.
 bool _enableStackAllocationTracking = false;
 
+// Controls whether jumps in uninteresting images are instrumented. If strict filtering is enabled, only calls and returns are tracked there, to keep the call stack consistent.
+bool _strictImageFiltering = false;
+
+// Determines whether trace entries are reduced to leakage fingerprints, which do not need jumps (only calls and returns).
+bool _fingerprintMode = false;
+
+// Controls whether the memory accesses of a basic block are collected into a single BlockMemoryAccesses entry.
+bool _blockMemoryAccessRecords = false;
+
 // Tracks whether libc was loaded.
 #ifdef WIN32
 	bool _libcLoadDetected = true;
@@ -71,10 +151,34 @@ bool _enableStackAllocationTracking = false;
 // The fixed random number to be returned after each RDRAND instruction.
 UINT64 _fixedRandomNumber = 0;
 
-// Depth of the allocation call stack.
-// 0 is the call stack level of the allocation function itself.
-// -1 indicates that allocation tracking is inactive.
-int _allocationCallStackDepth = -1;
+
+/* TYPES */
+
+// A memory access which is collected for the BlockMemoryAccesses entry of a basic block.
+struct BlockMemoryAccess
+{
+    // The accessing instruction.
+    INS instruction;
+
+    // The IARG type which yields the accessed address.
+    IARG_TYPE addressArgument;
+
+    // The static part of the access (MemoryRead/MemoryWrite entry without memory address).
+    TraceEntry entry;
+};
+
+// Per-thread state of the Pin trace buffer backend.
+struct TraceBufferThreadState
+{
+    // The trace writer of this thread.
+    TraceWriter* traceWriter;
+
+    // The next writable entry of the trace writer.
+    TraceEntry* nextEntry;
+
+    // The number of entries at the beginning of the Pin trace buffer which have already been stored.
+    UINT64 processedEntryCount;
+};
 
 
 /* CALLBACK PROTOTYPES */
@@ -82,14 +186,31 @@ int _allocationCallStackDepth = -1;
 VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v);
 VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[maybe_unused]] VOID* v);
 VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] INT32 code, [[maybe_unused]] VOID* v);
+VOID PrepareForFini([[maybe_unused]] VOID* v);
+VOID* TraceBufferFull([[maybe_unused]] BUFFER_ID id, THREADID tid, [[maybe_unused]] const CONTEXT* ctxt, VOID* buffer, UINT64 numElements, [[maybe_unused]] VOID* v);
 VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v);
-TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId);
-TraceEntry* TestcaseEnd(TraceWriter *traceWriter, TraceEntry* nextEntry);
+VOID UnloadImage(IMG img, [[maybe_unused]] VOID* v);
+VOID GetImageBounds(IMG img, UINT64& imageStart, UINT64& imageEnd);
+VOID AddBlockMemoryAccess(std::vector<BlockMemoryAccess>& accesses, INS ins, IARG_TYPE addressArgument, TraceEntryTypes type, UINT32 size);
+VOID InstrumentBlockMemoryAccesses(std::vector<BlockMemoryAccess>& accesses);
+bool IsRoutineEntry(INS ins);
+ImageData* FindImage(BBL bbl);
+TraceEntry* TestcaseStart(THREADID tid, TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId);
+TraceEntry* TestcaseEnd(THREADID tid, TraceWriter *traceWriter, TraceEntry* nextEntry);
+VOID StopOtherThreads(THREADID tid);
+VOID ResumeOtherThreads(THREADID tid);
+VOID SwitchStoppedThreadsTestcase(int testcaseId);
+VOID TestcaseStartBuffered(THREADID tid, CONTEXT* ctxt, ADDRINT newTestcaseId);
+VOID TestcaseEndBuffered(THREADID tid, CONTEXT* ctxt);
+VOID StoreTraceBufferEntries(TraceBufferThreadState* state, BufferedTraceEntry* buffer, UINT64 entryCount);
+VOID FlushTraceBuffer(THREADID tid, CONTEXT* ctxt);
+VOID InsertFillBufferAtRoutineEntry(RTN rtn, TraceEntryTypes type, INT32 param1ArgumentIndex, INT32 param2ArgumentIndex, UINT32 flags);
 EXCEPT_HANDLING_RESULT HandlePinToolException([[maybe_unused]] THREADID tid, EXCEPTION_INFO* exceptionInfo,
                                               [[maybe_unused]] PHYSICAL_CONTEXT* physicalContext, [[maybe_unused]] VOID* v);
 ADDRINT CheckNextTraceEntryPointerValid(TraceEntry* nextEntry);
-VOID StartAllocationTracking(TraceEntry *nextEntry);
-VOID TrackAllocationCall();
+VOID StartAllocationTracking(TraceWriter *traceWriter);
+VOID TrackAllocationCall(TraceWriter *traceWriter);
+ADDRINT CheckAllocationReturn(TraceWriter *traceWriter);
 TraceEntry* TrackAllocationReturn(TraceWriter *traceWriter, TraceEntry *nextEntry, ADDRINT returnValue);
 void ChangeRandomNumber(ADDRINT* outputReg);
 
@@ -144,17 +265,147 @@ int main(int argc, char* argv[])
 		std::cerr << "Stack allocation tracking is enabled" << std::endl;
 	}
 
+	// Check if strict image filtering is enabled
+	if(KnobStrictImageFiltering.Value() != 0)
+	{
+		_strictImageFiltering = true;
+		std::cerr << "Strict image filtering is enabled" << std::endl;
+	}
+
+	// Check if compact trace encoding is enabled
+	if(KnobCompactTraceEncoding.Value() != 0)
+		std::cerr << "Compact trace encoding is enabled" << std::endl;
+
+	// Check if trace compression is enabled
+	if(KnobTraceCompression.Value() != 0)
+		std::cerr << "Trace compression is enabled" << std::endl;
+
+	// Check trace buffer backend
+	if(KnobTraceBufferBackend.Value() == 1)
+	{
+#ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
+		std::cerr << "Error: The Pin trace buffer backend does not support legacy allocation return tracking." << std::endl;
+		return -1;
+#endif
+
+		// Each thread gets a buffer with the same capacity as the trace writer's entry buffer
+		_traceBufferId = PIN_DefineTraceBuffer(sizeof(BufferedTraceEntry), ENTRY_BUFFER_SIZE * sizeof(BufferedTraceEntry) / 4096, TraceBufferFull, nullptr);
+		if(_traceBufferId == BUFFER_ID_INVALID)
+		{
+			std::cerr << "Error: Could not allocate Pin trace buffer." << std::endl;
+			return -1;
+		}
+		_traceBufferThreadStateKey = PIN_CreateThreadDataKey(nullptr);
+
+		_useTraceBuffer = true;
+		std::cerr << "Using Pin trace buffer backend" << std::endl;
+	}
+
+	// Check if all threads should be traced
+	PIN_InitLock(&_threadStateLock);
+	if(KnobTraceAllThreads.Value() != 0)
+	{
+#ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
+		std::cerr << "Error: Tracing all threads is not supported with legacy allocation return tracking." << std::endl;
+		return -1;
+#endif
+
+		// The testcase switch needs to access the entry buffer pointers of stopped threads, which are only available in tool registers
+		if(_useTraceBuffer)
+		{
+			std::cerr << "Error: Tracing all threads is not supported with the Pin trace buffer backend." << std::endl;
+			return -1;
+		}
+
+		// The shared memory ring only supports one file at a time
+		if(!trim(KnobSharedMemoryRingPath.Value()).empty())
+		{
+			std::cerr << "Error: Tracing all threads is not supported with the shared memory transport." << std::endl;
+			return -1;
+		}
+
+		_traceAllThreads = true;
+		std::cerr << "Tracing all threads" << std::endl;
+	}
+
+	// Check output mode
+	if(KnobFingerprintMode.Value() == 1 || KnobFingerprintMode.Value() == 2)
+	{
+		// Fingerprints are written as a whole at the end of each testcase, so there is no file to stream
+		if(!trim(KnobSharedMemoryRingPath.Value()).empty())
+		{
+			std::cerr << "Error: The fingerprint mode is not supported with the shared memory transport." << std::endl;
+			return -1;
+		}
+
+		// Allocations are resolved per thread, so the fingerprints of different threads could not be merged
+		if(_traceAllThreads)
+		{
+			std::cerr << "Error: The fingerprint mode is not supported when tracing all threads." << std::endl;
+			return -1;
+		}
+
+		_fingerprintMode = true;
+		TraceWriter::InitFingerprintMode(static_cast<FingerprintKinds>(KnobFingerprintMode.Value()));
+	}
+	else if(KnobFingerprintMode.Value() != 0)
+	{
+		std::cerr << "Error: Unknown fingerprint mode " << KnobFingerprintMode.Value() << "." << std::endl;
+		return -1;
+	}
+
+	// Check if basic block memory access records are enabled
+	if(KnobBlockMemoryAccessRecords.Value() != 0)
+	{
+		// Pin fills its trace buffer with fixed-size records
+		if(_useTraceBuffer)
+		{
+			std::cerr << "Error: Basic block memory access records are not supported with the Pin trace buffer backend." << std::endl;
+			return -1;
+		}
+
+		// The records are filled while the block executes, and stopped threads could be flushed in the middle of a block
+		if(_traceAllThreads)
+		{
+			std::cerr << "Error: Basic block memory access records are not supported when tracing all threads." << std::endl;
+			return -1;
+		}
+
+		// Fingerprints directly consume the entry buffer
+		if(_fingerprintMode)
+		{
+			std::cerr << "Error: Basic block memory access records are not supported with the fingerprint mode." << std::endl;
+			return -1;
+		}
+
+		_blockMemoryAccessRecords = true;
+		TraceWriter::InitBlockMemoryAccessRecords();
+	}
+
+	// Check if tracing statistics are enabled
+	if(KnobTracingStatistics.Value() != 0)
+		TraceWriter::InitStatistics();
+
 	// Initialize prefix mode
-	TraceWriter::InitPrefixMode(trim(KnobOutputFilePrefix.Value()));
+	TraceWriter::InitPrefixMode(trim(KnobOutputFilePrefix.Value()), KnobRecordPrefixTrace.Value() != 0);
+
+	// Initialize shared memory transport
+	std::string sharedMemoryRingPath = trim(KnobSharedMemoryRingPath.Value());
+	if(!sharedMemoryRingPath.empty())
+		TraceWriter::InitSharedMemoryTransport(sharedMemoryRingPath);
 
 	// Instrument instructions and routines
 	IMG_AddInstrumentFunction(InstrumentImage, nullptr);
+	IMG_AddUnloadFunction(UnloadImage, nullptr);
 	TRACE_AddInstrumentFunction(InstrumentTrace, nullptr);
 
 	// Set thread event handlers
 	PIN_AddThreadStartFunction(ThreadStart, nullptr);
 	PIN_AddThreadFiniFunction(ThreadFini, nullptr);
 
+	// Stop internal threads before the application exits
+	PIN_AddPrepareForFiniFunction(PrepareForFini, nullptr);
+
 	// Handle internal exceptions (for debugging)
 	PIN_AddInternalExceptionHandler(HandlePinToolException, nullptr);
 
@@ -172,17 +423,20 @@ int main(int argc, char* argv[])
 // [Callback] Instruments memory access instructions.
 VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 {
+	// Measure instrumentation effort
+	bool statisticsEnabled = TraceWriter::IsStatisticsEnabled();
+	UINT64 startTime = statisticsEnabled ? TraceWriter::GetTimestamp() : 0;
+	UINT64 instrumentedBasicBlockCount = 0;
+	UINT64 skippedBasicBlockCount = 0;
+
+	// The memory accesses of the current basic block, which are not yet instrumented (only used with basic block memory access records)
+	std::vector<BlockMemoryAccess> blockAccesses;
+
 	// Check each instruction in each basic block
 	for(BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
 	{
 		// Before instrumentation check first whether we are in an interesting image
-		ImageData* img = nullptr;
-		for(ImageData* i : _images)
-			if(i->ContainsBasicBlock(bbl))
-			{
-				img = i;
-				break;
-			}
+		ImageData* img = FindImage(bbl);
 		bool interesting;
 		if(img == nullptr)
 		{
@@ -201,9 +455,19 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			interesting = img->IsInteresting();
 		}
 
+		if(interesting)
+			++instrumentedBasicBlockCount;
+		else
+			++skippedBasicBlockCount;
+
 		// Run through instructions
 		for(INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
 		{
+			// The payload of a basic block memory access record is addressed relative to the next entry pointer, so no other entries may be created until the record is complete
+			// Close the pending record before instructions which create their own entries: Control flow instructions, and routine entries (testcase notifications, allocations)
+			if(_blockMemoryAccessRecords && (INS_IsControlFlow(ins) || IsRoutineEntry(ins)))
+				InstrumentBlockMemoryAccesses(blockAccesses);
+
 			// Ignore everything that uses segment registers (shouldn't be used by relevant software parts)
 			// Windows e.g. uses GS for thread local storage
 			// We also don't support far jumps/call/returns, so tracing programs which make use of those may lead to interesting behavior 
@@ -262,34 +526,59 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			// Trace branch instructions (conditional and unconditional)
 			if(INS_IsCall(ins) && INS_IsControlFlow(ins))
 			{
-				// call instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_BOOL, 1,
-					IARG_UINT32, TraceEntryFlags::BranchTypeCall,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				if(_useTraceBuffer)
+				{
+					// call instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
+					INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::Branch, offsetof(BufferedTraceEntry, Type),
+						IARG_UINT32, TraceEntryFlags::BranchTypeCall, offsetof(BufferedTraceEntry, Flags),
+						IARG_UINT32, 1, offsetof(BufferedTraceEntry, Param0),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_BRANCH_TARGET_ADDR, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
 
-				// Store stack pointer value
-				if(_enableStackAllocationTracking)
+					// Store stack pointer value
+					if(_enableStackAllocationTracking)
+					{
+						INS_InsertFillBuffer(ins, IPOINT_TAKEN_BRANCH, _traceBufferId,
+							IARG_UINT32, TraceEntryTypes::StackPointerModification, offsetof(BufferedTraceEntry, Type),
+							IARG_UINT32, TraceEntryFlags::StackIsCall, offsetof(BufferedTraceEntry, Flags),
+							IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+							IARG_REG_VALUE, REG_RSP, offsetof(BufferedTraceEntry, Param2),
+							IARG_END);
+					}
+				}
+				else
 				{
-					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
+					// call instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
+					INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
 						IARG_REG_VALUE, _nextBufferEntryReg,
 						IARG_END);
-					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
-                        IARG_REG_VALUE, _traceWriterReg,
+					INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
+						IARG_REG_VALUE, _traceWriterReg,
 						IARG_REG_VALUE, _nextBufferEntryReg,
 						IARG_INST_PTR,
-						IARG_REG_VALUE, REG_RSP,
-						IARG_UINT32, TraceEntryFlags::StackIsCall,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_BOOL, 1,
+						IARG_UINT32, TraceEntryFlags::BranchTypeCall,
 						IARG_RETURN_REGS, _nextBufferEntryReg,
 						IARG_END);
+
+					// Store stack pointer value
+					if(_enableStackAllocationTracking)
+					{
+						INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
+							IARG_REG_VALUE, _nextBufferEntryReg,
+							IARG_END);
+						INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
+							IARG_REG_VALUE, _traceWriterReg,
+							IARG_REG_VALUE, _nextBufferEntryReg,
+							IARG_INST_PTR,
+							IARG_REG_VALUE, REG_RSP,
+							IARG_UINT32, TraceEntryFlags::StackIsCall,
+							IARG_RETURN_REGS, _nextBufferEntryReg,
+							IARG_END);
+					}
 				}
 
 #ifndef USE_LEGACY_ALLOC_RETURN_TRACKING
@@ -298,6 +587,7 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
                     IARG_REG_VALUE, _nextBufferEntryReg,
                     IARG_END);
                 INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationCall),
+                    IARG_REG_VALUE, _traceWriterReg,
                     IARG_END);
 #endif
 
@@ -305,62 +595,125 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			}
 			if(INS_IsBranch(ins) && INS_IsControlFlow(ins))
 			{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_BRANCH_TAKEN,
-					IARG_UINT32, TraceEntryFlags::BranchTypeJump,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				// Strict mode: Jumps in uninteresting images do not affect the call stack
+				if(!interesting && _strictImageFiltering)
+					continue;
+
+				// Fingerprints only consider memory accesses
+				if(_fingerprintMode)
+					continue;
+
+				if(_useTraceBuffer)
+				{
+					INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::Branch, offsetof(BufferedTraceEntry, Type),
+						IARG_UINT32, TraceEntryFlags::BranchTypeJump, offsetof(BufferedTraceEntry, Flags),
+						IARG_BRANCH_TAKEN, offsetof(BufferedTraceEntry, Param0),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_BRANCH_TARGET_ADDR, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+				else
+				{
+					INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_INST_PTR,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_BRANCH_TAKEN,
+						IARG_UINT32, TraceEntryFlags::BranchTypeJump,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+				}
 
 				continue;
 			}
 			if(INS_IsRet(ins) && INS_IsControlFlow(ins))
 			{
-				// ret instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
-				INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertRetBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				if(_useTraceBuffer)
+				{
+					// ret instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckRetBranchEntry),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_END);
+					INS_InsertFillBufferThen(ins, IPOINT_TAKEN_BRANCH, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::Branch, offsetof(BufferedTraceEntry, Type),
+						IARG_UINT32, TraceEntryFlags::BranchTypeReturn, offsetof(BufferedTraceEntry, Flags),
+						IARG_UINT32, 1, offsetof(BufferedTraceEntry, Param0),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_BRANCH_TARGET_ADDR, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
 
-				// Store stack pointer value
-				if(_enableStackAllocationTracking)
+					// Store stack pointer value
+					if(_enableStackAllocationTracking)
+					{
+						INS_InsertFillBuffer(ins, IPOINT_TAKEN_BRANCH, _traceBufferId,
+							IARG_UINT32, TraceEntryTypes::StackPointerModification, offsetof(BufferedTraceEntry, Type),
+							IARG_UINT32, TraceEntryFlags::StackIsReturn, offsetof(BufferedTraceEntry, Flags),
+							IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+							IARG_REG_VALUE, REG_RSP, offsetof(BufferedTraceEntry, Param2),
+							IARG_END);
+					}
+				}
+				else
 				{
+					// ret instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
 					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
 						IARG_REG_VALUE, _nextBufferEntryReg,
 						IARG_END);
-					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
-                        IARG_REG_VALUE, _traceWriterReg,
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertRetBranchEntry),
+						IARG_REG_VALUE, _traceWriterReg,
 						IARG_REG_VALUE, _nextBufferEntryReg,
 						IARG_INST_PTR,
-						IARG_REG_VALUE, REG_RSP,
-						IARG_UINT32, TraceEntryFlags::StackIsReturn,
+						IARG_BRANCH_TARGET_ADDR,
 						IARG_RETURN_REGS, _nextBufferEntryReg,
 						IARG_END);
+
+					// Store stack pointer value
+					if(_enableStackAllocationTracking)
+					{
+						INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
+							IARG_REG_VALUE, _nextBufferEntryReg,
+							IARG_END);
+						INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
+							IARG_REG_VALUE, _traceWriterReg,
+							IARG_REG_VALUE, _nextBufferEntryReg,
+							IARG_INST_PTR,
+							IARG_REG_VALUE, REG_RSP,
+							IARG_UINT32, TraceEntryFlags::StackIsReturn,
+							IARG_RETURN_REGS, _nextBufferEntryReg,
+							IARG_END);
+					}
 				}
 
 #ifndef USE_LEGACY_ALLOC_RETURN_TRACKING
-                // Trace allocation function returns
-                INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-                    IARG_REG_VALUE, _nextBufferEntryReg,
-                    IARG_END);
-                INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationReturn),
-                    IARG_REG_VALUE, _traceWriterReg,
-                    IARG_REG_VALUE, _nextBufferEntryReg,
-                    IARG_FUNCRET_EXITPOINT_VALUE,
-                    IARG_RETURN_REGS, _nextBufferEntryReg,
-                    IARG_END);
+				// Trace allocation function returns
+				if(_useTraceBuffer)
+				{
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckAllocationReturn),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+					INS_InsertFillBufferThen(ins, IPOINT_TAKEN_BRANCH, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::HeapAllocAddressReturn, offsetof(BufferedTraceEntry, Type),
+						IARG_FUNCRET_EXITPOINT_VALUE, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+				else
+				{
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationReturn),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_FUNCRET_EXITPOINT_VALUE,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+				}
 #endif
 				continue;
 			}
@@ -369,9 +722,61 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			if(!interesting)
 				continue;
 
+			// Pin trace buffer backend: Let Pin write the entries directly into the buffer
+			if(_useTraceBuffer)
+			{
+				// Stack allocation tracking
+				// ret is already tracked above; push/pop are ignored
+				if(_enableStackAllocationTracking && INS_FullRegWContain(ins, REG_RSP))
+				{
+					INS_InsertFillBuffer(ins, IPOINT_AFTER, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::StackPointerModification, offsetof(BufferedTraceEntry, Type),
+						IARG_UINT32, TraceEntryFlags::StackIsOther, offsetof(BufferedTraceEntry, Flags),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_REG_VALUE, REG_RSP, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+
+				// Trace instructions with memory read
+				if(INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
+				{
+					INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::MemoryRead, offsetof(BufferedTraceEntry, Type),
+						IARG_MEMORYREAD_SIZE, offsetof(BufferedTraceEntry, Param0),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_MEMORYREAD_EA, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+
+				// Trace instructions with a second memory read operand
+				if(INS_HasMemoryRead2(ins) && INS_IsStandardMemop(ins))
+				{
+					INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::MemoryRead, offsetof(BufferedTraceEntry, Type),
+						IARG_MEMORYREAD_SIZE, offsetof(BufferedTraceEntry, Param0), // IARG_MEMORYREAD2_SIZE does not exist, but we can assume that both operands have the same size
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_MEMORYREAD2_EA, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+
+				// Trace instructions with memory write
+				if(INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+				{
+					INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+						IARG_UINT32, TraceEntryTypes::MemoryWrite, offsetof(BufferedTraceEntry, Type),
+						IARG_MEMORYWRITE_SIZE, offsetof(BufferedTraceEntry, Param0),
+						IARG_INST_PTR, offsetof(BufferedTraceEntry, Param1),
+						IARG_MEMORYWRITE_EA, offsetof(BufferedTraceEntry, Param2),
+						IARG_END);
+				}
+
+				continue;
+			}
+
 			// Stack allocation tracking
 			// ret is already tracked above; push/pop are ignored
-			if(_enableStackAllocationTracking && INS_FullRegWContain(ins, REG_RSP))
+			bool modifiesStackPointer = _enableStackAllocationTracking && INS_FullRegWContain(ins, REG_RSP);
+			if(modifiesStackPointer)
 			{
 				INS_InsertIfCall(ins, IPOINT_AFTER, AFUNPTR(CheckNextTraceEntryPointerValid),
 					IARG_REG_VALUE, _nextBufferEntryReg,
@@ -386,6 +791,29 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 					IARG_END);
 			}
 
+			// Basic block memory access records: Collect the accesses of consecutive instructions, and instrument them once the record is complete
+			// String instructions with REP prefix access memory once per iteration, so they keep their own entries
+			if(_blockMemoryAccessRecords)
+			{
+				if(!INS_HasRealRep(ins))
+				{
+					if(INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
+						AddBlockMemoryAccess(blockAccesses, ins, IARG_MEMORYREAD_EA, TraceEntryTypes::MemoryRead, INS_MemoryReadSize(ins));
+					if(INS_HasMemoryRead2(ins) && INS_IsStandardMemop(ins))
+						AddBlockMemoryAccess(blockAccesses, ins, IARG_MEMORYREAD2_EA, TraceEntryTypes::MemoryRead, INS_MemoryReadSize(ins));
+					if(INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+						AddBlockMemoryAccess(blockAccesses, ins, IARG_MEMORYWRITE_EA, TraceEntryTypes::MemoryWrite, INS_MemoryWriteSize(ins));
+
+					// The record must precede the stack pointer modification, and the next instruction must not exceed the maximum record size
+					if(modifiesStackPointer || blockAccesses.size() > BLOCK_RECORD_MAX_ACCESS_COUNT - 3)
+						InstrumentBlockMemoryAccesses(blockAccesses);
+
+					continue;
+				}
+
+				InstrumentBlockMemoryAccesses(blockAccesses);
+			}
+
 			// Trace instructions with memory read
 			if(INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
 			{
@@ -434,17 +862,104 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 					IARG_END);
 			}
 		}
+
+		// Remaining accesses of the basic block
+		if(_blockMemoryAccessRecords)
+			InstrumentBlockMemoryAccesses(blockAccesses);
 	}
+
+	if(statisticsEnabled)
+		TraceWriter::AddInstrumentationStatistics(instrumentedBasicBlockCount, skippedBasicBlockCount, TraceWriter::GetTimestamp() - startTime);
+}
+
+// Adds a memory access to the pending BlockMemoryAccesses entry of the current basic block.
+VOID AddBlockMemoryAccess(std::vector<BlockMemoryAccess>& accesses, INS ins, IARG_TYPE addressArgument, TraceEntryTypes type, UINT32 size)
+{
+	BlockMemoryAccess access{};
+	access.instruction = ins;
+	access.addressArgument = addressArgument;
+	access.entry.Type = type;
+	access.entry.Param0 = static_cast<UINT16>(size);
+	access.entry.Param1 = INS_Address(ins);
+	accesses.push_back(access);
+}
+
+// Instruments the given memory accesses of a basic block, such that they are recorded in a single BlockMemoryAccesses entry, and clears the list.
+VOID InstrumentBlockMemoryAccesses(std::vector<BlockMemoryAccess>& accesses)
+{
+	if(accesses.empty())
+		return;
+
+	std::vector<TraceEntry> definitionEntries;
+	for(const BlockMemoryAccess& access : accesses)
+		definitionEntries.push_back(access.entry);
+	UINT32 blockId = TraceWriter::AddBlockDefinition(definitionEntries);
+	auto accessCount = static_cast<UINT32>(accesses.size());
+
+	// Reserve the entry before the first access
+	// These calls run last, so entries which are created by routine instrumentation at the same instruction (e.g., malloc parameters) come first
+	INS headIns = accesses[0].instruction;
+	INS_InsertIfCall(headIns, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
+		IARG_CALL_ORDER, CALL_ORDER_LAST,
+		IARG_REG_VALUE, _nextBufferEntryReg,
+		IARG_END);
+	INS_InsertThenCall(headIns, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBlockMemoryAccessesEntry),
+		IARG_CALL_ORDER, CALL_ORDER_LAST,
+		IARG_REG_VALUE, _traceWriterReg,
+		IARG_REG_VALUE, _nextBufferEntryReg,
+		IARG_UINT32, blockId,
+		IARG_UINT32, accessCount,
+		IARG_RETURN_REGS, _nextBufferEntryReg,
+		IARG_END);
+
+	// Let each access store its address; the next entry pointer stays at the end of the payload until the block has completed
+	// This relies on InstrumentTrace() closing the record before any instruction which creates its own entries
+	ADDRINT payloadSize = BLOCK_RECORD_PAYLOAD_ENTRIES(accessCount) * sizeof(TraceEntry);
+	for(UINT32 i = 0; i < accessCount; ++i)
+	{
+		INS_InsertIfCall(accesses[i].instruction, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
+			IARG_CALL_ORDER, CALL_ORDER_LAST,
+			IARG_REG_VALUE, _nextBufferEntryReg,
+			IARG_END);
+		INS_InsertThenCall(accesses[i].instruction, IPOINT_BEFORE, AFUNPTR(TraceWriter::StoreBlockMemoryAddress),
+			IARG_CALL_ORDER, CALL_ORDER_LAST,
+			IARG_REG_VALUE, _nextBufferEntryReg,
+			IARG_ADDRINT, payloadSize - i * sizeof(UINT64),
+			accesses[i].addressArgument,
+			IARG_END);
+	}
+
+	accesses.clear();
+}
+
+// Checks whether the given instruction is the first instruction of a routine, which may have been instrumented by InstrumentImage().
+bool IsRoutineEntry(INS ins)
+{
+	RTN rtn = INS_Rtn(ins);
+	return RTN_Valid(rtn) && RTN_Address(rtn) == INS_Address(ins);
 }
 
 // [Callback] Creates a new trace logger for the given new thread.
 VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[maybe_unused]] VOID* v)
 {
 	// Only instrument main thread
-	if(tid == 0)
+	if(tid == 0 || _traceAllThreads)
 	{
 		// Create new trace logger for this thread
-		auto* traceWriter = new TraceWriter(trim(KnobOutputFilePrefix.Value()));
+		// Secondary threads join the current testcase, and their stack boundaries are estimated from the initial stack pointer
+		PIN_GetLock(&_threadStateLock, tid + 1);
+		auto* traceWriter = new TraceWriter(trim(KnobOutputFilePrefix.Value()), tid, KnobAsyncTraceBufferCount.Value(), KnobCompactTraceEncoding.Value() != 0, KnobTraceCompression.Value() != 0);
+		if(tid != 0)
+		{
+			if(_currentTestcaseId >= 0)
+				traceWriter->TestcaseStart(_currentTestcaseId, traceWriter->Begin(), false);
+
+			ADDRINT stackPointer = PIN_GetContextReg(ctxt, REG_STACK_PTR);
+			traceWriter->SetStackPointerInfo(stackPointer - KnobSecondaryThreadStackSize.Value(), stackPointer);
+			std::cerr << "Tracing thread #" << tid << std::endl;
+		}
+		_traceWriters.push_back(traceWriter);
+		PIN_ReleaseLock(&_threadStateLock);
 
 		// Store logger
         PIN_SetContextReg(ctxt, _traceWriterReg, reinterpret_cast<ADDRINT>(traceWriter));
@@ -452,6 +967,16 @@ VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[ma
 		// Initialize entry buffer pointers
 		PIN_SetContextReg(ctxt, _nextBufferEntryReg, reinterpret_cast<ADDRINT>(traceWriter->Begin()));
 		PIN_SetContextReg(ctxt, _entryBufferEndReg, reinterpret_cast<ADDRINT>(traceWriter->End()));
+
+		// Initialize Pin trace buffer state
+		if(_useTraceBuffer)
+		{
+			// Unfilled buffer entries must have type 0
+			memset(PIN_GetBufferPointer(ctxt, _traceBufferId), 0, ENTRY_BUFFER_SIZE * sizeof(BufferedTraceEntry));
+
+			auto* state = new TraceBufferThreadState{ traceWriter, traceWriter->Begin(), 0 };
+			PIN_SetThreadData(_traceBufferThreadStateKey, state, tid);
+		}
 	}
 	else
 	{
@@ -466,14 +991,77 @@ VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[ma
 // [Callback] Cleans up after thread exit.
 VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] INT32 code, [[maybe_unused]] VOID* v)
 {
-	// Only the main thread is instrumented
-	if(tid != 0)
+	// Ignore non-instrumented threads
+	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+	if(traceWriter == nullptr)
 		return;
 
 	// Finalize trace logger of this thread
-	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
-	traceWriter->WriteBufferToFile(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)));
-	delete traceWriter;
+	// Pin has already passed the remaining trace buffer contents to TraceBufferFull()
+	PIN_GetLock(&_threadStateLock, tid + 1);
+	if(tid != 0 && traceWriter->IsTracingTestcase())
+	{
+		// A secondary thread has exited during a testcase, report its trace file now
+		traceWriter->TestcaseEnd(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)), false);
+	}
+	else if(_useTraceBuffer)
+	{
+		auto* state = static_cast<TraceBufferThreadState*>(PIN_GetThreadData(_traceBufferThreadStateKey, tid));
+		traceWriter->WriteBufferToFile(state->nextEntry);
+		PIN_SetThreadData(_traceBufferThreadStateKey, nullptr, tid);
+		delete state;
+	}
+	else
+	{
+		traceWriter->WriteBufferToFile(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)));
+	}
+	_traceWriters.erase(std::find(_traceWriters.begin(), _traceWriters.end(), traceWriter));
+
+	// An asynchronous writer thread still has to write the remaining buffers, which we must not wait for here
+	bool deferDelete = traceWriter->HasWriterThread();
+	if(deferDelete)
+	{
+		traceWriter->RequestWriterThreadExit();
+		_exitedTraceWriters.push_back(traceWriter);
+	}
+	PIN_ReleaseLock(&_threadStateLock);
+
+	if(!deferDelete)
+		delete traceWriter;
+}
+
+// [Callback] Stops the asynchronous trace writer thread, as Pin requires internal threads to exit before the application does.
+VOID PrepareForFini([[maybe_unused]] VOID* v)
+{
+	// Remaining buffers are written synchronously from now on
+	PIN_GetLock(&_threadStateLock, PIN_ThreadId() + 1);
+	for(TraceWriter* traceWriter : _traceWriters)
+		traceWriter->StopWriterThread();
+
+	// Free trace writers of exited threads, once their writer threads are done
+	for(TraceWriter* traceWriter : _exitedTraceWriters)
+	{
+		traceWriter->StopWriterThread();
+		delete traceWriter;
+	}
+	_exitedTraceWriters.clear();
+	PIN_ReleaseLock(&_threadStateLock);
+}
+
+// [Callback] Stores the contents of a full Pin trace buffer.
+VOID* TraceBufferFull([[maybe_unused]] BUFFER_ID id, THREADID tid, [[maybe_unused]] const CONTEXT* ctxt, VOID* buffer, UINT64 numElements, [[maybe_unused]] VOID* v)
+{
+	// Entries of non-instrumented threads are discarded
+	auto* state = static_cast<TraceBufferThreadState*>(PIN_GetThreadData(_traceBufferThreadStateKey, tid));
+	if(state != nullptr)
+	{
+		StoreTraceBufferEntries(state, static_cast<BufferedTraceEntry*>(buffer), numElements);
+		state->processedEntryCount = 0;
+	}
+
+	// Reset buffer, so we can find the filled part when flushing it early
+	memset(buffer, 0, numElements * sizeof(BufferedTraceEntry));
+	return buffer;
 }
 
 // [Callback] Instruments the memory allocation/deallocation functions.
@@ -488,25 +1076,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	INT8 interesting = (find_if(_interestingImages.begin(), _interestingImages.end(), [&](std::string& interestingImageName) { return imageNameLower.find(interestingImageName) != std::string::npos; }) != _interestingImages.end()) ? 1 : 0;
 
 	// Retrieve image memory offsets
-	UINT64 imageStart = IMG_LowAddress(img);
-	UINT64 imageEnd = IMG_HighAddress(img);
-	UINT32 numRegions = IMG_NumRegions(img);
-	for(UINT32 r = 0; r < numRegions; ++r)
-	{
-		UINT64 low = IMG_RegionLowAddress(img, r);
-		if(low < imageStart)
-			imageStart = low;
-		
-		UINT64 high = IMG_RegionHighAddress(img, r);
-		if(high > imageEnd)
-			imageEnd = high;
-	}
+	UINT64 imageStart;
+	UINT64 imageEnd;
+	GetImageBounds(img, imageStart, imageEnd);
 
 	// Record image data
 	TraceWriter::WriteImageLoadData(static_cast<int>(interesting), imageStart, imageEnd, imageName);
 
 	// Remember image for filtered trace instrumentation
-	_images.push_back(new ImageData(interesting, imageName, imageStart, imageEnd));
+	_images[imageStart] = new ImageData(interesting, imageName, imageStart, imageEnd);
 	std::cerr << "Image '" << imageName << "' loaded at " << std::hex << imageStart << " ... " << std::hex << imageEnd << (interesting != 0 ? " [interesting]" : "") << std::endl;
 
 	// libc?
@@ -522,12 +1100,20 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Switch to next testcase
 		RTN_Open(notifyStartRtn);
-		RTN_InsertCall(notifyStartRtn, IPOINT_BEFORE, AFUNPTR(TestcaseStart),
-			IARG_REG_VALUE, _traceWriterReg,
-			IARG_REG_VALUE, _nextBufferEntryReg,
-            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-			IARG_RETURN_REGS, _nextBufferEntryReg,
-			IARG_END);
+		if(_useTraceBuffer)
+			RTN_InsertCall(notifyStartRtn, IPOINT_BEFORE, AFUNPTR(TestcaseStartBuffered),
+				IARG_THREAD_ID,
+				IARG_CONTEXT,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+				IARG_END);
+		else
+			RTN_InsertCall(notifyStartRtn, IPOINT_BEFORE, AFUNPTR(TestcaseStart),
+				IARG_THREAD_ID,
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 		RTN_Close(notifyStartRtn);
 
 		std::cerr << "    PinNotifyTestcaseStart() instrumented." << std::endl;
@@ -537,11 +1123,18 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Close testcase
 		RTN_Open(notifyEndRtn);
-		RTN_InsertCall(notifyEndRtn, IPOINT_BEFORE, AFUNPTR(TestcaseEnd),
-            IARG_REG_VALUE, _traceWriterReg,
-			IARG_REG_VALUE, _nextBufferEntryReg,
-			IARG_RETURN_REGS, _nextBufferEntryReg,
-			IARG_END);
+		if(_useTraceBuffer)
+			RTN_InsertCall(notifyEndRtn, IPOINT_BEFORE, AFUNPTR(TestcaseEndBuffered),
+				IARG_THREAD_ID,
+				IARG_CONTEXT,
+				IARG_END);
+		else
+			RTN_InsertCall(notifyEndRtn, IPOINT_BEFORE, AFUNPTR(TestcaseEnd),
+				IARG_THREAD_ID,
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 		RTN_Close(notifyEndRtn);
 
 		std::cerr << "    PinNotifyTestcaseEnd() instrumented." << std::endl;
@@ -553,13 +1146,16 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Save stack pointer value
 		RTN_Open(notifyStackPointerRtn);
-		RTN_InsertCall(notifyStackPointerRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertStackPointerInfoEntry),
-            IARG_REG_VALUE, _traceWriterReg,
-			IARG_REG_VALUE, _nextBufferEntryReg,
-			IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-			IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
-			IARG_RETURN_REGS, _nextBufferEntryReg,
-			IARG_END);
+		if(_useTraceBuffer)
+			InsertFillBufferAtRoutineEntry(notifyStackPointerRtn, TraceEntryTypes::StackPointerInfo, 0, 1, 0);
+		else
+			RTN_InsertCall(notifyStackPointerRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertStackPointerInfoEntry),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 		RTN_Close(notifyStackPointerRtn);
 
 		std::cerr << "    PinNotifyStackPointer() instrumented." << std::endl;
@@ -571,18 +1167,24 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Send allocation info
 		RTN_Open(notifyAllocationRtn);
-		RTN_InsertCall(notifyAllocationRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
-            IARG_REG_VALUE, _traceWriterReg,
-            IARG_REG_VALUE, _nextBufferEntryReg,
-            IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
-            IARG_RETURN_REGS, _nextBufferEntryReg,
-            IARG_END);
-		RTN_InsertCall(notifyAllocationRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocAddressReturnEntry),
-            IARG_REG_VALUE, _traceWriterReg,
-            IARG_REG_VALUE, _nextBufferEntryReg,
-            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-            IARG_RETURN_REGS, _nextBufferEntryReg,
-            IARG_END);
+		if(_useTraceBuffer)
+			InsertFillBufferAtRoutineEntry(notifyAllocationRtn, TraceEntryTypes::HeapAllocSizeParameter, 1, -1, 0);
+		else
+			RTN_InsertCall(notifyAllocationRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
+		if(_useTraceBuffer)
+			InsertFillBufferAtRoutineEntry(notifyAllocationRtn, TraceEntryTypes::HeapAllocAddressReturn, -1, 0, 0);
+		else
+			RTN_InsertCall(notifyAllocationRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocAddressReturnEntry),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 		RTN_Close(notifyAllocationRtn);
 
 		std::cerr << "    PinNotifyAllocation() instrumented." << std::endl;
@@ -595,12 +1197,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Trace size parameter
 		RTN_Open(mallocRtn);
-		RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
-            IARG_REG_VALUE, _traceWriterReg,
-			IARG_REG_VALUE, _nextBufferEntryReg,
-			IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
-			IARG_RETURN_REGS, _nextBufferEntryReg,
-			IARG_END);
+		if(_useTraceBuffer)
+			InsertFillBufferAtRoutineEntry(mallocRtn, TraceEntryTypes::HeapAllocSizeParameter, 2, -1, 0);
+		else
+			RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 
 		// Trace returned address
 #ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
@@ -612,7 +1217,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			IARG_END);
 #else
         RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-           IARG_REG_VALUE, _nextBufferEntryReg,
+           IARG_REG_VALUE, _traceWriterReg,
            IARG_END);
 #endif
 
@@ -626,12 +1231,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	{
 		// Trace address parameter
 		RTN_Open(freeRtn);
-		RTN_InsertCall(freeRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapFreeAddressParameterEntry),
-            IARG_REG_VALUE, _traceWriterReg,
-			IARG_REG_VALUE, _nextBufferEntryReg,
-			IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
-			IARG_RETURN_REGS, _nextBufferEntryReg,
-			IARG_END);
+		if(_useTraceBuffer)
+			InsertFillBufferAtRoutineEntry(freeRtn, TraceEntryTypes::HeapFreeAddressParameter, -1, 2, 0);
+		else
+			RTN_InsertCall(freeRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapFreeAddressParameterEntry),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
 		RTN_Close(freeRtn);
 
 		std::cerr << "    RtlFreeHeap() instrumented." << std::endl;
@@ -645,12 +1253,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		{
 			// Trace size parameter
 			RTN_Open(mallocRtn);
-			RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
-                IARG_REG_VALUE, _traceWriterReg,
-				IARG_REG_VALUE, _nextBufferEntryReg,
-				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-				IARG_RETURN_REGS, _nextBufferEntryReg,
-				IARG_END);
+			if(_useTraceBuffer)
+				InsertFillBufferAtRoutineEntry(mallocRtn, TraceEntryTypes::HeapAllocSizeParameter, 0, -1, 0);
+			else
+				RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
 
 			// Trace returned address
 #ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
@@ -662,7 +1273,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
                IARG_END);
 #endif
 
@@ -676,13 +1287,16 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		{
 			// Trace size parameter
 			RTN_Open(callocRtn);
-			RTN_InsertCall(callocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertCallocSizeParameterEntry),
-                IARG_REG_VALUE, _traceWriterReg,
-				IARG_REG_VALUE, _nextBufferEntryReg,
-				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-				IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
-				IARG_RETURN_REGS, _nextBufferEntryReg,
-				IARG_END);
+			if(_useTraceBuffer)
+				InsertFillBufferAtRoutineEntry(callocRtn, TraceEntryTypes::HeapAllocSizeParameter, 0, 1, BUFFERED_ENTRY_FLAG_CALLOC);
+			else
+				RTN_InsertCall(callocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertCallocSizeParameterEntry),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
 
 			// Trace returned address
 #ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
@@ -694,7 +1308,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(callocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
                IARG_END);
 #endif
 
@@ -708,12 +1322,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		{
 			// Trace size parameter
 			RTN_Open(reallocRtn);
-			RTN_InsertCall(reallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
-                IARG_REG_VALUE, _traceWriterReg,
-				IARG_REG_VALUE, _nextBufferEntryReg,
-				IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
-				IARG_RETURN_REGS, _nextBufferEntryReg,
-				IARG_END);
+			if(_useTraceBuffer)
+				InsertFillBufferAtRoutineEntry(reallocRtn, TraceEntryTypes::HeapAllocSizeParameter, 1, -1, 0);
+			else
+				RTN_InsertCall(reallocRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapAllocSizeParameterEntry),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
 
 			// Trace returned address
 #ifdef USE_LEGACY_ALLOC_RETURN_TRACKING
@@ -725,7 +1342,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(reallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
                IARG_END);
 #endif
 
@@ -739,12 +1356,15 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		{
 			// Trace address parameter
 			RTN_Open(freeRtn);
-			RTN_InsertCall(freeRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapFreeAddressParameterEntry),
-                IARG_REG_VALUE, _traceWriterReg,
-				IARG_REG_VALUE, _nextBufferEntryReg,
-				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-				IARG_RETURN_REGS, _nextBufferEntryReg,
-				IARG_END);
+			if(_useTraceBuffer)
+				InsertFillBufferAtRoutineEntry(freeRtn, TraceEntryTypes::HeapFreeAddressParameter, -1, 0, 0);
+			else
+				RTN_InsertCall(freeRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertHeapFreeAddressParameterEntry),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
 			RTN_Close(freeRtn);
 
 			std::cerr << "    free() instrumented." << std::endl;
@@ -753,22 +1373,217 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 #endif
 }
 
+// [Callback] Removes the data of unloaded images, so their address ranges can be reused by later images.
+VOID UnloadImage(IMG img, [[maybe_unused]] VOID* v)
+{
+	UINT64 imageStart;
+	UINT64 imageEnd;
+	GetImageBounds(img, imageStart, imageEnd);
+
+	auto it = _images.find(imageStart);
+	if(it == _images.end())
+		return;
+	std::cerr << "Image '" << it->second->_name << "' unloaded" << std::endl;
+
+	if(_lastInstrumentedImage == it->second)
+		_lastInstrumentedImage = nullptr;
+	delete it->second;
+	_images.erase(it);
+}
+
+// Determines the address range covered by all regions of the given image.
+VOID GetImageBounds(IMG img, UINT64& imageStart, UINT64& imageEnd)
+{
+	imageStart = IMG_LowAddress(img);
+	imageEnd = IMG_HighAddress(img);
+	UINT32 numRegions = IMG_NumRegions(img);
+	for(UINT32 r = 0; r < numRegions; ++r)
+	{
+		UINT64 low = IMG_RegionLowAddress(img, r);
+		if(low < imageStart)
+			imageStart = low;
+		
+		UINT64 high = IMG_RegionHighAddress(img, r);
+		if(high > imageEnd)
+			imageEnd = high;
+	}
+}
+
+// Returns the image containing the given basic block, or nullptr if it cannot be resolved.
+ImageData* FindImage(BBL bbl)
+{
+	// Fast path: Same image as the last basic block
+	if(_lastInstrumentedImage != nullptr && _lastInstrumentedImage->ContainsBasicBlock(bbl))
+		return _lastInstrumentedImage;
+
+	// Find the image with the highest start address that is not greater than the block address
+	auto it = _images.upper_bound(BBL_Address(bbl));
+	if(it == _images.begin())
+		return nullptr;
+	--it;
+	if(!it->second->ContainsBasicBlock(bbl))
+		return nullptr;
+
+	_lastInstrumentedImage = it->second;
+	return _lastInstrumentedImage;
+}
+
 // Handles the beginning of a testcase.
-TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId)
+TraceEntry* TestcaseStart(THREADID tid, TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId)
 {
+	// Switch the other threads as well, while they are not running
+	int testcaseId = static_cast<int>(newTestcaseId);
+	if(_traceAllThreads)
+	{
+		StopOtherThreads(tid);
+		SwitchStoppedThreadsTestcase(testcaseId);
+		_currentTestcaseId = testcaseId;
+	}
+
 	// Get trace logger object and set the new testcase ID
-	traceWriter->TestcaseStart(static_cast<int>(newTestcaseId), nextEntry);
+	traceWriter->TestcaseStart(testcaseId, nextEntry);
+
+	if(_traceAllThreads)
+		ResumeOtherThreads(tid);
 	return traceWriter->Begin();
 }
 
 // Handles the ending of a testcase.
-TraceEntry* TestcaseEnd(TraceWriter *traceWriter, TraceEntry* nextEntry)
+TraceEntry* TestcaseEnd(THREADID tid, TraceWriter *traceWriter, TraceEntry* nextEntry)
 {
+	// The trace files of the other threads must be complete before the testcase is reported
+	if(_traceAllThreads)
+	{
+		StopOtherThreads(tid);
+		SwitchStoppedThreadsTestcase(-1);
+		_currentTestcaseId = -1;
+	}
+
 	// Get trace logger object and set the new testcase ID
 	traceWriter->TestcaseEnd(nextEntry);
+
+	if(_traceAllThreads)
+		ResumeOtherThreads(tid);
 	return traceWriter->Begin();
 }
 
+// Stops all application threads except the given one, and acquires the thread state lock.
+VOID StopOtherThreads(THREADID tid)
+{
+	if(!PIN_StopApplicationThreads(tid))
+	{
+		std::cerr << "Error: Could not stop application threads for switching the testcase." << std::endl;
+		exit(1);
+	}
+	PIN_GetLock(&_threadStateLock, tid + 1);
+}
+
+// Releases the thread state lock and resumes the threads stopped by StopOtherThreads().
+VOID ResumeOtherThreads(THREADID tid)
+{
+	PIN_ReleaseLock(&_threadStateLock);
+	PIN_ResumeApplicationThreads(tid);
+}
+
+// Switches the trace loggers of all stopped threads to the given testcase, or ends their current testcase if the ID is -1.
+VOID SwitchStoppedThreadsTestcase(int testcaseId)
+{
+	UINT32 stoppedThreadCount = PIN_GetStoppedThreadCount();
+	for(UINT32 i = 0; i < stoppedThreadCount; ++i)
+	{
+		// The entry buffer pointer is only consistent while the thread is stopped
+		CONTEXT* ctxt = PIN_GetStoppedThreadWriteableContext(PIN_GetStoppedThreadId(i));
+		auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+		if(traceWriter == nullptr)
+			continue;
+		auto* nextEntry = reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg));
+
+		if(testcaseId >= 0)
+			traceWriter->TestcaseStart(testcaseId, nextEntry, false);
+		else if(traceWriter->IsTracingTestcase())
+			traceWriter->TestcaseEnd(nextEntry, false);
+		else
+			continue;
+
+		PIN_SetContextReg(ctxt, _nextBufferEntryReg, reinterpret_cast<ADDRINT>(traceWriter->Begin()));
+	}
+}
+
+// Handles the beginning of a testcase, when the Pin trace buffer backend is used.
+VOID TestcaseStartBuffered(THREADID tid, CONTEXT* ctxt, ADDRINT newTestcaseId)
+{
+	// Ignore non-instrumented threads
+	auto* state = static_cast<TraceBufferThreadState*>(PIN_GetThreadData(_traceBufferThreadStateKey, tid));
+	if(state == nullptr)
+		return;
+
+	// Entries recorded before the testcase start belong to the prefix
+	FlushTraceBuffer(tid, ctxt);
+	state->traceWriter->TestcaseStart(static_cast<int>(newTestcaseId), state->nextEntry);
+	state->nextEntry = state->traceWriter->Begin();
+}
+
+// Handles the ending of a testcase, when the Pin trace buffer backend is used.
+VOID TestcaseEndBuffered(THREADID tid, CONTEXT* ctxt)
+{
+	// Ignore non-instrumented threads
+	auto* state = static_cast<TraceBufferThreadState*>(PIN_GetThreadData(_traceBufferThreadStateKey, tid));
+	if(state == nullptr)
+		return;
+
+	// Make sure that all entries of this testcase end up in its trace file
+	FlushTraceBuffer(tid, ctxt);
+	state->traceWriter->TestcaseEnd(state->nextEntry);
+	state->nextEntry = state->traceWriter->Begin();
+}
+
+// Converts the not yet processed entries of the given Pin trace buffer and passes them to the trace writer.
+VOID StoreTraceBufferEntries(TraceBufferThreadState* state, BufferedTraceEntry* buffer, UINT64 entryCount)
+{
+	for(UINT64 i = state->processedEntryCount; i < entryCount; ++i)
+		state->nextEntry = TraceWriter::InsertBufferedEntry(state->traceWriter, state->nextEntry, &buffer[i]);
+	state->processedEntryCount = entryCount;
+}
+
+// Stores the entries which have been written into the current Pin trace buffer so far.
+VOID FlushTraceBuffer(THREADID tid, CONTEXT* ctxt)
+{
+	auto* state = static_cast<TraceBufferThreadState*>(PIN_GetThreadData(_traceBufferThreadStateKey, tid));
+	auto* buffer = static_cast<BufferedTraceEntry*>(PIN_GetBufferPointer(ctxt, _traceBufferId));
+
+	// The buffer is cleared after processing, so the filled part ends with the first empty entry
+	UINT64 entryCount = state->processedEntryCount;
+	while(entryCount < ENTRY_BUFFER_SIZE && buffer[entryCount].Type != 0)
+		++entryCount;
+
+	StoreTraceBufferEntries(state, buffer, entryCount);
+}
+
+// Inserts a trace buffer fill at the entry of the given routine, passing the given function arguments as entry parameters (-1 for unused).
+VOID InsertFillBufferAtRoutineEntry(RTN rtn, TraceEntryTypes type, INT32 param1ArgumentIndex, INT32 param2ArgumentIndex, UINT32 flags)
+{
+	INS ins = RTN_InsHead(rtn);
+	if(param1ArgumentIndex >= 0 && param2ArgumentIndex >= 0)
+		INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+			IARG_UINT32, type, offsetof(BufferedTraceEntry, Type),
+			IARG_UINT32, flags, offsetof(BufferedTraceEntry, Flags),
+			IARG_FUNCARG_ENTRYPOINT_VALUE, param1ArgumentIndex, offsetof(BufferedTraceEntry, Param1),
+			IARG_FUNCARG_ENTRYPOINT_VALUE, param2ArgumentIndex, offsetof(BufferedTraceEntry, Param2),
+			IARG_END);
+	else if(param1ArgumentIndex >= 0)
+		INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+			IARG_UINT32, type, offsetof(BufferedTraceEntry, Type),
+			IARG_UINT32, flags, offsetof(BufferedTraceEntry, Flags),
+			IARG_FUNCARG_ENTRYPOINT_VALUE, param1ArgumentIndex, offsetof(BufferedTraceEntry, Param1),
+			IARG_END);
+	else
+		INS_InsertFillBuffer(ins, IPOINT_BEFORE, _traceBufferId,
+			IARG_UINT32, type, offsetof(BufferedTraceEntry, Type),
+			IARG_UINT32, flags, offsetof(BufferedTraceEntry, Flags),
+			IARG_FUNCARG_ENTRYPOINT_VALUE, param2ArgumentIndex, offsetof(BufferedTraceEntry, Param2),
+			IARG_END);
+}
+
 // Handles an internal exception of this trace tool.
 EXCEPT_HANDLING_RESULT HandlePinToolException([[maybe_unused]] THREADID tid, EXCEPTION_INFO* exceptionInfo, [[maybe_unused]] PHYSICAL_CONTEXT* physicalContext, [[maybe_unused]] VOID* v)
 {
@@ -783,33 +1598,38 @@ ADDRINT CheckNextTraceEntryPointerValid(TraceEntry* nextEntry)
 	return reinterpret_cast<ADDRINT>(nextEntry);
 }
 
-VOID StartAllocationTracking(TraceEntry *nextEntry)
+// Starts allocation tracking for the calling thread.
+// The state is kept per thread, since concurrently traced threads may call allocation functions at the same time.
+VOID StartAllocationTracking(TraceWriter *traceWriter)
 {
-    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
-    if(nextEntry == nullptr)
+    // Check whether given trace writer is valid (we might be in a non-instrumented thread)
+    if(traceWriter == nullptr)
         return;
 
-    _allocationCallStackDepth = 0;
+    traceWriter->StartAllocationTracking();
 }
 
-VOID TrackAllocationCall()
+VOID TrackAllocationCall(TraceWriter *traceWriter)
 {
-    if(_allocationCallStackDepth >= 0)
-        ++_allocationCallStackDepth;
+    if(traceWriter == nullptr)
+        return;
+
+    traceWriter->TrackAllocationCall();
 }
 
-// Checks whether the current allocation tracking call stack is exited. If it is, the returned allocation address is stored in the trace.
-TraceEntry* TrackAllocationReturn(TraceWriter *traceWriter, TraceEntry *nextEntry, ADDRINT returnValue)
+// Tracks a return while allocation tracking is active. Returns 1 if this return exits the allocation function.
+ADDRINT CheckAllocationReturn(TraceWriter *traceWriter)
 {
-    // Tracking active?
-    if(_allocationCallStackDepth < 0)
-        return nextEntry;
+    if(traceWriter == nullptr)
+        return 0;
 
-    // Return
-    --_allocationCallStackDepth;
+    return traceWriter->TrackAllocationReturn() ? 1 : 0;
+}
 
-    // Have we reached the end of the call stack?
-    if(_allocationCallStackDepth < 0)
+// Checks whether the current allocation tracking call stack is exited. If it is, the returned allocation address is stored in the trace.
+TraceEntry* TrackAllocationReturn(TraceWriter *traceWriter, TraceEntry *nextEntry, ADDRINT returnValue)
+{
+    if(CheckAllocationReturn(traceWriter))
         return TraceWriter::InsertHeapAllocAddressReturnEntry(traceWriter, nextEntry, returnValue);
 
     return nextEntry;
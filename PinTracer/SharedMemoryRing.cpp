@@ -0,0 +1,121 @@
+/* INCLUDES */
+
+#include "SharedMemoryRing.h"
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if !defined(FUTEX_WAKE)
+#define FUTEX_WAKE 1
+#endif
+
+
+/* TYPES */
+
+SharedMemoryRing::SharedMemoryRing(const std::string& path)
+{
+#if defined(_WIN32)
+    std::cerr << "Error: The shared memory trace transport is not supported on Windows." << std::endl;
+    exit(1);
+#else
+    // Map shared memory file
+    int fd = open(path.c_str(), O_RDWR);
+    struct stat fileInfo{};
+    if(fd < 0 || fstat(fd, &fileInfo) != 0 || static_cast<size_t>(fileInfo.st_size) <= SHARED_MEMORY_RING_DATA_OFFSET)
+    {
+        std::cerr << "Error: Could not open shared memory file '" << path << "'." << std::endl;
+        exit(1);
+    }
+    void* mapping = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "Error: Could not map shared memory file '" << path << "'." << std::endl;
+        exit(1);
+    }
+
+    // Check header
+    _header = static_cast<SharedMemoryRingHeader*>(mapping);
+    _data = static_cast<UINT8*>(mapping) + SHARED_MEMORY_RING_DATA_OFFSET;
+    _capacity = _header->Capacity;
+    if(_header->Magic != SHARED_MEMORY_RING_MAGIC || _header->Version != SHARED_MEMORY_RING_VERSION || _capacity == 0 || _capacity + SHARED_MEMORY_RING_DATA_OFFSET > static_cast<UINT64>(fileInfo.st_size))
+    {
+        std::cerr << "Error: Invalid shared memory ring header in '" << path << "'." << std::endl;
+        exit(1);
+    }
+
+    std::cerr << "Shared memory trace transport enabled (" << std::dec << _capacity << " bytes)" << std::endl;
+#endif
+}
+
+void SharedMemoryRing::Write(const void* data, size_t length)
+{
+    const auto* input = static_cast<const UINT8*>(data);
+    UINT64 writePosition = _header->WritePosition;
+    while(length > 0)
+    {
+        // Wait until the consumer has freed some space
+        UINT64 readPosition = __atomic_load_n(&_header->ReadPosition, __ATOMIC_ACQUIRE);
+        UINT64 freeSpace = _capacity - (writePosition - readPosition);
+        if(freeSpace == 0)
+        {
+            PIN_Sleep(1);
+            continue;
+        }
+
+        // Copy as much as possible, wrapping around at the end of the ring
+        UINT64 offset = writePosition % _capacity;
+        size_t chunkLength = static_cast<size_t>(std::min<UINT64>({ freeSpace, length, _capacity - offset }));
+        memcpy(_data + offset, input, chunkLength);
+        input += chunkLength;
+        length -= chunkLength;
+        writePosition += chunkLength;
+
+        // Publish data
+        // Sequentially consistent, so either the consumer sees the new position after announcing that it waits, or we see its announcement
+        __atomic_store_n(&_header->WritePosition, writePosition, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&_header->ConsumerWaiting, __ATOMIC_SEQ_CST) != 0)
+            WakeConsumer();
+    }
+}
+
+void SharedMemoryRing::WakeConsumer()
+{
+#if !defined(_WIN32)
+    __atomic_store_n(&_header->ConsumerWaiting, 0, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &_header->ConsumerWaiting, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+void SharedMemoryRing::WriteRecordHeader(SharedMemoryRingRecordTypes type, size_t length)
+{
+    UINT32 recordHeader[2] = { static_cast<UINT32>(type), static_cast<UINT32>(length) };
+    Write(recordHeader, sizeof(recordHeader));
+}
+
+void SharedMemoryRing::BeginFile(const std::string& name)
+{
+    WriteRecordHeader(SharedMemoryRingRecordTypes::FileBegin, name.length());
+    Write(name.c_str(), name.length());
+}
+
+void SharedMemoryRing::WriteFileData(const UINT8* data, size_t length)
+{
+    if(length == 0)
+        return;
+
+    WriteRecordHeader(SharedMemoryRingRecordTypes::FileData, length);
+    Write(data, length);
+}
+
+void SharedMemoryRing::EndFile()
+{
+    WriteRecordHeader(SharedMemoryRingRecordTypes::FileEnd, 0);
+}
@@ -0,0 +1,103 @@
+#pragma once
+/*
+Contains a single-producer/single-consumer ring buffer in a shared memory file, for passing trace data to Microwalk without going through the file system.
+*/
+
+/* INCLUDES */
+
+#include "pin.H"
+#include <string>
+
+
+/* DEFINES */
+
+// Magic number at the beginning of the shared memory ring ("MWRB").
+#define SHARED_MEMORY_RING_MAGIC 0x4252574D
+
+// Version of the shared memory ring layout.
+#define SHARED_MEMORY_RING_VERSION 2
+
+// Offset of the ring data in the shared memory file.
+#define SHARED_MEMORY_RING_DATA_OFFSET 256
+
+
+/* TYPES */
+
+// The different record types in the shared memory ring.
+enum struct SharedMemoryRingRecordTypes : UINT32
+{
+    // Begins a new trace file. Payload: File name.
+    FileBegin = 1,
+
+    // Contents of the current trace file. Payload: File data.
+    FileData = 2,
+
+    // Ends the current trace file. No payload.
+    FileEnd = 3
+};
+
+// Header of the shared memory ring. The file is created and initialized by Microwalk; the producer and consumer positions are placed on separate cache lines.
+struct SharedMemoryRingHeader
+{
+    // Magic number (SHARED_MEMORY_RING_MAGIC).
+    UINT32 Magic;
+
+    // Layout version (SHARED_MEMORY_RING_VERSION).
+    UINT32 Version;
+
+    // Size of the ring data.
+    UINT64 Capacity;
+
+    UINT8 _padding1[48];
+
+    // Total number of bytes written by the producer.
+    volatile UINT64 WritePosition;
+
+    UINT8 _padding2[56];
+
+    // Total number of bytes consumed by the consumer.
+    volatile UINT64 ReadPosition;
+
+    UINT8 _padding3[56];
+
+    // Set by the consumer before it blocks on this futex word while the ring is empty. Reset by the producer when waking the consumer.
+    volatile UINT32 ConsumerWaiting;
+};
+
+// Writes trace files as a sequence of records into a shared memory ring.
+// The ring has exactly one producer, i.e., the methods of this class must not be called concurrently.
+class SharedMemoryRing
+{
+private:
+    // The shared memory ring header.
+    SharedMemoryRingHeader* _header;
+
+    // The ring data.
+    UINT8* _data;
+
+    // Size of the ring data.
+    UINT64 _capacity;
+
+private:
+    // Copies the given data into the ring, waiting for the consumer if the ring is full.
+    void Write(const void* data, size_t length);
+
+    // Wakes the consumer, if it is blocked waiting for data.
+    void WakeConsumer();
+
+    // Writes a record header.
+    void WriteRecordHeader(SharedMemoryRingRecordTypes type, size_t length);
+
+public:
+    // Maps the given shared memory file, which must have been initialized by the consumer.
+    explicit SharedMemoryRing(const std::string& path);
+
+    // Begins a new trace file with the given name.
+    void BeginFile(const std::string& name);
+
+    // Appends the given data to the current trace file.
+    void WriteFileData(const UINT8* data, size_t length);
+
+    // Ends the current trace file.
+    void EndFile();
+};
@@ -0,0 +1,83 @@
+/*
+Test application for basic block memory access records (PinTracer knob -g 1).
+Executes basic blocks which access memory and end in a direct or an indirect call, and writes the values the trace must contain to the given file.
+The resulting trace is checked by check_block_record_trace.py.
+*/
+
+/* INCLUDES */
+#include <cstdio>
+#include <cstdint>
+
+
+/* PIN NOTIFICATIONS */
+
+extern "C"
+{
+// These functions must not be inlined or optimized away, so Pin can find and instrument them.
+__attribute__((noinline, noipa)) int PinNotifyTestcaseStart(int t) { return t + 42; }
+__attribute__((noinline, noipa)) int PinNotifyTestcaseEnd() { return 42; }
+
+// Runs the tested basic blocks on the given buffer, which holds 4 entries. The last entry must point to CallTarget().
+void RunBlocks(uint64_t* buffer);
+
+// Target of the calls in RunBlocks().
+void CallTarget();
+}
+
+// Written in assembly, so the compiler cannot change the block structure.
+asm(R"(
+    .text
+
+    .globl RunBlocks
+    .type RunBlocks, @function
+RunBlocks:
+    # Read and write, followed by a direct call which writes the return address to the stack
+    movq (%rdi), %rax
+    movq %rax, 8(%rdi)
+    call CallTarget
+
+    # Read and write, followed by an indirect call which additionally reads its target from memory
+    movq 8(%rdi), %rax
+    movq %rax, 16(%rdi)
+    call *24(%rdi)
+
+    ret
+    .size RunBlocks, .-RunBlocks
+
+    .globl CallTarget
+    .type CallTarget, @function
+CallTarget:
+    ret
+    .size CallTarget, .-CallTarget
+)");
+
+
+/* MAIN */
+
+int main(int argc, const char** argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <expected values file>\n", argv[0]);
+        return 1;
+    }
+
+    static uint64_t buffer[4] = { 0x1234, 0, 0, 0 };
+    buffer[3] = reinterpret_cast<uint64_t>(&CallTarget);
+
+    // Buffer address and call target address
+    FILE* expectedFile = fopen(argv[1], "w");
+    if(!expectedFile)
+    {
+        fprintf(stderr, "Error opening expected values file '%s'\n", argv[1]);
+        return 1;
+    }
+    fprintf(expectedFile, "%llx\n%llx\n", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(buffer)), static_cast<unsigned long long>(buffer[3]));
+    fclose(expectedFile);
+
+    PinNotifyTestcaseStart(1);
+    RunBlocks(buffer);
+    PinNotifyTestcaseEnd();
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+# Checks the raw trace of BlockRecordCallApp, which was recorded with basic block memory access records (PinTracer knob -g 1).
+# Each tested block must yield a BlockMemoryAccesses entry with the expected addresses, directly followed by an intact Branch entry for the call.
+#
+# Usage: check_block_record_trace.py <expected values file> <trace file>
+
+import struct
+import sys
+
+# Layout of TraceEntry, see TraceWriter.h
+ENTRY_FORMAT = "<IBBHQQ"
+ENTRY_SIZE = struct.calcsize(ENTRY_FORMAT)
+ADDRESSES_PER_ENTRY = ENTRY_SIZE // 8
+
+# Values of TraceEntryTypes
+MEMORY_READ = 1
+MEMORY_WRITE = 2
+BRANCH = 6
+BLOCK_DEFINITION = 9
+BLOCK_MEMORY_ACCESSES = 10
+MAX_ENTRY_TYPE = 10
+
+# Flag of a taken call Branch entry (TraceEntryFlags::BranchTypeCall | TraceEntryFlags::BranchTaken)
+BRANCH_FLAG_CALL_TAKEN = (2 << 1) | 1
+
+
+def fail(message):
+    print("Error: " + message, file=sys.stderr)
+    sys.exit(1)
+
+
+# Decodes the given raw trace file.
+# Returns the list of entries as (type, flag, param0, param1, param2) tuples, where BlockMemoryAccesses entries get the list of addresses
+# in place of param2, and the block definitions as a dictionary, which maps block IDs to lists of access types.
+def decode_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % ENTRY_SIZE != 0:
+        fail(f"Size of trace file is not a multiple of {ENTRY_SIZE}")
+
+    entries = []
+    block_definitions = {}
+    offset = 0
+    while offset < len(data):
+        entry_type, flag, _, param0, param1, param2 = struct.unpack_from(ENTRY_FORMAT, data, offset)
+        offset += ENTRY_SIZE
+        if entry_type < 1 or entry_type > MAX_ENTRY_TYPE:
+            fail(f"Invalid entry type {entry_type} at offset {offset - ENTRY_SIZE}")
+
+        if entry_type == BLOCK_DEFINITION:
+            access_types = []
+            for _ in range(param0):
+                access_type = struct.unpack_from(ENTRY_FORMAT, data, offset)[0]
+                offset += ENTRY_SIZE
+                if access_type != MEMORY_READ and access_type != MEMORY_WRITE:
+                    fail(f"Invalid access type {access_type} in definition of block {param1}")
+                access_types.append(access_type)
+            block_definitions[param1] = access_types
+            continue
+
+        if entry_type == BLOCK_MEMORY_ACCESSES:
+            if param1 not in block_definitions:
+                fail(f"Block {param1} is used before its definition")
+            payload_entries = (param0 + ADDRESSES_PER_ENTRY - 1) // ADDRESSES_PER_ENTRY
+            addresses = list(struct.unpack_from(f"<{payload_entries * ADDRESSES_PER_ENTRY}Q", data, offset))[:param0]
+            offset += payload_entries * ENTRY_SIZE
+            entries.append((entry_type, flag, param0, param1, addresses))
+            continue
+
+        entries.append((entry_type, flag, param0, param1, param2))
+
+    if offset != len(data):
+        fail("Trace file ends within a block definition or record")
+    return entries, block_definitions
+
+
+def main():
+    if len(sys.argv) != 3:
+        fail("Usage: check_block_record_trace.py <expected values file> <trace file>")
+
+    with open(sys.argv[1], "r") as f:
+        buffer_address = int(f.readline(), 16)
+        call_target_address = int(f.readline(), 16)
+
+    entries, block_definitions = decode_trace(sys.argv[2])
+
+    # Accesses of the blocks ending in the direct and the indirect call, see BlockRecordCallApp.cpp
+    expected_blocks = [
+        ("direct call", [buffer_address, buffer_address + 8]),
+        ("indirect call", [buffer_address + 8, buffer_address + 16]),
+    ]
+    for name, expected_addresses in expected_blocks:
+        index = next((i for i, entry in enumerate(entries) if entry[0] == BLOCK_MEMORY_ACCESSES and entry[4] == expected_addresses), None)
+        if index is None:
+            fail(f"No block memory access record for the block ending in the {name}")
+
+        block_id = entries[index][3]
+        if block_definitions[block_id] != [MEMORY_READ, MEMORY_WRITE]:
+            fail(f"Unexpected access types {block_definitions[block_id]} for the block ending in the {name}")
+
+        if index + 1 >= len(entries):
+            fail(f"Missing branch entry after the block ending in the {name}")
+        branch_type, branch_flag, _, _, branch_target = entries[index + 1]
+        if branch_type != BRANCH or branch_flag != BRANCH_FLAG_CALL_TAKEN or branch_target != call_target_address:
+            fail(f"Expected call branch entry after the block ending in the {name}, got {entries[index + 1]}")
+
+    print(f"OK: {len(entries)} entries, {len(block_definitions)} block definitions")
+
+
+if __name__ == "__main__":
+    main()
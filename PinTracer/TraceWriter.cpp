@@ -1,42 +1,122 @@
 /* INCLUDES */
 #include "TraceWriter.h"
+#include "Compression.h"
 #include "pin.H"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <utility>
+#include <algorithm>
 
 
 /* STATIC VARIABLES */
 
 bool TraceWriter::_prefixMode;
 std::ofstream TraceWriter::_prefixDataFileStream;
-bool TraceWriter::_sawFirstReturn;
+bool TraceWriter::_recordPrefixTrace = true;
+SharedMemoryRing* TraceWriter::_sharedMemoryRing = nullptr;
+bool TraceWriter::_fingerprintMode = false;
+FingerprintKinds TraceWriter::_fingerprintKind = FingerprintKinds::InstructionMemoryAccess;
+bool TraceWriter::_statisticsEnabled = false;
+PIN_LOCK TraceWriter::_instrumentationStatisticsLock;
+UINT64 TraceWriter::_instrumentedBasicBlockCount = 0;
+UINT64 TraceWriter::_skippedBasicBlockCount = 0;
+UINT64 TraceWriter::_instrumentationTime = 0;
+bool TraceWriter::_blockMemoryAccessRecords = false;
+PIN_LOCK TraceWriter::_blockDefinitionsLock;
+std::vector<std::vector<TraceEntry>> TraceWriter::_blockDefinitions;
 
 
 /* TYPES */
 
-TraceWriter::TraceWriter(const std::string& filenamePrefix)
+TraceWriter::TraceWriter(const std::string& filenamePrefix, THREADID threadId, int bufferCount, bool compactEncoding, bool compression)
 {
     // Remember prefix
     _outputFilenamePrefix = filenamePrefix;
+    _threadId = threadId;
+
+    // Threads which are created after the first testcase has started do not have a prefix
+    _tracingPrefix = _prefixMode;
+
+    // Entries are only hashed in fingerprint mode
+    if(_fingerprintMode)
+        _fingerprint = new LeakageFingerprint(_fingerprintKind);
+
+    // Allocate encoding buffer
+    _compactEncoding = compactEncoding;
+    if(_compactEncoding)
+        _encodedEntries = new UINT8[ENTRY_BUFFER_SIZE * COMPACT_TRACE_MAX_ENTRY_SIZE];
+
+    // Allocate compression buffers, large enough for a full buffer in either representation
+    _compression = compression;
+    if(_compression)
+    {
+        _compressedData = new UINT8[Lz4CompressBound(ENTRY_BUFFER_SIZE * std::max<size_t>(sizeof(TraceEntry), COMPACT_TRACE_MAX_ENTRY_SIZE))];
+        _compressionHashTable = new UINT32[LZ4_HASH_TABLE_SIZE];
+    }
+
+    // Allocate entry buffers
+    if(bufferCount < 1)
+        bufferCount = 1;
+    for(int i = 0; i < bufferCount; ++i)
+        _buffers.push_back(new TraceEntry[ENTRY_BUFFER_SIZE]{});
+    _bufferEnds.resize(bufferCount, nullptr);
+    _entries = _buffers[0];
 
     // Open prefix output file
-	std::string filename = filenamePrefix + "prefix.trace";
-    OpenOutputFile(filename);
+    if(_tracingPrefix && IsProcessingPrefix())
+    {
+        std::string filename = GetTraceFilename("prefix");
+        OpenOutputFile(filename);
+    }
+
+    // Start asynchronous writer thread, if there are enough buffers to rotate through
+    if(bufferCount > 1)
+    {
+        PIN_MutexInit(&_bufferMutex);
+        PIN_SemaphoreInit(&_bufferPendingSemaphore);
+        PIN_SemaphoreInit(&_bufferFreeSemaphore);
+
+        if(PIN_SpawnInternalThread(WriterThreadMain, this, 0, &_writerThreadUid) == INVALID_THREADID)
+        {
+            std::cerr << "Error: Could not spawn trace writer thread." << std::endl;
+            exit(1);
+        }
+        _writerThreadRunning = true;
+        std::cerr << "Asynchronous trace writing enabled (" << std::dec << bufferCount << " buffers)" << std::endl;
+    }
 }
 
 TraceWriter::~TraceWriter()
 {
+    // Write remaining buffers
+    bool asyncMode = _buffers.size() > 1;
+    StopWriterThread();
+    if(asyncMode)
+    {
+        PIN_SemaphoreFini(&_bufferFreeSemaphore);
+        PIN_SemaphoreFini(&_bufferPendingSemaphore);
+        PIN_MutexFini(&_bufferMutex);
+    }
+
     // Close file stream
-    _outputFileStream.close();
+    if(_sharedMemoryRing == nullptr)
+        _outputFileStream.close();
+
+    // Free buffers
+    for(TraceEntry* buffer : _buffers)
+        delete[] buffer;
+    delete[] _encodedEntries;
+    delete[] _compressedData;
+    delete[] _compressionHashTable;
+    delete _fingerprint;
 }
 
-void TraceWriter::InitPrefixMode(const std::string& filenamePrefix)
+void TraceWriter::InitPrefixMode(const std::string& filenamePrefix, bool recordPrefixTrace)
 {
     // Start trace prefix mode
     _prefixMode = true;
-    _sawFirstReturn = true;
+    _recordPrefixTrace = recordPrefixTrace;
 
     // Open prefix metadata output file
     _prefixDataFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
@@ -47,7 +127,7 @@ void TraceWriter::InitPrefixMode(const std::string& filenamePrefix)
         std::cerr << "Error: Could not open prefix metadata output file '" << prefixDataFilename << "'." << std::endl;
         exit(1);
     }
-    std::cerr << "Trace prefix mode started" << std::endl;
+    std::cerr << "Trace prefix mode started" << (_recordPrefixTrace ? "" : " (only recording image metadata)") << std::endl;
 }
 
 TraceEntry* TraceWriter::Begin()
@@ -60,71 +140,631 @@ TraceEntry* TraceWriter::End()
     return &_entries[ENTRY_BUFFER_SIZE];
 }
 
+void TraceWriter::InitSharedMemoryTransport(const std::string& path)
+{
+    _sharedMemoryRing = new SharedMemoryRing(path);
+}
+
+void TraceWriter::InitFingerprintMode(FingerprintKinds kind)
+{
+    _fingerprintMode = true;
+    _fingerprintKind = kind;
+    std::cerr << "Leakage fingerprint mode enabled (" << (kind == FingerprintKinds::CallStackMemoryAccess ? "call stack" : "instruction") << " memory access)" << std::endl;
+}
+
+void TraceWriter::InitStatistics()
+{
+    _statisticsEnabled = true;
+    PIN_InitLock(&_instrumentationStatisticsLock);
+    std::cerr << "Tracing statistics enabled" << std::endl;
+}
+
+void TraceWriter::InitBlockMemoryAccessRecords()
+{
+    _blockMemoryAccessRecords = true;
+    PIN_InitLock(&_blockDefinitionsLock);
+    std::cerr << "Basic block memory access records enabled" << std::endl;
+}
+
+UINT32 TraceWriter::AddBlockDefinition(const std::vector<TraceEntry>& accesses)
+{
+    PIN_GetLock(&_blockDefinitionsLock, 0);
+    auto blockId = static_cast<UINT32>(_blockDefinitions.size());
+
+    std::vector<TraceEntry> definition;
+    definition.reserve(1 + accesses.size());
+    TraceEntry header{};
+    header.Type = TraceEntryTypes::BlockDefinition;
+    header.Param0 = static_cast<UINT16>(accesses.size());
+    header.Param1 = blockId;
+    definition.push_back(header);
+    definition.insert(definition.end(), accesses.begin(), accesses.end());
+    _blockDefinitions.push_back(std::move(definition));
+
+    PIN_ReleaseLock(&_blockDefinitionsLock);
+    return blockId;
+}
+
+void TraceWriter::AddInstrumentationStatistics(UINT64 instrumentedBasicBlocks, UINT64 skippedBasicBlocks, UINT64 time)
+{
+    PIN_GetLock(&_instrumentationStatisticsLock, 0);
+    _instrumentedBasicBlockCount += instrumentedBasicBlocks;
+    _skippedBasicBlockCount += skippedBasicBlocks;
+    _instrumentationTime += time;
+    PIN_ReleaseLock(&_instrumentationStatisticsLock);
+}
+
+UINT64 TraceWriter::GetTimestamp()
+{
+    return static_cast<UINT64>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void TraceWriter::ReportStatistics(bool includeInstrumentation)
+{
+    // One line with tab-separated key=value pairs, which precedes the respective trace file notification
+    std::stringstream statisticsStream;
+    statisticsStream << "m" << std::dec
+        << "\tmemory-reads=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::MemoryRead)]
+        << "\tmemory-writes=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::MemoryWrite)]
+        << "\theap-allocations=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::HeapAllocSizeParameter)]
+        << "\theap-allocation-returns=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::HeapAllocAddressReturn)]
+        << "\theap-frees=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::HeapFreeAddressParameter)]
+        << "\tbranches=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::Branch)]
+        << "\tstack-pointer-infos=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::StackPointerInfo)]
+        << "\tstack-pointer-modifications=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::StackPointerModification)]
+        << "\tmemory-access-blocks=" << _statistics.EntryCounts[static_cast<int>(TraceEntryTypes::BlockMemoryAccesses)]
+        << "\tblock-memory-accesses=" << _statistics.BlockMemoryAccessCount
+        << "\tbuffer-flushes=" << _statistics.BufferFlushCount
+        << "\tbuffer-flush-time-us=" << _statistics.BufferFlushTime / 1000;
+    _statistics = TraceWriterStatistics{};
+
+    if(includeInstrumentation)
+    {
+        PIN_GetLock(&_instrumentationStatisticsLock, 0);
+        statisticsStream
+            << "\tinstrumented-basic-blocks=" << _instrumentedBasicBlockCount
+            << "\tskipped-basic-blocks=" << _skippedBasicBlockCount
+            << "\tinstrumentation-time-us=" << _instrumentationTime / 1000;
+        _instrumentedBasicBlockCount = 0;
+        _skippedBasicBlockCount = 0;
+        _instrumentationTime = 0;
+        PIN_ReleaseLock(&_instrumentationStatisticsLock);
+    }
+
+    std::cout << statisticsStream.str() << std::endl;
+}
+
+std::string TraceWriter::GetTraceFilename(const std::string& name) const
+{
+    std::stringstream filenameStream;
+    filenameStream << _outputFilenamePrefix << name;
+    if(_threadId != 0)
+        filenameStream << "_" << std::dec << _threadId;
+    filenameStream << (_fingerprint != nullptr ? ".fingerprint" : ".trace");
+    return filenameStream.str();
+}
+
+bool TraceWriter::IsProcessingPrefix() const
+{
+    // The fingerprint always needs the allocations of the prefix, as there is no preprocessor which could reuse another prefix
+    return _recordPrefixTrace || _fingerprint != nullptr;
+}
+
 void TraceWriter::OpenOutputFile(std::string& filename)
 {
-    // Open file for writing
-    _outputFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
     _currentOutputFilename = filename;
-    _outputFileStream.open(_currentOutputFilename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-    if(!_outputFileStream)
+    _writtenBlockDefinitions.clear();
+    if(_fingerprint != nullptr)
     {
-        std::cerr << "Error: Could not open output file '" << _currentOutputFilename << "'." << std::endl;
-        exit(1);
+        // The fingerprint file is written as a whole when the testcase ends
+        _fingerprint->BeginFile();
+        if(_hasStackPointerInfo)
+            WriteEntries(&_stackPointerInfoEntry, &_stackPointerInfoEntry + 1);
+        return;
+    }
+
+    if(_sharedMemoryRing != nullptr)
+    {
+        // The file only exists as a sequence of records in the shared memory ring
+        _sharedMemoryRing->BeginFile(_currentOutputFilename);
+    }
+    else
+    {
+        // Open file for writing
+        _outputFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        _outputFileStream.open(_currentOutputFilename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        if(!_outputFileStream)
+        {
+            std::cerr << "Error: Could not open output file '" << _currentOutputFilename << "'." << std::endl;
+            exit(1);
+        }
+    }
+
+    // Write compressed container header; everything else goes into compressed frames
+    if(_compression)
+    {
+        UINT32 header[2] = { COMPRESSED_TRACE_MAGIC, COMPRESSED_TRACE_VERSION };
+        WriteRaw(header, sizeof(header));
+    }
+
+    // Write file header and reset delta bases
+    if(_compactEncoding)
+    {
+        UINT32 header[2] = { COMPACT_TRACE_MAGIC, COMPACT_TRACE_VERSION };
+        WriteOutput(reinterpret_cast<UINT8*>(header), sizeof(header));
+        _lastInstructionAddress = 0;
+        _lastMemoryAddress = 0;
+    }
+
+    // Each trace file of a secondary thread needs to know that thread's stack
+    if(_hasStackPointerInfo)
+        WriteEntries(&_stackPointerInfoEntry, &_stackPointerInfoEntry + 1);
+}
+
+void TraceWriter::WriteEntries(TraceEntry* begin, TraceEntry* end)
+{
+    if(!_blockMemoryAccessRecords)
+    {
+        WriteEntryRange(begin, end);
+        return;
+    }
+
+    // Each trace file must be readable on its own, so the blocks are defined on their first use in the file
+    TraceEntry* rangeBegin = begin;
+    for(TraceEntry* entry = begin; entry != end; entry = NextEntry(entry))
+    {
+        if(entry->Type != TraceEntryTypes::BlockMemoryAccesses)
+            continue;
+
+        auto blockId = static_cast<UINT32>(entry->Param1);
+        if(blockId < _writtenBlockDefinitions.size() && _writtenBlockDefinitions[blockId])
+            continue;
+
+        WriteEntryRange(rangeBegin, entry);
+        WriteBlockDefinition(blockId);
+        rangeBegin = entry;
+    }
+    WriteEntryRange(rangeBegin, end);
+}
+
+void TraceWriter::WriteBlockDefinition(UINT32 blockId)
+{
+    if(blockId >= _writtenBlockDefinitions.size())
+        _writtenBlockDefinitions.resize(blockId + 1, false);
+    _writtenBlockDefinitions[blockId] = true;
+
+    // The definition is copied, as the list may be resized by the instrumentation of further blocks
+    PIN_GetLock(&_blockDefinitionsLock, 0);
+    std::vector<TraceEntry> definition = _blockDefinitions[blockId];
+    PIN_ReleaseLock(&_blockDefinitionsLock);
+
+    WriteEntryRange(definition.data(), definition.data() + definition.size());
+}
+
+TraceEntry* TraceWriter::NextEntry(TraceEntry* entry)
+{
+    if(entry->Type == TraceEntryTypes::BlockDefinition)
+        return entry + 1 + entry->Param0;
+    if(entry->Type == TraceEntryTypes::BlockMemoryAccesses)
+        return entry + 1 + BLOCK_RECORD_PAYLOAD_ENTRIES(entry->Param0);
+    return entry + 1;
+}
+
+void TraceWriter::WriteEntryRange(TraceEntry* begin, TraceEntry* end)
+{
+    if(begin == end)
+        return;
+
+    if(_fingerprint != nullptr)
+    {
+        _fingerprint->AddEntries(begin, end);
+        return;
+    }
+
+    if(_compactEncoding)
+    {
+        UINT8* encodedEnd = EncodeEntries(begin, end, _encodedEntries);
+        WriteOutput(_encodedEntries, static_cast<size_t>(encodedEnd - _encodedEntries));
+        return;
+    }
+
+    WriteOutput(reinterpret_cast<UINT8*>(begin), static_cast<size_t>(reinterpret_cast<ADDRINT>(end) - reinterpret_cast<ADDRINT>(begin)));
+}
+
+void TraceWriter::WriteRaw(const void* data, size_t length)
+{
+    if(_sharedMemoryRing != nullptr)
+        _sharedMemoryRing->WriteFileData(static_cast<const UINT8*>(data), length);
+    else
+        _outputFileStream.write(static_cast<const char*>(data), static_cast<std::streamsize>(length));
+}
+
+void TraceWriter::CloseOutputFile()
+{
+    if(_fingerprint != nullptr)
+    {
+        // The prefix only provides the initial state of the testcases
+        if(_tracingPrefix)
+            _fingerprint->EndPrefix();
+        else
+            _fingerprint->WriteToFile(_currentOutputFilename);
+        return;
+    }
+
+    if(_sharedMemoryRing != nullptr)
+    {
+        _sharedMemoryRing->EndFile();
+        return;
+    }
+
+    _outputFileStream.close();
+    _outputFileStream.clear();
+}
+
+void TraceWriter::WriteOutput(const UINT8* data, size_t length)
+{
+    if(!_compression)
+    {
+        WriteRaw(data, length);
+        return;
     }
+
+    if(length == 0)
+        return;
+
+    // Frame header: Uncompressed and stored size; if compression does not help, the data is stored as is (stored size == uncompressed size)
+    size_t compressedLength = Lz4CompressBlock(data, length, _compressedData, _compressionHashTable);
+    bool stored = compressedLength >= length;
+    UINT32 frameHeader[2] = { static_cast<UINT32>(length), static_cast<UINT32>(stored ? length : compressedLength) };
+    WriteRaw(frameHeader, sizeof(frameHeader));
+    if(stored)
+        WriteRaw(data, length);
+    else
+        WriteRaw(_compressedData, compressedLength);
+}
+
+UINT8* TraceWriter::EncodeEntries(TraceEntry* begin, TraceEntry* end, UINT8* output)
+{
+    for(TraceEntry* entry = begin; entry != end; entry = NextEntry(entry))
+    {
+        // Header byte: Entry type in the lower, flags in the upper 4 bits
+        *output++ = static_cast<UINT8>(static_cast<UINT32>(entry->Type) | (entry->Flag << 4));
+
+        switch(entry->Type)
+        {
+            case TraceEntryTypes::MemoryRead:
+            case TraceEntryTypes::MemoryWrite:
+            {
+                output = EncodeUnsigned(output, entry->Param0);
+                output = EncodeDelta(output, entry->Param1, _lastInstructionAddress);
+                output = EncodeDelta(output, entry->Param2, _lastMemoryAddress);
+                _lastInstructionAddress = entry->Param1;
+                _lastMemoryAddress = entry->Param2;
+                break;
+            }
+
+            case TraceEntryTypes::HeapAllocSizeParameter:
+            {
+                output = EncodeUnsigned(output, entry->Param1);
+                break;
+            }
+
+            case TraceEntryTypes::HeapAllocAddressReturn:
+            case TraceEntryTypes::HeapFreeAddressParameter:
+            {
+                output = EncodeDelta(output, entry->Param2, _lastMemoryAddress);
+                _lastMemoryAddress = entry->Param2;
+                break;
+            }
+
+            case TraceEntryTypes::Branch:
+            {
+                // The target is stored relative to the source; execution continues near the target if the branch is taken
+                output = EncodeDelta(output, entry->Param1, _lastInstructionAddress);
+                output = EncodeDelta(output, entry->Param2, entry->Param1);
+                bool taken = (entry->Flag & static_cast<UINT8>(TraceEntryFlags::BranchTaken)) != 0;
+                _lastInstructionAddress = taken ? entry->Param2 : entry->Param1;
+                break;
+            }
+
+            case TraceEntryTypes::StackPointerModification:
+            {
+                output = EncodeDelta(output, entry->Param1, _lastInstructionAddress);
+                output = EncodeDelta(output, entry->Param2, _lastMemoryAddress);
+                _lastInstructionAddress = entry->Param1;
+                _lastMemoryAddress = entry->Param2;
+                break;
+            }
+
+            case TraceEntryTypes::BlockDefinition:
+            {
+                // The accesses only need their type, size and instruction address
+                output = EncodeUnsigned(output, entry->Param0);
+                output = EncodeUnsigned(output, entry->Param1);
+                for(TraceEntry* access = entry + 1; access != entry + 1 + entry->Param0; ++access)
+                {
+                    *output++ = static_cast<UINT8>(access->Type);
+                    output = EncodeUnsigned(output, access->Param0);
+                    output = EncodeDelta(output, access->Param1, _lastInstructionAddress);
+                    _lastInstructionAddress = access->Param1;
+                }
+                break;
+            }
+
+            case TraceEntryTypes::BlockMemoryAccesses:
+            {
+                output = EncodeUnsigned(output, entry->Param0);
+                output = EncodeUnsigned(output, entry->Param1);
+                auto* addresses = reinterpret_cast<UINT64*>(entry + 1);
+                for(UINT32 i = 0; i < entry->Param0; ++i)
+                {
+                    output = EncodeDelta(output, addresses[i], _lastMemoryAddress);
+                    _lastMemoryAddress = addresses[i];
+                }
+                break;
+            }
+
+            default:
+            {
+                // StackPointerInfo and unknown entries are stored as is
+                output = EncodeUnsigned(output, entry->Param0);
+                output = EncodeUnsigned(output, entry->Param1);
+                output = EncodeUnsigned(output, entry->Param2);
+                break;
+            }
+        }
+    }
+
+    return output;
+}
+
+UINT8* TraceWriter::EncodeUnsigned(UINT8* output, UINT64 value)
+{
+    while(value >= 0x80)
+    {
+        *output++ = static_cast<UINT8>(value | 0x80);
+        value >>= 7;
+    }
+    *output++ = static_cast<UINT8>(value);
+    return output;
+}
+
+UINT8* TraceWriter::EncodeDelta(UINT8* output, UINT64 value, UINT64 base)
+{
+    // Zig-zag encoding maps small negative and positive differences to small unsigned values
+    INT64 delta = static_cast<INT64>(value - base);
+    return EncodeUnsigned(output, (static_cast<UINT64>(delta) << 1) ^ static_cast<UINT64>(delta >> 63));
 }
 
 void TraceWriter::WriteBufferToFile(TraceEntry* end)
 {
-    // Write buffer contents
-    if(_testcaseId != -1 || _prefixMode)
-        _outputFileStream.write(reinterpret_cast<char*>(_entries), static_cast<std::streamsize>(reinterpret_cast<ADDRINT>(end) - reinterpret_cast<ADDRINT>(_entries)));
+    // Discard buffer contents if we are not tracing right now
+    if(_testcaseId == -1 && (!_tracingPrefix || !IsProcessingPrefix()))
+        return;
+
+    // Count entries; the per-entry insertion functions are not touched, so this costs nothing when disabled
+    UINT64 startTime = 0;
+    if(_statisticsEnabled)
+    {
+        for(TraceEntry* entry = _entries; entry != end; entry = NextEntry(entry))
+        {
+            ++_statistics.EntryCounts[static_cast<UINT32>(entry->Type) % TRACE_ENTRY_TYPE_SLOTS];
+            if(entry->Type == TraceEntryTypes::BlockMemoryAccesses)
+                _statistics.BlockMemoryAccessCount += entry->Param0;
+        }
+        ++_statistics.BufferFlushCount;
+        startTime = GetTimestamp();
+    }
+
+    // Synchronous mode: Write buffer contents directly
+    if(!_writerThreadRunning)
+    {
+        WriteEntries(_entries, end);
+        if(_statisticsEnabled)
+            _statistics.BufferFlushTime += GetTimestamp() - startTime;
+        return;
+    }
+
+    // Hand current buffer over to the writer thread
+    PIN_MutexLock(&_bufferMutex);
+    _bufferEnds[_currentBufferIndex] = end;
+    ++_pendingBufferCount;
+    PIN_SemaphoreSet(&_bufferPendingSemaphore);
+
+    // Switch to next buffer; if all buffers are in flight, we have to wait until the oldest one has been written
+    _currentBufferIndex = (_currentBufferIndex + 1) % static_cast<int>(_buffers.size());
+    while(_pendingBufferCount == static_cast<int>(_buffers.size()))
+    {
+        PIN_SemaphoreClear(&_bufferFreeSemaphore);
+        PIN_MutexUnlock(&_bufferMutex);
+        PIN_SemaphoreWait(&_bufferFreeSemaphore);
+        PIN_MutexLock(&_bufferMutex);
+    }
+    _entries = _buffers[_currentBufferIndex];
+    PIN_MutexUnlock(&_bufferMutex);
+
+    if(_statisticsEnabled)
+        _statistics.BufferFlushTime += GetTimestamp() - startTime;
+}
+
+void TraceWriter::WaitForPendingBuffers()
+{
+    if(!_writerThreadRunning)
+        return;
+
+    PIN_MutexLock(&_bufferMutex);
+    while(_pendingBufferCount > 0)
+    {
+        PIN_SemaphoreClear(&_bufferFreeSemaphore);
+        PIN_MutexUnlock(&_bufferMutex);
+        PIN_SemaphoreWait(&_bufferFreeSemaphore);
+        PIN_MutexLock(&_bufferMutex);
+    }
+    PIN_MutexUnlock(&_bufferMutex);
+}
+
+void TraceWriter::StopWriterThread()
+{
+    if(!_writerThreadRunning)
+        return;
+
+    RequestWriterThreadExit();
+    PIN_WaitForThreadTermination(_writerThreadUid, PIN_INFINITE_TIMEOUT, nullptr);
+    _writerThreadRunning = false;
+}
+
+void TraceWriter::RequestWriterThreadExit()
+{
+    if(!_writerThreadRunning)
+        return;
+
+    // Ask writer thread to exit; it writes all pending buffers first
+    PIN_MutexLock(&_bufferMutex);
+    _writerThreadExitRequested = true;
+    PIN_SemaphoreSet(&_bufferPendingSemaphore);
+    PIN_MutexUnlock(&_bufferMutex);
+}
+
+bool TraceWriter::HasWriterThread() const
+{
+    return _writerThreadRunning;
 }
 
-void TraceWriter::TestcaseStart(int testcaseId, TraceEntry* nextEntry)
+VOID TraceWriter::WriterThreadMain(VOID* arg)
+{
+    auto* traceWriter = static_cast<TraceWriter*>(arg);
+    int bufferCount = static_cast<int>(traceWriter->_buffers.size());
+
+    PIN_MutexLock(&traceWriter->_bufferMutex);
+    while(true)
+    {
+        // Wait for next full buffer
+        while(traceWriter->_pendingBufferCount == 0 && !traceWriter->_writerThreadExitRequested)
+        {
+            PIN_SemaphoreClear(&traceWriter->_bufferPendingSemaphore);
+            PIN_MutexUnlock(&traceWriter->_bufferMutex);
+            PIN_SemaphoreWait(&traceWriter->_bufferPendingSemaphore);
+            PIN_MutexLock(&traceWriter->_bufferMutex);
+        }
+
+        // Exit requested and nothing left to do?
+        if(traceWriter->_pendingBufferCount == 0)
+            break;
+
+        // Write oldest pending buffer; the instrumented thread does not touch it until it is marked as free again
+        int bufferIndex = traceWriter->_firstPendingBufferIndex;
+        PIN_MutexUnlock(&traceWriter->_bufferMutex);
+        traceWriter->WriteEntries(traceWriter->_buffers[bufferIndex], traceWriter->_bufferEnds[bufferIndex]);
+        PIN_MutexLock(&traceWriter->_bufferMutex);
+
+        // Release buffer
+        traceWriter->_firstPendingBufferIndex = (bufferIndex + 1) % bufferCount;
+        --traceWriter->_pendingBufferCount;
+        PIN_SemaphoreSet(&traceWriter->_bufferFreeSemaphore);
+    }
+    PIN_MutexUnlock(&traceWriter->_bufferMutex);
+}
+
+void TraceWriter::TestcaseStart(int testcaseId, TraceEntry* nextEntry, bool isNotifyingThread)
 {
     // Exit prefix mode if necessary
-    if(_prefixMode)
+    if(_tracingPrefix)
         TestcaseEnd(nextEntry);
 
     // Remember new testcase ID
     _testcaseId = testcaseId;
-    _sawFirstReturn = false;
+    _sawFirstReturn = !isNotifyingThread;
+    _statistics = TraceWriterStatistics{};
 
     // Open file for writing
-    std::stringstream filenameStream;
-    filenameStream << _outputFilenamePrefix << "t" << std::dec << _testcaseId << ".trace";
-	std::string filename = filenameStream.str();
+    std::stringstream testcaseNameStream;
+    testcaseNameStream << "t" << std::dec << _testcaseId;
+	std::string filename = GetTraceFilename(testcaseNameStream.str());
     OpenOutputFile(filename);
-    std::cerr << "Switched to testcase #" << std::dec << _testcaseId << std::endl;
+    std::cerr << "Switched to testcase #" << std::dec << _testcaseId;
+    if(_threadId != 0)
+        std::cerr << " (thread #" << std::dec << _threadId << ")";
+    std::cerr << std::endl;
 }
 
-void TraceWriter::TestcaseEnd(TraceEntry* nextEntry)
+void TraceWriter::TestcaseEnd(TraceEntry* nextEntry, bool isNotifyingThread)
 {
     // Save remaining trace data
     if(nextEntry != _entries)
         WriteBufferToFile(nextEntry);
+    WaitForPendingBuffers();
 
     // Close file handle and reset flags
-    _outputFileStream.close();
-    _outputFileStream.clear();
+    if(!_tracingPrefix || IsProcessingPrefix())
+        CloseOutputFile();
 
     // Exit prefix mode if necessary
-    if(_prefixMode)
+    if(_tracingPrefix)
     {
-        _prefixDataFileStream.close();
-        _prefixMode = false;
-        std::cerr << "Trace prefix mode ended" << std::endl;
+        _tracingPrefix = false;
+
+        // The first thread leaving the prefix ends the prefix mode for the entire process
+        if(_prefixMode)
+        {
+            _prefixDataFileStream.close();
+            _prefixMode = false;
+            std::cerr << "Trace prefix mode ended" << std::endl;
+        }
     }
     else
     {
         // Notify caller that the trace file is complete
-		std::cout << "t\t" << _currentOutputFilename << std::endl;
+        // The trace files of other threads are reported first, so the caller can attach them to the testcase
+        if(_statisticsEnabled)
+            ReportStatistics(isNotifyingThread);
+        std::cout << (isNotifyingThread ? "t\t" : "s\t") << _currentOutputFilename << std::endl;
     }
 
     // Disable tracing until next test case starts
     _testcaseId = -1;
 }
 
+bool TraceWriter::IsTracingTestcase() const
+{
+    return _testcaseId != -1;
+}
+
+void TraceWriter::StartAllocationTracking()
+{
+    _allocationCallStackDepth = 0;
+}
+
+void TraceWriter::TrackAllocationCall()
+{
+    if(_allocationCallStackDepth >= 0)
+        ++_allocationCallStackDepth;
+}
+
+bool TraceWriter::TrackAllocationReturn()
+{
+    // Tracking active?
+    if(_allocationCallStackDepth < 0)
+        return false;
+
+    // Return
+    --_allocationCallStackDepth;
+
+    // Have we reached the end of the call stack?
+    return _allocationCallStackDepth < 0;
+}
+
+void TraceWriter::SetStackPointerInfo(ADDRINT stackPointerMin, ADDRINT stackPointerMax)
+{
+    _stackPointerInfoEntry.Type = TraceEntryTypes::StackPointerInfo;
+    _stackPointerInfoEntry.Param1 = stackPointerMin;
+    _stackPointerInfoEntry.Param2 = stackPointerMax;
+    _hasStackPointerInfo = true;
+
+    // Store in current trace file; this is called before the thread starts writing entries, so no buffers are pending
+    if(_testcaseId != -1 || (_tracingPrefix && IsProcessingPrefix()))
+        WriteEntries(&_stackPointerInfoEntry, &_stackPointerInfoEntry + 1);
+}
+
 void TraceWriter::WriteImageLoadData(int interesting, uint64_t startAddress, uint64_t endAddress, std::string& name)
 {
     // Prefix mode active?
@@ -135,13 +775,14 @@ void TraceWriter::WriteImageLoadData(int interesting, uint64_t startAddress, uin
     }
 
     // Write image data
+    if(_fingerprintMode)
+        LeakageFingerprint::AddImage(interesting != 0, startAddress, endAddress, name);
     _prefixDataFileStream << "i\t" << interesting << "\t" << std::hex << startAddress << "\t" << std::hex << endAddress << "\t" << name << std::endl;
 }
 
 TraceEntry* TraceWriter::CheckBufferAndStore(TraceWriter *traceWriter, TraceEntry* nextEntry)
 {
-    if(traceWriter == nullptr || nextEntry == nullptr)
-        return nullptr;
+    // No null checks here: Callers have just written the preceding entry, so both pointers belong to an instrumented thread
 
     // Entry list full?
     if(nextEntry == traceWriter->End())
@@ -177,6 +818,32 @@ TraceEntry* TraceWriter::InsertMemoryWriteEntry(TraceWriter *traceWriter, TraceE
     return CheckBufferAndStore(traceWriter, nextEntry + 1);
 }
 
+TraceEntry* TraceWriter::InsertBlockMemoryAccessesEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT32 blockId, UINT32 accessCount)
+{
+    // The payload is only filled while the block executes, so it must not be flushed in between
+    // Keep at least one free entry after the payload, so the next entry pointer never reaches the buffer end
+    TraceEntry* payloadEnd = nextEntry + 1 + BLOCK_RECORD_PAYLOAD_ENTRIES(accessCount);
+    if(payloadEnd >= traceWriter->End())
+    {
+        traceWriter->WriteBufferToFile(nextEntry);
+        nextEntry = traceWriter->Begin();
+        payloadEnd = nextEntry + 1 + BLOCK_RECORD_PAYLOAD_ENTRIES(accessCount);
+    }
+
+    // Create entry
+    nextEntry->Type = TraceEntryTypes::BlockMemoryAccesses;
+    nextEntry->Param0 = static_cast<UINT16>(accessCount);
+    nextEntry->Param1 = blockId;
+
+    return payloadEnd;
+}
+
+VOID TraceWriter::StoreBlockMemoryAddress(TraceEntry* nextEntry, ADDRINT offset, ADDRINT memoryAddress)
+{
+    // No checks, so Pin can inline this
+    *reinterpret_cast<UINT64*>(reinterpret_cast<UINT8*>(nextEntry) - offset) = memoryAddress;
+}
+
 TraceEntry* TraceWriter::InsertHeapAllocSizeParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT64 size)
 {
     // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
@@ -246,9 +913,9 @@ TraceEntry* TraceWriter::InsertBranchEntry(TraceWriter *traceWriter, TraceEntry*
 TraceEntry* TraceWriter::InsertRetBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress)
 {
     // Skip the very first return after testcase begin (else we get an invalid call stack)
-    if(!_sawFirstReturn)
+    if(!traceWriter->_sawFirstReturn)
     {
-        _sawFirstReturn = true;
+        traceWriter->_sawFirstReturn = true;
         return nextEntry;
     }
     
@@ -266,6 +933,47 @@ TraceEntry* TraceWriter::InsertStackPointerInfoEntry(TraceWriter *traceWriter, T
     return CheckBufferAndStore(traceWriter, nextEntry + 1);
 }
 
+TraceEntry* TraceWriter::InsertBufferedEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, const BufferedTraceEntry* bufferedEntry)
+{
+    // Create entry
+    nextEntry->Type = static_cast<TraceEntryTypes>(bufferedEntry->Type);
+    nextEntry->Flag = static_cast<UINT8>(bufferedEntry->Flags);
+    nextEntry->Param0 = static_cast<UINT16>(bufferedEntry->Param0);
+    nextEntry->Param1 = bufferedEntry->Param1;
+    nextEntry->Param2 = bufferedEntry->Param2;
+
+    // Compute fields which can not be filled by Pin directly
+    if(nextEntry->Type == TraceEntryTypes::Branch)
+    {
+        nextEntry->Flag |= static_cast<UINT8>(bufferedEntry->Param0 == 0 ? TraceEntryFlags::BranchNotTaken : TraceEntryFlags::BranchTaken);
+        nextEntry->Param0 = 0;
+    }
+    else if(nextEntry->Type == TraceEntryTypes::HeapAllocSizeParameter && (bufferedEntry->Flags & BUFFERED_ENTRY_FLAG_CALLOC) != 0)
+    {
+        nextEntry->Flag = 0;
+        nextEntry->Param1 = bufferedEntry->Param1 * bufferedEntry->Param2;
+        nextEntry->Param2 = 0;
+    }
+
+    return CheckBufferAndStore(traceWriter, nextEntry + 1);
+}
+
+ADDRINT TraceWriter::CheckRetBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry)
+{
+    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
+    if(nextEntry == nullptr)
+        return 0;
+
+    // Skip the very first return after testcase begin (else we get an invalid call stack)
+    if(!traceWriter->_sawFirstReturn)
+    {
+        traceWriter->_sawFirstReturn = true;
+        return 0;
+    }
+
+    return 1;
+}
+
 ImageData::ImageData(bool interesting, std::string name, UINT64 startAddress, UINT64 endAddress)
 {
     _interesting = interesting;
@@ -6,12 +6,41 @@ Contains structs to store the trace data.
 // The size of the entry buffer.
 #define ENTRY_BUFFER_SIZE 16384
 
+// Magic number at the beginning of compact encoded trace files ("MWCT"). Raw trace files start with an entry type, so both formats can be told apart.
+#define COMPACT_TRACE_MAGIC 0x5443574D
+
+// Version of the compact trace encoding.
+#define COMPACT_TRACE_VERSION 1
+
+// Upper bound for the compact encoded size of a single TraceEntry slot: Either a header byte, Param0 and two 64-bit values, or the three addresses
+// stored in a payload slot of a BlockMemoryAccesses entry, all as variable-length integers.
+#define COMPACT_TRACE_MAX_ENTRY_SIZE (3 * 10)
+
+// Magic number at the beginning of compressed trace files ("MWCZ"). The file then consists of LZ4 compressed frames, one per written buffer.
+#define COMPRESSED_TRACE_MAGIC 0x5A43574D
+
+// Version of the compressed trace container.
+#define COMPRESSED_TRACE_VERSION 1
+
+// Maximum number of memory accesses in a single BlockMemoryAccesses entry. Longer basic blocks are split into several records.
+#define BLOCK_RECORD_MAX_ACCESS_COUNT 48
+
+// Number of memory addresses stored in each payload slot of a BlockMemoryAccesses entry.
+#define BLOCK_RECORD_ADDRESSES_PER_ENTRY (sizeof(TraceEntry) / sizeof(UINT64))
+
+// Number of payload slots following a BlockMemoryAccesses entry with the given number of memory accesses.
+#define BLOCK_RECORD_PAYLOAD_ENTRIES(accessCount) (((accessCount) + BLOCK_RECORD_ADDRESSES_PER_ENTRY - 1) / BLOCK_RECORD_ADDRESSES_PER_ENTRY)
+
 
 /* INCLUDES */
 #include "pin.H"
+#include "SharedMemoryRing.h"
+#include "LeakageFingerprint.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <chrono>
 
 
 /* TYPES */
@@ -41,7 +70,16 @@ enum struct TraceEntryTypes : UINT32
     StackPointerInfo = 7,
 
     // A modification of the stack pointer.
-    StackPointerModification = 8
+    StackPointerModification = 8,
+
+    // The static memory accesses of a basic block, which are referenced by BlockMemoryAccesses entries.
+    // Is followed by Param0 MemoryRead/MemoryWrite entries, which have the instruction address and access size, but no memory address.
+    // Written once per trace file, before the first BlockMemoryAccesses entry of the respective block.
+    BlockDefinition = 9,
+
+    // The memory addresses accessed by one execution of a basic block.
+    // Is followed by BLOCK_RECORD_PAYLOAD_ENTRIES(Param0) slots, which hold the Param0 64-bit addresses in the order of the BlockDefinition entries.
+    BlockMemoryAccesses = 10
 };
 
 // Represents one entry in a trace buffer.
@@ -58,12 +96,12 @@ struct TraceEntry
     // (Padding for reliable parsing by analysis programs)
     UINT8 _padding1;
 
-    // The size of a memory access.
-    // Used with: MemoryRead, MemoryWrite
+    // The size of a memory access, or the number of memory accesses of a basic block.
+    // Used with: MemoryRead, MemoryWrite, BlockDefinition, BlockMemoryAccesses
     UINT16 Param0;
 
-    // The address of the instruction triggering the trace entry creation, or the size of an allocation.
-    // Used with: MemoryRead, MemoryWrite, Branch, AllocSizeParameter, StackPointerInfo, StackPointerModification.
+    // The address of the instruction triggering the trace entry creation, the size of an allocation, or a basic block ID.
+    // Used with: MemoryRead, MemoryWrite, Branch, AllocSizeParameter, StackPointerInfo, StackPointerModification, BlockDefinition, BlockMemoryAccesses.
     UINT64 Param1;
 
     // The accessed/passed memory address.
@@ -91,45 +129,262 @@ enum struct TraceEntryFlags : UINT8
     StackIsOther = 3 << 0
 };
 
+// Represents one entry in a Pin trace buffer (PIN_DefineTraceBuffer), as filled by INS_InsertFillBuffer().
+// Pin writes each field with the natural size of the respective IARG type, so these entries are converted into TraceEntry objects before writing them to the trace file.
+struct BufferedTraceEntry
+{
+    // The type of this entry (TraceEntryTypes). An entry type of 0 marks an entry which has not been filled yet.
+    UINT32 Type;
+
+    // Static flags of this entry.
+    // Used with: Branch (branch type), StackPointerModification, HeapAllocSizeParameter (BUFFERED_ENTRY_FLAG_CALLOC).
+    UINT32 Flags;
+
+    // The size of a memory access, or whether a branch was taken.
+    // Used with: MemoryRead, MemoryWrite, Branch.
+    UINT32 Param0;
+
+    // (Padding)
+    UINT32 _padding1;
+
+    // See TraceEntry::Param1. For calloc size parameters this holds the element count.
+    UINT64 Param1;
+
+    // See TraceEntry::Param2. For calloc size parameters this holds the element size.
+    UINT64 Param2;
+};
+static_assert(sizeof(BufferedTraceEntry) == 4 + 4 + 4 + 4 + 8 + 8, "Wrong size of BufferedTraceEntry struct");
+
+// Marks a HeapAllocSizeParameter buffer entry, where the size has to be computed by multiplying Param1 and Param2.
+#define BUFFERED_ENTRY_FLAG_CALLOC 1
+
+// The number of slots for per-type entry counters (TraceEntryTypes values are 1-based).
+#define TRACE_ENTRY_TYPE_SLOTS 11
+
+// Per-testcase counters of a trace writer. These are only collected if tracing statistics are enabled.
+struct TraceWriterStatistics
+{
+    // The number of written entries, indexed by entry type.
+    UINT64 EntryCounts[TRACE_ENTRY_TYPE_SLOTS];
+
+    // The number of written entry buffers.
+    UINT64 BufferFlushCount;
+
+    // The number of memory accesses stored in BlockMemoryAccesses entries.
+    UINT64 BlockMemoryAccessCount;
+
+    // The time spent in WriteBufferToFile(), in nanoseconds. In asynchronous mode, this is the time the instrumented thread waits for a free buffer.
+    UINT64 BufferFlushTime;
+};
+
 // Provides functions to write trace buffer contents into a log file.
-// The prefix handling of this class is designed for single-threaded mode!
+// Each instrumented thread has its own instance. The trace files of secondary threads (thread ID > 0) are tagged with their thread ID.
+// Only the owning thread may use an instance, unless the owning thread is stopped (PIN_StopApplicationThreads).
 class TraceWriter
 {
 private:
     // The path prefix of the output file.
     std::string _outputFilenamePrefix;
 
+    // The ID of the thread owning this object.
+    THREADID _threadId;
+
     // The file where the trace data is currently written to.
 	std::ofstream _outputFileStream;
 
     // The name of the currently open output file.
 	std::string _currentOutputFilename;
 
-    // The buffer entries.
-    TraceEntry _entries[ENTRY_BUFFER_SIZE]{};
+    // The buffer entries which are currently filled by the instrumented thread.
+    TraceEntry* _entries;
 
     // The current testcase ID.
     int _testcaseId = -1;
 
+    // Determines whether this thread is currently tracing the trace prefix.
+    bool _tracingPrefix;
+
+    // Determines whether the first return entry after testcase begin has been observed.
+    bool _sawFirstReturn = true;
+
+    // Depth of the allocation call stack of this thread.
+    // 0 is the call stack level of the allocation function itself.
+    // -1 indicates that allocation tracking is inactive.
+    int _allocationCallStackDepth = -1;
+
+    // Determines whether a stack pointer info entry is written at the beginning of each trace file.
+    bool _hasStackPointerInfo = false;
+
+    // The stack pointer info entry of this thread, if the thread's stack is not announced by the investigated program.
+    TraceEntry _stackPointerInfoEntry{};
+
+    // The entry buffers. In asynchronous mode, the instrumented thread rotates through these, while full buffers are written by a separate thread.
+    std::vector<TraceEntry*> _buffers;
+
+    // The end pointers of the written parts of the pending buffers.
+    std::vector<TraceEntry*> _bufferEnds;
+
+    // The index of the buffer which is currently filled by the instrumented thread.
+    int _currentBufferIndex = 0;
+
+    // The index of the oldest buffer which still waits for being written.
+    int _firstPendingBufferIndex = 0;
+
+    // The number of buffers which still wait for being written.
+    int _pendingBufferCount = 0;
+
+    // Protects the pending buffer state.
+    PIN_MUTEX _bufferMutex{};
+
+    // Signaled when a new buffer is pending.
+    PIN_SEMAPHORE _bufferPendingSemaphore{};
+
+    // Signaled when a pending buffer has been written.
+    PIN_SEMAPHORE _bufferFreeSemaphore{};
+
+    // Determines whether the asynchronous writer thread is running.
+    bool _writerThreadRunning = false;
+
+    // Tells the writer thread to exit, once all pending buffers are written.
+    bool _writerThreadExitRequested = false;
+
+    // The ID of the writer thread.
+    PIN_THREAD_UID _writerThreadUid{};
+
+    // Determines whether entries are written in the compact variable-length encoding.
+    bool _compactEncoding;
+
+    // Buffer for compact encoded entries. Only used by the thread which currently writes to the output file.
+    UINT8* _encodedEntries = nullptr;
+
+    // The last instruction address written in compact encoding (delta base for instruction addresses).
+    UINT64 _lastInstructionAddress = 0;
+
+    // The last memory address written in compact encoding (delta base for memory addresses).
+    UINT64 _lastMemoryAddress = 0;
+
+    // Determines whether the written data is LZ4 compressed.
+    bool _compression;
+
+    // Buffer for compressed frames. Only used by the thread which currently writes to the output file.
+    UINT8* _compressedData = nullptr;
+
+    // Hash table scratch buffer of the compressor.
+    UINT32* _compressionHashTable = nullptr;
+
+    // The leakage fingerprint which replaces the trace file, if the fingerprint mode is enabled.
+    LeakageFingerprint* _fingerprint = nullptr;
+
+    // The tracing statistics of the current testcase.
+    TraceWriterStatistics _statistics{};
+
+    // Determines for each basic block ID whether its BlockDefinition entry has been written to the current output file.
+    std::vector<bool> _writtenBlockDefinitions;
+
 private:
     // Determines whether the program is currently tracing the trace prefix.
     static bool _prefixMode;
-    
-    // Determines whether the first return entry after testcase begin has been observed.
-    static bool _sawFirstReturn;
+
+    // Determines whether the trace entries of the prefix are recorded. If not, only the image metadata is written.
+    static bool _recordPrefixTrace;
 
     // The file where some additional trace prefix meta data is stored.
+    // Image loads are reported by Pin's instrumentation callbacks, which are serialized, so no further locking is needed.
     static std::ofstream _prefixDataFileStream;
 
+    // The shared memory ring which receives the trace files instead of the file system, if the shared memory transport is enabled.
+    static SharedMemoryRing* _sharedMemoryRing;
+
+    // Determines whether trace entries are reduced to leakage fingerprints, instead of being written to trace files.
+    static bool _fingerprintMode;
+
+    // The kind of the computed leakage fingerprints.
+    static FingerprintKinds _fingerprintKind;
+
+    // Determines whether tracing statistics are collected and reported.
+    static bool _statisticsEnabled;
+
+    // Protects the instrumentation statistics, which are updated by the instrumentation callbacks and reported by the instrumented threads.
+    static PIN_LOCK _instrumentationStatisticsLock;
+
+    // The number of basic blocks in interesting images, which were instrumented since the last report.
+    static UINT64 _instrumentedBasicBlockCount;
+
+    // The number of basic blocks in uninteresting images, where only calls and returns (and jumps without strict filtering) were instrumented since the last report.
+    static UINT64 _skippedBasicBlockCount;
+
+    // The time spent in trace instrumentation since the last report, in nanoseconds.
+    static UINT64 _instrumentationTime;
+
+    // Determines whether the memory accesses of basic blocks are recorded as BlockMemoryAccesses entries.
+    static bool _blockMemoryAccessRecords;
+
+    // Protects the basic block definitions, which are added by the instrumentation callbacks and read by the trace writers.
+    static PIN_LOCK _blockDefinitionsLock;
+
+    // The BlockDefinition entries (followed by their memory access entries) of all instrumented basic blocks, indexed by block ID.
+    static std::vector<std::vector<TraceEntry>> _blockDefinitions;
+
 private:
+    // Returns the path of the trace file with the given base name, tagged with the thread ID for secondary threads.
+    std::string GetTraceFilename(const std::string& name) const;
+
+    // Returns whether the entries of the trace prefix are processed (written to the prefix trace file or fed into the fingerprint).
+    [[nodiscard]] bool IsProcessingPrefix() const;
+
     // Opens the output file and sets the respective internal state.
     void OpenOutputFile(std::string& filename);
 
+    // Writes the given entries into the output file.
+    // If basic block memory access records are enabled, the definitions of blocks which are referenced for the first time in this file are written beforehand.
+    void WriteEntries(TraceEntry* begin, TraceEntry* end);
+
+    // Encodes the given entries and writes them into the output file, without further processing.
+    void WriteEntryRange(TraceEntry* begin, TraceEntry* end);
+
+    // Writes the BlockDefinition entry of the given basic block into the output file.
+    void WriteBlockDefinition(UINT32 blockId);
+
+    // Returns a pointer to the entry after the given one, skipping the payload of variable-length entries.
+    static TraceEntry* NextEntry(TraceEntry* entry);
+
+    // Writes the given data into the output file. If compression is enabled, the data is stored as a single compressed frame.
+    void WriteOutput(const UINT8* data, size_t length);
+
+    // Writes the given raw bytes into the output file or the shared memory ring.
+    void WriteRaw(const void* data, size_t length);
+
+    // Closes the current output file.
+    void CloseOutputFile();
+
+    // Encodes the given entries in the compact variable-length encoding and returns a pointer to the address *after* the last encoded byte.
+    UINT8* EncodeEntries(TraceEntry* begin, TraceEntry* end, UINT8* output);
+
+    // Writes the given value as a little endian base-128 variable-length integer.
+    static UINT8* EncodeUnsigned(UINT8* output, UINT64 value);
+
+    // Writes the given difference as a zig-zag encoded variable-length integer.
+    static UINT8* EncodeDelta(UINT8* output, UINT64 value, UINT64 base);
+
+    // Blocks until all pending buffers have been written by the writer thread.
+    void WaitForPendingBuffers();
+
+    // Main function of the asynchronous writer thread.
+    static VOID WriterThreadMain(VOID* arg);
+
+    // Prints the tracing statistics of the current testcase to stdout, and resets them.
+    // -> includeInstrumentation: Determines whether the (process-wide) instrumentation statistics are included and reset.
+    void ReportStatistics(bool includeInstrumentation);
+
 public:
 
     // Creates a new trace logger.
     // -> filenamePrefix: The path prefix of the output file. Existing files are overwritten.
-    explicit TraceWriter(const std::string& filenamePrefix);
+    // -> threadId: The ID of the thread owning this object.
+    // -> bufferCount: The number of entry buffers. If this is greater than 1, full buffers are written asynchronously by a Pin internal thread.
+    // -> compactEncoding: Determines whether the trace files use the compact variable-length encoding instead of raw TraceEntry records.
+    // -> compression: Determines whether the trace files are LZ4 compressed, with one frame per written buffer.
+    TraceWriter(const std::string& filenamePrefix, THREADID threadId, int bufferCount, bool compactEncoding, bool compression);
 
     // Frees resources.
     ~TraceWriter();
@@ -141,19 +396,49 @@ public:
     TraceEntry* End();
 
     // Writes the contents of the trace buffer into the output file.
+    // In asynchronous mode, the buffer is handed to the writer thread, and the next free buffer becomes the current one.
     // -> end: A pointer to the address *after* the last entry to be written.
     void WriteBufferToFile(TraceEntry* end);
 
+    // Writes all pending buffers and stops the asynchronous writer thread, if there is one.
+    // Subsequent buffers are written synchronously.
+    void StopWriterThread();
+
+    // Asks the asynchronous writer thread to exit once all pending buffers are written, without waiting for it.
+    // No further buffers must be written afterwards; StopWriterThread() must still be called to wait for the thread.
+    void RequestWriterThreadExit();
+
+    // Returns whether an asynchronous writer thread is running.
+    [[nodiscard]] bool HasWriterThread() const;
+
     // Sets the next testcase ID and opens a suitable trace file.
-    void TestcaseStart(int testcaseId, TraceEntry* nextEntry);
+    // -> isNotifyingThread: Determines whether this is the thread which has started the testcase. Only this thread skips the return from the notification function.
+    void TestcaseStart(int testcaseId, TraceEntry* nextEntry, bool isNotifyingThread = true);
 
     // Closes the current trace file and notifies the caller that the testcase has completed.
-    void TestcaseEnd(TraceEntry* nextEntry);
+    // -> isNotifyingThread: Determines whether this is the thread which has ended the testcase. Trace files of other threads are reported beforehand.
+    void TestcaseEnd(TraceEntry* nextEntry, bool isNotifyingThread = true);
+
+    // Returns whether a testcase is currently traced.
+    [[nodiscard]] bool IsTracingTestcase() const;
+
+    // Starts tracking the call stack of an allocation function, in order to find the return which yields the allocated address.
+    void StartAllocationTracking();
+
+    // Tracks a call while allocation tracking is active.
+    void TrackAllocationCall();
+
+    // Tracks a return while allocation tracking is active. Returns true if this return exits the allocation function.
+    bool TrackAllocationReturn();
+
+    // Sets the stack boundaries of this thread. A respective StackPointerInfo entry is written to the current and all subsequent trace files.
+    // This is needed for threads whose stack is not announced by the investigated program.
+    void SetStackPointerInfo(ADDRINT stackPointerMin, ADDRINT stackPointerMax);
 
 public:
 
     // Checks whether the next entry points beyond the entry list, and flushes the entry list to the trace file in that case.
-    // The function returns a pointer to the next entry.
+    // The function returns a pointer to the next entry. The pointers must be valid.
     static TraceEntry* CheckBufferAndStore(TraceWriter *traceWriter, TraceEntry* nextEntry);
 
     // Creates a new MemoryRead entry.
@@ -162,6 +447,14 @@ public:
     // Creates a new MemoryWrite entry.
     static TraceEntry* InsertMemoryWriteEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size);
 
+    // Creates a new BlockMemoryAccesses entry and reserves its payload, which is filled by the subsequent StoreBlockMemoryAddress() calls.
+    // The function returns a pointer to the entry after the payload. The buffer is flushed beforehand if needed, so the payload never reaches the buffer end.
+    static TraceEntry* InsertBlockMemoryAccessesEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT32 blockId, UINT32 accessCount);
+
+    // Stores a memory address into the payload of the preceding BlockMemoryAccesses entry.
+    // -> offset: The distance of the address slot in bytes, counted backwards from the end of the payload (nextEntry).
+    static VOID StoreBlockMemoryAddress(TraceEntry* nextEntry, ADDRINT offset, ADDRINT memoryAddress);
+
     // Creates a new HeapAllocSizeParameter entry.
     static TraceEntry* InsertHeapAllocSizeParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT64 size);
     static TraceEntry* InsertCallocSizeParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT64 count, UINT64 size);
@@ -184,12 +477,45 @@ public:
     // Creates a new StackPointerInfo entry.
     static TraceEntry* InsertStackPointerInfoEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT stackPointerMin, ADDRINT stackPointerMax);
 
+    // Converts the given Pin trace buffer entry and stores it as a new trace entry.
+    static TraceEntry* InsertBufferedEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, const BufferedTraceEntry* bufferedEntry);
+
+    // Checks whether a "ret" Branch entry should be created, i.e., whether the thread is instrumented and this is not the very first return after testcase begin.
+    static ADDRINT CheckRetBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry);
+
     // Initializes the static part of the prefix mode (record image loads, even when the thread's TraceWriter object is not yet initialized).
     // -> filenamePrefix: The path prefix of the output file. Existing files are overwritten.
-    static void InitPrefixMode(const std::string& filenamePrefix);
+    // -> recordPrefixTrace: Determines whether the trace prefix file is written. If not, only the image metadata is recorded, e.g. for reusing the trace prefix of another Pin instance.
+    static void InitPrefixMode(const std::string& filenamePrefix, bool recordPrefixTrace);
+
+    // Redirects all trace files into the shared memory ring at the given path. Must be called before creating any TraceWriter objects.
+    static void InitSharedMemoryTransport(const std::string& path);
+
+    // Replaces the trace files by leakage fingerprints ("t<id>.fingerprint"), which are computed directly from the trace entries.
+    // Must be called before creating any TraceWriter objects.
+    // -> kind: The kind of the computed fingerprints.
+    static void InitFingerprintMode(FingerprintKinds kind);
 
     // Writes information about the given loaded image into the trace metadata file.
     static void WriteImageLoadData(int interesting, uint64_t startAddress, uint64_t endAddress, std::string& name);
+
+    // Enables recording the memory accesses of basic blocks as BlockMemoryAccesses entries. Must be called before creating any TraceWriter objects.
+    static void InitBlockMemoryAccessRecords();
+
+    // Stores the given memory accesses (MemoryRead/MemoryWrite entries without memory address) of a basic block, and returns the ID for its BlockMemoryAccesses entries.
+    static UINT32 AddBlockDefinition(const std::vector<TraceEntry>& accesses);
+
+    // Enables collecting tracing statistics, which are reported per testcase right before the trace file. Must be called before creating any TraceWriter objects.
+    static void InitStatistics();
+
+    // Returns whether tracing statistics are collected.
+    static bool IsStatisticsEnabled() { return _statisticsEnabled; }
+
+    // Adds the given numbers to the instrumentation statistics.
+    static void AddInstrumentationStatistics(UINT64 instrumentedBasicBlocks, UINT64 skippedBasicBlocks, UINT64 time);
+
+    // Returns a monotonic timestamp in nanoseconds, for measuring durations.
+    static UINT64 GetTimestamp();
 };
 
 // Contains meta data of loaded images.
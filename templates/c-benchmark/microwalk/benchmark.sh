@@ -0,0 +1,142 @@
+#!/bin/bash
+
+# Measures the slowdown of Pin and of the Pin tool with different knob combinations against native execution, and the throughput of the Microwalk
+# pipeline stages, for all benchmark targets. Call build.sh first.
+#
+# Results (CSV, separated by semicolons):
+#   results/overhead.csv   Run time, slowdown and trace size per target and configuration.
+#   results/stages.csv     Processed items, busy time and throughput per target and pipeline stage.
+#   results/binaries.txt   Hashes of the benchmark binaries. Results of different runs are only comparable if these match.
+#
+# Optional environment variables:
+#   TESTCASE_COUNT         Number of test cases per target (default: 256).
+#   REPETITIONS            Number of runs per configuration; the fastest run is reported (default: 3).
+
+set -e
+
+thisDir=$(pwd)
+mainDir=$(realpath $thisDir/..)
+resultsDir=$thisDir/results
+benchmarkWorkDir=$WORK_DIR/work/benchmark
+
+testcaseCount=${TESTCASE_COUNT:-256}
+repetitions=${REPETITIONS:-3}
+
+# Pin tool knob combinations, as "<name>|<knobs>"
+configurations=(
+  "default|"
+  "stack-tracking|-s 1"
+  "cpu-override|-c 3"
+  "async-buffers|-a 4"
+  "pin-trace-buffer|-b 1"
+  "compact-traces|-e 1"
+  "compressed-traces|-z 1"
+)
+
+export LD_LIBRARY_PATH=$mainDir${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}
+
+# Generates deterministic test cases for the given target, so all runs and Microwalk versions use the same inputs
+generateTestcases() {
+  local targetName=$1
+  local testcaseDir=$thisDir/testcases/$targetName
+  
+  if [ -d $testcaseDir ] && [ $(find $testcaseDir -name "*.testcase" | wc -l) -eq $testcaseCount ]; then
+    return
+  fi
+  
+  rm -rf $testcaseDir
+  mkdir -p $testcaseDir
+  for((i = 0; i < testcaseCount; ++i))
+  do
+    # 64 bytes from two SHA-256 hashes of the test case index
+    local hex=$(for j in 0 1; do printf "%s" "$targetName-$i-$j" | sha256sum | cut -d' ' -f1; done | tr -d '\n')
+    printf "$(echo $hex | sed 's/../\\x&/g')" > $testcaseDir/t$i.testcase
+  done
+}
+
+# Writes the wrapper commands for all test cases of the given target
+generateCommands() {
+  local targetName=$1
+  local commandFile=$2
+  
+  rm -f $commandFile
+  for((i = 0; i < testcaseCount; ++i))
+  do
+    printf "t %d\n%s\n" $i "$thisDir/testcases/$targetName/t$i.testcase" >> $commandFile
+  done
+  printf "e 0\n" >> $commandFile
+}
+
+# Runs the given command with the given wrapper command file as stdin, and prints the fastest wall clock time in seconds.
+# If a trace directory is given, it is cleared before each run.
+measure() {
+  local commandFile=$1
+  local traceDir=$2
+  shift 2
+  
+  local best=""
+  for((r = 0; r < repetitions; ++r))
+  do
+    if [ -n "$traceDir" ]; then
+      rm -rf $traceDir
+      mkdir -p $traceDir
+    fi
+    
+    local start=$(date +%s.%N)
+    "$@" < $commandFile > /dev/null
+    local end=$(date +%s.%N)
+    best=$(awk -v s=$start -v e=$end -v b="$best" 'BEGIN { t = e - s; if(b == "" || t < b) b = t; printf "%.6f", b }')
+  done
+  echo $best
+}
+
+mkdir -p $resultsDir $benchmarkWorkDir
+echo "target;configuration;time-s;slowdown;trace-bytes;trace-bytes-per-s" > $resultsDir/overhead.csv
+echo "target;stage;items;busy-time-s;active-time-s;throughput-items-per-s" > $resultsDir/stages.csv
+sha256sum $mainDir/libbenchmark.so $(find $thisDir -maxdepth 1 -name "target-*" ! -name "*.*" | sort) > $resultsDir/binaries.txt
+
+for target in $(find . -maxdepth 1 -name "target-*.c" -print | sort)
+do
+  targetName=$(basename -- ${target%.*})
+  echo "Benchmarking target ${targetName}..."
+  
+  generateTestcases $targetName
+  commandFile=$benchmarkWorkDir/$targetName.commands
+  generateCommands $targetName $commandFile
+  
+  # Baselines
+  nativeTime=$(measure $commandFile "" $thisDir/$targetName)
+  echo "$targetName;native;$nativeTime;1.00;0;0" >> $resultsDir/overhead.csv
+  
+  pinTime=$(measure $commandFile "" $PIN_PATH/pin -- $thisDir/$targetName)
+  awk -v t=$pinTime -v n=$nativeTime -v name=$targetName 'BEGIN { printf "%s;pin-without-tool;%s;%.2f;0;0\n", name, t, t / n }' >> $resultsDir/overhead.csv
+  
+  # Pin tool with the different knob combinations
+  for configuration in "${configurations[@]}"
+  do
+    configurationName=${configuration%%|*}
+    knobs=${configuration#*|}
+    echo "  Pin tool configuration ${configurationName}..."
+    
+    traceDir=$benchmarkWorkDir/$targetName/$configurationName
+    pinToolTime=$(measure $commandFile $traceDir $PIN_PATH/pin -t $PINTOOL -o "$traceDir/" -i "$targetName:libbenchmark.so" $knobs -- $thisDir/$targetName)
+    traceBytes=$(find $traceDir -name "*.trace" -printf "%s\n" | awk '{ s += $1 } END { printf "%d", s }')
+    awk -v t=$pinToolTime -v n=$nativeTime -v b=$traceBytes -v name=$targetName -v c=$configurationName 'BEGIN { printf "%s;%s;%s;%.2f;%d;%.0f\n", name, c, t, t / n, b, b / t }' >> $resultsDir/overhead.csv
+    rm -rf $traceDir
+  done
+  
+  # Full pipeline, the process monitor reports the throughput of each stage
+  echo "  Microwalk pipeline..."
+  export TESTCASE_DIRECTORY=$thisDir/testcases/$targetName
+  export TARGET_NAME=$targetName
+  rm -rf $WORK_DIR/work/$targetName
+  mkdir -p $WORK_DIR/work/$targetName
+  
+  pushd $MICROWALK_PATH > /dev/null
+  dotnet Microwalk.dll $thisDir/config.yml > /dev/null
+  popd > /dev/null
+  
+  sed -n "s/.*\[monitor\] Stage '\(.*\)': \([0-9]*\) items, busy time \([0-9.]*\) s, active time \([0-9.]*\) s, throughput \([0-9.]*\) items\/s.*/$targetName;\1;\2;\3;\4;\5/p" $WORK_DIR/work/$targetName/log.txt >> $resultsDir/stages.csv
+done
+
+echo "Results written to $resultsDir"
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+set -e
+
+thisDir=$(pwd)
+mainDir=$(realpath $thisDir/..)
+
+# Build kernel library
+pushd $mainDir
+make -j all
+popd
+
+# Generate MAP file for library
+pushd $MAP_GENERATOR_PATH
+dotnet MapFileGenerator.dll $mainDir/libbenchmark.so $thisDir/libbenchmark.map
+popd
+
+# Build targets
+for target in $(find . -name "target-*.c" -print)
+do
+  targetName=$(basename -- ${target%.*})
+  
+  gcc main.c $targetName.c -g -fno-inline -fno-split-stack -L "$mainDir" -lbenchmark -I "$mainDir/src" -o $targetName
+  
+  pushd $MAP_GENERATOR_PATH
+  dotnet MapFileGenerator.dll $thisDir/$targetName $thisDir/$targetName.map
+  popd
+done
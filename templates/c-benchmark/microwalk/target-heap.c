@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <benchmark.h>
+
+// Test case: 64 bytes, which determine the object sizes and fill values.
+
+extern void RunTarget(FILE* input)
+{
+    uint8_t data[64];
+    if(fread(data, 1, 64, input) != 64)
+        return;
+
+    // Several passes, so the heap is in a steady state for most of the allocations
+    for(int i = 0; i < 8; ++i)
+        heap_churn(data, 64);
+}
+
+extern void InitTarget(FILE* input)
+{
+    // Run the first test case, so the allocator is fully initialized before tracing starts
+    RunTarget(input);
+}
@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <benchmark.h>
+
+// Test case: 32 bytes base, 32 bytes exponent (big endian).
+
+extern void RunTarget(FILE* input)
+{
+    uint8_t data[64];
+    if(fread(data, 1, 64, input) != 64)
+        return;
+
+    uint8_t result[32];
+    modexp(data, data + 32, result);
+}
+
+extern void InitTarget(FILE* input)
+{
+    modexp_init();
+}
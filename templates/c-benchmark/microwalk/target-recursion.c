@@ -0,0 +1,19 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <benchmark.h>
+
+// Test case: 64 bytes; the first two bytes determine the recursion depth.
+
+extern void RunTarget(FILE* input)
+{
+    uint8_t data[64];
+    if(fread(data, 1, 64, input) != 64)
+        return;
+
+    deep_recursion(data, 64);
+}
+
+extern void InitTarget(FILE* input)
+{
+}
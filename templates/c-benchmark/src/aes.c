@@ -0,0 +1,110 @@
+#include "benchmark.h"
+
+// The tables are computed once by aes_init(), so they are part of the library image.
+static uint8_t sbox[256];
+static uint32_t te0[256], te1[256], te2[256], te3[256];
+
+#define ROTL8(x, shift) ((uint8_t)(((x) << (shift)) | ((x) >> (8 - (shift)))))
+#define ROTR32(x, shift) (((x) >> (shift)) | ((x) << (32 - (shift))))
+
+static uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+void aes_init(void)
+{
+    // Compute the S-box by iterating over the multiplicative group of GF(2^8)
+    uint8_t p = 1, q = 1;
+    do
+    {
+        // Multiply p by 3
+        p = p ^ xtime(p);
+
+        // Divide q by 3
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if(q & 0x80)
+            q ^= 0x09;
+
+        sbox[p] = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4) ^ 0x63;
+    } while(p != 1);
+    sbox[0] = 0x63;
+
+    // Combine S-box and MixColumns
+    for(int i = 0; i < 256; ++i)
+    {
+        uint8_t s = sbox[i];
+        uint8_t s2 = xtime(s);
+        uint8_t s3 = s2 ^ s;
+        te0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | s3;
+        te1[i] = ROTR32(te0[i], 8);
+        te2[i] = ROTR32(te0[i], 16);
+        te3[i] = ROTR32(te0[i], 24);
+    }
+}
+
+static uint32_t load32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t sub_word(uint32_t w)
+{
+    return ((uint32_t)sbox[w >> 24] << 24) | ((uint32_t)sbox[(w >> 16) & 0xff] << 16) | ((uint32_t)sbox[(w >> 8) & 0xff] << 8) | sbox[w & 0xff];
+}
+
+void aes_encrypt(const uint8_t key[16], const uint8_t input[16], uint8_t output[16])
+{
+    // Key expansion
+    uint32_t roundKeys[44];
+    for(int i = 0; i < 4; ++i)
+        roundKeys[i] = load32(key + 4 * i);
+    uint8_t rcon = 1;
+    for(int i = 4; i < 44; ++i)
+    {
+        uint32_t w = roundKeys[i - 1];
+        if(i % 4 == 0)
+        {
+            w = sub_word((w << 8) | (w >> 24)) ^ ((uint32_t)rcon << 24);
+            rcon = xtime(rcon);
+        }
+        roundKeys[i] = roundKeys[i - 4] ^ w;
+    }
+
+    // Initial round
+    uint32_t s0 = load32(input) ^ roundKeys[0];
+    uint32_t s1 = load32(input + 4) ^ roundKeys[1];
+    uint32_t s2 = load32(input + 8) ^ roundKeys[2];
+    uint32_t s3 = load32(input + 12) ^ roundKeys[3];
+
+    // Main rounds
+    for(int round = 1; round < 10; ++round)
+    {
+        const uint32_t* rk = roundKeys + 4 * round;
+        uint32_t t0 = te0[s0 >> 24] ^ te1[(s1 >> 16) & 0xff] ^ te2[(s2 >> 8) & 0xff] ^ te3[s3 & 0xff] ^ rk[0];
+        uint32_t t1 = te0[s1 >> 24] ^ te1[(s2 >> 16) & 0xff] ^ te2[(s3 >> 8) & 0xff] ^ te3[s0 & 0xff] ^ rk[1];
+        uint32_t t2 = te0[s2 >> 24] ^ te1[(s3 >> 16) & 0xff] ^ te2[(s0 >> 8) & 0xff] ^ te3[s1 & 0xff] ^ rk[2];
+        uint32_t t3 = te0[s3 >> 24] ^ te1[(s0 >> 16) & 0xff] ^ te2[(s1 >> 8) & 0xff] ^ te3[s2 & 0xff] ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // Final round without MixColumns
+    const uint32_t* rk = roundKeys + 40;
+    store32(output, (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0]);
+    store32(output + 4, (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1]);
+    store32(output + 8, (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2]);
+    store32(output + 12, (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3]);
+}
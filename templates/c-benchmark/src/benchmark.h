@@ -0,0 +1,16 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Table-based AES-128 (T-tables), which produces secret-dependent memory accesses.
+void aes_init(void);
+void aes_encrypt(const uint8_t key[16], const uint8_t input[16], uint8_t output[16]);
+
+// 256-bit Montgomery modular exponentiation with square-and-multiply, which produces secret-dependent branches.
+void modexp_init(void);
+void modexp(const uint8_t base[32], const uint8_t exponent[32], uint8_t result[32]);
+
+// Allocates, fills and frees heap objects with input-dependent sizes.
+uint32_t heap_churn(const uint8_t* input, size_t length);
+
+// Descends recursively with an input-dependent depth, using a small stack buffer per frame.
+uint32_t deep_recursion(const uint8_t* input, size_t length);
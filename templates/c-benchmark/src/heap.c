@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+
+#define HEAP_SLOTS 16
+
+uint32_t heap_churn(const uint8_t* input, size_t length)
+{
+    uint8_t* slots[HEAP_SLOTS] = { 0 };
+    size_t sizes[HEAP_SLOTS] = { 0 };
+    uint32_t checksum = 0;
+
+    // Each input byte replaces one live object by a new one of input-dependent size
+    for(size_t i = 0; i < length; ++i)
+    {
+        int slot = input[i] % HEAP_SLOTS;
+        if(slots[slot])
+        {
+            checksum += slots[slot][sizes[slot] - 1];
+            free(slots[slot]);
+        }
+
+        sizes[slot] = 16 + 8 * (size_t)input[i];
+        slots[slot] = (input[i] & 1) ? calloc(1, sizes[slot]) : malloc(sizes[slot]);
+        if(!slots[slot])
+            break;
+        memset(slots[slot], input[(i + 1) % length], sizes[slot]);
+    }
+
+    for(int i = 0; i < HEAP_SLOTS; ++i)
+        free(slots[i]);
+    return checksum;
+}
@@ -0,0 +1,135 @@
+#include "benchmark.h"
+
+#define LIMBS 8
+
+// Modulus 2^256 - 189 (prime), little endian limbs.
+static const uint32_t modulus[LIMBS] = { 0xffffff43, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+
+// -modulus^-1 mod 2^32.
+static uint32_t modulusInverse;
+
+// R^2 mod modulus with R = 2^256, for converting into Montgomery form.
+static uint32_t rSquared[LIMBS];
+
+// Returns 1 if a >= b, else 0.
+static int greater_equal(const uint32_t* a, const uint32_t* b)
+{
+    for(int i = LIMBS - 1; i >= 0; --i)
+    {
+        if(a[i] != b[i])
+            return a[i] > b[i];
+    }
+    return 1;
+}
+
+// a -= b, returns the borrow.
+static uint32_t subtract(uint32_t* a, const uint32_t* b)
+{
+    uint64_t borrow = 0;
+    for(int i = 0; i < LIMBS; ++i)
+    {
+        uint64_t d = (uint64_t)a[i] - b[i] - borrow;
+        a[i] = (uint32_t)d;
+        borrow = (d >> 32) & 1;
+    }
+    return (uint32_t)borrow;
+}
+
+// result = a * b * R^-1 mod modulus (CIOS method).
+static void montgomery_multiply(uint32_t* result, const uint32_t* a, const uint32_t* b)
+{
+    uint32_t t[LIMBS + 2] = { 0 };
+    for(int i = 0; i < LIMBS; ++i)
+    {
+        uint64_t carry = 0;
+        for(int j = 0; j < LIMBS; ++j)
+        {
+            uint64_t s = (uint64_t)t[j] + (uint64_t)a[j] * b[i] + carry;
+            t[j] = (uint32_t)s;
+            carry = s >> 32;
+        }
+        uint64_t s = (uint64_t)t[LIMBS] + carry;
+        t[LIMBS] = (uint32_t)s;
+        t[LIMBS + 1] = (uint32_t)(s >> 32);
+
+        uint32_t m = t[0] * modulusInverse;
+        s = (uint64_t)t[0] + (uint64_t)m * modulus[0];
+        carry = s >> 32;
+        for(int j = 1; j < LIMBS; ++j)
+        {
+            s = (uint64_t)t[j] + (uint64_t)m * modulus[j] + carry;
+            t[j - 1] = (uint32_t)s;
+            carry = s >> 32;
+        }
+        s = (uint64_t)t[LIMBS] + carry;
+        t[LIMBS - 1] = (uint32_t)s;
+        t[LIMBS] = t[LIMBS + 1] + (uint32_t)(s >> 32);
+    }
+
+    if(t[LIMBS] != 0 || greater_equal(t, modulus))
+        subtract(t, modulus);
+    for(int i = 0; i < LIMBS; ++i)
+        result[i] = t[i];
+}
+
+void modexp_init(void)
+{
+    // Newton iteration for the inverse of the lowest limb
+    uint32_t inverse = 1;
+    for(int i = 0; i < 5; ++i)
+        inverse *= 2 - modulus[0] * inverse;
+    modulusInverse = (uint32_t)0 - inverse;
+
+    // Compute 2^512 mod modulus by repeated doubling
+    uint32_t value[LIMBS] = { 1 };
+    for(int i = 0; i < 512; ++i)
+    {
+        uint32_t carry = value[LIMBS - 1] >> 31;
+        for(int j = LIMBS - 1; j > 0; --j)
+            value[j] = (value[j] << 1) | (value[j - 1] >> 31);
+        value[0] <<= 1;
+        if(carry || greater_equal(value, modulus))
+            subtract(value, modulus);
+    }
+    for(int i = 0; i < LIMBS; ++i)
+        rSquared[i] = value[i];
+}
+
+static void load_number(uint32_t* number, const uint8_t* bytes)
+{
+    for(int i = 0; i < LIMBS; ++i)
+        number[i] = ((uint32_t)bytes[4 * i] << 24) | ((uint32_t)bytes[4 * i + 1] << 16) | ((uint32_t)bytes[4 * i + 2] << 8) | bytes[4 * i + 3];
+}
+
+void modexp(const uint8_t base[32], const uint8_t exponent[32], uint8_t result[32])
+{
+    uint32_t b[LIMBS], e[LIMBS];
+    load_number(b, base);
+    load_number(e, exponent);
+    while(greater_equal(b, modulus))
+        subtract(b, modulus);
+
+    // Convert into Montgomery form
+    uint32_t one[LIMBS] = { 1 };
+    uint32_t baseMontgomery[LIMBS], accumulator[LIMBS];
+    montgomery_multiply(baseMontgomery, b, rSquared);
+    montgomery_multiply(accumulator, one, rSquared);
+
+    // Left-to-right square-and-multiply, which branches on the exponent bits
+    for(int i = 256 - 1; i >= 0; --i)
+    {
+        montgomery_multiply(accumulator, accumulator, accumulator);
+        if((e[i / 32] >> (i % 32)) & 1)
+            montgomery_multiply(accumulator, accumulator, baseMontgomery);
+    }
+
+    // Convert back
+    montgomery_multiply(accumulator, accumulator, one);
+    for(int i = 0; i < LIMBS; ++i)
+    {
+        result[4 * i] = (uint8_t)(accumulator[i] >> 24);
+        result[4 * i + 1] = (uint8_t)(accumulator[i] >> 16);
+        result[4 * i + 2] = (uint8_t)(accumulator[i] >> 8);
+        result[4 * i + 3] = (uint8_t)accumulator[i];
+    }
+}
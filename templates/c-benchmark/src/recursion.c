@@ -0,0 +1,27 @@
+#include "benchmark.h"
+
+static uint32_t descend(const uint8_t* input, size_t length, size_t position, int depth)
+{
+    // Touch a small stack buffer in every frame, so the stack allocation tracking has something to do
+    volatile uint8_t frame[32];
+    for(int i = 0; i < 32; ++i)
+        frame[i] = input[(position + i) % length];
+
+    if(depth == 0)
+        return frame[0];
+
+    // Branch on the input to vary the call tree
+    if(frame[depth % 32] & 1)
+        return frame[1] + descend(input, length, position + 1, depth - 1);
+    return frame[2] ^ descend(input, length, position + 3, depth - 1);
+}
+
+uint32_t deep_recursion(const uint8_t* input, size_t length)
+{
+    if(length == 0)
+        return 0;
+
+    // Between 256 and 1279 frames
+    int depth = 256 + ((input[0] << 2) | (input[1] & 3));
+    return descend(input, length, 2, depth);
+}
@@ -54,10 +54,18 @@ void ReadAndSendStackPointer()
     PinNotifyStackPointer(stackMin, stackMax);
 }
 
+// Tells the trace generator that the given testcase was skipped, so it does not wait for its trace file.
+void ReportTestcaseFailure(int testcaseId)
+{
+    printf("e\t%d\n", testcaseId);
+    fflush(stdout);
+}
+
 // Main trace target function. The following actions are performed:
 //     The current action is read from stdin.
 //     A line with "t" followed by a numeric ID, and another line with a file path determining a new testcase, that is subsequently loaded and fed into the target function, while calling PinNotifyNextFile() beforehand.
 //     A line with "e 0" terminates the program.
+//     If a testcase cannot be loaded, a line with "e", a tab and its ID is written to stdout, and the testcase is skipped.
 void TraceFunc()
 {
     // First transmit stack pointer information
@@ -94,6 +102,7 @@ void TraceFunc()
             {
                 strerror_r(errno, errBuffer, sizeof(errBuffer));
                 fprintf(stderr, "Error opening input file '%s': [%d] %s\n", inputBuffer, errno, errBuffer);
+                ReportTestcaseFailure(testcaseId);
                 continue;
             }
 			
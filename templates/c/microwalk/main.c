@@ -5,6 +5,7 @@
 #include <sys/resource.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
@@ -54,10 +55,19 @@ void ReadAndSendStackPointer()
     PinNotifyStackPointer(stackMin, stackMax);
 }
 
+// Tells the trace generator that the given testcase was skipped, so it does not wait for its trace file.
+void ReportTestcaseFailure(int testcaseId)
+{
+    printf("e\t%d\n", testcaseId);
+    fflush(stdout);
+}
+
 // Main trace target function. The following actions are performed:
 //     The current action is read from stdin.
 //     A line with "t" followed by a numeric ID, and another line with a file path determining a new testcase, that is subsequently loaded and fed into the target function, while calling PinNotifyNextFile() beforehand.
+//     A line with "d" followed by a numeric ID and the testcase length in bytes, and then the raw testcase bytes. The testcase is fed into the target function like a testcase file, but without a filesystem round trip.
 //     A line with "e 0" terminates the program.
+//     If a testcase cannot be loaded, a line with "e", a tab and its ID is written to stdout, and the testcase is skipped.
 void TraceFunc()
 {
     // First transmit stack pointer information
@@ -69,32 +79,74 @@ void TraceFunc()
     char inputBuffer[512];
     char errBuffer[128];
 	int targetInitialized = 0;
+    char* testcaseBuffer = NULL;
+    size_t testcaseBufferSize = 0;
     while(1)
     {
         // Read command and testcase ID (0 for exit command)
         char command;
         int testcaseId;
-        fgets(inputBuffer, sizeof(inputBuffer), stdin);
-        sscanf(inputBuffer, "%c %d", &command, &testcaseId);
+        size_t testcaseLength = 0;
+        if(!fgets(inputBuffer, sizeof(inputBuffer), stdin))
+            break;
+        sscanf(inputBuffer, "%c %d %zu", &command, &testcaseId, &testcaseLength);
 
         // Exit or process given testcase
         if(command == 'e')
             break;
-        if(command == 't')
+        if(command == 't' || command == 'd')
         {
-            // Read testcase file name
-            fgets(inputBuffer, sizeof(inputBuffer), stdin);
-            int inputFileNameLength = strlen(inputBuffer);
-            if(inputFileNameLength > 0 && inputBuffer[inputFileNameLength - 1] == '\n')
-                inputBuffer[inputFileNameLength - 1] = '\0';
-
-            // Load testcase file and run target function
-            FILE* inputFile = fopen(inputBuffer, "rb");
-            if(!inputFile)
+            FILE* inputFile;
+            if(command == 't')
             {
-                strerror_r(errno, errBuffer, sizeof(errBuffer));
-                fprintf(stderr, "Error opening input file '%s': [%d] %s\n", inputBuffer, errno, errBuffer);
-                continue;
+                // Read testcase file name
+                fgets(inputBuffer, sizeof(inputBuffer), stdin);
+                int inputFileNameLength = strlen(inputBuffer);
+                if(inputFileNameLength > 0 && inputBuffer[inputFileNameLength - 1] == '\n')
+                    inputBuffer[inputFileNameLength - 1] = '\0';
+
+                // Load testcase file
+                inputFile = fopen(inputBuffer, "rb");
+                if(!inputFile)
+                {
+                    strerror_r(errno, errBuffer, sizeof(errBuffer));
+                    fprintf(stderr, "Error opening input file '%s': [%d] %s\n", inputBuffer, errno, errBuffer);
+                    ReportTestcaseFailure(testcaseId);
+                    continue;
+                }
+            }
+            else
+            {
+                // Read testcase bytes into a buffer, which is reused for subsequent testcases
+                if(testcaseLength > testcaseBufferSize)
+                {
+                    char* newTestcaseBuffer = realloc(testcaseBuffer, testcaseLength);
+                    if(!newTestcaseBuffer)
+                    {
+                        fprintf(stderr, "Error allocating %zu bytes for testcase #%d\n", testcaseLength, testcaseId);
+                        break;
+                    }
+                    testcaseBuffer = newTestcaseBuffer;
+                    testcaseBufferSize = testcaseLength;
+                }
+                if(fread(testcaseBuffer, 1, testcaseLength, stdin) != testcaseLength)
+                {
+                    fprintf(stderr, "Error reading %zu bytes for testcase #%d from stdin\n", testcaseLength, testcaseId);
+                    break;
+                }
+
+                // Expose the buffer as a file stream; fmemopen() does not accept empty buffers
+                if(testcaseLength > 0)
+                    inputFile = fmemopen(testcaseBuffer, testcaseLength, "rb");
+                else
+                    inputFile = fopen("/dev/null", "rb");
+                if(!inputFile)
+                {
+                    strerror_r(errno, errBuffer, sizeof(errBuffer));
+                    fprintf(stderr, "Error opening in-memory testcase #%d: [%d] %s\n", testcaseId, errno, errBuffer);
+                    ReportTestcaseFailure(testcaseId);
+                    continue;
+                }
             }
 			
 			// If the target was not yet initialized, call the init function for the first test case
@@ -112,6 +164,8 @@ void TraceFunc()
             fclose(inputFile);
         }
     }
+
+    free(testcaseBuffer);
 }
 
 // Wrapper entry point.